@@ -8,12 +8,19 @@
 #include "ComputeQValues.h"
 #include "io/MatchCollectionParser.h"
 #include "PosteriorEstimator.h"
+#include "PsmTable.h"
 #include "util/FileUtils.h"
 #include "util/Params.h"
+#include "util/QValues.h"
 #include "util/StringUtils.h"
 
+#include <algorithm>
 #include <map>
+#include <unordered_map>
 #include <utility>
+#include <boost/thread.hpp>
+#include "boost/tuple/tuple.hpp"
+#include "boost/tuple/tuple_comparison.hpp"
 
 using namespace std;
 using namespace Crux;
@@ -26,7 +33,7 @@ static const double EPSILON = 0.00000000000001;
 * \returns a blank ComputeQValues object
 */
 AssignConfidenceApplication::AssignConfidenceApplication():
-  spectrum_flag_(NULL), iteration_cnt_(0) {
+  spectrum_flag_(NULL), iteration_cnt_(0), num_threads_(1) {
 }
 
 /**
@@ -145,13 +152,19 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
     carp(CARP_WARNING, "Sidak adjustment may not be compatible with score: %s", score_param.c_str());
   }
 
-  // Create two match collections, for targets and decoys.
+  num_threads_ = Params::GetInt("num-threads");
+  if (num_threads_ < 1) {
+    num_threads_ = max(1u, boost::thread::hardware_concurrency());
+  }
+
+  // The PSMs that q-values are computed over, and a collection that the
+  // targets are put in for writing.
+  PsmTable table;
   MatchCollection* target_matches = new MatchCollection();
-  map<int, MatchCollection*> decoy_matches; // key is decoy index
 
   bool ascending, distinct_matches;
   MatchCollectionParser parser;
-  map<string, FLOAT_T> BestPeptideScore;
+  vector<FLOAT_T> BestPeptideScore; // indexed by peptide id
 
   bool avgTdc = estimation_method == TDC_METHOD;
   for (vector<string>::const_iterator iter = input_files.begin(); iter != input_files.end(); ++iter) {
@@ -230,8 +243,8 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
 
     // Find and keep the best score for each peptide.
     if (estimation_method == PEPTIDE_LEVEL_METHOD) {
-      peptide_level_filtering(match_collection, &BestPeptideScore, score_type, ascending);
-      carp(CARP_INFO, "%d distinct target peptides.", BestPeptideScore.size());
+      peptide_level_filtering(match_collection, &table, &BestPeptideScore, score_type, ascending);
+      carp(CARP_INFO, "%d distinct target peptides.", table.numPeptides());
     }
 
     target_matches->setScoredType(score_type, match_collection->getScoredType(score_type));
@@ -243,9 +256,6 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
     target_matches->setScoredType(SIDAK_ADJUSTED, sidak);
     //Added for tailor score calibration method by AKF
     target_matches->setScoredType(TAILOR_SCORE, match_collection->getScoredType(TAILOR_SCORE));
-    for (map<int, MatchCollection*>::iterator i = decoy_matches.begin(); i != decoy_matches.end(); i++) {
-      i->second->setScoredType(SIDAK_ADJUSTED, sidak);
-    }
 
     // Counters just to let the user know what's up.
     int num_target_rank_skipped = 0;
@@ -284,16 +294,8 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
           decoy_match->setNullPeptide(true);
           switch (estimation_method) {
           case MIXMAX_METHOD:
-            {
-              // Put match directly in the final set of decoys, because no TDC.
-              int decoyIndex = decoy_match->decoyIndex();
-              map<int, MatchCollection*>::iterator lookup = decoy_matches.find(decoyIndex);
-              if (lookup == decoy_matches.end()) {
-                decoy_matches[decoyIndex] = new MatchCollection();
-                lookup = decoy_matches.find(decoyIndex);
-              }
-              lookup->second->addMatch(decoy_match);
-            }
+            // Put match directly in the final set of decoys, because no TDC.
+            table.add(decoy_match, sidak ? SIDAK_ADJUSTED : score_type, -1);
             break;
           case TDC_METHOD:
           case PEPTIDE_LEVEL_METHOD:
@@ -321,8 +323,8 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
 
         // Find and keep the best score for each decoy peptide.
         if (estimation_method == PEPTIDE_LEVEL_METHOD) {
-          peptide_level_filtering(temp_collection, &BestPeptideScore, score_type, ascending);
-          carp(CARP_INFO, "%d distinct target+decoy peptides.", BestPeptideScore.size());
+          peptide_level_filtering(temp_collection, &table, &BestPeptideScore, score_type, ascending);
+          carp(CARP_INFO, "%d distinct target+decoy peptides.", table.numPeptides());
         }
 
         if (estimation_method != MIXMAX_METHOD) {
@@ -415,7 +417,7 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
       delete temp_collection;
     }
 
-    // Iterate, gathering matches into one or two collections.
+    // Iterate, gathering matches into the table.
     MatchIterator* match_iterator = new MatchIterator(match_collection, score_type, false);
     while (match_iterator->hasNext()) {
       Match* match = match_iterator->next();
@@ -452,25 +454,22 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
       }
 
       // Find and keep the best score for each decoy peptide.
+      int peptide = -1;
       if (estimation_method == PEPTIDE_LEVEL_METHOD) {
         FLOAT_T score = match->getScore(score_type);
-        string peptideStr = getPeptideSeq(match);
-
-        FLOAT_T bestScore;
-        try {
-          bestScore = BestPeptideScore.at(peptideStr);
-          if (bestScore != score) {  //not the best scoring peptide
-            if (is_decoy) {
-              num_decoy_peptide_skipped++;
-            } else {
-              num_target_peptide_skipped++;              
-            }
-            continue;
+        peptide = table.findPeptide(getPeptideSeq(match));
+
+        if (peptide < 0) {
+          carp(CARP_DEBUG, "Error in peptide-level filtering");
+        } else if (BestPeptideScore[peptide] != score) {  //not the best scoring peptide
+          if (is_decoy) {
+            num_decoy_peptide_skipped++;
           } else {
-            BestPeptideScore.at(peptideStr) += ascending ? -1.0 : 1.0;  //make sure only one best scoring peptide reported.
+            num_target_peptide_skipped++;
           }
-        } catch (const out_of_range& oor) {
-          carp(CARP_DEBUG, "Error in peptide-level filtering");
+          continue;
+        } else {
+          BestPeptideScore[peptide] += ascending ? -1.0 : 1.0;  //make sure only one best scoring peptide reported.
         }
       }
 
@@ -483,18 +482,8 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
         match->setScore(SIDAK_ADJUSTED, sidak_adjustment);
       }
 
-      // Add this match to one of the collections.
-      if (is_decoy) {
-        int decoyIndex = match->decoyIndex();
-        map<int, MatchCollection*>::iterator lookup = decoy_matches.find(decoyIndex);
-        if (lookup == decoy_matches.end()) {
-          decoy_matches[decoyIndex] = new MatchCollection();
-          lookup = decoy_matches.find(decoyIndex);
-        }
-        lookup->second->addMatch(match);
-      } else {
-        target_matches->addMatch(match);
-      }
+      // Add this match to the table; only targets keep their match.
+      table.add(match, sidak ? SIDAK_ADJUSTED : score_type, peptide);
       Match::freeMatch(match);
     }
     delete match_iterator;
@@ -514,9 +503,6 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
   }
 
   target_matches->setScoredType(score_type, true);
-  for (map<int, MatchCollection*>::iterator i = decoy_matches.begin(); i != decoy_matches.end(); i++) {
-    i->second->setScoredType(score_type, true);
-  }
 
   // get from the input files which columns to print in the output files
   if (iteration_cnt_ == 0) {
@@ -605,21 +591,18 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
   switch (estimation_method) {
   case TDC_METHOD:
     if (avgTdc) {
-      carp(CARP_INFO, "Using a-TDC (%d decoy sets).", decoy_matches.size());
-      vector< vector<FLOAT_T> > decoy_scores;
-      AtdcScoreSet::getScores(target_matches, decoy_matches, score_type, ascending, target_scores, decoy_scores);
-      qvalues = AtdcScoreSet(target_scores, decoy_scores, ascending).fdps();
+      vector<FLOAT_T> decoy_scores;
+      size_t num_decoy_sets = getAtdcScores(table, ascending, num_threads_, target_scores, decoy_scores);
+      carp(CARP_INFO, "Using a-TDC (%d decoy sets).", num_decoy_sets);
+      QValues::Atdc(target_scores, decoy_scores, num_decoy_sets, ascending,
+                    Params::GetBool("use-old-atdc"), myrandom_limit, &qvalues);
       convert_fdr_to_qvalue(qvalues);
       break;
     }
   case PEPTIDE_LEVEL_METHOD:
     {
-      target_scores = target_matches->extractScores(score_type);
-      vector<FLOAT_T> decoy_scores;
-      for (map<int, MatchCollection*>::const_iterator i = decoy_matches.begin(); i != decoy_matches.end(); i++) {
-        vector<FLOAT_T> curScores = i->second->extractScores(score_type);
-        copy(curScores.begin(), curScores.end(), back_inserter(decoy_scores));
-      }
+      target_scores = table.scores(false);
+      vector<FLOAT_T> decoy_scores = table.scores(true);
       carp(CARP_INFO, "There are %d target and %d decoy PSMs for q-value computation.",
            target_scores.size(), decoy_scores.size());
       qvalues = compute_decoy_qvalues_tdc(target_scores, decoy_scores, ascending, 1.0);
@@ -627,12 +610,8 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
     break;
   case MIXMAX_METHOD:
     {
-      target_scores = target_matches->extractScores(score_type);
-      vector<FLOAT_T> decoy_scores;
-      for (map<int, MatchCollection*>::const_iterator i = decoy_matches.begin(); i != decoy_matches.end(); i++) {
-        vector<FLOAT_T> curScores = i->second->extractScores(score_type);
-        copy(curScores.begin(), curScores.end(), back_inserter(decoy_scores));
-      }
+      target_scores = table.scores(false);
+      vector<FLOAT_T> decoy_scores = table.scores(true);
       carp(CARP_INFO, "There are %d target and %d decoy PSMs for q-value computation.",
            target_scores.size(), decoy_scores.size());
       qvalues = compute_decoy_qvalues_mixmax(target_scores, decoy_scores, ascending, Params::GetDouble("pi-zero"));
@@ -654,12 +633,12 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
   carp(CARP_INFO, "Number of PSMs at 5%% FDR = %d.", fdr5);
   carp(CARP_INFO, "Number of PSMs at 10%% FDR = %d.", fdr10);
 
-  // Store p-values to q-values as a hash, and then assign them.
-  map<FLOAT_T, FLOAT_T> qvalue_hash = store_arrays_as_hash(target_scores, qvalues);
-
-  target_matches->assignQValues(&qvalue_hash, score_type, derived_score_type);
+  // Pair scores with q-values, and then assign them.
+  table.assignQValues(target_scores, qvalues, derived_score_type);
+  target_matches->setScoredType(derived_score_type, true);
 
   // Store targets by score.
+  table.addTargetMatches(target_matches);
   target_matches->sort(score_type);
   if (spectrum_flag_ == NULL) {
     output_->writeMatches(target_matches);
@@ -693,9 +672,6 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
     output_->writeMatches(&accepted_matches);
   }
   delete target_matches;
-  for (map<int, MatchCollection*>::const_iterator i = decoy_matches.begin(); i != decoy_matches.end(); i++) {
-    delete i->second;
-  }
 
   return 0;
 } // Main
@@ -778,282 +754,86 @@ void AssignConfidenceApplication::identify_best_psm_per_peptide(
 void AssignConfidenceApplication::convert_fdr_to_qvalue(
   vector<FLOAT_T>& qvalues ///< Come in as FDRs, go out as q-values.
 ) {
-  FLOAT_T prev_fdr = qvalues[qvalues.size() - 1];
-  for (int idx = qvalues.size() - 2; idx >= 0; idx--) {
-    carp(CARP_DETAILED_DEBUG, "fdr[%i] = %.10f", idx, qvalues[idx]);
-    FLOAT_T this_fdr = qvalues[idx];
-    if (prev_fdr < this_fdr) {
-      qvalues[idx] = prev_fdr;
-    }
-    prev_fdr = qvalues[idx];
-    carp(CARP_DETAILED_DEBUG, "qvalue[%i] = %.10f", idx, qvalues[idx]);
-  }
+  QValues::FdrToQValues(&qvalues);
 }
 
-/**
- * Store two parallel arrays of floats in a hash table.
- */
-map<FLOAT_T, FLOAT_T> AssignConfidenceApplication::store_arrays_as_hash(
-  const vector<FLOAT_T>& keys,
-  const vector<FLOAT_T>& values
-) {
-  map<FLOAT_T, FLOAT_T> return_value;
-  for (size_t i = 0; i < keys.size(); i++) {
-    carp(CARP_DETAILED_DEBUG, "%g maps to %g", keys[i], values[i]);
-    return_value[keys[i]] = values[i];
-  }
-  return return_value;
-}
+namespace {
 
-AssignConfidenceApplication::AtdcScoreSet::AtdcScoreSet(
-  const vector<FLOAT_T>& targetScores,
-  const vector< vector<FLOAT_T> >& decoyScores,
-  bool ascending
-) {
-  for (vector< vector<FLOAT_T> >::const_iterator i = decoyScores.begin(); i != decoyScores.end(); i++) {
-    if (i->size() != targetScores.size()) {
-      carp(CARP_FATAL, "a decoy set contained %d scores when %d were expected", i->size(), targetScores.size());
-    }
+// The spectrum a PSM is for: file index, scan and charge.
+struct SpectrumKey {
+  int file;
+  int scan;
+  int charge;
+  bool operator==(const SpectrumKey& other) const {
+    return file == other.file && scan == other.scan && charge == other.charge;
   }
-
-  for (size_t i = 0; i < targetScores.size(); i++) {
-    FLOAT_T targetScore = ascending ? targetScores[i] : -targetScores[i];
-    if (i > 0 && targetScore < scores_.back().first) {
-      carp(CARP_FATAL, "internal error; unsorted scores were passed into AtdcScoreSet");
-    }
-    scores_.push_back(make_pair(targetScore, vector<FLOAT_T>(decoyScores.size(), 0)));
-    for (size_t j = 0; j < decoyScores.size(); j++) {
-      scores_.back().second[j] = ascending ? decoyScores[j][i] : -decoyScores[j][i];
-    }
+};
+
+struct SpectrumKeyHash {
+  size_t operator()(const SpectrumKey& key) const {
+    size_t h = (size_t)key.file;
+    h = h * 1000003 + (size_t)key.scan;
+    h = h * 1000003 + (size_t)key.charge;
+    return h ^ (h >> 29);
   }
+};
+
 }
 
-void AssignConfidenceApplication::AtdcScoreSet::getScores(
-  MatchCollection* targets,
-  map<int, MatchCollection*> decoys,
-  SCORER_TYPE_T scoreType,
+size_t AssignConfidenceApplication::getAtdcScores(
+  const PsmTable& table,
   bool ascending,
+  int numThreads,
   vector<FLOAT_T>& outTargetScores,
-  vector< vector<FLOAT_T> >& outDecoyScores
+  vector<FLOAT_T>& outDecoyScores
 ) {
-  outTargetScores.clear();
-  outDecoyScores.clear();
-
-  vector< boost::tuple<FLOAT_T, int, int, int> > targetScores; // score, file, scan, charge
-  for (MatchIterator i(targets, scoreType, false); i.hasNext(); ) {
-    Match* match = i.next();
-    targetScores.push_back(boost::make_tuple(
-      match->getScore(scoreType),
-      match->getFileIndex(),
-      match->getSpectrum()->getFirstScan(),
-      match->getCharge()));
-  }
-
-  if (ascending) {
-    sort(targetScores.begin(), targetScores.end(), sortScoresAsc);
-  } else {
-    sort(targetScores.begin(), targetScores.end(), sortScoresDesc);
-  }
-
-  map< boost::tuple<int, int, int>, pair<size_t, size_t> > idxMap; // <file, scan, charge> -> <idx, decoys found>
-  for (size_t i = 0; i < targetScores.size(); i++) {
-    const boost::tuple<FLOAT_T, int, int, int>& score = targetScores[i];
-    outTargetScores.push_back(score.get<0>());
-    int file = score.get<1>();
-    int scan = score.get<2>();
-    int charge = score.get<3>();
-    boost::tuple<int, int, int> idxKey = boost::make_tuple(file, scan, charge);
-    if (!idxMap.insert(make_pair(idxKey, make_pair(i, 0))).second) {
-      carp(CARP_FATAL, "Multiple target scores found for file %d, scan %d, charge %d", file, scan, charge);
-    }
-  }
-
-  for (map<int, MatchCollection*>::const_iterator i = decoys.begin(); i != decoys.end(); i++) {
-    outDecoyScores.push_back(vector<FLOAT_T>(outTargetScores.size(), numeric_limits<FLOAT_T>::quiet_NaN()));
-    for (MatchIterator j(i->second, scoreType, false); j.hasNext(); ) {
-      Match* match = j.next();
-      boost::tuple<int, int, int> idxKey = boost::make_tuple(
-        match->getFileIndex(), match->getSpectrum()->getFirstScan(), match->getCharge());
-      map< boost::tuple<int, int, int>, pair<size_t, size_t> >::iterator k = idxMap.find(idxKey);
-      if (k != idxMap.end()) {
-        k->second.second++;
-        outDecoyScores.back()[k->second.first] = match->getScore(scoreType);
-      }
-    }
-  }
-
-  for (map< boost::tuple<int, int, int>, pair<size_t, size_t> >::const_iterator i = idxMap.begin();
-       i != idxMap.end();
-       i++) {
-    size_t decoysFound = i->second.second;
-    if (decoys.size() > decoysFound) {
-      carp(CARP_FATAL, "Missing %d decoy scores for file %d, scan %d, charge %d (expected %d, found %d)",
-           decoys.size() - decoysFound, i->first.get<0>(), i->first.get<1>(), i->first.get<2>(),
-           decoys.size(), decoysFound);
-    } else if (decoysFound > decoys.size()) {
-      carp(CARP_FATAL, "Found %d extra decoy scores for file %d, scan %d, charge %d (expectede %d, found %d)",
-           decoysFound - decoys.size(), i->first.get<0>(), i->first.get<1>(), i->first.get<2>(),
-           decoys.size(), decoysFound);
-    }
-  }
-}
-
-vector<FLOAT_T> AssignConfidenceApplication::AtdcScoreSet::fdps() const {
-  const size_t numScores = scores_.size();
-  const size_t numDecoySets = scores_.front().second.size();
-  const FLOAT_T bc1 = -1/(FLOAT_T)numDecoySets;
-
-  vector<size_t> optIdxCnt(numScores, 0);
-  vector<FLOAT_T> sumNtds(numScores, 0);
-  vector<FLOAT_T> sumNdds(numScores, 0);
-  for (size_t i = 0; i < numDecoySets; i++) {
-    vector<int> ntds(numScores, 0);
-    vector<int> ndds(numScores, 0);
-    for (size_t j = 0; j < numScores; j++) {
-      FLOAT_T scoreTarget = scores_[j].first;
-      FLOAT_T scoreDecoy = scores_[j].second[i];
-      bool targetBetter = scoreTarget != scoreDecoy ? scoreTarget < scoreDecoy : myrandom_limit(2) == 0;
-      if (targetBetter) {
-        optIdxCnt[j]++;
-        histBin(ntds, scoreTarget);
-      } else {
-        histBin(ndds, scoreDecoy);
-      }
-    }
-
-    int ntdsTotal = 0, nddsTotal = 0;
-    for (size_t j = 0; j < numScores; j++) {
-      sumNtds[j] += (ntdsTotal += ntds[j]);
-      sumNdds[j] += (nddsTotal += ndds[j]);
+  vector<size_t> targetRows = table.sortedRows(ascending, false, 0, numThreads);
+  const size_t numTargets = targetRows.size();
+
+  unordered_map<SpectrumKey, size_t, SpectrumKeyHash> idxMap; // <file, scan, charge> -> idx
+  idxMap.reserve(numTargets);
+  outTargetScores.resize(numTargets);
+  for (size_t i = 0; i < numTargets; i++) {
+    size_t row = targetRows[i];
+    outTargetScores[i] = table.score(row);
+    SpectrumKey key = { table.file(row), table.scan(row), table.charge(row) };
+    if (!idxMap.insert(make_pair(key, i)).second) {
+      carp(CARP_FATAL, "Multiple target scores found for file %d, scan %d, charge %d",
+           key.file, key.scan, key.charge);
     }
   }
 
-  bool oldATDC = Params::GetBool("use-old-atdc");
-  if (oldATDC) {
-    for (size_t i = 0; i < numScores; i++) {
-      sumNtds[i] /= numDecoySets;
-      sumNdds[i] /= numDecoySets;
-    }
-  }
-  
-  vector<bool> isTargetPsm(numScores, true);
-  int numTargetPsms = 0;
-  vector< vector<int> > optIdxCntMat(numDecoySets + 1, vector<int>(numScores, 0));
-  vector<size_t> currentOptIdx(numDecoySets + 1, 0);
-  size_t lowestOptIdx = numDecoySets + 1;
-  for (size_t i = 0; i < numScores; i++) {
-    size_t idx = optIdxCnt[i];
-    size_t idx2;
-    if (oldATDC) {
-      idx2 = currentOptIdx[idx]++;
-    } else {
-      idx2 = ++currentOptIdx[idx];
-    }
-    optIdxCntMat[idx][idx2] = i;
-    if (idx < lowestOptIdx) {
-      lowestOptIdx = idx;
-    }
-    int denominator;
-    if (oldATDC) {
-      denominator = 1;
-    } else {
-      denominator = numDecoySets;
-    }
-    if ((FLOAT_T)numTargetPsms <= (sumNtds[i] / denominator) - 0.5) {
-      numTargetPsms++;
+  vector<int> decoyIndexes = table.decoyIndexes();
+  const size_t numDecoySets = decoyIndexes.size();
+  outDecoyScores.assign(numDecoySets * numTargets, numeric_limits<FLOAT_T>::quiet_NaN());
+  vector<size_t> decoysFound(numTargets, 0);
+  for (size_t row = 0; row < table.size(); row++) {
+    if (!table.isDecoy(row)) {
       continue;
     }
-    if (oldATDC) {
-      isTargetPsm[optIdxCntMat[lowestOptIdx][--currentOptIdx[lowestOptIdx]]] = false;
-    } else {
-      isTargetPsm[optIdxCntMat[lowestOptIdx][currentOptIdx[lowestOptIdx]--]] = false;
-    }
-    for ( ; lowestOptIdx < numDecoySets + 1 && currentOptIdx[lowestOptIdx] == 0; lowestOptIdx++);
-  }
-
-  if (oldATDC) {
-
-    int targetPsmsTotal = 0;
-    for (size_t i = 0; i < numScores; i++) {
-      if (isTargetPsm[i]) {
-        targetPsmsTotal++;
-      }
-      sumNdds[i] = (1 + sumNdds[i]) / max(1, targetPsmsTotal);
-    }
-
-  } else {
-  
-    if (bc1 >= 0) {
-      int targetPsmsTotal = 0;
-      for (size_t i = 0; i < numScores; i++) {
-        if (isTargetPsm[i]) {
-          targetPsmsTotal++;
-        }
-        sumNdds[i] = (bc1 + sumNdds[i] / numDecoySets) / max(1, targetPsmsTotal);
-      }
-    } else {
-      vector<FLOAT_T> ndds(numScores, 0);
-      FLOAT_T prev = 0;
-      for (size_t i = 0; i < numScores; i++) {
-        FLOAT_T current = sumNdds[i];
-        ndds[i] = current - prev;
-        prev = current;
-      }
-      int targetPsmsTotal = 0;
-      for (size_t i = 0; i < numScores; i++) {
-        if (isTargetPsm[i]) {
-          targetPsmsTotal++;
-        }
-        sumNdds[i] = ((min((FLOAT_T)numDecoySets, max((FLOAT_T)1, ndds[i])) + sumNdds[i]) / numDecoySets) /
-          max(1, targetPsmsTotal);
-      }
+    SpectrumKey key = { table.file(row), table.scan(row), table.charge(row) };
+    unordered_map<SpectrumKey, size_t, SpectrumKeyHash>::const_iterator k = idxMap.find(key);
+    if (k != idxMap.end()) {
+      size_t set = lower_bound(decoyIndexes.begin(), decoyIndexes.end(), table.decoyIndex(row)) -
+                   decoyIndexes.begin();
+      decoysFound[k->second]++;
+      outDecoyScores[set * numTargets + k->second] = table.score(row);
     }
   }
-  
-  return sumNdds;
-}
 
-void AssignConfidenceApplication::AtdcScoreSet::histBin(vector<int>& hist, FLOAT_T x) const {
-  // the value x is in the nth bin if edges[n] < x <= edges[n+1]
-  // edges are [-inf, <target scores...>]
-  for (size_t i = 0; i < scores_.size(); i++) {
-    if (x <= scores_[i].first) {
-      hist[i]++;
-      return;
+  for (size_t i = 0; i < numTargets; i++) {
+    size_t row = targetRows[i];
+    if (numDecoySets > decoysFound[i]) {
+      carp(CARP_FATAL, "Missing %d decoy scores for file %d, scan %d, charge %d (expected %d, found %d)",
+           numDecoySets - decoysFound[i], table.file(row), table.scan(row), table.charge(row),
+           numDecoySets, decoysFound[i]);
+    } else if (decoysFound[i] > numDecoySets) {
+      carp(CARP_FATAL, "Found %d extra decoy scores for file %d, scan %d, charge %d (expectede %d, found %d)",
+           decoysFound[i] - numDecoySets, table.file(row), table.scan(row), table.charge(row),
+           numDecoySets, decoysFound[i]);
     }
   }
-}
-
-bool AssignConfidenceApplication::AtdcScoreSet::sortScoresAsc(
-  const boost::tuple<FLOAT_T, int, int, int>& x,
-  const boost::tuple<FLOAT_T, int, int, int>& y
-) {
-  FLOAT_T scoreX = x.get<0>(), scoreY = y.get<0>();
-  return scoreX != scoreY ? scoreX < scoreY : sortScoresByIdentifier(x, y);
-}
-
-bool AssignConfidenceApplication::AtdcScoreSet::sortScoresDesc(
-  const boost::tuple<FLOAT_T, int, int, int>& x,
-  const boost::tuple<FLOAT_T, int, int, int>& y
-) {
-  FLOAT_T scoreX = x.get<0>(), scoreY = y.get<0>();
-  return scoreX != scoreY ? scoreX > scoreY : sortScoresByIdentifier(x, y);
-}
-
-bool AssignConfidenceApplication::AtdcScoreSet::sortScoresByIdentifier(
-  const boost::tuple<FLOAT_T, int, int, int>& x,
-  const boost::tuple<FLOAT_T, int, int, int>& y
-) {
-  int fileX = x.get<1>(), fileY = y.get<1>();
-  if (fileX != fileY) {
-    return fileX < fileY;
-  }
-  int scanX = x.get<2>(), scanY = y.get<2>();
-  if (scanX != scanY) {
-    return scanX < scanY;
-  }
-  int chargeX = x.get<2>(), chargeY = y.get<2>();
-  return chargeX < chargeY;
+  return numDecoySets;
 }
 
 /**
@@ -1075,55 +855,12 @@ vector<FLOAT_T> AssignConfidenceApplication::compute_decoy_qvalues_tdc(
   carp(CARP_DEBUG, "Computing decoy q-values with %d targets and %d decoys.",
        target_scores.size(), decoy_scores.size());
 
-  // Sort both sets of scores.
-  if (ascending) {
-    sort(target_scores.begin(), target_scores.end(), Match::ScoreLess);
-    sort(decoy_scores.begin(), decoy_scores.end(), Match::ScoreLess);
-  } else {
-    sort(target_scores.begin(), target_scores.end(), Match::ScoreGreater);
-    sort(decoy_scores.begin(), decoy_scores.end(), Match::ScoreGreater);
-  }
-
-  // Compute false discovery rate for each target score.
+  // Sort both sets of scores, then compute false discovery rates and
+  // convert them into q-values.
+  QValues::SortScores(&target_scores, ascending, num_threads_);
+  QValues::SortScores(&decoy_scores, ascending, num_threads_);
   vector<FLOAT_T> qvalues;
-  qvalues.reserve(target_scores.size());
-  int decoy_idx = 0;
-  for (int target_idx = 0; target_idx < target_scores.size(); target_idx++) {
-    double target_score = target_scores[target_idx];
-
-    // Find the index of the first decoy score greater than this target score.
-    if (ascending) {
-      while (decoy_idx < decoy_scores.size() &&
-             Match::ScoreLess(decoy_scores[decoy_idx], target_score)) {
-        carp(CARP_DEBUG, "Decoy score %g.", decoy_scores[decoy_idx]);
-        decoy_idx++;
-      }
-    } else {   
-      while (decoy_idx < decoy_scores.size() &&
-             Match::ScoreGreater(decoy_scores[decoy_idx], target_score)) {
-        carp(CARP_DEBUG, "Decoy score %g.", decoy_scores[decoy_idx]);
-        decoy_idx++;
-      }
-    }
-
-    // FDR = (#decoys + 1)/ #targets
-    FLOAT_T fdr = ((FLOAT_T)(decoy_idx + 1)/(FLOAT_T)(target_idx + 1));
-    if (fdr > 1.0) {
-      fdr = 1.0;
-    }
-    carp(CARP_DEBUG, "FDR for score %g = min(1,%d/%d) = %g",
-         target_score, decoy_idx, target_idx + 1, fdr);
-    qvalues.push_back(fdr);
-    // assign fdr for this and any following with same score
-    while (target_idx < target_scores.size() - 1 && target_scores[target_idx + 1] == target_score) {
-      target_idx++;
-      qvalues.push_back(fdr);
-    }
-  }
-  
-  // Convert the FDRs into q-values.
-  convert_fdr_to_qvalue(qvalues);
-
+  QValues::Tdc(target_scores, decoy_scores, ascending, &qvalues);
   return qvalues;
 }
 
@@ -1162,87 +899,20 @@ vector<FLOAT_T> AssignConfidenceApplication::compute_decoy_qvalues_mixmax(
          target_idx, decoy_scores[target_idx]);
   }
 
-  //Sort decoy and target stores
-  if (ascending) {
-    sort(target_scores.begin(), target_scores.end(), greater<FLOAT_T>());
-    sort(decoy_scores.begin(), decoy_scores.end(), greater<FLOAT_T>());
-  } else {
-    sort(target_scores.begin(), target_scores.end());
-    sort(decoy_scores.begin(), decoy_scores.end());
-  }
-
-  //histogram of the target scores.
-  vector<double> h_w_le_z(num_decoys + 1, 0); //histogram for N_{w<=z}
-  vector<double> h_z_le_z(num_decoys + 1, 0); //histogram for N_{z<=z}
-
-  int idx = 0;
-  for (int i = 0; i < num_decoys; ++i) {
-    while (idx < num_targets && (ascending ?
-      decoy_scores[i] <= target_scores[idx] :
-      decoy_scores[i] >= target_scores[idx])) {
-      ++idx;
-    }
-    h_w_le_z[i] = (double)idx;
-  }
-  idx = 0;
-  for (int i = 0; i < num_decoys; ++i) {
-    while (idx < num_targets && (ascending ?
-      decoy_scores[i] <= decoy_scores[idx] :
-      decoy_scores[i] >= decoy_scores[idx])) {
-      ++idx;
-    }
-    h_z_le_z[i] = (double)idx;
-  }
-  h_w_le_z[num_decoys] = (double)(num_targets);
-  h_z_le_z[num_decoys] = (double)(num_decoys);
-
-  vector<FLOAT_T> fdrmod(num_targets, 0);
-  double estPx_lt_zj = 0.0;
-  double E_f1_mod_run_tot = 0.0;
-  int j = num_decoys-1;
-  int k = num_targets-1;
-  int n_z_ge_w = 0;
-  int n_w_ge_w = 0;
-  double qvalue;
-  double cnt_z, cnt_w;
-  double prev_fdr = -1;
-
-  for (int i = num_targets - 1; i >= 0; --i) {
-    while (j >= 0 && (ascending ? 
-      decoy_scores[j] <= target_scores[i] : 
-      decoy_scores[j] >= target_scores[i])) {
-      cnt_w = h_w_le_z[j + 1];
-      cnt_z = h_z_le_z[j + 1];
-      estPx_lt_zj = (double)(cnt_w - pi_zero*cnt_z) / ((1.0 - pi_zero)*cnt_z);
-      estPx_lt_zj = estPx_lt_zj > 1 ? 1 : estPx_lt_zj;
-      estPx_lt_zj = estPx_lt_zj < 0 ? 0 : estPx_lt_zj;
-      E_f1_mod_run_tot += estPx_lt_zj * ((1.0 - pi_zero));
-      ++n_z_ge_w;
-      --j;
-    }
-    while (k >= 0 && (ascending ?
-      target_scores[k] <= target_scores[i] :
-      target_scores[k] >= target_scores[i])) {
-      ++n_w_ge_w;
-      --k;
-    }
-    qvalue = ((double)n_z_ge_w * pi_zero + E_f1_mod_run_tot) / (double)(n_w_ge_w);
-    fdrmod[i] = qvalue > 1.0 ? 1.0 : qvalue;
-    
-    //convert qvalues to fdr
-    if (prev_fdr > fdrmod[i]) {
-      fdrmod[i] = prev_fdr;
-    }
-
-    prev_fdr = fdrmod[i];
-  }
-  // Convert the FDRs into q-values.
-  return fdrmod;
+  // Sort decoy and target scores, worst first.
+  QValues::SortScores(&target_scores, ascending, num_threads_);
+  QValues::SortScores(&decoy_scores, ascending, num_threads_);
+  reverse(target_scores.begin(), target_scores.end());
+  reverse(decoy_scores.begin(), decoy_scores.end());
+  vector<FLOAT_T> qvalues;
+  QValues::MixMax(target_scores, decoy_scores, ascending, pi_zero, &qvalues);
+  return qvalues;
 }
 
 void AssignConfidenceApplication::peptide_level_filtering(
   MatchCollection* match_collection,
-  map<string, FLOAT_T>* BestPeptideScore, 
+  PsmTable* table,
+  vector<FLOAT_T>* BestPeptideScore,
   SCORER_TYPE_T score_type,
   bool ascending) {
 
@@ -1251,17 +921,15 @@ void AssignConfidenceApplication::peptide_level_filtering(
     while (temp_iter->hasNext()) {
       Crux::Match* match = temp_iter->next();
       FLOAT_T score = match->getScore(score_type);
-      string peptideStr = getPeptideSeq(match);
+      int peptide = table->internPeptide(getPeptideSeq(match));
 
-      FLOAT_T bestScore = 0.0;
-      try {
-        bestScore = BestPeptideScore->at(peptideStr);
-      } catch (const out_of_range& oor) {
-        BestPeptideScore->insert(make_pair(peptideStr, score));
+      if ((size_t)peptide == BestPeptideScore->size()) {
+        BestPeptideScore->push_back(score);
         continue;
       }
+      FLOAT_T bestScore = (*BestPeptideScore)[peptide];
       if ((ascending && bestScore > score) || (!ascending && score > bestScore)) {
-        BestPeptideScore->at(peptideStr) = score;
+        (*BestPeptideScore)[peptide] = score;
       }
     }
     delete temp_iter;
@@ -1421,6 +1089,7 @@ vector<string> AssignConfidenceApplication::getOptions() const {
     "list-of-files",
     "combine-charge-states",
     "combine-modified-peptides",
+    "num-threads",
     "fileroot"
   };
   return vector<string>(arr, arr + sizeof(arr) / sizeof(string));
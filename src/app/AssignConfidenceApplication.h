@@ -21,8 +21,7 @@
 #include "model/MatchCollection.h"
 #include "io/OutputFiles.h"
 #include "model/Peptide.h"
-#include "boost/tuple/tuple.hpp" // This will be <tuple> once we move to C++11.
-#include "boost/tuple/tuple_comparison.hpp"
+#include "PsmTable.h"
 
 /**
  * Legal values for the --estimation-method option.
@@ -47,34 +46,19 @@ class AssignConfidenceApplication : public CruxApplication {
   string index_name_;
   bool is_final_;
 
-  class AtdcScoreSet {
-   public:
-    AtdcScoreSet(
-      const std::vector<FLOAT_T>& targetScores,
-      const std::vector< std::vector<FLOAT_T> >& decoyScores,
-      bool ascending);
-    static void getScores(
-      MatchCollection* targets,
-      std::map<int, MatchCollection*> decoys,
-      SCORER_TYPE_T scoreType,
-      bool ascending,
-      std::vector<FLOAT_T>& outTargetScores,
-      std::vector< std::vector<FLOAT_T> >& outDecoyScores);
-    std::vector<FLOAT_T> fdps() const;
-   private:
-    void histBin(std::vector<int>& hist, FLOAT_T x) const;
-    static bool sortScoresAsc(
-      const boost::tuple<FLOAT_T, int, int, int>& x,
-      const boost::tuple<FLOAT_T, int, int, int>& y);
-    static bool sortScoresDesc(
-      const boost::tuple<FLOAT_T, int, int, int>& x,
-      const boost::tuple<FLOAT_T, int, int, int>& y);
-    static bool sortScoresByIdentifier(
-      const boost::tuple<FLOAT_T, int, int, int>& x,
-      const boost::tuple<FLOAT_T, int, int, int>& y);
-
-    std::vector< std::pair<FLOAT_T, std::vector<FLOAT_T> > > scores_; // <target score, [decoy scores]>
-  };
+  int num_threads_;
+
+  /**
+   * Pairs the targets in a table, sorted best first, with their decoy in each
+   * decoy set. Decoy set i fills decoyScores[i * targetScores.size() ...].
+   * \returns the number of decoy sets.
+   */
+  static size_t getAtdcScores(
+    const PsmTable& table,
+    bool ascending,
+    int numThreads,
+    std::vector<FLOAT_T>& targetScores,
+    std::vector<FLOAT_T>& decoyScores);
 
  public:
   map<pair<string, unsigned int>, bool>* getSpectrumFlag();
@@ -165,7 +149,8 @@ class AssignConfidenceApplication : public CruxApplication {
 
   void peptide_level_filtering(
     MatchCollection* match_collection,
-    std::map<string, FLOAT_T>* BestPeptideScore,
+    PsmTable* table,
+    std::vector<FLOAT_T>* BestPeptideScore, ///< indexed by peptide id
     SCORER_TYPE_T score_type,
     bool ascending);
   
@@ -175,9 +160,6 @@ class AssignConfidenceApplication : public CruxApplication {
   static void convert_fdr_to_qvalue(
     std::vector<FLOAT_T>& qvalues); ///< Come in as FDRs, go out as q-values.
 
-  map<FLOAT_T, FLOAT_T> store_arrays_as_hash(
-    const std::vector<FLOAT_T>& keys,
-    const std::vector<FLOAT_T>& values);
   std::vector<FLOAT_T> compute_decoy_qvalues_tdc(
     std::vector<FLOAT_T>& target_scores,
     std::vector<FLOAT_T>& decoy_scores,
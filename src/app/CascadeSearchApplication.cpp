@@ -40,12 +40,21 @@ int CascadeSearchApplication::main(int argc, char** argv) {
   vector<string> database_indices = StringUtils::Split(database_string, ',');
   OutputFiles* output = new OutputFiles(this);
 
+  // Every database is searched by a new tide-search. Unless the spectra are
+  // cached already, they are converted once, into a cache of this run.
+  string cache_dir;
+  if (Params::GetString("spectrum-cache-dir").empty() &&
+      Params::GetString("store-spectra").empty()) {
+    cache_dir = make_file_path("cascade-search.spectrum-cache");
+  }
+
   int return_code;
   for (unsigned int cascade_cnt = 0; cascade_cnt < database_indices.size(); ++cascade_cnt) {
 
     //carry out tide-search
     TideSearchApplication TideSearchProgram;
     TideSearchProgram.setSpectrumFlag(spectrum_flag);
+    TideSearchProgram.setSpectrumCacheDir(cache_dir);
     return_code = TideSearchProgram.main(Params::GetStrings("tide spectra file"), database_indices[cascade_cnt]);
     if (return_code != 0) {
       return return_code;
@@ -85,6 +94,9 @@ int CascadeSearchApplication::main(int argc, char** argv) {
 
   }
   delete output;
+  if (!cache_dir.empty()) {
+    FileUtils::Remove(cache_dir);
+  }
 
   return 0;
 }
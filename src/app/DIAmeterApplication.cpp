@@ -1,10 +1,13 @@
 #include <cstdio>
 #include <numeric>
 #include "app/tide/abspath.h"
+#include "app/tide/protein_store.h"
 #include "app/tide/records_to_vector-inl.h"
+#include "app/tide/xcorr_kernel.h"
 
 #include "io/carp.h"
 #include "parameter.h"
+#include "io/SpectrumCache.h"
 #include "io/SpectrumRecordWriter.h"
 #include "TideIndexApplication.h"
 #include "TideSearchApplication.h"
@@ -13,6 +16,7 @@
 #include "PercolatorApplication.h"
 #include "tide/mass_constants.h"
 #include "TideMatchSet.h"
+#include "util/GlobalParams.h"
 #include "util/Params.h"
 #include "util/FileUtils.h"
 #include "util/StringUtils.h"
@@ -54,15 +58,33 @@ int DIAmeterApplication::main(const vector<string>& input_files, const string in
   string peptides_file = FileUtils::Join(index, "pepix");
   string proteins_file = FileUtils::Join(index, "protix");
   string auxlocs_file = FileUtils::Join(index, "auxlocs");
+  string protstore_file = FileUtils::Join(index, "protstore");
 
   double bin_width_  = Params::GetDouble("mz-bin-width");
   double bin_offset_ = Params::GetDouble("mz-bin-offset");
   vector<int> negative_isotope_errors = TideSearchApplication::getNegativeIsotopeErrors();
+  string xcorr_kernel = Params::GetString("xcorr-kernel");
+  if (!XCorrKernel::SetGlobal(xcorr_kernel)) {
+    carp(CARP_FATAL, "The %s XCorr kernel is not supported on this CPU.", xcorr_kernel.c_str());
+  }
+  carp(CARP_DEBUG, "Using the %s XCorr kernel.", XCorrKernel::GlobalName());
 
-  // Read proteins index file
+  // Read proteins index file, and auxlocs index file, from the protein store
+  // of the index if it is up to date
   ProteinVec proteins;
+  vector<const pb::AuxLocation*> locations;
+  ProteinStore* protein_store;
   pb::Header protein_header;
-  if (!ReadRecordsToVector<pb::Protein, const pb::Protein>(&proteins, proteins_file, &protein_header)) { carp(CARP_FATAL, "Error reading index (%s)", proteins_file.c_str()); }
+  if (ProteinStore::Usable(protstore_file, proteins_file, auxlocs_file)) {
+    HeadedRecordReader protein_reader(proteins_file, &protein_header);
+    if (!protein_reader.OK()) { carp(CARP_FATAL, "Error reading index (%s)", proteins_file.c_str()); }
+    protein_store = new ProteinStore(protstore_file);
+    if (!protein_store->OK()) { carp(CARP_FATAL, "Error reading index (%s)", protstore_file.c_str()); }
+  } else {
+    if (!ReadRecordsToVector<pb::Protein, const pb::Protein>(&proteins, proteins_file, &protein_header)) { carp(CARP_FATAL, "Error reading index (%s)", proteins_file.c_str()); }
+    if (!ReadRecordsToVector<pb::AuxLocation>(&locations, auxlocs_file)) { carp(CARP_FATAL, "Error reading index (%s)", auxlocs_file.c_str()); }
+    protein_store = new ProteinStore(proteins, &locations);
+  }
   // There shouldn't be more than one header in the protein pb.
   pb::Header_Source headerSource = protein_header.source(0);  
   string decoy_prefix = "";
@@ -74,9 +96,6 @@ int DIAmeterApplication::main(const vector<string>& input_files, const string in
                        "re-created to work with future versions of tide-index. ");
   }
   TideMatchSet::decoy_prefix_ = decoy_prefix;
-  // Read auxlocs index file
-  vector<const pb::AuxLocation*> locations;
-  if (!ReadRecordsToVector<pb::AuxLocation>(&locations, auxlocs_file)) { carp(CARP_FATAL, "Error reading index (%s)", auxlocs_file.c_str()); }
 
   // Read peptides index file
   pb::Header peptides_header;
@@ -112,13 +131,18 @@ int DIAmeterApplication::main(const vector<string>& input_files, const string in
     carp(CARP_DEBUG, "Either file exists or it needs to be overwritten: %s", output_file_name_unsorted_.c_str());
 
     ofstream* output_file = create_stream_in_path(output_file_name_unsorted_.c_str(), NULL, Params::GetBool("overwrite"));
-    TideMatchSet::writeHeadersDIA(output_file, Params::GetBool("compute-sp"));
+    TideMatchSet::writeHeadersDIA(output_file, GlobalParams::getComputeSp());
 
     map<string, double> peptide_predrt_map;
     getPeptidePredRTMapping(&peptide_predrt_map);
 
-    vector<InputFile> ms1_spectra_files = getInputFiles(input_files, 1);
-    vector<InputFile> ms2_spectra_files = getInputFiles(input_files, 2);
+    SpectrumCache* cache = NULL;
+    if (!Params::GetString("spectrum-cache-dir").empty()) {
+      cache = SpectrumCache::create(Params::GetString("spectrum-cache-dir"),
+                                    (uint64_t)Params::GetInt("spectrum-cache-size") << 20);
+    }
+    vector<InputFile> ms1_spectra_files = getInputFiles(input_files, 1, cache);
+    vector<InputFile> ms2_spectra_files = getInputFiles(input_files, 2, cache);
 
     // Loop through spectrum files
     for (int file_idx=0; file_idx < input_files.size(); ++file_idx) {
@@ -146,17 +170,17 @@ int DIAmeterApplication::main(const vector<string>& input_files, const string in
       carp(CARP_DEBUG, "Maximum observed MS2 m/z:%f", highest_ms2_mz);
 
       // Active queue to process the indexed peptides
-      ActivePeptideQueue* active_peptide_queue = new ActivePeptideQueue(peptide_reader->Reader(), proteins);
+      ActivePeptideQueue* active_peptide_queue = new ActivePeptideQueue(peptide_reader->Reader(), *protein_store);
       active_peptide_queue->setElutionWindow(0);
       active_peptide_queue->setPeptideCentric(false);
       active_peptide_queue->SetBinSize(bin_width_, bin_offset_);
-      active_peptide_queue->SetOutputs(NULL, &locations, Params::GetInt("top-match"), true, output_file, NULL, highest_ms2_mz);
+      active_peptide_queue->SetOutputs(NULL, PSMSink::Key(), GlobalParams::getTopMatch(), true, output_file, NULL, highest_ms2_mz);
 
       // Some setup adoped from TideSearch
       const vector<SpectrumCollection::SpecCharge>* spec_charges = spectra->SpecCharges();
       int sc_index = -1;
       FLOAT_T sc_total = (FLOAT_T)spec_charges->size();
-      int print_interval = Params::GetInt("print-search-progress");
+      int print_interval = GlobalParams::getPrintSearchProgress();
       // Keep track of observed peaks that get filtered out in various ways.
       long int num_range_skipped = 0;
       long int num_precursors_skipped = 0;
@@ -179,7 +203,7 @@ int DIAmeterApplication::main(const vector<string>& input_files, const string in
       if (precursor_gap_vec.size() > 0) { avg_isowin_width_ = MathUtil::Mean(precursor_gap_vec); }
 
       // This is the main search loop.
-      ObservedPeakSet observed(bin_width_, bin_offset_, Params::GetBool("use-neutral-loss-peaks"), Params::GetBool("use-flanking-peaks") );
+      ObservedPeakSet observed(bin_width_, bin_offset_, GlobalParams::getUseNeutralLossPeaks(), GlobalParams::getUseFlankingPeaks() );
 
       // Note: We don't traverse the collection of SpecCharge, which is sorted by neutral mass and if the neutral mass is equal, sort by the MS2 scan.
       // Notice that in the DIA setting, each different neutral mass correspond to a (scan-win, charge) pair.
@@ -214,7 +238,7 @@ int DIAmeterApplication::main(const vector<string>& input_files, const string in
           int ms1_scan_num = spectrum->MS1SpectrumNum();
 
           //denoising-related
-          if (Params::GetBool("spectra-denoising")) {
+          if (GlobalParams::getSpectraDenoising()) {
             int neighbor_cnt = 0;
             vector<double> proceed_mzs, succeed_mzs;
             if (chunk_idx > 0) {
@@ -246,14 +270,14 @@ int DIAmeterApplication::main(const vector<string>& input_files, const string in
               if (proceed_mz_idx >= 0) {
                 double matched_mz = proceed_mzs.at(proceed_mz_idx);
                 double ppm = fabs(peak_mz - matched_mz) * 1000000 / max(peak_mz, matched_mz);
-                if (ppm <= Params::GetInt("frag-ppm")) { ++supported_cnt; }
+                if (ppm <= GlobalParams::getFragPpm()) { ++supported_cnt; }
               }
 
               int succeed_mz_idx = MathUtil::binarySearch(&succeed_mzs, peak_mz);
               if (succeed_mz_idx >= 0) {
                 double matched_mz = succeed_mzs.at(succeed_mz_idx);
                 double ppm = fabs(peak_mz - matched_mz) * 1000000 / max(peak_mz, matched_mz);
-                if (ppm <= Params::GetInt("frag-ppm")) { ++supported_cnt; }
+                if (ppm <= GlobalParams::getFragPpm()) { ++supported_cnt; }
               }
 
               if (supported_cnt >= neighbor_cnt) {
@@ -308,7 +332,7 @@ int DIAmeterApplication::main(const vector<string>& input_files, const string in
 
           TideMatchSet matches(&match_arr, highest_ms2_mz);
           if (!match_arr.empty()) {
-            reportDIA(output_file, origin_file, spec_charge_chunk.at(chunk_idx), active_peptide_queue, proteins, locations,
+            reportDIA(output_file, origin_file, spec_charge_chunk.at(chunk_idx), active_peptide_queue, *protein_store,
                 &matches,
                 &observed,
                 &ms1scan_mz_intensity_rank_map,
@@ -351,7 +375,9 @@ int DIAmeterApplication::main(const vector<string>& input_files, const string in
 
     // clean up
     if (output_file) { output_file->close(); delete output_file; }
+    delete cache;
   }
+  delete protein_store;
 
   // standardize the features
   if (!FileUtils::Exists(output_file_name_scaled_) /*|| Params::GetBool("overwrite")*/ ) {
@@ -393,8 +419,7 @@ void DIAmeterApplication::reportDIA(
   const string& spectrum_filename, // name of spectrum file
   const SpectrumCollection::SpecCharge& sc, // spectrum and charge for matches
   const ActivePeptideQueue* peptides, // peptide queue
-  const ProteinVec& proteins, // proteins corresponding with peptides
-  const vector<const pb::AuxLocation*>& locations,  // auxiliary locations
+  const ProteinStore& proteins, // proteins and auxiliary locations of peptides
   TideMatchSet* matches, // object to manage PSMs
   ObservedPeakSet* observed,
   map<int, boost::tuple<double*, double*, double*, int>>* ms1scan_mz_intensity_rank_map,
@@ -409,7 +434,7 @@ void DIAmeterApplication::reportDIA(
 
   // get top-n targets and decoys by the heap
   vector<TideMatchSet::Arr::iterator> targets, decoys;
-  matches->gatherTargetsAndDecoys(peptides, proteins, targets, decoys, Params::GetInt("top-match"), 1, true);
+  matches->gatherTargetsAndDecoys(peptides, proteins, targets, decoys, GlobalParams::getTopMatch(), 1, true);
 
   // calculate precursor intensity logrank (ppm-based)
   int peak_num_new = -1; double *mz_arr_new = NULL, *intensity_arr_new = NULL, *intensity_rank_arr_new = NULL;
@@ -439,10 +464,10 @@ void DIAmeterApplication::reportDIA(
   computePrecIntRank(decoys, peptides, mz_arr_new, intensity_arr_new, intensity_rank_arr_new, slope_intercept_tp, peak_num_new, &intensity_map, &logrank_map, charge);
 
   // calculate precursor fragment co-elution
-  carp(CARP_DETAILED_DEBUG, "scan_gap:%d \t coelution-oneside-scans:%d", scan_gap_, Params::GetInt("coelution-oneside-scans") );
+  carp(CARP_DETAILED_DEBUG, "scan_gap:%d \t coelution-oneside-scans:%d", scan_gap_, GlobalParams::getCoelutionOnesideScans() );
   // extract the MS1 and MS2 scan numbers which constitute the local chromatogram
   vector<int> valid_ms1scans, valid_ms2scans;
-  for (int offset = -Params::GetInt("coelution-oneside-scans"); offset <= Params::GetInt("coelution-oneside-scans"); ++offset) {
+  for (int offset = -GlobalParams::getCoelutionOnesideScans(); offset <= GlobalParams::getCoelutionOnesideScans(); ++offset) {
     int candidate_ms1scan = ms1_scan_num + offset*scan_gap_;
     int candidate_ms2scan = ms2_scan_num + offset*scan_gap_;
     if (candidate_ms1scan < 1 || candidate_ms1scan > max_ms1scan_) { continue; }
@@ -501,24 +526,23 @@ void DIAmeterApplication::reportDIA(
 
   // calculate SpScore if necessary
   map<TideMatchSet::Arr::iterator, pair<const SpScorer::SpScoreData, int> > sp_map;
-  if (Params::GetBool("compute-sp")) {
+  if (GlobalParams::getComputeSp()) {
     SpScorer sp_scorer(proteins, *spectrum, charge, matches->max_mz_);
     TideMatchSet::computeSpData(targets, &sp_map, &sp_scorer, peptides);
     TideMatchSet::computeSpData(decoys, &sp_map, &sp_scorer, peptides);
   }
 
   matches->writeToFileDIA(output_file,
-      Params::GetInt("top-match"),
+      GlobalParams::getTopMatch(),
       targets,
       spectrum_filename,
       spectrum,
       charge,
       peptides,
       proteins,
-      locations,
       &delta_cn_map,
       &delta_lcn_map,
-      Params::GetBool("compute-sp")? &sp_map : NULL,
+      GlobalParams::getComputeSp()? &sp_map : NULL,
       &intensity_map,
       &logrank_map,
       &coelute_map,
@@ -526,17 +550,16 @@ void DIAmeterApplication::reportDIA(
       peptide_predrt_map);
 
   matches->writeToFileDIA(output_file,
-      Params::GetInt("top-match"),
+      GlobalParams::getTopMatch(),
       decoys,
       spectrum_filename,
       spectrum,
       charge,
       peptides,
       proteins,
-      locations,
       &delta_cn_map,
       &delta_lcn_map,
-      Params::GetBool("compute-sp")? &sp_map : NULL,
+      GlobalParams::getComputeSp()? &sp_map : NULL,
       &intensity_map,
       &logrank_map,
       &coelute_map,
@@ -576,7 +599,7 @@ void DIAmeterApplication::computePrecFragCoelute(
          double* ms1_intensity_arr = mz_intensity_arrs.get<1>();
          int ms1_peak_num = mz_intensity_arrs.get<2>();
 
-         intensity_arr[coelute_idx] = closestPPMValue(ms1_mz_arr, ms1_intensity_arr, ms1_peak_num, prec_mz, Params::GetInt("prec-ppm"), 0, true);
+         intensity_arr[coelute_idx] = closestPPMValue(ms1_mz_arr, ms1_intensity_arr, ms1_peak_num, prec_mz, GlobalParams::getPrecPpm(), 0, true);
        }
        ms1_chroms.push_back(intensity_arr);
      }
@@ -594,7 +617,7 @@ void DIAmeterApplication::computePrecFragCoelute(
          double* ms2_intensity_arr = mz_intensity_arrs.get<4>();
          int ms2_peak_num = mz_intensity_arrs.get<5>();
 
-         intensity_arr[coelute_idx] = closestPPMValue(ms2_mz_arr, ms2_intensity_arr, ms2_peak_num, frag_mz, Params::GetInt("frag-ppm"), 0, true);
+         intensity_arr[coelute_idx] = closestPPMValue(ms2_mz_arr, ms2_intensity_arr, ms2_peak_num, frag_mz, GlobalParams::getFragPpm(), 0, true);
        }
        ms2_chroms.push_back(intensity_arr);
      }
@@ -627,9 +650,9 @@ void DIAmeterApplication::computePrecFragCoelute(
      sort(ms1_ms2_corrs.begin(), ms1_ms2_corrs.end(), greater<double>());
 
      double ms1_mean = 0, ms2_mean = 0, ms1_ms2_mean = 0;
-     if (ms1_corrs.size() > 0) { ms1_corrs.resize(Params::GetInt("coelution-topk")); ms1_mean = std::accumulate(ms1_corrs.begin(), ms1_corrs.end(), 0.0) / ms1_corrs.size(); }
-     if (ms2_corrs.size() > 0) { ms2_corrs.resize(Params::GetInt("coelution-topk")); ms2_mean = std::accumulate(ms2_corrs.begin(), ms2_corrs.end(), 0.0) / ms2_corrs.size(); }
-     if (ms1_ms2_corrs.size() > 0) { ms1_ms2_corrs.resize(Params::GetInt("coelution-topk")); ms1_ms2_mean = std::accumulate(ms1_ms2_corrs.begin(), ms1_ms2_corrs.end(), 0.0) / ms1_ms2_corrs.size(); }
+     if (ms1_corrs.size() > 0) { ms1_corrs.resize(GlobalParams::getCoelutionTopk()); ms1_mean = std::accumulate(ms1_corrs.begin(), ms1_corrs.end(), 0.0) / ms1_corrs.size(); }
+     if (ms2_corrs.size() > 0) { ms2_corrs.resize(GlobalParams::getCoelutionTopk()); ms2_mean = std::accumulate(ms2_corrs.begin(), ms2_corrs.end(), 0.0) / ms2_corrs.size(); }
+     if (ms1_ms2_corrs.size() > 0) { ms1_ms2_corrs.resize(GlobalParams::getCoelutionTopk()); ms1_ms2_mean = std::accumulate(ms1_ms2_corrs.begin(), ms1_ms2_corrs.end(), 0.0) / ms1_ms2_corrs.size(); }
      coelute_map->insert(make_pair((*i), boost::make_tuple(ms1_mean, ms2_mean, ms1_ms2_mean)));
 
      // clean up
@@ -738,25 +761,38 @@ void DIAmeterApplication::computePrecIntRank(
     Peptide& peptide = *(peptides->GetPeptide((*i)->rank));
     double peptide_mz_m0 = Peptide::MassToMz(peptide.Mass(), charge);
 
-    double intensity_rank_m0 = closestPPMValue(mz_arr, intensity_rank_arr, peak_num, peptide_mz_m0, Params::GetInt("prec-ppm"), noise_intensity_rank, false);
-    double intensity_rank_m1 = closestPPMValue(mz_arr, intensity_rank_arr, peak_num, peptide_mz_m0 + 1.0/(charge * 1.0), Params::GetInt("prec-ppm"), noise_intensity_rank, false);
-    double intensity_rank_m2 = closestPPMValue(mz_arr, intensity_rank_arr, peak_num, peptide_mz_m0 + 2.0/(charge * 1.0), Params::GetInt("prec-ppm"), noise_intensity_rank, false);
+    double intensity_rank_m0 = closestPPMValue(mz_arr, intensity_rank_arr, peak_num, peptide_mz_m0, GlobalParams::getPrecPpm(), noise_intensity_rank, false);
+    double intensity_rank_m1 = closestPPMValue(mz_arr, intensity_rank_arr, peak_num, peptide_mz_m0 + 1.0/(charge * 1.0), GlobalParams::getPrecPpm(), noise_intensity_rank, false);
+    double intensity_rank_m2 = closestPPMValue(mz_arr, intensity_rank_arr, peak_num, peptide_mz_m0 + 2.0/(charge * 1.0), GlobalParams::getPrecPpm(), noise_intensity_rank, false);
 
-    double intensity_m0 = closestPPMValue(mz_arr, intensity_arr, peak_num, peptide_mz_m0, Params::GetInt("prec-ppm"), 0, false);
-    double intensity_m1 = closestPPMValue(mz_arr, intensity_arr, peak_num, peptide_mz_m0 + 1.0/(charge * 1.0), Params::GetInt("prec-ppm"), 0, false);
-    double intensity_m2 = closestPPMValue(mz_arr, intensity_arr, peak_num, peptide_mz_m0 + 2.0/(charge * 1.0), Params::GetInt("prec-ppm"), 0, false);
+    double intensity_m0 = closestPPMValue(mz_arr, intensity_arr, peak_num, peptide_mz_m0, GlobalParams::getPrecPpm(), 0, false);
+    double intensity_m1 = closestPPMValue(mz_arr, intensity_arr, peak_num, peptide_mz_m0 + 1.0/(charge * 1.0), GlobalParams::getPrecPpm(), 0, false);
+    double intensity_m2 = closestPPMValue(mz_arr, intensity_arr, peak_num, peptide_mz_m0 + 2.0/(charge * 1.0), GlobalParams::getPrecPpm(), 0, false);
 
     intensity_map->insert(make_pair((*i), boost::make_tuple(intensity_rank_m0, intensity_rank_m1, intensity_rank_m2)));
     logrank_map->insert(make_pair((*i), boost::make_tuple(slope*log(1.0+intensity_m0)+intercept, slope*log(1.0+intensity_m1)+intercept, slope*log(1.0+intensity_m2)+intercept)));
   }
 }
 
-vector<InputFile> DIAmeterApplication::getInputFiles(const vector<string>& filepaths, int ms_level) const {
+vector<InputFile> DIAmeterApplication::getInputFiles(const vector<string>& filepaths, int ms_level, SpectrumCache* cache) const {
   vector<InputFile> input_sr;
 
   if (Params::GetString("spectrum-parser") != "pwiz") { carp(CARP_FATAL, "spectrum-parser must be pwiz instead of %s", Params::GetString("spectrum-parser").c_str() ); }
 
   for (vector<string>::const_iterator f = filepaths.begin(); f != filepaths.end(); f++) {
+    if (cache) {
+      string entry = cache->entry(*f, ms_level, true);
+      if (cache->reserve(entry)) {
+        carp(CARP_INFO, "Converting %s to spectrumrecords %s", f->c_str(), entry.c_str());
+        bool converted = SpectrumRecordWriter::convert(*f, cache->tempFile(entry), ms_level, true);
+        cache->commit(entry, converted);
+        if (!converted) {
+          carp(CARP_FATAL, "Error converting MS%d spectrumrecords from %s", ms_level, f->c_str());
+        }
+      }
+      input_sr.push_back(InputFile(*f, entry, true));
+      continue;
+    }
     string spectrum_input_url = *f;
     string spectrumrecords_url = make_file_path(FileUtils::BaseName(spectrum_input_url) + ".spectrumrecords.ms" + to_string(ms_level));
     carp(CARP_INFO, "Converting %s to spectrumrecords %s", spectrum_input_url.c_str(), spectrumrecords_url.c_str());
@@ -839,7 +875,7 @@ void DIAmeterApplication::buildSpectraIndexFromIsoWindow(vector<SpectrumCollecti
 
       mz_arr[peak_idx] = peak_mz;
 
-      if (Params::GetBool("spectra-denoising") && !spectrum->Is_supported(peak_idx)) {
+      if (GlobalParams::getSpectraDenoising() && !spectrum->Is_supported(peak_idx)) {
         intensity_arr[peak_idx] = 0;
       } else {
         intensity_arr[peak_idx] = peak_intensity;
@@ -1099,6 +1135,9 @@ vector<string> DIAmeterApplication::getOptions() const {
   "frag-ppm",
   "top-match",
   "diameter-instrument",
+  "spectrum-cache-dir",
+  "spectrum-cache-size",
+  "xcorr-kernel",
   "verbosity"
   };
   return vector<string>(arr, arr + sizeof(arr) / sizeof(string));
@@ -23,6 +23,8 @@
 
 using namespace std;
 
+class SpectrumCache;
+
 // It is modified from TideSearchApplication ScSortByMz with following differences:
 // By default the mz tolerane would be half of the isolation window
 // In case the isolation window is 0 which should cause a fatal error elsewhere
@@ -56,7 +58,7 @@ class DIAmeterApplication : public CruxApplication {
 
   std::string remove_index_, output_pin_, output_percolator_;
 
-  vector<InputFile> getInputFiles(const vector<string>& filepaths, int ms_level) const;
+  vector<InputFile> getInputFiles(const vector<string>& filepaths, int ms_level, SpectrumCache* cache) const;
 
   SpectrumCollection* loadSpectra(const std::string& file);
 
@@ -72,8 +74,7 @@ class DIAmeterApplication : public CruxApplication {
     const string& spectrum_filename, // name of spectrum file
     const SpectrumCollection::SpecCharge& sc, // spectrum and charge for matches
     const ActivePeptideQueue* peptides, // peptide queue
-    const ProteinVec& proteins, // proteins corresponding with peptides
-    const vector<const pb::AuxLocation*>& locations,  // auxiliary locations
+    const ProteinStore& proteins, // proteins and auxiliary locations of peptides
     TideMatchSet* matches, // object to manage PSMs
     ObservedPeakSet* observed,
     map<int, boost::tuple<double*, double*, double*, int>>* ms1scan_mz_intensity_rank_map,
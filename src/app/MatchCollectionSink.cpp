@@ -0,0 +1,109 @@
+#include <algorithm>
+
+#include "MatchCollectionSink.h"
+#include "PSMConvertApplication.h"
+#include "TideMatchSet.h"
+#include "io/carp.h"
+#include "io/MatchCollectionParser.h"
+#include "model/PeptideSrc.h"
+#include "util/crux-utils.h"
+
+using namespace Crux;
+
+MatchCollectionSink::MatchCollectionSink(const vector<SCORER_TYPE_T>& scored_types,
+                                         bool decoy_indexes)
+  : scored_types_(scored_types), decoy_indexes_(decoy_indexes) {
+}
+
+MatchCollectionSink::~MatchCollectionSink() {
+  for (size_t i = 0; i < targets_.size(); i++) {
+    Match::freeMatch(targets_[i].match);
+  }
+  for (size_t i = 0; i < decoys_.size(); i++) {
+    Match::freeMatch(decoys_[i].match);
+  }
+}
+
+void MatchCollectionSink::add(
+  Match* match,
+  const vector<PSMLocation>& locations,
+  const string& file_path,
+  bool decoy,
+  const Key& key
+) {
+  Entry entry;
+  entry.key = key;
+  entry.match = match;
+  entry.locations = locations;
+  entry.file_path = file_path;
+  boost::mutex::scoped_lock lock(mutex_);
+  (decoy ? decoys_ : targets_).push_back(entry);
+}
+
+/**
+ * Gives the peptides their protein sources, as MatchFileReader does for the
+ * rows of a tab-delimited file, puts the matches into a collection in key
+ * order and writes it.
+ */
+void MatchCollectionSink::write(
+  bool decoy,
+  CruxApplication* application,
+  const vector<string>& formats,
+  const string& output_file_base,
+  const string& database_file
+) {
+  vector<Entry>& entries = decoy ? decoys_ : targets_;
+  sort(entries.begin(), entries.end());
+
+  Database* database = database_file.empty()
+    ? new Database() : new Database(database_file.c_str(), false);
+  DIGEST_T digestion = string_to_digest_type(TideMatchSet::CleavageType);
+
+  MatchCollection* collection = new MatchCollection();
+  collection->preparePostProcess();
+  for (vector<SCORER_TYPE_T>::const_iterator i = scored_types_.begin();
+       i != scored_types_.end();
+       ++i) {
+    collection->setScoredType(*i, true);
+  }
+  collection->setHasDistinctMatches(true);
+
+  for (vector<Entry>::iterator i = entries.begin(); i != entries.end(); ++i) {
+    Match* match = i->match;
+    Crux::Peptide* peptide = match->getPeptide();
+    string sequence = peptide->getUnshuffledSequence();
+    for (vector<PSMLocation>::const_iterator j = i->locations.begin();
+         j != i->locations.end();
+         ++j) {
+      string protein_id = j->ProteinId;
+      string prev_aa = j->FlankingAAs.substr(0, 1);
+      string next_aa = j->FlankingAAs.substr(1, 1);
+      bool is_decoy;
+      Protein* protein = MatchCollectionParser::getProtein(database, NULL, protein_id, is_decoy);
+      PeptideSrc* peptide_src = new PeptideSrc();
+      if (protein->isPostProcess()) {
+        peptide_src->setStartIdxOriginal(j->Pos);
+      }
+      peptide_src->setParentProtein(protein);
+      peptide_src->setDigest(digestion);
+      peptide_src->setStartIdx(protein->findStart(sequence, prev_aa, next_aa));
+      peptide->addPeptideSrc(peptide_src);
+    }
+    if (!i->file_path.empty()) {
+      match->setFilePath(i->file_path);
+    }
+    if (decoy_indexes_ && match->getNullPeptide()) {
+      collection->setHasDecoyIndexes(true);
+    }
+    collection->addMatchToPostMatchCollection(match);
+    Match::freeMatch(match);
+  }
+  entries.clear();
+
+  carp(CARP_INFO, "Writing %d %s PSMs.", collection->getMatchTotal(),
+       decoy ? "decoy" : "target");
+  PSMConvertApplication::writeCollection(application, collection, formats,
+                                         output_file_base, database_file);
+  delete collection;
+  delete database;
+}
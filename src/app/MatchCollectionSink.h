@@ -0,0 +1,75 @@
+/**
+ * \file MatchCollectionSink.h
+ * \brief Collects the matches of a search in memory, to write them in the
+ * formats that are not written row by row.
+ *
+ * pepXML and SQT group matches by protein, and pin needs all matches of the
+ * run, so the matches are kept until the search is done. They then go into
+ * a MatchCollection for the target output and one for the decoy output, in
+ * the order of the tab-delimited rows, whichever threads reported them.
+ *****************************************************************************/
+#ifndef MATCHCOLLECTIONSINK_H
+#define MATCHCOLLECTIONSINK_H
+
+#include <string>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include "io/PSMSink.h"
+#include "model/MatchCollection.h"
+
+class CruxApplication;
+
+class MatchCollectionSink : public PSMSink {
+
+ public:
+
+  /**
+   * The collections have the scores of scored_types. If decoy_indexes is
+   * set, decoy matches have decoy indexes.
+   */
+  MatchCollectionSink(const std::vector<SCORER_TYPE_T>& scored_types, bool decoy_indexes);
+
+  /**
+   * Frees the matches that were not written.
+   */
+  ~MatchCollectionSink();
+
+  virtual void add(
+    Crux::Match* match,
+    const std::vector<PSMLocation>& locations,
+    const std::string& file_path,
+    bool decoy,
+    const Key& key
+  );
+
+  /**
+   * Writes the matches of the target or the decoy output in each of formats,
+   * to files beginning with output_file_base, and frees them. Proteins are
+   * looked up in database_file, or made up if it is empty.
+   */
+  void write(
+    bool decoy,
+    CruxApplication* application,
+    const std::vector<std::string>& formats,
+    const std::string& output_file_base,
+    const std::string& database_file
+  );
+
+ private:
+
+  struct Entry {
+    Key key;
+    Crux::Match* match;
+    std::vector<PSMLocation> locations;
+    std::string file_path;
+    bool operator<(const Entry& other) const { return key < other.key; }
+  };
+
+  std::vector<SCORER_TYPE_T> scored_types_;
+  bool decoy_indexes_;
+  boost::mutex mutex_;
+  std::vector<Entry> targets_;
+  std::vector<Entry> decoys_;
+};
+
+#endif
@@ -29,6 +29,13 @@ PSMConvertApplication::~PSMConvertApplication() {
 }
 
 void PSMConvertApplication::convertFile(string input_format, string output_format, string input_file, string output_file_base, string database_file, bool distinct_matches) {
+  convertFile(input_format, vector<string>(1, output_format), input_file, output_file_base, database_file, distinct_matches);
+}
+
+/**
+ * Reads input_file once and writes its PSMs in each of output_formats.
+ */
+void PSMConvertApplication::convertFile(string input_format, const vector<string>& output_formats, string input_file, string output_file_base, string database_file, bool distinct_matches) {
   Database* data;
   if (database_file.empty()) {
     data = new Database();
@@ -95,50 +102,77 @@ void PSMConvertApplication::convertFile(string input_format, string output_forma
   }
   
   carp(CARP_INFO, "Successfully read %d PSMs.", collection->getMatchTotal());
-  
-  // What will be used when PSMWriter is finished.
-  
-  PSMWriter* writer;
-  stringstream output_file_name_builder;
-  output_file_name_builder << output_file_base;
-  
+
+  writeCollection(this, collection, output_formats, output_file_base, database_file);
+
+  // Clean Up
+  delete collection;
+  delete reader;
+
+}
+
+/**
+ * Writes the PSMs of collection in each of output_formats. The pepXML and
+ * SQT writers share one ProteinMatchCollection.
+ */
+void PSMConvertApplication::writeCollection(CruxApplication* application, MatchCollection* collection, const vector<string>& output_formats, const string& output_file_base, const string& database_file) {
+  ProteinMatchCollection* protein_collection = NULL;
+  for (vector<string>::const_iterator format = output_formats.begin();
+       format != output_formats.end();
+       ++format) {
+    string extension;
+    PSMWriter* writer = createWriter(*format, &extension);
+    string output_file_name = make_file_path(output_file_base + extension);
+
+    writer->openFile(application, output_file_name, PSMWriter::PSMS);
+    if (*format == "pepxml" || *format == "sqt") {
+      if (protein_collection == NULL) {
+        protein_collection = new ProteinMatchCollection(collection);
+      }
+      if (*format == "pepxml") {
+        ((PMCPepXMLWriter*)writer)->write(protein_collection);
+      } else {
+        ((PMCSQTWriter*)writer)->write(protein_collection, database_file);
+      }
+    } else {
+      writer->write(collection, database_file);
+    }
+    writer->closeFile();
+    delete writer;
+  }
+
+  delete protein_collection;
+}
+
+
+/**
+ * Returns a new writer for output_format, and the extension of its files.
+ */
+PSMWriter* PSMConvertApplication::createWriter(const string& output_format, string* extension) {
   if (output_format == "tsv") {
-    output_file_name_builder << "txt";
-    writer = new PMCDelimitedFileWriter();
+    *extension = "txt";
+    return new PMCDelimitedFileWriter();
   } else if (output_format == "html") {
-    output_file_name_builder << "html";
-    writer = new HTMLWriter();
+    *extension = "html";
+    return new HTMLWriter();
   } else if (output_format == "sqt") {
-    output_file_name_builder << "sqt";
-    writer = new PMCSQTWriter();
+    *extension = "sqt";
+    return new PMCSQTWriter();
   } else if (output_format == "pin") {
-    output_file_name_builder << "pin";
-    writer = new PinWriter();
+    *extension = "pin";
+    return new PinWriter();
   } else if (output_format == "pepxml") {
-    output_file_name_builder << "pep.xml";
-    writer = new PMCPepXMLWriter();
+    *extension = "pep.xml";
+    return new PMCPepXMLWriter();
   } else if (output_format == "mzidentml") {
-    output_file_name_builder << "mzid";
-    writer = new MzIdentMLWriter();
-  } else {
-    carp(CARP_FATAL, "Invalid output format.  Valid formats are: tsv, html, "
-         "sqt, pin, pepxml, mzidentml.");
+    *extension = "mzid";
+    return new MzIdentMLWriter();
   }
-  
-  string output_file_name = make_file_path(output_file_name_builder.str());
-  
-  writer->openFile(this, output_file_name, PSMWriter::PSMS);
-  writer->write(collection, database_file);
-  writer->closeFile();
-  
-  // Clean Up
-  delete collection;
-  delete reader;
-  delete writer;
-
+  carp(CARP_FATAL, "Invalid output format.  Valid formats are: tsv, html, "
+       "sqt, pin, pepxml, mzidentml.");
+  return NULL;
 }
 
-
 int PSMConvertApplication::main(int argc, char** argv) {
   string database_file = Params::GetString("protein-database");
   string input_format = Params::GetString("input-format");
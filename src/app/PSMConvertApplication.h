@@ -11,6 +11,9 @@
 
 using namespace std;
 
+class MatchCollection;
+class PSMWriter;
+
 class PSMConvertApplication : public CruxApplication {
 
  public:
@@ -34,6 +37,16 @@ class PSMConvertApplication : public CruxApplication {
    * Perform Convert
    */
   virtual void convertFile(string input_format, string output_format, string input_file, string output_file_base, string database_file, bool distinct_matches);
+
+  /**
+   * Perform Convert to several formats, reading the input once
+   */
+  virtual void convertFile(string input_format, const vector<string>& output_formats, string input_file, string output_file_base, string database_file, bool distinct_matches);
+
+  /**
+   * Writes the PSMs of a collection in several formats
+   */
+  static void writeCollection(CruxApplication* application, MatchCollection* collection, const vector<string>& output_formats, const string& output_file_base, const string& database_file);
   
   /**
    * Returns the command name
@@ -66,6 +79,13 @@ class PSMConvertApplication : public CruxApplication {
   virtual bool needsOutputDirectory() const;
 
   virtual COMMAND_T getCommand() const;
+
+ protected:
+
+  /**
+   * Returns a new writer for output_format, and the extension of its files
+   */
+  static PSMWriter* createWriter(const string& output_format, string* extension);
   
 };
 
@@ -0,0 +1,201 @@
+/**
+ * \file PsmTable.cpp
+ * \brief The PSMs that q-values are computed over, stored by column.
+ *****************************************************************************/
+#include "PsmTable.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <set>
+#include "io/carp.h"
+#include "model/Spectrum.h"
+#include "util/QValues.h"
+
+using namespace std;
+using namespace Crux;
+
+namespace {
+
+// Orders rows by file, scan, charge and row, for rows with tied scores.
+class IdentifierLess {
+ public:
+  explicit IdentifierLess(const PsmTable& table) : table_(table) {
+  }
+  bool operator()(size_t x, size_t y) const {
+    if (table_.file(x) != table_.file(y)) {
+      return table_.file(x) < table_.file(y);
+    }
+    if (table_.scan(x) != table_.scan(y)) {
+      return table_.scan(x) < table_.scan(y);
+    }
+    if (table_.charge(x) != table_.charge(y)) {
+      return table_.charge(x) < table_.charge(y);
+    }
+    return x < y;
+  }
+ private:
+  const PsmTable& table_;
+};
+
+// Orders (score, q-value) pairs by score alone.
+struct LookupLess {
+  bool operator()(const pair<FLOAT_T, FLOAT_T>& x, const pair<FLOAT_T, FLOAT_T>& y) const {
+    return x.first < y.first;
+  }
+};
+
+}
+
+PsmTable::PsmTable() {
+}
+
+PsmTable::~PsmTable() {
+  for (vector<Match*>::iterator i = matches_.begin(); i != matches_.end(); i++) {
+    if (*i != NULL) {
+      Match::freeMatch(*i);
+    }
+  }
+}
+
+size_t PsmTable::add(
+  Match* match,
+  SCORER_TYPE_T score_type,
+  int peptide
+) {
+  bool decoy = match->getNullPeptide();
+  scores_.push_back(match->getScore(score_type));
+  files_.push_back(match->getFileIndex());
+  scans_.push_back(match->getSpectrum()->getFirstScan());
+  charges_.push_back(match->getCharge());
+  peptides_.push_back(peptide);
+  decoys_.push_back(decoy ? 1 : 0);
+  decoy_indexes_.push_back(match->decoyIndex());
+  if (decoy) {
+    matches_.push_back(NULL);
+  } else {
+    match->incrementPointerCount();
+    matches_.push_back(match);
+  }
+  return scores_.size() - 1;
+}
+
+int PsmTable::internPeptide(
+  const string& sequence
+) {
+  return peptide_ids_.insert(make_pair(sequence, (int)peptide_ids_.size())).first->second;
+}
+
+int PsmTable::findPeptide(
+  const string& sequence
+) const {
+  unordered_map<string, int>::const_iterator i = peptide_ids_.find(sequence);
+  return i != peptide_ids_.end() ? i->second : -1;
+}
+
+vector<FLOAT_T> PsmTable::scores(
+  bool decoys
+) const {
+  vector<FLOAT_T> out;
+  for (size_t row = 0; row < scores_.size(); row++) {
+    if (isDecoy(row) == decoys) {
+      out.push_back(scores_[row]);
+    }
+  }
+  return out;
+}
+
+vector<int> PsmTable::decoyIndexes() const {
+  set<int> indexes;
+  for (size_t row = 0; row < scores_.size(); row++) {
+    if (isDecoy(row)) {
+      indexes.insert(decoy_indexes_[row]);
+    }
+  }
+  return vector<int>(indexes.begin(), indexes.end());
+}
+
+vector<size_t> PsmTable::sortedRows(
+  bool ascending,
+  bool decoys,
+  int decoy_index,
+  int num_threads
+) const {
+  vector<size_t> rows;
+  for (size_t row = 0; row < scores_.size(); row++) {
+    if (isDecoy(row) == decoys && (!decoys || decoy_indexes_[row] == decoy_index)) {
+      rows.push_back(row);
+    }
+  }
+
+  QValues::SortByScore(scores_, ascending, num_threads, &rows);
+
+  // Rows with tied scores come out in row order; put them in identifier order
+  // so that the order does not depend on how the rows were read.
+  IdentifierLess less(*this);
+  for (size_t begin = 0; begin < rows.size(); ) {
+    size_t end = begin + 1;
+    while (end < rows.size() && !QValues::Better(scores_[rows[begin]], scores_[rows[end]], ascending)) {
+      end++;
+    }
+    if (end - begin > 1) {
+      sort(rows.begin() + begin, rows.begin() + end, less);
+    }
+    begin = end;
+  }
+  return rows;
+}
+
+void PsmTable::assignQValues(
+  const vector<FLOAT_T>& scores,
+  const vector<FLOAT_T>& qvalues,
+  SCORER_TYPE_T derived_score_type
+) const {
+  vector< pair<FLOAT_T, FLOAT_T> > lookup;
+  lookup.reserve(scores.size());
+  for (size_t i = 0; i < scores.size(); i++) {
+    if (!isnan(scores[i]) && !isinf(scores[i])) {
+      lookup.push_back(make_pair(scores[i], qvalues[i]));
+    }
+  }
+  stable_sort(lookup.begin(), lookup.end(), LookupLess());
+
+  for (size_t row = 0; row < scores_.size(); row++) {
+    if (matches_[row] == NULL) {
+      continue;
+    }
+    FLOAT_T score = scores_[row];
+    FLOAT_T qvalue;
+    // If the score is not a number, punt.
+    if (isinf(score) || isnan(score)) {
+      carp(CARP_DEBUG, "Found inf or nan score.");
+      qvalue = numeric_limits<double>::quiet_NaN();
+    } else {
+      // The last of the entries for this score.
+      vector< pair<FLOAT_T, FLOAT_T> >::const_iterator i =
+        upper_bound(lookup.begin(), lookup.end(), make_pair(score, (FLOAT_T)0), LookupLess());
+      if (i == lookup.begin() || (--i)->first != score) {
+        carp(CARP_FATAL, "Cannot find q-value corresponding to score of %g.", score);
+      }
+      qvalue = i->second;
+    }
+    matches_[row]->setScore(derived_score_type, qvalue);
+  }
+}
+
+void PsmTable::addTargetMatches(
+  MatchCollection* collection
+) const {
+  for (vector<Match*>::const_iterator i = matches_.begin(); i != matches_.end(); i++) {
+    if (*i != NULL) {
+      collection->addMatch(*i);
+    }
+  }
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 2
+ * End:
+ */
@@ -0,0 +1,137 @@
+/**
+ * \file PsmTable.h
+ * \brief The PSMs that q-values are computed over, stored by column.
+ *
+ * A row holds what a q-value procedure looks at for one PSM: its score,
+ * spectrum file, scan and charge, an interned peptide id and its decoy
+ * index. Targets also hold their Match, which is kept only so that it can
+ * be written out; decoys hold none, so their Match objects can be freed as
+ * soon as they are read.
+ *****************************************************************************/
+#ifndef PSMTABLE_H
+#define PSMTABLE_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "model/Match.h"
+#include "model/MatchCollection.h"
+
+class PsmTable {
+
+ public:
+
+  PsmTable();
+
+  /**
+   * Releases the matches of the targets.
+   */
+  ~PsmTable();
+
+  /**
+   * Adds a PSM and returns its row. A target's match is kept until the
+   * table is deleted; a decoy's match is not kept.
+   */
+  size_t add(
+    Crux::Match* match,
+    SCORER_TYPE_T score_type,
+    int peptide ///< id from internPeptide(), or -1
+  );
+
+  /**
+   * \returns the id of a peptide sequence, adding it if it is new.
+   */
+  int internPeptide(
+    const std::string& sequence
+  );
+
+  /**
+   * \returns the id of a peptide sequence, or -1 if it has not been added.
+   */
+  int findPeptide(
+    const std::string& sequence
+  ) const;
+
+  size_t size() const { return scores_.size(); }
+  size_t numPeptides() const { return peptide_ids_.size(); }
+
+  FLOAT_T score(size_t row) const { return scores_[row]; }
+  int file(size_t row) const { return files_[row]; }
+  int scan(size_t row) const { return scans_[row]; }
+  int charge(size_t row) const { return charges_[row]; }
+  int peptide(size_t row) const { return peptides_[row]; }
+  int decoyIndex(size_t row) const { return decoy_indexes_[row]; }
+  bool isDecoy(size_t row) const { return decoys_[row] != 0; }
+  Crux::Match* match(size_t row) const { return matches_[row]; }
+
+  /**
+   * \returns the scores of the targets, or of the decoys, in row order.
+   */
+  std::vector<FLOAT_T> scores(
+    bool decoys
+  ) const;
+
+  /**
+   * \returns the decoy indexes of the decoys, in increasing order.
+   */
+  std::vector<int> decoyIndexes() const;
+
+  /**
+   * \returns the rows of the targets, or of the decoys with the given decoy
+   * index, best score first, then by file, scan, charge and row. Large
+   * tables are sorted on num_threads threads.
+   */
+  std::vector<size_t> sortedRows(
+    bool ascending,
+    bool decoys,
+    int decoy_index,
+    int num_threads
+  ) const;
+
+  /**
+   * Sets derived_score_type on each target match to the q-value paired with
+   * its score, as MatchCollection::assignQValues does: scores that are not
+   * numbers get NaN, and if a score is listed more than once the last q-value
+   * given for it is used.
+   */
+  void assignQValues(
+    const std::vector<FLOAT_T>& scores,
+    const std::vector<FLOAT_T>& qvalues,
+    SCORER_TYPE_T derived_score_type
+  ) const;
+
+  /**
+   * Adds the target matches to a collection, for writing.
+   */
+  void addTargetMatches(
+    MatchCollection* collection
+  ) const;
+
+ protected:
+
+  std::vector<FLOAT_T> scores_;
+  std::vector<int> files_;
+  std::vector<int> scans_;
+  std::vector<int> charges_;
+  std::vector<int> peptides_;
+  std::vector<char> decoys_; ///< whether each PSM is a decoy
+  std::vector<int> decoy_indexes_;
+  std::vector<Crux::Match*> matches_; ///< NULL for decoys
+
+  std::unordered_map<std::string, int> peptide_ids_;
+
+ private:
+
+  PsmTable(const PsmTable&);  // not copyable; holds matches
+  PsmTable& operator=(const PsmTable&);
+
+};
+
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 2
+ * End:
+ */
@@ -3,8 +3,10 @@
 #include "TideMatchSet.h"
 #include "io/carp.h"
 #include "parameter.h"
+#include "app/tide/mass_index.h"
 #include "app/tide/records_to_vector-inl.h"
 #include "app/tide/peptide.h"
+#include "app/tide/protein_store.h"
 #include "util/Params.h"
 #include <vector>
 
@@ -21,26 +23,39 @@ int ReadTideIndex::main(int argc, char** argv) {
 
   string index_dir = Params::GetString("tide database");
   string peptides_file = index_dir + "/pepix";
+  string massix_file = index_dir + "/massix";
   string proteins_file = index_dir + "/protix";
   string auxlocs_file = index_dir + "/auxlocs";
+  string protstore_file = index_dir + "/protstore";
 
-  // Read proteins index file
-  carp(CARP_INFO, "Reading proteins...");
+  // The proteins and auxiliary locations come from the protein store if the
+  // index has one.
   ProteinVec proteins;
-  pb::Header protein_header;
-  if (!ReadRecordsToVector<pb::Protein, const pb::Protein>(&proteins,
-      proteins_file, &protein_header)) {
-    carp(CARP_FATAL, "Error reading index (%s)", proteins_file.c_str());
-  }
-  carp(CARP_DEBUG, "Read %d proteins", proteins.size());
-
-  // Read auxlocs index file
-  carp(CARP_INFO, "Reading auxiliary locations...");
   vector<const pb::AuxLocation*> locations;
-  if (!ReadRecordsToVector<pb::AuxLocation>(&locations, auxlocs_file)) {
-    carp(CARP_FATAL, "Error reading index (%s)", auxlocs_file.c_str());
+  ProteinStore* protein_store;
+  if (ProteinStore::Usable(protstore_file, proteins_file, auxlocs_file)) {
+    protein_store = new ProteinStore(protstore_file);
+    if (!protein_store->OK()) {
+      carp(CARP_FATAL, "Error reading index (%s)", protstore_file.c_str());
+    }
+  } else {
+    // Read proteins index file
+    carp(CARP_INFO, "Reading proteins...");
+    pb::Header protein_header;
+    if (!ReadRecordsToVector<pb::Protein, const pb::Protein>(&proteins,
+        proteins_file, &protein_header)) {
+      carp(CARP_FATAL, "Error reading index (%s)", proteins_file.c_str());
+    }
+    carp(CARP_DEBUG, "Read %d proteins", proteins.size());
+
+    // Read auxlocs index file
+    carp(CARP_INFO, "Reading auxiliary locations...");
+    if (!ReadRecordsToVector<pb::AuxLocation>(&locations, auxlocs_file)) {
+      carp(CARP_FATAL, "Error reading index (%s)", auxlocs_file.c_str());
+    }
+    carp(CARP_DEBUG, "Read %d auxlocs", locations.size());
+    protein_store = new ProteinStore(proteins, &locations);
   }
-  carp(CARP_DEBUG, "Read %d auxlocs", locations.size());
 
   // Read peptides index file
   carp(CARP_INFO, "Reading peptides...");
@@ -66,31 +81,47 @@ int ReadTideIndex::main(int argc, char** argv) {
   *output_stream << get_column_header(SEQUENCE_COL) << '\t'
                  << get_column_header(PROTEIN_ID_COL) << endl;
 
+  // The peptides come from the mass index if the index has one.
+  MassIndexReader* mass_reader = NULL;
+  if (MassIndexReader::Usable(massix_file, peptides_file)) {
+    mass_reader = new MassIndexReader(massix_file);
+    if (!mass_reader->OK()) {
+      carp(CARP_FATAL, "Error reading index (%s)", massix_file.c_str());
+    }
+  }
   RecordReader* reader = peptide_reader.Reader();
-  while (!reader->Done()) {
+  pb::Peptide pb_peptide;
+  while (mass_reader != NULL ? !mass_reader->Done() : !reader->Done()) {
     // Read peptide
-    pb::Peptide pb_peptide;
-    reader->Read(&pb_peptide);
+    if (mass_reader != NULL) {
+      mass_reader->Read(&pb_peptide);
+    } else {
+      reader->Read(&pb_peptide);
+    }
     if (Params::GetBool("skip-decoys") && pb_peptide.has_decoy_index()) {
       continue;
     }
-    Peptide peptide(pb_peptide, proteins);
+    Peptide peptide(pb_peptide, *protein_store);
 
     // Output to file
     *output_stream << peptide.SeqWithMods() << '\t'
-                   << proteins[peptide.FirstLocProteinId()]->name();
+                   << protein_store->Name(peptide.FirstLocProteinId());
     if (peptide.HasAuxLocationsIndex()) {
-      const pb::AuxLocation* aux_loc = locations[peptide.AuxLocationsIndex()];
-      for (int i = 0; i < aux_loc->location_size(); i++) {
-        const pb::Protein* protein = proteins[aux_loc->location(i).protein_id()];
-        if (protein->has_name()) {
-          *output_stream << ';' << protein->name();
+      int aux = peptide.AuxLocationsIndex();
+      for (int i = 0; i < protein_store->NumAuxLocations(aux); i++) {
+        int protein_id, pos;
+        protein_store->AuxLocation(aux, i, &protein_id, &pos);
+        string name = protein_store->Name(protein_id);
+        if (!name.empty()) {
+          *output_stream << ';' << name;
         }
       }
     }
     *output_stream << endl;
   }
 
+  delete mass_reader;
+  delete protein_store;
   output_stream->close();
   delete output_stream;
 
@@ -28,6 +28,8 @@
 #include "GeneratePeptides.h"
 #include "TideIndexApplication.h"
 #include "TideMatchSet.h"
+#include "app/tide/mass_index.h"
+#include "app/tide/protein_store.h"
 #include "app/tide/modifications.h"
 #include "app/tide/records_to_vector-inl.h"
 #include "ParamMedicApplication.h"
@@ -46,7 +48,9 @@ std::string peptideFile = "pepTarget.txt";
 
 extern void AddTheoreticalPeaks(const vector<const pb::Protein*>& proteins,
                                 const string& input_filename,
-                                const string& output_filename);
+                                const string& output_filename,
+                                double bin_width,
+                                double bin_offset);
 extern unsigned long long AddMods(HeadedRecordReader* reader,
                     string out_file,
                     string tmpDir,                    
@@ -132,6 +136,8 @@ int TideIndexApplication::main(
     
   string out_proteins = FileUtils::Join(index, "protix");
   string out_peptides = FileUtils::Join(index, "pepix");
+  string out_massix = FileUtils::Join(index, "massix");
+  string out_protstore = FileUtils::Join(index, "protstore");
   string auxLocsPbFile = FileUtils::Join(index, "auxlocs");
   string modless_peptides = out_peptides + ".nomods.tmp";
   string peakless_peptides = out_peptides + ".nopeaks.tmp";
@@ -146,6 +152,8 @@ int TideIndexApplication::main(
       carp(CARP_DEBUG, "Removing old index file(s)");
       FileUtils::Remove(out_proteins);
       FileUtils::Remove(out_peptides);
+      FileUtils::Remove(out_massix);
+      FileUtils::Remove(out_protstore);
       FileUtils::Remove(auxLocsPbFile);
       FileUtils::Remove(modless_peptides);
       FileUtils::Remove(peakless_peptides);
@@ -227,7 +235,7 @@ int TideIndexApplication::main(
   headerSource->set_filename(AbsPath(fasta));
   headerSource->set_filetype("fasta");
   headerSource->set_decoy_prefix(Params::GetString("decoy-prefix"));
-  HeadedRecordWriter proteinWriter(out_proteins, proteinPbHeader);
+  HeadedRecordWriter* proteinWriter = new HeadedRecordWriter(out_proteins, proteinPbHeader);
 
 
   // Generate peptide sequences via in silico cleavage.     
@@ -257,7 +265,7 @@ int TideIndexApplication::main(
   while (GeneratePeptides::getNextProtein(fastaStream, &proteinHeader, &proteinSequence)) {
   
     // Write pb::Protein
-    const pb::Protein* pbProtein = writePbProtein(proteinWriter, ++curProtein, proteinHeader, proteinSequence);
+    const pb::Protein* pbProtein = writePbProtein(*proteinWriter, ++curProtein, proteinHeader, proteinSequence);
     // Store the pretein header and the protein sequence
     vProteinHeaderSequence.push_back(pbProtein);
   
@@ -878,6 +886,25 @@ int TideIndexApplication::main(
   carp(CARP_INFO, "Generated %lu target peptides.", peptide_cnt);
   carp(CARP_INFO, "Generated %lu decoy peptides.", decoy_count);
   carp(CARP_INFO, "Generated %lu peptides in total.", peptide_cnt + decoy_count);
+
+  if (Params::GetBool("precompute-peaks")) {
+    carp(CARP_INFO, "Computing theoretical peaks...");
+    string peak_peptides = out_peptides + ".peaks.tmp";
+    AddTheoreticalPeaks(vProteinHeaderSequence, out_peptides, peak_peptides,
+                        Params::GetDouble("mz-bin-width"), Params::GetDouble("mz-bin-offset"));
+    FileUtils::Remove(out_peptides);
+    if (rename(peak_peptides.c_str(), out_peptides.c_str()) != 0) {
+      carp(CARP_FATAL, "Error creating index files");
+    }
+  }
+
+  carp(CARP_INFO, "Writing mass index...");
+  MassIndexWriter::Convert(out_peptides, out_massix);
+
+  // The protein store is made from the complete protix and auxlocs files.
+  delete proteinWriter;
+  carp(CARP_INFO, "Writing protein store...");
+  ProteinStore::Write(out_proteins, auxLocsPbFile, out_protstore);
   
   // Recover stderr
   cerr.rdbuf(old);
@@ -956,6 +983,9 @@ vector<string> TideIndexApplication::getOptions() const {
     "overwrite",
     "parameter-file",
     "peptide-list",
+    "precompute-peaks",
+    "mz-bin-width",
+    "mz-bin-offset",
     "seed",
     "temp-dir",
     "verbosity"
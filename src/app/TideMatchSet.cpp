@@ -1,10 +1,9 @@
 /*
- * There are two versions of the report function, which writes matches to output
- * files. The first version, which takes ofstreams as arguments, is used when
- * only tab-delimited output is required. It does not perform any object
- * conversions. The second version takes an OutputFiles object as an argument
- * and is used when any non-tab-delimited output is required. It must convert
- * the data from Tide into Crux objects, which increases runtime.
+ * There are two versions of the report function, which writes matches to the
+ * tab-delimited output: one for peptide-centric search and one for
+ * spectrum-centric search. Both write rows from the Tide objects without
+ * converting them. If other formats are written, each row is also converted
+ * into a Crux match, which goes to psm_sink_.
  */
 
 #include <fstream>
@@ -13,7 +12,9 @@
 #include "TideIndexApplication.h"
 #include "TideMatchSet.h"
 #include "TideSearchApplication.h"
+#include "util/GlobalParams.h"
 #include "util/Params.h"
+#include "util/RowFormatter.h"
 #include "util/StringUtils.h"
 
 string TideMatchSet::CleavageType;
@@ -23,11 +24,13 @@ char TideMatchSet::match_collection_loc_[] = {0};
 char TideMatchSet::decoy_match_collection_loc_[] = {0};
 
 TideMatchSet::TideMatchSet(Arr* matches, double max_mz)
-  : matches_(matches), max_mz_(max_mz), exact_pval_search_(false), elution_window_(0), cur_score_function_(XCORR_SCORE) {
+  : matches_(matches), max_mz_(max_mz), exact_pval_search_(false), elution_window_(0), cur_score_function_(XCORR_SCORE),
+    psm_sink_(NULL) {
 }
 
 TideMatchSet::TideMatchSet(Peptide* peptide, double max_mz)
-  : peptide_(peptide), max_mz_(max_mz), exact_pval_search_(false), elution_window_(0), cur_score_function_(XCORR_SCORE) {
+  : peptide_(peptide), max_mz_(max_mz), exact_pval_search_(false), elution_window_(0), cur_score_function_(XCORR_SCORE),
+    psm_sink_(NULL) {
 }
 
 TideMatchSet::~TideMatchSet() {
@@ -42,8 +45,7 @@ void TideMatchSet::report(
   ofstream* decoy_file, ///< decoy file to write to
   int top_matches,
   const ActivePeptideQueue* peptides, ///< peptide queue
-  const ProteinVec& proteins, ///< proteins corresponding with peptides
-  const vector<const pb::AuxLocation*>& locations,  ///< auxiliary locations
+  const ProteinStore& proteins, ///< proteins and auxiliary locations of peptides
   bool compute_sp ///< whether to compute sp or not
 ) {
   if (peptide_->spectrum_matches_array.empty()) {
@@ -153,8 +155,8 @@ void TideMatchSet::report(
   }
   // target peptide or concat search
   ofstream* file =
-    (Params::GetBool("concat") || !peptide_->IsDecoy()) ? target_file : decoy_file;
-  writeToFile(file, peptides, proteins, locations, compute_sp);
+    (GlobalParams::getConcat() || !peptide_->IsDecoy()) ? target_file : decoy_file;
+  writeToFile(file, peptides, proteins, compute_sp);
 }
 
 /**
@@ -163,8 +165,7 @@ void TideMatchSet::report(
 void TideMatchSet::writeToFile(
   ofstream* file,
   const ActivePeptideQueue* peptides,
-  const ProteinVec& proteins,
-  const vector<const pb::AuxLocation*>& locations,
+  const ProteinStore& proteins,
   bool compute_sp ///< whether to compute sp or not
 ) {
   if (!file) {
@@ -172,114 +173,141 @@ void TideMatchSet::writeToFile(
   }
   int cur = 0;
 
-  bool brief = Params::GetBool("brief-output");
-  int massPrecision = Params::GetInt("mass-precision");  
+  bool brief = GlobalParams::getBriefOutput();
+  int massPrecision = GlobalParams::getMassPrecision();  
 
   const Peptide* peptide = peptides->GetPeptide(0);
-  const pb::Protein* protein = proteins[peptide->FirstLocProteinId()];
+  int protein_id = peptide->FirstLocProteinId();
   int pos = peptide->FirstLocPos();
-  string proteinNames = getProteinName(*protein,
-      (!protein->has_target_pos()) ? pos : protein->target_pos(), peptide->IsDecoy());
+  string proteinNames = getProteinName(proteins, protein_id, pos, peptide->IsDecoy());
   string flankingAAs, n_term, c_term;
-  getFlankingAAs(peptide, protein, pos, &n_term, &c_term);
+  getFlankingAAs(peptide, proteins, protein_id, pos, &n_term, &c_term);
   flankingAAs = n_term + c_term;
 
-  int precision = Params::GetInt("precision");
+  int precision = GlobalParams::getPrecision();
+  vector<PSMLocation> locations;
+  if (psm_sink_ != NULL) {
+    locations.push_back(getLocation(peptide, proteins, protein_id, pos));
+  }
 
   // look for other locations
   if (peptide->HasAuxLocationsIndex()) {
-      const pb::AuxLocation* aux = locations[peptide->AuxLocationsIndex()];
-      for (int i = 0; i < aux->location_size(); ++i) {
-      const pb::Location& location = aux->location(i);
-      protein = proteins[location.protein_id()];
-      pos = location.pos();
-      proteinNames += "," + getProteinName(*protein,
-          (!protein->has_target_pos()) ? pos : protein->target_pos(), peptide->IsDecoy());
-      getFlankingAAs(peptide, protein, pos, &n_term, &c_term);
+      int aux = peptide->AuxLocationsIndex();
+      for (int i = 0; i < proteins.NumAuxLocations(aux); ++i) {
+      proteins.AuxLocation(aux, i, &protein_id, &pos);
+      proteinNames += "," + getProteinName(proteins, protein_id, pos, peptide->IsDecoy());
+      getFlankingAAs(peptide, proteins, protein_id, pos, &n_term, &c_term);
       flankingAAs += "," + n_term + c_term;
+      if (psm_sink_ != NULL) {
+        locations.push_back(getLocation(peptide, proteins, protein_id, pos));
+      }
       }
   }
+  int distinctMatches = GlobalParams::getConcat()
+    ? peptides->ActiveTargets() + peptides->ActiveDecoys()
+    : (!peptide->IsDecoy() ? peptides->ActiveTargets() : peptides->ActiveDecoys());
 
+  RowFormatter row;
   for (vector<Peptide::spectrum_matches>::const_iterator
         i = peptide_->spectrum_matches_array.begin();
         i != peptide_->spectrum_matches_array.end();
         ++i) {
     Spectrum* spectrum = i->spectrum_;
 
-    *file << spectrum->SpectrumNumber() << '\t'
+    row << spectrum->SpectrumNumber() << '\t'
           << i->charge_ << '\t';
     if (!brief) {
-        *file << StringUtils::ToString(spectrum->PrecursorMZ(), massPrecision) << '\t'
-              << StringUtils::ToString((spectrum->PrecursorMZ() - MASS_PROTON) * i->charge_, massPrecision) << '\t'
-              << StringUtils::ToString(peptide->Mass(), massPrecision) << '\t'
+        row << RowFormatter::number(spectrum->PrecursorMZ(), massPrecision) << '\t'
+              << RowFormatter::number((spectrum->PrecursorMZ() - MASS_PROTON) * i->charge_, massPrecision) << '\t'
+              << RowFormatter::number(peptide->Mass(), massPrecision) << '\t'
               << i->d_cn_ << '\t'
               << i->d_lcn_ << '\t';              
         SpScorer::SpScoreData spData;
         if (compute_sp) {
-          *file << i->spData_.sp_score << '\t'
+          row << i->spData_.sp_score << '\t'
                 << i->spData_.sp_rank << '\t';
         }
     }
 
     // Use scientific notation for exact p-value, but not refactored XCorr.
     if (exact_pval_search_) {
-      *file << StringUtils::ToString(i->score1_, precision, false) << '\t';
+      row << RowFormatter::number(i->score1_, precision, false) << '\t';
       if (!brief) {
-          *file << StringUtils::ToString(i->score2_, precision, true) << '\t';
+          row << RowFormatter::number(i->score2_, precision, true) << '\t';
       }
     } else {
-      *file << StringUtils::ToString(i->score1_, precision, true) << '\t';
+      row << RowFormatter::number(i->score1_, precision, true) << '\t';
     }
     //Added for tailor score calibration method by AKF
-/*    if (Params::GetBool("use-tailor-calibration")) {
-      *file << StringUtils::ToString(i->tailor, precision, true) << '\t';
+/*    if (GlobalParams::getUseTailorCalibration()) {
+      row << RowFormatter::number(i->tailor, precision, true) << '\t';
     }    
 */
     if (elution_window_ && !brief) {
-      *file << i->elution_score_ << '\t';
+      row << i->elution_score_ << '\t';
     }
 
     if (!brief) {
-        *file << ++cur << '\t';
+        row << ++cur << '\t';
         if (compute_sp) {
-          *file << i->spData_.matched_ions << '\t'
+          row << i->spData_.matched_ions << '\t'
                 << i->spData_.total_ions << '\t';
         }
-        *file << i->score3_ << '\t';
-
-        if (Params::GetBool("concat")) {
-          *file << peptides->ActiveTargets() + peptides->ActiveDecoys() << '\t';
-        } else {
-          *file << (!peptide->IsDecoy() ? peptides->ActiveTargets() : peptides->ActiveDecoys()) << '\t';
-        }
+        row << i->score3_ << '\t';
+        row << distinctMatches << '\t';
     }
     string peptide_with_mods = peptide->SeqWithMods();    
-    *file << peptide_with_mods;
+    row << peptide_with_mods;
     Crux::Peptide cruxPep = getCruxPeptide(peptide);
     
     if (!brief) {
-      *file  << '\t'
+      row  << '\t'
              << cruxPep.getModsString() << '\t'
              << CleavageType << '\t'
              << proteinNames << '\t'
              << flankingAAs;
       if (peptide->IsDecoy()) {
-        *file << "\tdecoy";
+        row << "\tdecoy";
       } else {
-        *file << "\ttarget";
+        row << "\ttarget";
       }             
              
       if (peptide->IsDecoy() && !TideSearchApplication::proteinLevelDecoys()) {
         // write target sequence
-        *file << '\t'
+        row << '\t'
               << peptide->TargetSeq();
-      } else if (Params::GetBool("concat") && !TideSearchApplication::proteinLevelDecoys()) {
-        *file << '\t'
+      } else if (GlobalParams::getConcat() && !TideSearchApplication::proteinLevelDecoys()) {
+        row << '\t'
               << peptide->TargetSeq();
       }
     }
-    *file << endl;
+    row << '\n';
+
+    if (psm_sink_ != NULL) {
+      Crux::Match* match = getCruxMatch(peptide, spectrum, i->charge_, "", distinctMatches);
+      match->setScore(DELTA_CN, i->d_cn_);
+      match->setScore(DELTA_LCN, i->d_lcn_);
+      if (compute_sp) {
+        match->setScore(SP, i->spData_.sp_score);
+        match->setRank(SP, i->spData_.sp_rank);
+        match->setScore(BY_IONS_MATCHED, i->spData_.matched_ions);
+        match->setScore(BY_IONS_TOTAL, i->spData_.total_ions);
+      }
+      if (exact_pval_search_) {
+        match->setScore(TIDE_SEARCH_EXACT_PVAL, i->score1_);
+        match->setScore(TIDE_SEARCH_REFACTORED_XCORR, i->score2_);
+        match->setRank(TIDE_SEARCH_EXACT_PVAL, cur);
+      } else {
+        match->setScore(XCORR, i->score1_);
+      }
+      match->setRank(XCORR, cur);
+      PSMSink::Key key = psm_key_;
+      key.Row = cur;
+      psm_sink_->add(match, locations, "",
+                     !GlobalParams::getConcat() && peptide->IsDecoy(), key);
+    }
   }
+  row.writeTo(file);
 }
 
 /**
@@ -287,19 +315,17 @@ void TideMatchSet::writeToFile(
  * This is for writing tab-delimited only
  */
 void TideMatchSet::report(
-  ofstream* target_file,  ///< target file to write to
-  ofstream* decoy_file, ///< decoy file to write to
+  ostream* target_file,  ///< target stream to write to
+  ostream* decoy_file, ///< decoy stream to write to
   int top_n,  ///< number of matches to report
   int decoys_per_target,
   const string& spectrum_filename, ///< name of spectrum file
   const Spectrum* spectrum, ///< spectrum for matches
   int charge, ///< charge for matches
   const ActivePeptideQueue* peptides, ///< peptide queue
-  const ProteinVec& proteins,  ///< proteins corresponding with peptides
-  const vector<const pb::AuxLocation*>& locations,  ///< auxiliary locations
+  const ProteinStore& proteins,  ///< proteins and auxiliary locations of peptides
   bool compute_sp, ///< whether to compute sp or not
-  bool highScoreBest, //< indicates semantics of score magnitude
-  boost::mutex * rwlock
+  bool highScoreBest //< indicates semantics of score magnitude
 ) {
   if (matches_->empty()) {
     return;
@@ -312,10 +338,9 @@ void TideMatchSet::report(
   gatherTargetsAndDecoys(peptides, proteins, targets, decoys, top_n, decoys_per_target, highScoreBest);
   carp(CARP_DETAILED_DEBUG, "Gathered targets:%d \t decoy:%d", targets.size(), decoys.size());
 
-  map<Arr::iterator, FLOAT_T> delta_cn_map;
-  map<Arr::iterator, FLOAT_T> delta_lcn_map;
-  computeDeltaCns(targets, &delta_cn_map, &delta_lcn_map);
-  computeDeltaCns(decoys, &delta_cn_map, &delta_lcn_map);
+  vector< pair<FLOAT_T, FLOAT_T> > target_delta_cns, decoy_delta_cns;
+  computeDeltaCns(targets, &target_delta_cns);
+  computeDeltaCns(decoys, &decoy_delta_cns);
 
   map<Arr::iterator, pair<const SpScorer::SpScoreData, int> > sp_map;
   if (compute_sp) {
@@ -324,11 +349,11 @@ void TideMatchSet::report(
     computeSpData(decoys, &sp_map, &sp_scorer, peptides);
   }
   writeToFile(target_file, top_n, decoys_per_target, targets, spectrum_filename, spectrum, charge,
-              peptides, proteins, locations, delta_cn_map, delta_lcn_map,
-              compute_sp ? &sp_map : NULL, rwlock);
+              peptides, proteins, target_delta_cns,
+              compute_sp ? &sp_map : NULL);
   writeToFile(decoy_file, top_n, decoys_per_target, decoys, spectrum_filename, spectrum, charge,
-              peptides, proteins, locations, delta_cn_map, delta_lcn_map,
-              compute_sp ? &sp_map : NULL, rwlock);
+              peptides, proteins, decoy_delta_cns,
+              compute_sp ? &sp_map : NULL);
 }
 
 // added by Yang
@@ -365,8 +390,7 @@ void TideMatchSet::writeToFileDIA(
   const Spectrum* spectrum,
   int charge,
   const ActivePeptideQueue* peptides,
-  const ProteinVec& proteins,
-  const vector<const pb::AuxLocation*>& locations,
+  const ProteinStore& proteins,
   const map<Arr::iterator, FLOAT_T>* delta_cn_map,
   const map<Arr::iterator, FLOAT_T>* delta_lcn_map,
   const map<Arr::iterator, pair<const SpScorer::SpScoreData, int> >* sp_map,
@@ -378,34 +402,33 @@ void TideMatchSet::writeToFileDIA(
 ) {
   if (!file || vec.empty()) { return; }
   
-  int massPrecision = Params::GetInt("mass-precision");
-  int precision = Params::GetInt("precision");
+  int massPrecision = GlobalParams::getMassPrecision();
+  int precision = GlobalParams::getPrecision();
   const int concatDistinctMatches = peptides->ActiveTargets() + peptides->ActiveDecoys();
 
+  RowFormatter row;
   for (size_t idx = 0; idx < vec.size(); idx++) {
       const Arr::iterator& i = vec[idx];
       Peptide* peptide = peptides->GetPeptide(i->rank);
       size_t rank;
 
-      if (idx >= top_n) { return; }
+      if (idx >= top_n) { break; }
       rank = idx + 1;
 
-      const pb::Protein* protein = proteins[peptide->FirstLocProteinId()];
+      int protein_id = peptide->FirstLocProteinId();
       int pos = peptide->FirstLocPos();
-      string proteinNames = getProteinName(*protein, (!protein->has_target_pos()) ? pos : protein->target_pos(), peptide->IsDecoy());
+      string proteinNames = getProteinName(proteins, protein_id, pos, peptide->IsDecoy());
       string flankingAAs, n_term, c_term;
-      getFlankingAAs(peptide, protein, pos, &n_term, &c_term);
+      getFlankingAAs(peptide, proteins, protein_id, pos, &n_term, &c_term);
       flankingAAs = n_term + c_term;
 
       // look for other locations
       if (peptide->HasAuxLocationsIndex()) {
-         const pb::AuxLocation* aux = locations[peptide->AuxLocationsIndex()];
-         for (int j = 0; j < aux->location_size(); j++) {
-            const pb::Location& location = aux->location(j);
-              protein = proteins[location.protein_id()];
-              pos = location.pos();
-              proteinNames += "," + getProteinName(*protein, (!protein->has_target_pos()) ? pos : protein->target_pos(), peptide->IsDecoy());
-              getFlankingAAs(peptide, protein, pos, &n_term, &c_term);
+         int aux = peptide->AuxLocationsIndex();
+         for (int j = 0; j < proteins.NumAuxLocations(aux); j++) {
+              proteins.AuxLocation(aux, j, &protein_id, &pos);
+              proteinNames += "," + getProteinName(proteins, protein_id, pos, peptide->IsDecoy());
+              getFlankingAAs(peptide, proteins, protein_id, pos, &n_term, &c_term);
               flankingAAs += "," + n_term + c_term;
          }
       }
@@ -413,59 +436,59 @@ void TideMatchSet::writeToFileDIA(
       const SpScorer::SpScoreData* sp_data = sp_map ? &(sp_map->at(i).first) : NULL;
 
       // FILE_COL, SCAN_COL, CHARGE_COL, SPECTRUM_PRECURSOR_MZ_COL, SPECTRUM_NEUTRAL_MASS_COL, PEPTIDE_MASS_COL, DELTA_CN_COL, DELTA_LCN_COL,
-      *file << spectrum_filename << '\t'
+      row << spectrum_filename << '\t'
            << spectrum->SpectrumNumber() << '\t'
            << charge << '\t'
-           << StringUtils::ToString(spectrum->PrecursorMZ(), massPrecision) << '\t'
-           << StringUtils::ToString((spectrum->PrecursorMZ() - MASS_PROTON) * charge, massPrecision) << '\t'
-            << StringUtils::ToString(peptide->Mass(), massPrecision) << '\t'
+           << RowFormatter::number(spectrum->PrecursorMZ(), massPrecision) << '\t'
+           << RowFormatter::number((spectrum->PrecursorMZ() - MASS_PROTON) * charge, massPrecision) << '\t'
+            << RowFormatter::number(peptide->Mass(), massPrecision) << '\t'
             << delta_cn_map->at(i) << '\t'
             << delta_lcn_map->at(i) << '\t';
 
       if (sp_map) {
          // SP_SCORE_COL, SP_RANK_COL, BY_IONS_MATCHED_COL, BY_IONS_TOTAL_COL
-         *file << StringUtils::ToString(sp_data->sp_score, precision) << '\t'
+         row << RowFormatter::number(sp_data->sp_score, precision) << '\t'
               << sp_map->at(i).second << '\t'
               << sp_data->matched_ions << '\t'
               << sp_data->total_ions << '\t';
       }
 
       // XCORR_SCORE_COL, TAILOR_COL, XCORR_RANK_COL
-      *file << StringUtils::ToString(i->xcorr_score, precision, true) << '\t'
-             << StringUtils::ToString(i->tailor, precision, true) << '\t'
+      row << RowFormatter::number(i->xcorr_score, precision, true) << '\t'
+             << RowFormatter::number(i->tailor, precision, true) << '\t'
              << rank << '\t';
 
       // PRECURSOR_INTENSITY_RANK_M0_COL, PRECURSOR_INTENSITY_RANK_M1_COL, PRECURSOR_INTENSITY_RANK_M2_COL
       boost::tuple<double, double, double> intensity_tuple = intensity_map->at(i);
       boost::tuple<double, double, double> logrank_tuple = logrank_map->at(i);
-      *file << StringUtils::ToString(intensity_tuple.get<0>()+intensity_tuple.get<1>()+intensity_tuple.get<2>(), precision, true) << '\t'
-           << StringUtils::ToString(intensity_tuple.get<0>(), precision, true) << '\t'
-           << StringUtils::ToString(logrank_tuple.get<0>()+logrank_tuple.get<1>()+logrank_tuple.get<2>(), precision, true) << '\t';
+      row << RowFormatter::number(intensity_tuple.get<0>()+intensity_tuple.get<1>()+intensity_tuple.get<2>(), precision, true) << '\t'
+           << RowFormatter::number(intensity_tuple.get<0>(), precision, true) << '\t'
+           << RowFormatter::number(logrank_tuple.get<0>()+logrank_tuple.get<1>()+logrank_tuple.get<2>(), precision, true) << '\t';
 
       // RT_DIFF_COL
       double predrt = 0.5;
       string peptide_with_mods = peptide->SeqWithMods();
       map<string, double>::iterator predrtIter = peptide_predrt_map->find(peptide_with_mods);
       if (predrtIter != peptide_predrt_map->end()) { predrt = predrtIter->second; }
-      *file << StringUtils::ToString(fabs(predrt - spectrum->RTime()), precision, true) << '\t';
+      row << RowFormatter::number(fabs(predrt - spectrum->RTime()), precision, true) << '\t';
 
       // DYN_FRAGMENT_PVALUE_COL, STA_FRAGMENT_PVALUE_COL,
       boost::tuple<double, double> ms2pval = ms2pval_map->at(i);
-      *file << StringUtils::ToString(ms2pval.get<0>(), precision, true) << '\t'
-    	    << StringUtils::ToString(ms2pval.get<1>(), precision, true) << '\t';
+      row << RowFormatter::number(ms2pval.get<0>(), precision, true) << '\t'
+    	    << RowFormatter::number(ms2pval.get<1>(), precision, true) << '\t';
 
       // COELUTE_MS1_COL, COELUTE_MS2_COL, COELUTE_MS1_MS2_COL
       boost::tuple<double, double, double> coelute_tuple = coelute_map->at(i);
-      *file << StringUtils::ToString(coelute_tuple.get<0>(), precision, true) << '\t'
-            << StringUtils::ToString(coelute_tuple.get<1>(), precision, true) << '\t'
-            << StringUtils::ToString(coelute_tuple.get<2>(), precision, true) << '\t';
+      row << RowFormatter::number(coelute_tuple.get<0>(), precision, true) << '\t'
+            << RowFormatter::number(coelute_tuple.get<1>(), precision, true) << '\t'
+            << RowFormatter::number(coelute_tuple.get<2>(), precision, true) << '\t';
 
       // ENSEMBLE_SCORE_COL
-      *file << StringUtils::ToString(0.0, precision, true) << '\t';
+      row << RowFormatter::number(0.0, precision, true) << '\t';
 
       // DISTINCT_MATCHES_SPECTRUM_COL, SEQUENCE_COL, MODIFICATIONS_COL, CLEAVAGE_TYPE_COL, PROTEIN_ID_COL, FLANKING_AA_COL
       Crux::Peptide cruxPep = getCruxPeptide(peptide);      
-      *file << concatDistinctMatches << '\t'
+      row << concatDistinctMatches << '\t'
            << peptide_with_mods << '\t'
            << cruxPep.getModsString() << '\t'
            << CleavageType << '\t'
@@ -474,23 +497,24 @@ void TideMatchSet::writeToFileDIA(
 
       // TARGET_DECOY_COL
       if (peptide->IsDecoy()) {
-        *file << "decoy";
+        row << "decoy";
       } else {
-        *file << "target";
+        row << "target";
       }
       
       // TODO: Original target sequence isn't reported? 
       // TODO: The decoy index for multiple decoys per target isn't reported?
 
-      *file << endl;
+      row << '\n';
   }
+  row.writeTo(file);
 }
 
 /**
  * Helper function for tab delimited report function
  */
 void TideMatchSet::writeToFile(
-  ofstream* file,
+  ostream* file,
   int top_n,
   int decoys_per_target,
   const vector<Arr::iterator>& vec,
@@ -498,25 +522,23 @@ void TideMatchSet::writeToFile(
   const Spectrum* spectrum,
   int charge,
   const ActivePeptideQueue* peptides,
-  const ProteinVec& proteins,
-  const vector<const pb::AuxLocation*>& locations,
-  const map<Arr::iterator, FLOAT_T>& delta_cn_map,
-  const map<Arr::iterator, FLOAT_T>& delta_lcn_map,
-  const map<Arr::iterator, pair<const SpScorer::SpScoreData, int> >* sp_map,
-  boost::mutex * rwlock
+  const ProteinStore& proteins,
+  const vector< pair<FLOAT_T, FLOAT_T> >& delta_cns,
+  const map<Arr::iterator, pair<const SpScorer::SpScoreData, int> >* sp_map
 ) {
   if (!file || vec.empty()) {
     return;
   }
 
-  int massPrecision = Params::GetInt("mass-precision");
-  int precision = Params::GetInt("precision");
+  int massPrecision = GlobalParams::getMassPrecision();
+  int precision = GlobalParams::getPrecision();
 
-  const bool concat = Params::GetBool("concat");
-  const bool brief = Params::GetBool("brief-output");
+  const bool concat = GlobalParams::getConcat();
+  const bool brief = GlobalParams::getBriefOutput();
   const int concatDistinctMatches = peptides->ActiveTargets() + peptides->ActiveDecoys();
   map<int, int> decoyWriteCount;
 
+  RowFormatter row;
   for (size_t idx = 0; idx < vec.size(); idx++) {
     const Arr::iterator& i = vec[idx];
     Peptide* peptide = peptides->GetPeptide(i->rank);
@@ -524,7 +546,7 @@ void TideMatchSet::writeToFile(
     if (concat || !peptide->IsDecoy() || decoys_per_target <= 1) {
       // concat, target file, or only 1 decoy per target
       if (idx >= top_n) {
-        return;
+        break;
       }
       rank = idx + 1;
     } else {
@@ -539,48 +561,45 @@ void TideMatchSet::writeToFile(
       }
       rank = ++(j->second);
     }
-    const pb::Protein* protein = proteins[peptide->FirstLocProteinId()];
+    int protein_id = peptide->FirstLocProteinId();
     int pos = peptide->FirstLocPos();
-    string proteinNames = getProteinName(*protein,
-      (!protein->has_target_pos()) ? pos : protein->target_pos(), peptide->IsDecoy());
+    string proteinNames = getProteinName(proteins, protein_id, pos, peptide->IsDecoy());
     string flankingAAs, n_term, c_term;
-    getFlankingAAs(peptide, protein, pos, &n_term, &c_term);
+    getFlankingAAs(peptide, proteins, protein_id, pos, &n_term, &c_term);
     flankingAAs = n_term + c_term;
 
     // look for other locations
   /*  if (peptide->HasAuxLocationsIndex()) {
-      const pb::AuxLocation* aux = locations[peptide->AuxLocationsIndex()];
-      for (int j = 0; j < aux->location_size(); j++) {
-        const pb::Location& location = aux->location(j);
-        protein = proteins[location.protein_id()];
-        pos = location.pos();
-        proteinNames += "," + getProteinName(*protein,
-          (!protein->has_target_pos()) ? pos : protein->target_pos(), peptide->IsDecoy());
-        getFlankingAAs(peptide, protein, pos, &n_term, &c_term);
+      int aux = peptide->AuxLocationsIndex();
+      for (int j = 0; j < proteins.NumAuxLocations(aux); j++) {
+        proteins.AuxLocation(aux, j, &protein_id, &pos);
+        proteinNames += "," + getProteinName(proteins, protein_id, pos, peptide->IsDecoy());
+        getFlankingAAs(peptide, proteins, protein_id, pos, &n_term, &c_term);
         flankingAAs += "," + n_term + c_term;
       }
     }
 */
     const SpScorer::SpScoreData* sp_data = sp_map ? &(sp_map->at(i).first) : NULL;
+    int distinctMatches = concat ? concatDistinctMatches
+      : (!peptide->IsDecoy() ? peptides->ActiveTargets() : peptides->ActiveDecoys());
 
-    if (rwlock != NULL) { rwlock->lock(); }
-    if (Params::GetBool("file-column")) {
-      *file << spectrum_filename << '\t';
+    if (GlobalParams::getFileColumn()) {
+      row << spectrum_filename << '\t';
     }
-    *file << spectrum->SpectrumNumber() << '\t'
+    row << spectrum->SpectrumNumber() << '\t'
           << charge << '\t';
     if (!brief) {
-      *file << StringUtils::ToString(spectrum->PrecursorMZ(), massPrecision) 
+      row << RowFormatter::number(spectrum->PrecursorMZ(), massPrecision) 
             << '\t'
-            << StringUtils::ToString((spectrum->PrecursorMZ() - MASS_PROTON) 
+            << RowFormatter::number((spectrum->PrecursorMZ() - MASS_PROTON) 
                                      * charge, massPrecision)
             << '\t'
-            << StringUtils::ToString(peptide->Mass(), massPrecision)
+            << RowFormatter::number(peptide->Mass(), massPrecision)
             << '\t'
-            << delta_cn_map.at(i) << '\t'
-            << delta_lcn_map.at(i) << '\t';
+            << delta_cns[idx].first << '\t'
+            << delta_cns[idx].second << '\t';
       if (sp_map) {
-        *file << StringUtils::ToString(sp_data->sp_score, precision) << '\t'
+        row << RowFormatter::number(sp_data->sp_score, precision) << '\t'
               << sp_map->at(i).second << '\t';
       }
     }
@@ -590,92 +609,139 @@ void TideMatchSet::writeToFile(
     switch (cur_score_function_) {
     case XCORR_SCORE:
       if (exact_pval_search_) {
-        *file << StringUtils::ToString(i->xcorr_pval, precision, false) << '\t';
+        row << RowFormatter::number(i->xcorr_pval, precision, false) << '\t';
         if (!brief) {
-          *file << StringUtils::ToString(i->xcorr_score, precision, true) << '\t';
+          row << RowFormatter::number(i->xcorr_score, precision, true) << '\t';
         }
       } else {
-        *file << StringUtils::ToString(i->xcorr_score, precision, true) << '\t';
+        row << RowFormatter::number(i->xcorr_score, precision, true) << '\t';
       }
       //Added for tailor score calibration method by AKF
-      if (Params::GetBool("use-tailor-calibration")) {
-        *file << StringUtils::ToString(i->tailor, precision, true) << '\t';
+      if (GlobalParams::getUseTailorCalibration()) {
+        row << RowFormatter::number(i->tailor, precision, true) << '\t';
       }
-      if (Params::GetBool("seva")){ //Added by AKF for reporting the best scoring peptide seq from DP table
-        *file << StringUtils::ToString(i->DPPeptideScore, precision, true) << '\t';
-        *file << StringUtils::ToString(i->DPPeptideTailor, precision, true) << '\t';
-        *file << i->DPPeptideSeq << '\t';
-        *file << StringUtils::ToString(i->time, precision, true) << '\t';
+      if (GlobalParams::getSeva()){ //Added by AKF for reporting the best scoring peptide seq from DP table
+        row << RowFormatter::number(i->DPPeptideScore, precision, true) << '\t';
+        row << RowFormatter::number(i->DPPeptideTailor, precision, true) << '\t';
+        row << i->DPPeptideSeq << '\t';
+        row << RowFormatter::number(i->time, precision, true) << '\t';
       }                  	        
       break;
     case RESIDUE_EVIDENCE_MATRIX:
       if (exact_pval_search_) {
-        *file << StringUtils::ToString(i->resEv_pval, precision, false) << '\t';
+        row << RowFormatter::number(i->resEv_pval, precision, false) << '\t';
         if (!brief) {
-          *file << StringUtils::ToString(i->resEv_score, 1, true) << '\t';
+          row << RowFormatter::number(i->resEv_score, 1, true) << '\t';
         }
       } else {
-        *file << StringUtils::ToString(i->resEv_score, 1, true) << '\t';
+        row << RowFormatter::number(i->resEv_score, 1, true) << '\t';
       }
       break;
     case BOTH_SCORE:
       if (!brief) {
-        *file << StringUtils::ToString(i->xcorr_pval, precision, false) << '\t';
-        *file << StringUtils::ToString(i->xcorr_score, precision, true) << '\t';
-        *file << StringUtils::ToString(i->resEv_pval, precision, false) << '\t';
-        *file << StringUtils::ToString(i->resEv_score, 1, true) << '\t';
+        row << RowFormatter::number(i->xcorr_pval, precision, false) << '\t';
+        row << RowFormatter::number(i->xcorr_score, precision, true) << '\t';
+        row << RowFormatter::number(i->resEv_pval, precision, false) << '\t';
+        row << RowFormatter::number(i->resEv_score, 1, true) << '\t';
       }
-      *file << StringUtils::ToString(i->combinedPval, precision, false) << '\t';
+      row << RowFormatter::number(i->combinedPval, precision, false) << '\t';
       break;
     }
 
     if (!brief) {
-      *file << rank << '\t';
+      row << rank << '\t';
       if (sp_map) {
-        *file << sp_data->matched_ions << '\t'
+        row << sp_data->matched_ions << '\t'
               << sp_data->total_ions << '\t';
       }
 
-      if (Params::GetBool("concat")) {
-        *file << concatDistinctMatches << '\t';
-      } else {
-        *file << (!peptide->IsDecoy() ? peptides->ActiveTargets() : peptides->ActiveDecoys()) << '\t';
-      }
+      row << distinctMatches << '\t';
     }
     string peptide_with_mods = peptide->SeqWithMods();
-    *file << peptide_with_mods; // Print the actual peptide sequence, with modifications
+    row << peptide_with_mods; // Print the actual peptide sequence, with modifications
     Crux::Peptide cruxPep = getCruxPeptide(peptide);
     if (!brief) {
-      *file << '\t'
+      row << '\t'
             << cruxPep.getModsString() << '\t'
             << CleavageType << '\t'
             << proteinNames << '\t'
             << flankingAAs;
       if (peptide->IsDecoy()) {
-        *file << "\tdecoy";
+        row << "\tdecoy";
       } else {
-        *file << "\ttarget";
+        row << "\ttarget";
       }
       if (peptide->IsDecoy() && !TideSearchApplication::proteinLevelDecoys()) {
         // write target sequence
-        *file  << '\t' 
+        row  << '\t' 
                << peptide->TargetSeq();
-      } else if (Params::GetBool("concat") && !TideSearchApplication::proteinLevelDecoys()) {
-        *file  << '\t' 
+      } else if (GlobalParams::getConcat() && !TideSearchApplication::proteinLevelDecoys()) {
+        row  << '\t' 
                << peptide->TargetSeq();
       }
       if (decoys_per_target > 1) {
         if (peptide->IsDecoy()) {
-          *file << '\t'
+          row << '\t'
                 << peptide->DecoyIdx();
         } else if (concat) {
-          *file << '\t';
+          row << '\t';
+        }
+      }
+    }
+    row << '\n';
+
+    if (psm_sink_ != NULL) {
+      string file_path = GlobalParams::getFileColumn() ? spectrum_filename : "";
+      Crux::Match* match = getCruxMatch(peptide, spectrum, charge, file_path, distinctMatches);
+      match->setScore(DELTA_CN, delta_cns[idx].first);
+      match->setScore(DELTA_LCN, delta_cns[idx].second);
+      if (sp_map) {
+        match->setScore(SP, sp_data->sp_score);
+        match->setRank(SP, sp_map->at(i).second);
+        match->setScore(BY_IONS_MATCHED, sp_data->matched_ions);
+        match->setScore(BY_IONS_TOTAL, sp_data->total_ions);
+      }
+      switch (cur_score_function_) {
+      case XCORR_SCORE:
+        if (exact_pval_search_) {
+          match->setScore(TIDE_SEARCH_EXACT_PVAL, i->xcorr_pval);
+          match->setScore(TIDE_SEARCH_REFACTORED_XCORR, i->xcorr_score);
+          match->setRank(TIDE_SEARCH_EXACT_PVAL, rank);
+        } else {
+          match->setScore(XCORR, i->xcorr_score);
+        }
+        match->setRank(XCORR, rank);
+        if (GlobalParams::getUseTailorCalibration()) {
+          match->setScore(TAILOR_SCORE, i->tailor);
+        }
+        break;
+      case RESIDUE_EVIDENCE_MATRIX:
+        match->setScore(RESIDUE_EVIDENCE_SCORE, i->resEv_score);
+        match->setRank(RESIDUE_EVIDENCE_SCORE, rank);
+        if (exact_pval_search_) {
+          match->setScore(RESIDUE_EVIDENCE_PVAL, i->resEv_pval);
+          match->setRank(RESIDUE_EVIDENCE_PVAL, rank);
         }
+        break;
+      case BOTH_SCORE:
+        match->setScore(TIDE_SEARCH_EXACT_PVAL, i->xcorr_pval);
+        match->setScore(TIDE_SEARCH_REFACTORED_XCORR, i->xcorr_score);
+        match->setScore(RESIDUE_EVIDENCE_SCORE, i->resEv_score);
+        match->setScore(RESIDUE_EVIDENCE_PVAL, i->resEv_pval);
+        match->setScore(BOTH_PVALUE, i->combinedPval);
+        match->setRank(BOTH_PVALUE, rank);
+        break;
       }
+      if (decoys_per_target > 1 && peptide->IsDecoy()) {
+        match->setDecoyIndex(peptide->DecoyIdx());
+      }
+      PSMSink::Key key = psm_key_;
+      key.Row = idx;
+      psm_sink_->add(match, vector<PSMLocation>(1, getLocation(peptide, proteins, protein_id, pos)),
+                     file_path, !concat && peptide->IsDecoy(), key);
     }
-    *file << endl;
-    if (rwlock != NULL) { rwlock->unlock(); }
   }
+  row.writeTo(file);
 }
 
 /**
@@ -705,8 +771,8 @@ void TideMatchSet::writeHeaders(
   if (!file) {
     return;
   }
-  bool concat = Params::GetBool("concat");
-  bool brief = Params::GetBool("brief-output");
+  bool concat = GlobalParams::getConcat();
+  bool brief = GlobalParams::getBriefOutput();
 
   const int headers[] = {
     FILE_COL, SCAN_COL, CHARGE_COL, SPECTRUM_PRECURSOR_MZ_COL, SPECTRUM_NEUTRAL_MASS_COL,
@@ -732,13 +798,13 @@ void TideMatchSet::writeHeaders(
     }
 
     if (header == FILE_COL &&
-        (!Params::GetBool("file-column") || Params::GetBool("peptide-centric-search"))) {
+        (!GlobalParams::getFileColumn() || GlobalParams::getPeptideCentricSearch())) {
       continue;
     }
 
     if (header == XCORR_SCORE_COL) {
-      if (Params::GetString("score-function") == "xcorr") {
-        if (Params::GetBool("exact-p-value")) {
+      if (GlobalParams::getScoreFunction() == XCORR_SCORE) {
+        if (GlobalParams::getExactPValue()) {
           colPrint(&writtenHeader, file, get_column_header(EXACT_PVALUE_COL));
           if (!brief) {
             colPrint(&writtenHeader, file, get_column_header(REFACTORED_SCORE_COL));
@@ -747,10 +813,10 @@ void TideMatchSet::writeHeaders(
           colPrint(&writtenHeader, file, get_column_header(XCORR_SCORE_COL));
         }
         //Added for tailor score calibration method by AKF
-        if (Params::GetBool("use-tailor-calibration")) {
+        if (GlobalParams::getUseTailorCalibration()) {
           colPrint(&writtenHeader, file, get_column_header(TAILOR_COL));
         }
-        if (Params::GetBool("seva")){   //Added for best scoring peptide from DP by AKF        
+        if (GlobalParams::getSeva()){   //Added for best scoring peptide from DP by AKF        
           colPrint(&writtenHeader, file, get_column_header(DP_PEPT_SCORE_COL));
           colPrint(&writtenHeader, file, get_column_header(DP_PEPT_TAILOR_COL));
           colPrint(&writtenHeader, file, get_column_header(DP_PEPT_SEQ_COL));
@@ -759,8 +825,8 @@ void TideMatchSet::writeHeaders(
         if (!brief) {
           colPrint(&writtenHeader, file, get_column_header(XCORR_RANK_COL));
         }
-      } else if (Params::GetString("score-function") == "residue-evidence") {
-        if (Params::GetBool("exact-p-value")) {
+      } else if (GlobalParams::getScoreFunction() == RESIDUE_EVIDENCE_MATRIX) {
+        if (GlobalParams::getExactPValue()) {
           colPrint(&writtenHeader, file, get_column_header(RESIDUE_PVALUE_COL));
           if (!brief) {
             colPrint(&writtenHeader, file, get_column_header(RESIDUE_EVIDENCE_COL));
@@ -769,7 +835,7 @@ void TideMatchSet::writeHeaders(
           colPrint(&writtenHeader, file, get_column_header(RESIDUE_EVIDENCE_COL));
         }
         colPrint(&writtenHeader, file, get_column_header(RESIDUE_RANK_COL));
-      } else if (Params::GetString("score-function") == "both") {
+      } else if (GlobalParams::getScoreFunction() == BOTH_SCORE) {
         if (!brief) {
           colPrint(&writtenHeader, file, get_column_header(EXACT_PVALUE_COL));
           colPrint(&writtenHeader, file, get_column_header(REFACTORED_SCORE_COL));
@@ -782,14 +848,14 @@ void TideMatchSet::writeHeaders(
         }
       }
 
-      if ( (Params::GetInt("elution-window-size") > 0) && (!brief) ) {
+      if ( (GlobalParams::getElutionWindowSize() > 0) && (!brief) ) {
         colPrint(&writtenHeader, file, get_column_header(ELUTION_WINDOW_COL));
       }
       continue;
     }
 
     if ( (header == DISTINCT_MATCHES_SPECTRUM_COL) && (!brief) ) {
-      if (Params::GetBool("peptide-centric-search")) {
+      if (GlobalParams::getPeptideCentricSearch()) {
         colPrint(&writtenHeader, file, 
                  get_column_header(DISTINCT_MATCHES_PEPTIDE_COL));
         colPrint(&writtenHeader, file, 
@@ -812,6 +878,51 @@ void TideMatchSet::writeHeaders(
   *file << endl;
 }
 
+/**
+ * Returns the scores of the matches given to a PSMSink, following the score
+ * columns of writeHeaders().
+ */
+vector<SCORER_TYPE_T> TideMatchSet::getScoredTypes(bool compute_sp) {
+  vector<SCORER_TYPE_T> types;
+  types.push_back(DELTA_CN);
+  types.push_back(DELTA_LCN);
+  if (compute_sp) {
+    types.push_back(SP);
+    types.push_back(BY_IONS_MATCHED);
+    types.push_back(BY_IONS_TOTAL);
+  }
+  bool exact = GlobalParams::getExactPValue();
+  switch (GlobalParams::getScoreFunction()) {
+  case XCORR_SCORE:
+    if (exact) {
+      types.push_back(TIDE_SEARCH_EXACT_PVAL);
+      types.push_back(TIDE_SEARCH_REFACTORED_XCORR);
+    } else {
+      types.push_back(XCORR);
+    }
+    if (GlobalParams::getUseTailorCalibration()) {
+      types.push_back(TAILOR_SCORE);
+    }
+    break;
+  case RESIDUE_EVIDENCE_MATRIX:
+    types.push_back(RESIDUE_EVIDENCE_SCORE);
+    if (exact) {
+      types.push_back(RESIDUE_EVIDENCE_PVAL);
+    }
+    break;
+  case BOTH_SCORE:
+    types.push_back(TIDE_SEARCH_EXACT_PVAL);
+    types.push_back(TIDE_SEARCH_REFACTORED_XCORR);
+    types.push_back(RESIDUE_EVIDENCE_SCORE);
+    types.push_back(RESIDUE_EVIDENCE_PVAL);
+    types.push_back(BOTH_PVALUE);
+    break;
+  default:
+    break;
+  }
+  return types;
+}
+
 void TideMatchSet::initModMap(const pb::ModTable& modTable, ModPosition position) {
   for (int i = 0; i < modTable.variable_mod_size(); i++) {
     const pb::Modification& mod = modTable.variable_mod(i);
@@ -827,6 +938,31 @@ void TideMatchSet::initModMap(const pb::ModTable& modTable, ModPosition position
   }
 }
 
+/**
+ * Creates the match for a reported PSM, as MatchFileReader would read it from
+ * the row. The match owns its peptide and spectrum.
+ */
+Crux::Match* TideMatchSet::getCruxMatch(
+  const Peptide* peptide,
+  const Spectrum* spectrum,
+  int charge,
+  const string& file_path,
+  int distinct_matches
+) {
+  Crux::Peptide* cruxPeptide = new Crux::Peptide();
+  cruxPeptide->setUnmodifiedSequence(peptide->Seq());
+  cruxPeptide->setMods(getMods(peptide));
+  Crux::Spectrum* cruxSpectrum = new Crux::Spectrum(
+    spectrum->SpectrumNumber(), spectrum->SpectrumNumber(), spectrum->PrecursorMZ(),
+    vector<int>(1, charge), file_path);
+  SpectrumZState zState((spectrum->PrecursorMZ() - MASS_PROTON) * charge, charge);
+  Crux::Match* match = new Crux::Match(cruxPeptide, cruxSpectrum, zState, peptide->IsDecoy());
+  match->setPostProcess(true);
+  match->setTargetExperimentSize(distinct_matches);
+  match->setLnExperimentSize(distinct_matches > 0 ? log((FLOAT_T)distinct_matches) : 0);
+  return match;
+}
+
 Crux::Peptide TideMatchSet::getCruxPeptide(const Peptide* peptide) {
   Crux::ProteinTerminal term = Crux::ProteinTerminal::PROT_TERM_NONE;
     if(peptide->FirstLocPos() == 0) term = Crux::ProteinTerminal::PROT_TERM_N;
@@ -853,60 +989,104 @@ vector<Crux::Modification> TideMatchSet::getMods(const Peptide* peptide) {
   return modVector;
 }
 
+/**
+ * Orders matches best first by one of the score comparators, which order
+ * worst first; ties go to the match earlier in the array.
+ */
+class BetterMatch {
+ public:
+  typedef bool (*Less)(const TideMatchSet::Scores&, const TideMatchSet::Scores&);
+
+  explicit BetterMatch(Less less) : less_(less) {}
+
+  bool operator()(TideMatchSet::Arr::iterator x, TideMatchSet::Arr::iterator y) const {
+    if (less_(*y, *x)) {
+      return true;
+    }
+    return !less_(*x, *y) && x < y;
+  }
+
+ private:
+  Less less_;
+};
+
+/**
+ * Adds a match to a heap of at most size matches, whose top is the worst one.
+ */
+static void keepBest(
+  vector<TideMatchSet::Arr::iterator>* heap,
+  TideMatchSet::Arr::iterator match,
+  size_t size,
+  const BetterMatch& better
+) {
+  if (heap->size() < size) {
+    heap->push_back(match);
+    push_heap(heap->begin(), heap->end(), better);
+  } else if (better(match, heap->front())) {
+    pop_heap(heap->begin(), heap->end(), better);
+    heap->back() = match;
+    push_heap(heap->begin(), heap->end(), better);
+  }
+}
+
 void TideMatchSet::gatherTargetsAndDecoys(
   const ActivePeptideQueue* peptides,
-  const ProteinVec& proteins,
+  const ProteinStore& proteins,
   vector<Arr::iterator>& targetsOut,
   vector<Arr::iterator>& decoysOut,
   int top_n,
   int numDecoys,
   bool highScoreBest // indicates semantics of score magnitude
 ) {
+  BetterMatch::Less less = NULL;
   switch (cur_score_function_) {
   case XCORR_SCORE:
     if (exact_pval_search_) {
-      make_heap(matches_->begin(), matches_->end(), highScoreBest ? lessXcorrPvalScore : moreXcorrPvalScore);
+      less = highScoreBest ? lessXcorrPvalScore : moreXcorrPvalScore;
     } else {
-      make_heap(matches_->begin(), matches_->end(), highScoreBest ? lessXcorrScore : moreXcorrScore);
+      less = highScoreBest ? lessXcorrScore : moreXcorrScore;
     }
     break;
   case RESIDUE_EVIDENCE_MATRIX:
     if (exact_pval_search_) {
-      make_heap(matches_->begin(), matches_->end(), highScoreBest ? lessResEvPvalScore : moreResEvPvalScore);
+      less = highScoreBest ? lessResEvPvalScore : moreResEvPvalScore;
     } else {
-      make_heap(matches_->begin(), matches_->end(), highScoreBest ? lessResEvScore : moreResEvScore);
+      less = highScoreBest ? lessResEvScore : moreResEvScore;
     }
     break;
   case BOTH_SCORE:
-    make_heap(matches_->begin(), matches_->end(), highScoreBest ? lessCombinedPvalScore : moreCombinedPvalScore);
+    less = highScoreBest ? lessCombinedPvalScore : moreCombinedPvalScore;
     break;
   }
+  BetterMatch better(less);
 
-  map<int, int> decoyWriteCount;
-  const bool concat = Params::GetBool("concat");
+  const bool concat = GlobalParams::getConcat();
   const int gatherSize = top_n + 1;
 
-  // decoys but not concat, populate targets and decoys
-  for (Arr::iterator i = matches_->end(); i != matches_->begin(); ) {
-    switch (cur_score_function_) {
-    case XCORR_SCORE:
-      if (exact_pval_search_) {
-        pop_heap(matches_->begin(), i--, highScoreBest ? lessXcorrPvalScore : moreXcorrPvalScore);
-      } else {
-        pop_heap(matches_->begin(), i--, highScoreBest ? lessXcorrScore : moreXcorrScore);
-      }
-      break;
-    case RESIDUE_EVIDENCE_MATRIX:
-      if (exact_pval_search_) {
-        pop_heap(matches_->begin(), i--, highScoreBest ? lessResEvPvalScore : moreResEvPvalScore);
-      } else {
-        pop_heap(matches_->begin(), i--, highScoreBest ? lessResEvScore : moreResEvScore);
-      }
-      break;
-    case BOTH_SCORE:
-      pop_heap(matches_->begin(), i--, highScoreBest ? lessCombinedPvalScore : moreCombinedPvalScore);
-      break;
+  // Keep the best gatherSize targets, and the best gatherSize decoys of each
+  // decoy index; nothing else can be gathered below.
+  vector<Arr::iterator> best;
+  map<int, vector<Arr::iterator> > bestDecoys;
+  for (Arr::iterator i = matches_->begin(); i != matches_->end(); ++i) {
+    Peptide& peptide = *(peptides->GetPeptide(i->rank));
+    if (concat || !peptide.IsDecoy()) {
+      keepBest(&best, i, gatherSize, better);
+    } else {
+      keepBest(&bestDecoys[peptide.DecoyIdx()], i, gatherSize, better);
     }
+  }
+  for (map<int, vector<Arr::iterator> >::const_iterator i = bestDecoys.begin();
+       i != bestDecoys.end();
+       ++i) {
+    best.insert(best.end(), i->second.begin(), i->second.end());
+  }
+  sort(best.begin(), best.end(), better);
+
+  map<int, int> decoyWriteCount;
+
+  // decoys but not concat, populate targets and decoys
+  for (vector<Arr::iterator>::const_iterator b = best.begin(); b != best.end(); ++b) {
+    Arr::iterator i = *b;
     Peptide& peptide = *(peptides->GetPeptide(i->rank));
     if (concat || !peptide.IsDecoy()) {
       if (targetsOut.size() < gatherSize) {
@@ -962,15 +1142,36 @@ pb::Peptide* TideMatchSet::getPbPeptide(const Peptide& peptide) {
 }
 
 /**
- * Gets the protein name with the index appended.
+ * Gets the protein name with the index appended. Decoy proteins that were
+ * made by shuffling a target protein use the position in the target.
+ */
+string TideMatchSet::getProteinName(const ProteinStore& proteins, int protein_id,
+                                    int pos, bool decoy) {
+  if (proteins.HasTargetPos(protein_id)) {
+    pos = proteins.TargetPos(protein_id);
+  }
+  string proteinName = decoy ? decoy_prefix_ : "";
+  proteinName += proteins.Name(protein_id);
+  proteinName += '(';
+  StringUtils::AppendInt(&proteinName, pos + 1);
+  proteinName += ')';
+  return proteinName;
+}
+
+/**
+ * Gets a protein location of a peptide: the protein name that
+ * getProteinName() gives, without the position, which comes separately.
  */
-string TideMatchSet::getProteinName(const pb::Protein& protein, int pos, bool decoy) {
-  stringstream proteinNameStream;
-  if (decoy) {
-    proteinNameStream << decoy_prefix_; 
+PSMLocation TideMatchSet::getLocation(const Peptide* peptide, const ProteinStore& proteins,
+                                      int protein_id, int pos) {
+  string n_term, c_term;
+  getFlankingAAs(peptide, proteins, protein_id, pos, &n_term, &c_term);
+  if (proteins.HasTargetPos(protein_id)) {
+    pos = proteins.TargetPos(protein_id);
   }
-  proteinNameStream << protein.name() << '(' << pos + 1 << ')';
-  return proteinNameStream.str();
+  string proteinId = peptide->IsDecoy() ? decoy_prefix_ : "";
+  proteinId += proteins.Name(protein_id);
+  return PSMLocation(proteinId, pos + 1, n_term + c_term);
 }
 
 /**
@@ -978,37 +1179,51 @@ string TideMatchSet::getProteinName(const pb::Protein& protein, int pos, bool de
  */
 void TideMatchSet::getFlankingAAs(
   const Peptide* peptide, ///< Tide peptide to get flanking AAs for
-  const pb::Protein* protein, ///< Tide protein for the peptide
+  const ProteinStore& proteins, ///< Tide proteins
+  int protein_id, ///< protein of the peptide
   int pos,  ///< location of peptide within protein
   string* out_n,  ///< out parameter for n flank
   string* out_c ///< out parameter for c flank
 ) {
   int idx_n = pos - 1;
   int idx_c = pos + peptide->Len();
-  const string& seq = protein->residues();
+  const char* seq = proteins.Residues(protein_id);
 
-  *out_n = (idx_n >= 0) ? seq.substr(idx_n, 1) : "-";
-  *out_c = (idx_c < seq.length()) ? seq.substr(idx_c, 1) : "-";
+  *out_n = (idx_n >= 0) ? string(1, seq[idx_n]) : "-";
+  *out_c = (idx_c < proteins.Length(protein_id)) ? string(1, seq[idx_c]) : "-";
 }
 
 void TideMatchSet::computeDeltaCns(
   const vector<Arr::iterator>& vec, // xcorr*100000000.0, high to low
   map<Arr::iterator, FLOAT_T>* delta_cn_map, // map to add delta cn scores to
   map<Arr::iterator, FLOAT_T>* delta_lcn_map // map to add delta cn scores to
+) {
+  vector< pair<FLOAT_T, FLOAT_T> > deltaCns;
+  computeDeltaCns(vec, &deltaCns);
+  for (int i = 0; i < vec.size(); i++) {
+    delta_cn_map->insert(make_pair(vec[i], deltaCns[i].first));
+    delta_lcn_map->insert(make_pair(vec[i], deltaCns[i].second));
+  }
+}
+
+void TideMatchSet::computeDeltaCns(
+  const vector<Arr::iterator>& vec,
+  vector< pair<FLOAT_T, FLOAT_T> >* delta_cns
 ) {
   // get vectore of scores
   vector<FLOAT_T> scores;
+  scores.reserve(vec.size());
   for (vector<Arr::iterator>::const_iterator i = vec.begin(); i != vec.end(); i++) {
-    if (Params::GetBool("exact-p-value")) { // p-value scores
-      if (Params::GetString("score-function") == "both") {
+    if (GlobalParams::getExactPValue()) { // p-value scores
+      if (GlobalParams::getScoreFunction() == BOTH_SCORE) {
         scores.push_back((*i)->combinedPval);
-      } else if (Params::GetString("score-function") == "residue-evidence") {
+      } else if (GlobalParams::getScoreFunction() == RESIDUE_EVIDENCE_MATRIX) {
         scores.push_back((*i)->resEv_pval);
       } else {
         scores.push_back((*i)->xcorr_pval);
       }
     } else { // non p-value scores
-      if (Params::GetString("score-function") == "residue-evidence") {
+      if (GlobalParams::getScoreFunction() == RESIDUE_EVIDENCE_MATRIX) {
         scores.push_back((*i)->resEv_score);
       } else {
         scores.push_back((*i)->xcorr_score);
@@ -1017,27 +1232,23 @@ void TideMatchSet::computeDeltaCns(
   }
 
   // calculate DeltaCns
-  vector< pair<FLOAT_T, FLOAT_T> > deltaCns;
-  if (Params::GetBool("exact-p-value")) { // p-value scores
-    if (Params::GetString("score-function") == "both") {
-      deltaCns = MatchCollection::calculateDeltaCns(scores, BOTH_PVALUE);
-    } else if (Params::GetString("score-function") == "residue-evidence") {
-      deltaCns = MatchCollection::calculateDeltaCns(scores, RESIDUE_EVIDENCE_PVAL);
+  SCORER_TYPE_T type;
+  if (GlobalParams::getExactPValue()) { // p-value scores
+    if (GlobalParams::getScoreFunction() == BOTH_SCORE) {
+      type = BOTH_PVALUE;
+    } else if (GlobalParams::getScoreFunction() == RESIDUE_EVIDENCE_MATRIX) {
+      type = RESIDUE_EVIDENCE_PVAL;
     } else {
-      deltaCns = MatchCollection::calculateDeltaCns(scores, TIDE_SEARCH_EXACT_PVAL);
+      type = TIDE_SEARCH_EXACT_PVAL;
     }
   } else { // non p-value scores
-    if (Params::GetString("score-function") == "residue-evidence") {
-      deltaCns = MatchCollection::calculateDeltaCns(scores, RESIDUE_EVIDENCE_SCORE);
+    if (GlobalParams::getScoreFunction() == RESIDUE_EVIDENCE_MATRIX) {
+      type = RESIDUE_EVIDENCE_SCORE;
     } else {
-      deltaCns = MatchCollection::calculateDeltaCns(scores, XCORR);
+      type = XCORR;
     }
   }
-
-  for (int i = 0; i < vec.size(); i++) {
-    delta_cn_map->insert(make_pair(vec[i], deltaCns[i].first));
-    delta_lcn_map->insert(make_pair(vec[i], deltaCns[i].second));
-  }
+  *delta_cns = MatchCollection::calculateSortedDeltaCns(scores, type, GlobalParams::getTopMatch());
 }
 
 void TideMatchSet::computeSpData(
@@ -9,9 +9,12 @@
 #include "tide/active_peptide_queue.h"  // no include guard
 #include "tide/fixed_cap_array.h"
 #include "tide/peptide.h"
+#include "tide/protein_store.h"
 #include "tide/sp_scorer.h"
 #include "tide/spectrum_collection.h"
 
+#include "io/PSMSink.h"
+#include "model/MatchCollection.h"
 #include "model/Modification.h"
 #include "model/PostProcessProtein.h"
 
@@ -26,6 +29,10 @@ class TideMatchSet {
   int elution_window_;
   SCORE_FUNCTION_T cur_score_function_;
   double max_mz_;
+  // If set, every reported match is also added to psm_sink_, under
+  // psm_key_ with the row filled in.
+  PSMSink* psm_sink_;
+  PSMSink::Key psm_key_;
 
   typedef pair<int, int> Pair2;
   typedef FixedCapacityArray<Pair2> Arr2;
@@ -78,28 +85,25 @@ class TideMatchSet {
     ofstream* decoy_file, ///< decoy file to write to
     int top_matches,
     const ActivePeptideQueue* peptides, ///< peptide queue
-    const ProteinVec& proteins, ///< proteins corresponding with peptides
-    const vector<const pb::AuxLocation*>& locations,  ///< auxiliary locations
+    const ProteinStore& proteins, ///< proteins and auxiliary locations of peptides
     bool compute_sp ///< whether to compute sp or not
   );
 
   /**
-   * Write spectrum centric to output files
+   * Write spectrum centric to output streams
    */
   void report(
-    ofstream* target_file,  ///< target file to write to
-    ofstream* decoy_file, ///< decoy file to write to
+    ostream* target_file,  ///< target stream to write to
+    ostream* decoy_file, ///< decoy stream to write to
     int top_n,  ///< number of matches to report
     int decoys_per_target,
     const string& spectrum_filename, ///< name of spectrum file
     const Spectrum* spectrum, ///< spectrum for matches
     int charge, ///< charge for matches
     const ActivePeptideQueue* peptides, ///< peptide queue
-    const ProteinVec& proteins, ///< proteins corresponding with peptides
-    const vector<const pb::AuxLocation*>& locations,  ///< auxiliary locations
+    const ProteinStore& proteins, ///< proteins and auxiliary locations of peptides
     bool compute_sp, ///< whether to compute sp or not
-    bool highScoreBest, //< indicates semantics of score magnitude
-    boost::mutex * rwlock = NULL
+    bool highScoreBest //< indicates semantics of score magnitude
   );
 
   static void colPrint(
@@ -115,6 +119,12 @@ class TideMatchSet {
     bool compute_sp
   );
 
+  /**
+   * Returns the scores that the matches given to a PSMSink have, which are
+   * those of the columns writeHeaders() writes.
+   */
+  static vector<SCORER_TYPE_T> getScoredTypes(bool compute_sp);
+
   // added by Yang
   static void writeHeadersDIA(ofstream* file, bool compute_sp);
 
@@ -126,8 +136,7 @@ class TideMatchSet {
     const Spectrum* spectrum,
     int charge,
     const ActivePeptideQueue* peptides,
-    const ProteinVec& proteins,
-    const vector<const pb::AuxLocation*>& locations,
+    const ProteinStore& proteins,
     const map<Arr::iterator, FLOAT_T>* delta_cn_map,
     const map<Arr::iterator, FLOAT_T>* delta_lcn_map,
     const map<Arr::iterator, pair<const SpScorer::SpScoreData, int> >* sp_map,
@@ -139,9 +148,13 @@ class TideMatchSet {
   );
 
 
+  // Collects the best matches, best first: top_n + 1 targets, and top_n + 1
+  // decoys for each decoy index. Only these are kept while going through the
+  // matches once, so the cost grows with log(top_n) rather than with the
+  // number of matches. Ties go to the match that comes first.
   void gatherTargetsAndDecoys(
     const ActivePeptideQueue* peptides,
-    const ProteinVec& proteins,
+    const ProteinStore& proteins,
     vector<Arr::iterator>& targetsOut,
     vector<Arr::iterator>& decoysOut,
     int top_n,
@@ -155,6 +168,14 @@ class TideMatchSet {
     map<Arr::iterator, FLOAT_T>* delta_lcn_map
   );
 
+  // Same, into a vector parallel to vec. vec must be sorted best first, as
+  // gatherTargetsAndDecoys() leaves it, so the deltas come from neighbours
+  // without sorting again.
+  static void computeDeltaCns(
+    const vector<Arr::iterator>& vec,
+    vector< pair<FLOAT_T, FLOAT_T> >* delta_cns
+  );
+
   static void computeSpData(
     const vector<Arr::iterator>& vec,
     map<Arr::iterator, pair<const SpScorer::SpScoreData, int> >* sp_rank_map,
@@ -223,8 +244,7 @@ class TideMatchSet {
   void writeToFile(
     ofstream* file,
     const ActivePeptideQueue* peptides,
-    const ProteinVec& proteins,
-    const vector<const pb::AuxLocation*>& locations,
+    const ProteinStore& proteins,
     bool compute_sp ///< whether to compute sp or not
   );
 
@@ -232,7 +252,7 @@ class TideMatchSet {
    * Helper function for tab delimited report function
    */
   void writeToFile(
-    ofstream* file,
+    ostream* file,
     int top_n,
     int decoys_per_target,
     const vector<Arr::iterator>& vec,
@@ -240,16 +260,25 @@ class TideMatchSet {
     const Spectrum* spectrum,
     int charge,
     const ActivePeptideQueue* peptides,
-    const ProteinVec& proteins,
-    const vector<const pb::AuxLocation*>& locations,
-    const map<Arr::iterator, FLOAT_T>& delta_cn_map,
-    const map<Arr::iterator, FLOAT_T>& delta_lcn_map,
-    const map<Arr::iterator, pair<const SpScorer::SpScoreData, int> >* sp_map,
-    boost::mutex * rwlock
+    const ProteinStore& proteins,
+    const vector< pair<FLOAT_T, FLOAT_T> >& delta_cns, ///< parallel to vec
+    const map<Arr::iterator, pair<const SpScorer::SpScoreData, int> >* sp_map
   );
 
   Crux::Peptide getCruxPeptide(const Peptide* peptide);
 
+  /**
+   * Creates the match for a reported PSM, with the spectrum and peptide
+   * values of its row. The caller adds the scores.
+   */
+  static Crux::Match* getCruxMatch(
+    const Peptide* peptide,
+    const Spectrum* spectrum,
+    int charge,
+    const string& file_path,
+    int distinct_matches
+  );
+
   /**
    * Create a pb peptide from Tide peptide
    */
@@ -261,17 +290,30 @@ class TideMatchSet {
    * Gets the protein name with the index appended.
    */
   static string getProteinName(
-    const pb::Protein& protein,
+    const ProteinStore& proteins,
+    int protein_id,
     int pos,
     bool decoy
   );
 
+  /**
+   * Gets a protein location of a peptide, as getProteinName() and
+   * getFlankingAAs() give it.
+   */
+  static PSMLocation getLocation(
+    const Peptide* peptide,
+    const ProteinStore& proteins,
+    int protein_id,
+    int pos
+  );
+
   /**
    * Gets the flanking AAs for a Tide peptide sequence
    */
   static void getFlankingAAs(
     const Peptide* peptide, ///< Tide peptide to get flanking AAs for
-    const pb::Protein* protein, ///< Tide protein for the peptide
+    const ProteinStore& proteins, ///< Tide proteins
+    int protein_id, ///< protein of the peptide
     int pos,  ///< location of peptide within protein
     string* out_n,  ///< out parameter for n flank
     string* out_c ///< out parameter for c flank
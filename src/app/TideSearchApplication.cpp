@@ -1,28 +1,69 @@
 #include <cstdio>
 #include "app/tide/abspath.h"
+#include "app/tide/mass_index.h"
+#include "app/tide/protein_store.h"
 #include "app/tide/records_to_vector-inl.h"
+#include "app/tide/score_count_cache.h"
+#include "app/tide/xcorr_kernel.h"
 
 #include "io/carp.h"
 #include "parameter.h"
+#include "io/SpectrumCache.h"
 #include "io/SpectrumRecordWriter.h"
+#include "io/SpectrumRecordSpectrumCollection.h"
+#include "MatchCollectionSink.h"
 #include "TideIndexApplication.h"
 #include "TideSearchApplication.h"
 #include "ParamMedicApplication.h"
-#include "PSMConvertApplication.h"
 #include "tide/mass_constants.h"
 #include "TideMatchSet.h"
+#include "util/GlobalParams.h"
 #include "util/Params.h"
 #include "util/FileUtils.h"
 #include "util/StringUtils.h"
 #include <math.h> //Added by Andy Lin
 #include <map> //Added by Andy Lin
 #include "time.h"
+#include <chrono>
 
 #define TAILOR_QUANTILE_TH 0.01
 #define TAILOR_OFFSET 5.0
 
 #define BIN_WIDTH_TH 1.0
 
+// Limits on the size of an epoch of spectrum-charges searched against one
+// fill of the shared peptide window: at most this many spectrum-charges, with
+// lower window bounds no more than this many Daltons apart. These bound the
+// size of the window independently of the number of threads.
+#define WINDOW_EPOCH_SPECTRA 2000
+#define WINDOW_EPOCH_SPAN 20.0
+
+// Largest number of spectrum-charges handed to a search thread at a time.
+// Smaller chunks are used for small epochs so that every thread gets several.
+#define WORK_CHUNK_SPECTRA 32
+
+// Largest number of neighbouring spectrum-charges scored together in one
+// pass over their candidate peptides.
+#define SCORING_TILE_SPECTRA 8
+
+
+/*
+ * Tailor calibration divisor for the n candidate scores of a spectrum: the
+ * score at the TAILOR_QUANTILE_TH quantile from the top (but at least the
+ * fourth best), plus TAILOR_OFFSET. Only that one score is placed, with
+ * nth_element, rather than sorting all of them. Reorders scores.
+ */
+static double tailorQuantile(double* scores, int n) {
+  int quantile_pos = (int)(TAILOR_QUANTILE_TH*(double)n+0.5);
+  if (quantile_pos < 3) {
+    quantile_pos = 3;
+  }
+  if (quantile_pos >= n) {
+    quantile_pos = n-1;
+  }
+  nth_element(scores, scores + quantile_pos, scores + n, greater<double>());
+  return scores[quantile_pos]+TAILOR_OFFSET; // Make sure scores positive
+}
 
 bool TideSearchApplication::HAS_DECOYS = false;
 bool TideSearchApplication::PROTEIN_LEVEL_DECOYS = false;
@@ -51,10 +92,12 @@ const double TideSearchApplication::RESCALE_FACTOR = 20.0;
  */
 
 TideSearchApplication::TideSearchApplication():
-  exact_pval_search_(false), remove_index_(""), spectrum_flag_(NULL) {
+  spectrum_flag_(NULL), remove_index_(""), thread_pool_(NULL), stats_file_(NULL),
+  psm_sink_(NULL), psm_file_base_(0), exact_pval_search_(false) {
 }
 
 TideSearchApplication::~TideSearchApplication() {
+  delete thread_pool_;
   if (!remove_index_.empty()) {
     carp(CARP_DEBUG, "Removing temp index '%s'", remove_index_.c_str());
     FileUtils::Remove(remove_index_);
@@ -98,10 +141,18 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
   }
   carp(CARP_INFO, "Number of Threads: %d", NUM_THREADS);
 
+  string xcorr_kernel = Params::GetString("xcorr-kernel");
+  if (!XCorrKernel::SetGlobal(xcorr_kernel)) {
+    carp(CARP_FATAL, "The %s XCorr kernel is not supported on this CPU.", xcorr_kernel.c_str());
+  }
+  carp(CARP_DEBUG, "Using the %s XCorr kernel.", XCorrKernel::GlobalName());
+
   const string index = input_index;
   string peptides_file = FileUtils::Join(index, "pepix");
+  string massix_file = FileUtils::Join(index, "massix");
   string proteins_file = FileUtils::Join(index, "protix");
   string auxlocs_file = FileUtils::Join(index, "auxlocs");
+  string protstore_file = FileUtils::Join(index, "protstore");
 
   // Check spectrum-charge parameter
   string charge_string = Params::GetString("spectrum-charge");
@@ -192,13 +243,27 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
   vector<int> negative_isotope_errors = getNegativeIsotopeErrors();
 
   ProteinVec proteins;
+  ProteinStore* protein_store;
   carp(CARP_INFO, "Reading index %s", index.c_str());
   
-  // Read proteins index file
+  // Read proteins index file. The protein store of the index is mapped if it
+  // is up to date; otherwise the proteins are read from protix.
   pb::Header protein_header;
-  if (!ReadRecordsToVector<pb::Protein, const pb::Protein>(&proteins,
-      proteins_file, &protein_header)) {
-    carp(CARP_FATAL, "Error reading index (%s)", proteins_file.c_str());
+  if (ProteinStore::Usable(protstore_file, proteins_file, auxlocs_file)) {
+    HeadedRecordReader protein_reader(proteins_file, &protein_header);
+    if (!protein_reader.OK()) {
+      carp(CARP_FATAL, "Error reading index (%s)", proteins_file.c_str());
+    }
+    protein_store = new ProteinStore(protstore_file);
+    if (!protein_store->OK()) {
+      carp(CARP_FATAL, "Error reading index (%s)", protstore_file.c_str());
+    }
+  } else {
+    if (!ReadRecordsToVector<pb::Protein, const pb::Protein>(&proteins,
+        proteins_file, &protein_header)) {
+      carp(CARP_FATAL, "Error reading index (%s)", proteins_file.c_str());
+    }
+    protein_store = new ProteinStore(proteins);
   }
   // There shouldn't be more than one header in the protein pb.
   pb::Header_Source headerSource = protein_header.source(0);  
@@ -213,8 +278,8 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
   TideMatchSet::decoy_prefix_ = decoy_prefix;
   
   int64_t targetProteinCount = 0;
-  for (ProteinVec::const_iterator i = proteins.begin(); i != proteins.end(); i++) {
-    if (!(*i)->has_target_pos()) {
+  for (size_t i = 0; i < protein_store->Size(); i++) {
+    if (!protein_store->HasTargetPos(i)) {
       ++targetProteinCount;
     }
   }
@@ -245,27 +310,18 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
                         bin_width_, bin_offset_);
 
     ActivePeptideQueue* active_peptide_queue =
-      new ActivePeptideQueue(aaf_peptide_reader.Reader(), proteins);
+      new ActivePeptideQueue(aaf_peptide_reader.Reader(), *protein_store);
 
     nAARes = active_peptide_queue->CountAAFrequency(dAAFreqN, dAAFreqI, dAAFreqC, dAAMass, mMass2AA);
     delete active_peptide_queue;
   }
 
-  // Read auxlocs index file
-  carp(CARP_INFO, "Reading auxiliary locations.");  
-  vector<const pb::AuxLocation*> locations;
-/*  if (!ReadRecordsToVector<pb::AuxLocation>(&locations, auxlocs_file)) {
-    carp(CARP_FATAL, "Error reading index (%s)", auxlocs_file.c_str());
-  }
-*/  carp(CARP_DEBUG, "Read %d auxiliary locations.", locations.size());
 
-  // Read peptides index file
+  // Read peptides index file. All threads search against a single window of
+  // peptides, so the index is read only once per spectrum file.
   pb::Header peptides_header;
   carp(CARP_INFO, "Reading peptide_header.");  
-  vector<HeadedRecordReader*> peptide_reader;
-  for (int i = 0; i < NUM_THREADS; i++) {
-    peptide_reader.push_back(new HeadedRecordReader(peptides_file, &peptides_header));
-  }
+  HeadedRecordReader* peptide_reader = new HeadedRecordReader(peptides_file, &peptides_header);
 
   if ((peptides_header.file_type() != pb::Header::PEPTIDES) ||
       !peptides_header.has_peptides_header()) {
@@ -273,6 +329,10 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
   }
 
   const pb::Header::PeptidesHeader& pepHeader = peptides_header.peptides_header();
+  // Indexes made by older versions of tide-index have no mass index.
+  bool use_mass_index = MassIndexReader::Usable(massix_file, peptides_file);
+  carp(CARP_DEBUG, "Reading peptides from %s.",
+       (use_mass_index ? massix_file : peptides_file).c_str());
   DECOY_TYPE_T headerDecoyType = (DECOY_TYPE_T)pepHeader.decoys();
   int decoysPerTarget = pepHeader.has_decoys_per_target() ? pepHeader.decoys_per_target() : 0;
   if (headerDecoyType != NO_DECOYS) {
@@ -315,79 +375,239 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
     TideMatchSet::writeHeaders(target_file, false, decoysPerTarget > 1, compute_sp);
     TideMatchSet::writeHeaders(decoy_file, true, decoysPerTarget > 1, compute_sp);
   }
+  // The other formats are written from the matches kept in memory, once all
+  // files are searched, since some of them group the matches of the whole run.
+  vector<string> formats = getOutputFormats();
+  if (!formats.empty()) {
+    psm_sink_ = new MatchCollectionSink(TideMatchSet::getScoredTypes(compute_sp),
+                                        decoysPerTarget > 1);
+  }
+  stats_file_ = create_stream_in_path(make_file_path("tide-search.stats.txt").c_str(),
+                                      NULL, overwrite);
+  *stats_file_ << "file\tthread\tspectrum-charges\tcandidates\tprecursor-peaks-deleted\t"
+                  "isotope-peaks-deleted\tout-of-range-peaks-deleted\tpeaks-retained\t"
+                  "intensity-memo-hits\tintensity-memo-misses\t"
+                  "score-count-memo-hits\tscore-count-memo-misses\t"
+                  "busy-seconds\tidle-seconds\tchunks\tstolen-chunks\tseconds\t"
+                  "spectrum-charges-per-second" << endl;
+
+  SpectrumCache* cache = NULL;
+  string cache_dir = Params::GetString("spectrum-cache-dir");
+  if (cache_dir.empty()) {
+    cache_dir = spectrum_cache_dir_;
+  }
+  if (!cache_dir.empty()) {
+    cache = SpectrumCache::create(cache_dir, (uint64_t)Params::GetInt("spectrum-cache-size") << 20);
+  }
+  vector<InputFile> sr = getInputFiles(input_files, cache);
+
+  // Spectrum files are searched in batches, each in a single pass over the
+  // index. Only spectrum-centric XCorr searches without exact p-values merge
+  // files; their results do not depend on the other spectra searched along.
+  size_t batch_size = 1;
+  if (curScoreFunction == XCORR_SCORE && !exact_pval_search_ &&
+      !Params::GetBool("peptide-centric-search") && spectrum_flag_ == NULL) {
+    batch_size = Params::GetInt("max-merged-files");
+  } else if (Params::GetInt("max-merged-files") > 1) {
+    carp(CARP_WARNING, "Searching one spectrum file at a time, because max-merged-files "
+         "only applies to spectrum-centric XCorr searches without exact p-values.");
+  }
+
+  // With a spectrum memory limit, the spectra of each file are sorted on disk
+  // and read back in segments while searching.
+  size_t spectrum_memory_limit = (size_t) Params::GetInt("spectrum-memory-limit") << 20;
+  if (spectrum_memory_limit > 0 && Params::GetBool("peptide-centric-search")) {
+    carp(CARP_WARNING, "Ignoring spectrum-memory-limit, which only applies to "
+         "spectrum-centric searches.");
+    spectrum_memory_limit = 0;
+  }
+  if (spectrum_memory_limit > 0 && batch_size > 1) {
+    carp(CARP_WARNING, "Searching one spectrum file at a time, because "
+         "spectrum-memory-limit is set.");
+    batch_size = 1;
+  }
+
+  // Loop through batches of spectrum files
+  for (size_t batch_begin = 0; batch_begin < sr.size(); batch_begin += batch_size) {
+    size_t batch_end = min(sr.size(), batch_begin + batch_size);
+    if (!peptide_reader) {
+      peptide_reader = new HeadedRecordReader(peptides_file, &peptides_header);
+    }
+
+    vector<SpectrumCollection*> batch_spectra;
+    vector<bool> batch_loaded;
+    vector<SearchFile> files;
+    SortedSpectrumStream* stream = NULL;
+    double batch_highest_mz = 0.0;
+
+    // The files of the batch that are not spectrumrecords are converted
+    // together. The converted spectra are searched as they are, and the
+    // spectrumrecords file is only written to be kept, or to be sorted on
+    // disk, which reads the spectra from it.
+    // Cache entries are written to a temporary file and added to the cache
+    // once converted. They are reserved in order of their names, so that
+    // processes converting some of the same files never wait on each other;
+    // an entry that another process, or this batch, makes is read instead.
+    vector<pair<string, size_t> > to_reserve;
+    for (size_t i = batch_begin; i < batch_end; i++) {
+      if (sr[i].Convert && sr[i].Cached) {
+        to_reserve.push_back(make_pair(sr[i].SpectrumRecords, i));
+      }
+    }
+    sort(to_reserve.begin(), to_reserve.end());
+    for (size_t i = 0; i < to_reserve.size(); i++) {
+      if (!cache->reserve(to_reserve[i].first)) {
+        sr[to_reserve[i].second].Convert = false;
+      }
+    }
+    map<size_t, SpectrumCollection*> converted;
+    vector<string> convert_in, convert_out;
+    vector<SpectrumCollection*> convert_spectra;
+    for (size_t i = batch_begin; i < batch_end; i++) {
+      if (sr[i].Convert && spectra_.find(sr[i].SpectrumRecords) == spectra_.end()) {
+        bool to_disk = spectrum_memory_limit > 0;
+        convert_in.push_back(sr[i].OriginalName);
+        convert_out.push_back(sr[i].Cached ? cache->tempFile(sr[i].SpectrumRecords)
+                              : sr[i].Keep || to_disk ? sr[i].SpectrumRecords : "");
+        convert_spectra.push_back(to_disk ? NULL : (converted[i] = new SpectrumCollection()));
+      }
+    }
+    if (!convert_in.empty()) {
+      carp(CARP_INFO, "Converting %d spectrum file(s) to spectrumrecords format.",
+           (int) convert_in.size());
+      carp(CARP_INFO, "Elapsed time starting conversion: %.3g s", wall_clock() / 1e6);
+      bool ok = SpectrumRecordWriter::load(convert_in, convert_out, convert_spectra, NUM_THREADS);
+      for (size_t i = batch_begin; i < batch_end; i++) {
+        if (sr[i].Convert && sr[i].Cached) {
+          cache->commit(sr[i].SpectrumRecords, ok);
+        }
+      }
+      if (!ok) {
+        carp(CARP_FATAL, "Error converting spectrum files to spectrumrecords format");
+      }
+    }
 
-  vector<InputFile> sr = getInputFiles(input_files);
+    for (size_t i = batch_begin; i < batch_end; i++) {
+      string spectra_file = sr[i].SpectrumRecords;
+      SpectrumCollection* spectra = NULL;
+      map<string, SpectrumCollection*>::iterator spectraIter = spectra_.find(spectra_file);
+      double max_mz, last_neutral_mass;
+      size_t spectrum_num;
+      if (spectraIter == spectra_.end() && spectrum_memory_limit > 0) {
+        carp(CARP_INFO, "Sorting spectrum file %s.", spectra_file.c_str());
+        stream = loadSpectraStream(spectra_file, spectrum_memory_limit);
+        carp(CARP_INFO, "Read %d spectra, sorted in %d runs.",
+             stream->NumSpectra(), stream->NumRuns());
+        max_mz = stream->HighestMZ();
+        last_neutral_mass = stream->LastNeutralMass();
+        spectrum_num = stream->NumSpecCharges();
+      } else {
+        if (converted.find(i) != converted.end()) {
+          spectra = converted[i];
+          sortSpectra(spectra);
+          carp(CARP_INFO, "Read %d spectra from %s.", spectra->Size(),
+               sr[i].OriginalName.c_str());
+        } else if (spectraIter == spectra_.end()) {
+          carp(CARP_INFO, "Reading spectrum file %s.", spectra_file.c_str());
+          spectra = loadSpectra(spectra_file);
+          carp(CARP_INFO, "Read %d spectra.", spectra->Size());
+        } else {
+          spectra = spectraIter->second;
+        }
+        max_mz = spectra->FindHighestMZ();
+        spectrum_num = spectra->SpecCharges()->size();
+        last_neutral_mass = spectrum_num > 0
+          ? spectra->SpecCharges()->at(spectrum_num - 1).neutral_mass : 0.0;
+      }
+      batch_spectra.push_back(spectra);
+      batch_loaded.push_back(spectraIter == spectra_.end());
 
-  // Loop through spectrum files
-  for (vector<InputFile>::const_iterator f = sr.begin(); f != sr.end(); f++) {
-    if (!peptide_reader[0]) {
-      for (int i = 0; i < NUM_THREADS; i++) {
-        peptide_reader[i] = new HeadedRecordReader(peptides_file, &peptides_header);
+      double highest_mz = max_mz;
+      if (spectrum_num > 0 &&
+          (exact_pval_search_ || curScoreFunction == RESIDUE_EVIDENCE_MATRIX || curScoreFunction == BOTH_SCORE)) {
+        highest_mz = last_neutral_mass;
       }
+      carp(CARP_DEBUG, "Maximum observed m/z = %f.", highest_mz);
+      files.push_back(SearchFile(sr[i].OriginalName, max_mz));
+      files.back().Bins.InitBin(highest_mz);
+      batch_highest_mz = max(batch_highest_mz, highest_mz);
     }
+    MaxBin::SetGlobalMax(batch_highest_mz);
 
-    string spectra_file = f->SpectrumRecords;
-    SpectrumCollection* spectra = NULL;
-    map<string, SpectrumCollection*>::iterator spectraIter = spectra_.find(spectra_file);
-    if (spectraIter == spectra_.end()) {
-      carp(CARP_INFO, "Reading spectrum file %s.", spectra_file.c_str());
-      spectra = loadSpectra(spectra_file);
-      carp(CARP_INFO, "Read %d spectra.", spectra->Size());
-    } else {
-      spectra = spectraIter->second;
+    // The spectrum-charges of the batch, in the order in which each file
+    // sorts its own, and the file each of them comes from.
+    const vector<SpectrumCollection::SpecCharge>* spec_charges =
+      stream == NULL ? batch_spectra[0]->SpecCharges() : NULL;
+    vector<SpectrumCollection::SpecCharge> merged;
+    vector<int> file_index;
+    if (files.size() > 1) {
+      carp(CARP_INFO, "Searching %d spectrum files together.", (int) files.size());
+      mergeSpecCharges(batch_spectra, &merged, &file_index);
+      spec_charges = &merged;
     }
 
-    double highest_mz = spectra->FindHighestMZ();
-    unsigned int spectrum_num = spectra->SpecCharges()->size();
-    if (spectrum_num > 0 &&
-        (exact_pval_search_ || curScoreFunction == RESIDUE_EVIDENCE_MATRIX || curScoreFunction == BOTH_SCORE)) {
-      highest_mz = spectra->SpecCharges()->at(spectrum_num - 1).neutral_mass;
-    }
-    carp(CARP_DEBUG, "Maximum observed m/z = %f.", highest_mz);
-    MaxBin::SetGlobalMax(highest_mz);
     // Do the search
     carp(CARP_INFO, "Starting search.");
     if (spectrum_flag_ == NULL) {
       resetMods();
     }
-    vector<ActivePeptideQueue*> active_peptide_queue;
-    for (int i = 0; i < NUM_THREADS; i++) {
-      active_peptide_queue.push_back(new ActivePeptideQueue(peptide_reader[i]->Reader(), proteins));
-      active_peptide_queue[i]->SetBinSize(bin_width_, bin_offset_);
+    MassIndexReader* mass_reader = NULL;
+    ActivePeptideQueue* active_peptide_queue;
+    if (use_mass_index) {
+      mass_reader = new MassIndexReader(massix_file);
+      if (!mass_reader->OK()) {
+        carp(CARP_FATAL, "Error reading index (%s)", massix_file.c_str());
+      }
+      active_peptide_queue = new ActivePeptideQueue(mass_reader, *protein_store);
+    } else {
+      active_peptide_queue = new ActivePeptideQueue(peptide_reader->Reader(), *protein_store);
     }
-    
-    search(f->OriginalName, spectra->SpecCharges(), active_peptide_queue, proteins,
-           locations, Params::GetDouble("precursor-window"),
+    active_peptide_queue->SetBinSize(bin_width_, bin_offset_);
+    if (pepHeader.has_peaks_bin_width()) {
+      bool stored_peaks = Peptide::StoredPeaksUsable(pepHeader);
+      carp(CARP_DEBUG, "%s the theoretical peaks stored in the index.",
+           stored_peaks ? "Using" : "Not using");
+      active_peptide_queue->SetUseStoredPeaks(stored_peaks);
+    }
+
+
+    psm_file_base_ = batch_begin;
+    search(files, spec_charges, files.size() > 1 ? &file_index : NULL, stream,
+           active_peptide_queue, protein_store,
+           Params::GetDouble("precursor-window"),
            string_to_window_type(Params::GetString("precursor-window-type")),
            Params::GetDouble("spectrum-min-mz"), Params::GetDouble("spectrum-max-mz"),
            min_scan, max_scan, Params::GetInt("min-peaks"), charge_to_search,
-           Params::GetInt("top-match"), spectra->FindHighestMZ(),
+           Params::GetInt("top-match"),
            target_file, decoy_file, compute_sp,
            nAARes, dAAFreqN, dAAFreqI, dAAFreqC, dAAMass,
            pepHeader.mods(), pepHeader.nterm_mods(), pepHeader.cterm_mods(),
            decoysPerTarget, &negative_isotope_errors);
 
-    if (spectraIter == spectra_.end()) {
-      delete spectra;
+    for (size_t i = 0; i < batch_spectra.size(); i++) {
+      if (batch_loaded[i]) {
+        delete batch_spectra[i];
+      }
     }
-    // convert tab delimited to other file formats.
-    convertResults();
+    delete stream;
 
-    // Delete temporary spectrumrecords file
-    if (!f->Keep) {
-      carp(CARP_DEBUG, "Deleting %s", spectra_file.c_str());
-      remove(spectra_file.c_str());
+    // Delete temporary spectrumrecords files
+    for (size_t i = batch_begin; i < batch_end; i++) {
+      if (!sr[i].Keep && FileUtils::Exists(sr[i].SpectrumRecords)) {
+        carp(CARP_DEBUG, "Deleting %s", sr[i].SpectrumRecords.c_str());
+        remove(sr[i].SpectrumRecords.c_str());
+      }
     }
 
     // Clean up
-    for (int i = 0; i < NUM_THREADS; i++) {
-      delete active_peptide_queue[i];
-      delete peptide_reader[i];
-      peptide_reader[i] = NULL;
-    }
+    delete active_peptide_queue;
+    delete mass_reader;
+    delete peptide_reader;
+    peptide_reader = NULL;
 
   } // End of spectrum file loop
 
+  delete protein_store;
   for (ProteinVec::iterator i = proteins.begin(); i != proteins.end(); ++i) {
     delete *i;
   }
@@ -397,6 +617,13 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
       delete decoy_file;
     }
   }
+  delete stats_file_;
+  stats_file_ = NULL;
+  delete cache;
+
+  writeResults(formats);
+  delete psm_sink_;
+  psm_sink_ = NULL;
 
   return 0;
 }
@@ -431,40 +658,37 @@ vector<int> TideSearchApplication::getNegativeIsotopeErrors() {
 }
 
 vector<InputFile> TideSearchApplication::getInputFiles(
-  const vector<string>& filepaths
+  const vector<string>& filepaths,
+  SpectrumCache* cache
 ) const {
-  // Try to read all spectrum files as spectrumrecords, convert those that fail
+  // Spectrumrecords files are recognized by their header. The others are
+  // taken from the spectrum cache if they are in it, and converted when
+  // they are searched otherwise.
   vector<InputFile> input_sr;
   for (vector<string>::const_iterator f = filepaths.begin(); f != filepaths.end(); f++) {
-    SpectrumCollection spectra;
-    pb::Header spectrum_header;
-    string spectrumrecords = *f;
-    bool keepSpectrumrecords = true;
-    if (!spectra.ReadSpectrumRecords(spectrumrecords, &spectrum_header)) {
-      // Failed, try converting to spectrumrecords file
-      carp(CARP_INFO, "Converting %s to spectrumrecords format", f->c_str());
-      carp(CARP_INFO, "Elapsed time starting conversion: %.3g s", wall_clock() / 1e6);
-      spectrumrecords = Params::GetString("store-spectra");
-      keepSpectrumrecords = !spectrumrecords.empty();
-      if (!keepSpectrumrecords) {
-        spectrumrecords = make_file_path(FileUtils::BaseName(*f) + ".spectrumrecords.tmp");
-      } else if (filepaths.size() > 1) {
-        carp(CARP_FATAL, "Cannot use store-spectra option with multiple input "
-                         "spectrum files");
-      }
-      carp(CARP_DEBUG, "New spectrumrecords filename: %s", spectrumrecords.c_str());
-      if (!SpectrumRecordWriter::convert(*f, spectrumrecords)) {
-        carp(CARP_FATAL, "Error converting %s to spectrumrecords format", f->c_str());
-      }
-      carp(CARP_DEBUG, "Reading converted spectrum file %s", spectrumrecords.c_str());
-      // Re-read converted file as spectrumrecords file
-      if (!spectra.ReadSpectrumRecords(spectrumrecords, &spectrum_header)) {
-        carp(CARP_DEBUG, "Deleting %s", spectrumrecords.c_str());
-        FileUtils::Remove(spectrumrecords);
-        carp(CARP_FATAL, "Error reading spectra file %s", spectrumrecords.c_str());
-      }
+    if (SpectrumRecordSpectrumCollection::IsSpectrumRecordFile(*f)) {
+      input_sr.push_back(InputFile(*f, *f, true));
+      continue;
+    }
+    string spectrumrecords = Params::GetString("store-spectra");
+    bool keepSpectrumrecords = !spectrumrecords.empty();
+    if (!keepSpectrumrecords && cache) {
+      string entry = cache->entry(*f);
+      bool cached = cache->use(entry);
+      carp(CARP_DEBUG, "%s spectrumrecords filename: %s", cached ? "Cached" : "New",
+           entry.c_str());
+      input_sr.push_back(InputFile(*f, entry, true, !cached, true));
+      continue;
+    }
+    if (!keepSpectrumrecords) {
+      spectrumrecords = make_file_path(FileUtils::BaseName(*f) + ".spectrumrecords.tmp");
+    } else if (filepaths.size() > 1) {
+      carp(CARP_FATAL, "Cannot use store-spectra option with multiple input "
+                       "spectrum files; use spectrum-cache-dir to keep the "
+                       "spectrumrecords of several files.");
     }
-    input_sr.push_back(InputFile(*f, spectrumrecords, keepSpectrumrecords));
+    carp(CARP_DEBUG, "New spectrumrecords filename: %s", spectrumrecords.c_str());
+    input_sr.push_back(InputFile(*f, spectrumrecords, keepSpectrumrecords, true));
   }
   return input_sr;
 }
@@ -475,34 +699,106 @@ SpectrumCollection* TideSearchApplication::loadSpectra(const string& file) {
   if (!spectra->ReadSpectrumRecords(file, &header)) {
     carp(CARP_FATAL, "Error reading spectrum file %s", file.c_str());
   }
+  sortSpectra(spectra);
+  return spectra;
+}
+
+void TideSearchApplication::sortSpectra(SpectrumCollection* spectra) {
   if (string_to_window_type(Params::GetString("precursor-window-type")) != WINDOW_MZ) {
     spectra->Sort();
   } else {
     spectra->Sort<ScSortByMz>(ScSortByMz(Params::GetDouble("precursor-window")));
   }
-  return spectra;
+}
+
+SortedSpectrumStream* TideSearchApplication::loadSpectraStream(
+  const string& file,
+  size_t memory_limit
+) {
+  // Spectrum-charges sort by neutral mass, or as ScSortByMz for m/z windows.
+  double mz_offset = string_to_window_type(Params::GetString("precursor-window-type")) != WINDOW_MZ
+    ? 0.0 : Params::GetDouble("precursor-window");
+  SortedSpectrumStream* stream = new SortedSpectrumStream(
+    file, make_file_path(FileUtils::BaseName(file) + ".run"), memory_limit, mz_offset);
+  if (!stream->OK()) {
+    carp(CARP_FATAL, "Error reading spectrum file %s", file.c_str());
+  }
+  return stream;
+}
+
+/*
+ * Each file's spectrum-charges are already in search order. A stable sort
+ * keeps them in that order, and puts ties between files in file order, so
+ * restricted to one file the merged order is the order in which that file
+ * alone would be searched.
+ */
+void TideSearchApplication::mergeSpecCharges(
+  const vector<SpectrumCollection*>& spectra,
+  vector<SpectrumCollection::SpecCharge>* merged,
+  vector<int>* file_index
+) {
+  vector<SpectrumCollection::SpecCharge> all;
+  vector<int> all_files;
+  for (size_t i = 0; i < spectra.size(); i++) {
+    const vector<SpectrumCollection::SpecCharge>* spec_charges = spectra[i]->SpecCharges();
+    all.insert(all.end(), spec_charges->begin(), spec_charges->end());
+    all_files.insert(all_files.end(), spec_charges->size(), (int) i);
+  }
+  vector<size_t> order(all.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  if (string_to_window_type(Params::GetString("precursor-window-type")) != WINDOW_MZ) {
+    stable_sort(order.begin(), order.end(), [&all](size_t x, size_t y) {
+      return all[x] < all[y];
+    });
+  } else {
+    ScSortByMz by_mz(Params::GetDouble("precursor-window"));
+    stable_sort(order.begin(), order.end(), [&all, &by_mz](size_t x, size_t y) {
+      return by_mz(all[x], all[y]);
+    });
+  }
+  merged->clear();
+  file_index->clear();
+  merged->reserve(all.size());
+  file_index->reserve(all.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    merged->push_back(all[order[i]]);
+    file_index->push_back(all_files[order[i]]);
+  }
+}
+
+void TideSearchApplication::appendAndRemove(const string& file, ofstream* out) {
+  ifstream in(file.c_str(), ios::binary);
+  char buffer[1 << 16];
+  while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+    out->write(buffer, in.gcount());
+  }
+  in.close();
+  FileUtils::Remove(file);
 }
 
 void TideSearchApplication::search(void* threadarg) {
   struct thread_data *my_data = (struct thread_data *) threadarg;
 
-  const string& spectrum_filename = my_data->spectrum_filename;
   const vector<SpectrumCollection::SpecCharge>* spec_charges = my_data->spec_charges;
   ActivePeptideQueue* active_peptide_queue = my_data->active_peptide_queue;
-  ProteinVec& proteins = my_data->proteins;
-  vector<const pb::AuxLocation*>& locations = my_data->locations;
+  const ProteinStore& proteins = *my_data->proteins;
   double precursor_window = my_data->precursor_window;
   WINDOW_TYPE_T window_type = my_data->window_type;
-  double spectrum_min_mz = my_data->spectrum_min_mz;
-  double spectrum_max_mz = my_data->spectrum_max_mz;
-  int min_scan = my_data->min_scan;
-  int max_scan = my_data->max_scan;
-  int min_peaks = my_data->min_peaks;
-  int search_charge = my_data->search_charge;
   int top_matches = my_data->top_matches;
-  double highest_mz = my_data->highest_mz;
-  ofstream* target_file = my_data->target_file;
-  ofstream* decoy_file = my_data->decoy_file;
+  // Results are formatted into this thread's own buffers, one pair for each
+  // spectrum file, which are handed to the ordered writers at the end of
+  // every chunk.
+  vector<ostringstream*> target_buffers, decoy_buffers;
+  for (size_t i = 0; i < my_data->files->size(); i++) {
+    target_buffers.push_back(new ostringstream());
+    decoy_buffers.push_back(new ostringstream());
+  }
+  my_data->target_buffers = &target_buffers;
+  my_data->decoy_buffers = &decoy_buffers;
+  ostream* target_file = NULL;
+  ostream* decoy_file = NULL;
   bool compute_sp = my_data->compute_sp;
   int64_t thread_num = my_data->thread_num;
   int64_t num_threads = my_data->num_threads;
@@ -522,26 +818,54 @@ void TideSearchApplication::search(void* threadarg) {
   double bin_width = my_data->bin_width;
   double bin_offset = my_data->bin_offset;
   bool exact_pval_search = my_data->exact_pval_search;
-  map<pair<string, unsigned int>, bool>* spectrum_flag = my_data->spectrum_flag;
 
-  int* sc_index = my_data->sc_index;
-  long* total_candidate_peptides = my_data->total_candidate_peptides;
+  SearchCounters* counters = my_data->counters;
+  ActivePeptideQueue* peptide_window = my_data->peptide_window;
+  const vector<WindowEpoch>* epochs = my_data->epochs;
+  boost::barrier* barrier = my_data->barrier;
+  chrono::steady_clock::time_point search_start = chrono::steady_clock::now();
+  double busy_start = my_data->busy_time;
 
   // params
-  bool peptide_centric = Params::GetBool("peptide-centric-search");
-  bool use_neutral_loss_peaks = Params::GetBool("use-neutral-loss-peaks");
-  bool use_flanking_peaks = Params::GetBool("use-flanking-peaks");
-  int max_charge = Params::GetInt("max-precursor-charge");
-  double max_spectrum_neutral_mass = Params::GetDouble("max-spectrum_neutral-mass");
+  bool peptide_centric = GlobalParams::getPeptideCentricSearch();
+  bool use_neutral_loss_peaks = GlobalParams::getUseNeutralLossPeaks();
+  bool use_flanking_peaks = GlobalParams::getUseFlankingPeaks();
+  int max_charge = GlobalParams::getMaxPrecursorCharge();
+  double max_spectrum_neutral_mass = GlobalParams::getMaxSpectrumNeutralMass();
   // Added by Andy Lin on 2/9/2016
   // Determines which score function to use for scoring PSMs and store in SCORE_FUNCTION enum
-  SCORE_FUNCTION_T curScoreFunction = string_to_score_function_type(Params::GetString("score-function"));
+  SCORE_FUNCTION_T curScoreFunction = GlobalParams::getScoreFunction();
 
   // This is the main search loop.
   ObservedPeakSet observed(bin_width, bin_offset,
                            use_neutral_loss_peaks,
                            use_flanking_peaks);
 
+  // XCorr scoring preprocesses and scores tiles of neighbouring
+  // spectrum-charges, each with peaks of its own. Peptide-centric search
+  // reads peptides as it goes, so it cannot select candidates ahead of the
+  // current spectrum and uses tiles of one.
+  vector<ObservedPeakSet*> tile_observed;
+  if (curScoreFunction == XCORR_SCORE && !exact_pval_search_) {
+    int tile_size = peptide_window != NULL ? SCORING_TILE_SPECTRA : 1;
+    for (int i = 0; i < tile_size; ++i) {
+      tile_observed.push_back(new ObservedPeakSet(bin_width, bin_offset,
+                                                  use_neutral_loss_peaks,
+                                                  use_flanking_peaks));
+    }
+  }
+  vector<TileSpectrum> tile;
+  size_t tile_next = 0;
+
+  // Temporaries of the search of one spectrum-charge, reused for the next.
+  ScratchArena scratch;
+  vector<double> scratch_min_mass, scratch_max_mass;
+  vector<bool> scratch_candidate_status;
+  vector<vector<vector<double> > > residueEvidenceMatrix;
+  // Evidence vectors and score counts for exact p-values, kept for the
+  // spectra this thread has searched last.
+  ScoreCountCache score_counts;
+
   // Keep track of observed peaks that get filtered out in various ways.
   long int num_range_skipped = 0;
   long int num_precursors_skipped = 0;
@@ -549,763 +873,801 @@ void TideSearchApplication::search(void* threadarg) {
   long int num_retained = 0;
 
   // cycle through spectrum-charge pairs, sorted by neutral mass
-  FLOAT_T sc_total = (FLOAT_T)spec_charges->size();
-  int print_interval = Params::GetInt("print-search-progress");
-  double fragmentIonMassRoundingPrecision = 1.0/Params::GetDouble("xpv-precision"); //   0.02;
-
-  for (vector<SpectrumCollection::SpecCharge>::const_iterator sc = spec_charges->begin()+thread_num;
-       sc < spec_charges->begin() + (spec_charges->size());
-       sc = sc + num_threads) {
-    locks_array[LOCK_REPORTING]->lock();
-    ++(*sc_index);
-    if (print_interval > 0 && *sc_index > 0 && *sc_index % print_interval == 0) {
-      carp(CARP_INFO, "%d spectrum-charge combinations searched, %.0f%% complete",
-           *sc_index, *sc_index / sc_total * 100);
-    }
-    locks_array[LOCK_REPORTING]->unlock();
-
-    Spectrum* spectrum = sc->spectrum;
-    double precursor_mz = spectrum->PrecursorMZ();
-    double precursorMass = sc->neutral_mass;  //Added by Andy Lin (needed for residue evidence)
-    int charge = sc->charge;
-
-    int scan_num = spectrum->SpectrumNumber();
-    if (spectrum_flag != NULL) {
-      locks_array[LOCK_CASCADE]->lock();
-      map<pair<string, unsigned int>, bool>::iterator spectrum_id;
-      spectrum_id = spectrum_flag->find(pair<string, unsigned int>(
-        spectrum_filename, scan_num * 10 + charge));
-      if (spectrum_id != spectrum_flag->end()) {
-        locks_array[LOCK_CASCADE]->unlock();
-        continue;
+  double fragmentIonMassRoundingPrecision = 1.0/GlobalParams::getXpvPrecision(); //   0.02;
+
+  for (vector<WindowEpoch>::const_iterator epoch = epochs->begin(); epoch != epochs->end(); ++epoch) {
+    // Fill the shared peptide window for this epoch. Thread 0 reads the
+    // peptides and deals out the spectrum-charges while the others wait, then
+    // every thread computes the peaks of its share of the peptides.
+    if (thread_num == 0) {
+      size_t chunk_size = (epoch->end - epoch->begin) / (4 * num_threads);
+      my_data->scheduler->Reset(epoch->begin, epoch->end,
+                                max((size_t)1, min(chunk_size, (size_t)WORK_CHUNK_SPECTRA)));
+      if (peptide_window != NULL) {
+        if (curScoreFunction == XCORR_SCORE && !exact_pval_search_) {
+          peptide_window->AdvanceWindow(epoch->min_range, epoch->max_range);
+        } else {
+          peptide_window->AdvanceWindowBIons(epoch->min_range, epoch->max_range);
+        }
       }
-      locks_array[LOCK_CASCADE]->unlock();
     }
-
-    if (precursor_mz < spectrum_min_mz || precursor_mz > spectrum_max_mz ||
-        scan_num < min_scan || scan_num > max_scan ||
-        spectrum->Size() < min_peaks ||
-        (search_charge != 0 && charge != search_charge) || charge > max_charge) {
-      continue;
+    if (peptide_window != NULL) {
+      barrier->wait();
+      active_peptide_queue->ComputeWindowPeaks(thread_num, num_threads);
+      barrier->wait();
     }
-    if (precursorMass > max_spectrum_neutral_mass) {
-      continue;
-    }
-    // The active peptide queue holds the candidate peptides for spectrum.
-    // Calculate and set the window, depending on the window type.
-    vector<double>* min_mass = new vector<double>();
-    vector<double>* max_mass = new vector<double>();
-    vector<bool>* candidatePeptideStatus = new vector<bool>();
-    double min_range, max_range;
-    computeWindow(*sc, window_type, precursor_window,
-                  negative_isotope_errors, min_mass, max_mass, &min_range, &max_range);
-
-    //TODO throw error when fragment-tolerance and evidence-granularity parameters are defined
-
-    if (curScoreFunction == XCORR_SCORE && !exact_pval_search_) {  //execute original tide-search program
-      // Normalize the observed spectrum and compute the cache of
-      // frequently-needed values for taking dot products with theoretical
-      // spectra.
-      observed.PreprocessSpectrum(*spectrum, charge, &num_range_skipped,
-                                  &num_precursors_skipped,
-                                  &num_isotopes_skipped, &num_retained);
-      int nCandPeptide = active_peptide_queue->SetActiveRange(
-        min_mass, max_mass, min_range, max_range, candidatePeptideStatus);
-      if (nCandPeptide == 0) {
+
+    // Spectrum-charges are taken a chunk of neighbouring masses at a time,
+    // from this thread's share first and then from other threads' shares.
+    size_t sc_pos = 0, chunk_end = 0;
+    while (nextSpecCharge(my_data, &sc_pos, &chunk_end)) {
+      vector<SpectrumCollection::SpecCharge>::const_iterator sc = spec_charges->begin() + sc_pos;
+      counters->Add(thread_num, SearchCounters::SPECTRA, 1);
+
+      Spectrum* spectrum = sc->spectrum;
+      double precursorMass = sc->neutral_mass;  //Added by Andy Lin (needed for residue evidence)
+      int charge = sc->charge;
+
+      if (identifiedInCascade(*sc, *my_data)) {
         continue;
       }
-      locks_array[LOCK_CANDIDATES]->lock();
-      *total_candidate_peptides += nCandPeptide;
-      locks_array[LOCK_CANDIDATES]->unlock();
 
-      int candidatePeptideStatusSize = candidatePeptideStatus->size();
-      TideMatchSet::Arr2 match_arr2(candidatePeptideStatusSize); // Scored peptides will go here.
-  
+      // Results go to the buffers of the spectrum file of sc.
+      int file_num = fileNum(*my_data, sc_pos);
+      const SearchFile& file = (*my_data->files)[file_num];
+      const string& spectrum_filename = file.Name;
+      double highest_mz = file.HighestMz;
+      target_file = my_data->target_file ? target_buffers[file_num] : NULL;
+      decoy_file = my_data->decoy_file ? decoy_buffers[file_num] : NULL;
+      observed.LimitBins(&file.Bins);
 
-      // Programs for taking the dot-product with the observed spectrum are laid
-      // out in memory managed by the active_peptide_queue, one program for each
-      // candidate peptide. The programs will store the results directly into
-      // match_arr. We now pass control to those programs.
+      if (!passesFilters(*sc, *my_data, max_charge, max_spectrum_neutral_mass)) {
+        continue;
+      }
+      // The active peptide queue holds the candidate peptides for spectrum.
+      // Calculate and set the window, depending on the window type.
+      scratch.Reset();
+      vector<double>* min_mass = &scratch_min_mass;
+      vector<double>* max_mass = &scratch_max_mass;
+      vector<bool>* candidatePeptideStatus = &scratch_candidate_status;
+      min_mass->clear();
+      max_mass->clear();
+      candidatePeptideStatus->clear();
+      double min_range, max_range;
+      computeWindow(*sc, window_type, precursor_window,
+                    negative_isotope_errors, min_mass, max_mass, &min_range, &max_range);
+
+      //TODO throw error when fragment-tolerance and evidence-granularity parameters are defined
+
+      if (curScoreFunction == XCORR_SCORE && !exact_pval_search_) {  //execute original tide-search program
+        // Normalize the observed spectrum, compute the cache of
+        // frequently-needed values for taking dot products with theoretical
+        // spectra, select the candidates and score them. This is done for a
+        // tile of spectrum-charges at once, when the first one comes up.
+        while (tile_next < tile.size() && tile[tile_next].sc_pos < sc_pos) {
+          ++tile_next;
+        }
+        if (tile_next == tile.size() || tile[tile_next].sc_pos != sc_pos) {
+          buildXCorrTile(*my_data, sc_pos, chunk_end, max_charge, max_spectrum_neutral_mass,
+                         tile_observed, &tile, &num_range_skipped, &num_precursors_skipped,
+                         &num_isotopes_skipped, &num_retained);
+          tile_next = 0;
+        }
+        TileSpectrum& scored = tile[tile_next];
+        int nCandPeptide = scored.nCandPeptide;
+        if (nCandPeptide == 0) {
+          continue;
+        }
+        active_peptide_queue->SetSelection(scored.selection);
+        candidatePeptideStatus->swap(scored.candidatePeptideStatus);
+        counters->Add(thread_num, SearchCounters::CANDIDATES, nCandPeptide);
 
-      collectScoresCompiled(active_peptide_queue, spectrum, observed, &match_arr2,
-                            candidatePeptideStatusSize, charge);
+        int candidatePeptideStatusSize = candidatePeptideStatus->size();
+        TideMatchSet::Arr2 match_arr2; // Scored peptides will go here.
+        match_arr2.Init(&scratch, candidatePeptideStatusSize);
+        copy(scored.scores.begin(), scored.scores.end(), match_arr2.begin());
+        match_arr2.set_size(candidatePeptideStatusSize);
 
-      // matches will arrange the results in a heap by score, return the top
-      // few, and recover the association between counter and peptide. We output
-      // the top matches.
-      if (peptide_centric) {
-        deque<Peptide*>::const_iterator iter_ = active_peptide_queue->iter_;
-        TideMatchSet::Arr2::iterator it = match_arr2.begin();
-        for (; it != match_arr2.end(); ++iter_, ++it) {
-          int peptide_idx = candidatePeptideStatusSize - (it->second);
-          if ((*candidatePeptideStatus)[peptide_idx]) {
-            (*iter_)->AddHit(spectrum, it->first, 0.0, it->second, charge);
+        // matches will arrange the results in a heap by score, return the top
+        // few, and recover the association between counter and peptide. We output
+        // the top matches.
+        if (peptide_centric) {
+          deque<Peptide*>::const_iterator iter_ = active_peptide_queue->iter_;
+          TideMatchSet::Arr2::iterator it = match_arr2.begin();
+          for (; it != match_arr2.end(); ++iter_, ++it) {
+            int peptide_idx = candidatePeptideStatusSize - (it->second);
+            if ((*candidatePeptideStatus)[peptide_idx]) {
+              (*iter_)->AddHit(spectrum, it->first, 0.0, it->second, charge);
+            }
           }
-        }
-      } else {  //spectrum centric match report.
-        //Implementation of the Tailor score calibration method, by AKF
-        double quantile_score = 1.0;
-        if (Params::GetBool("use-tailor-calibration")) {
-          vector<double> scores;
-          // Collect the scores for the score tail distribution
+        } else {  //spectrum centric match report.
+          //Implementation of the Tailor score calibration method, by AKF
+          double quantile_score = 1.0;
+          if (GlobalParams::getUseTailorCalibration()) {
+            // Collect the scores for the score tail distribution
+            double* scores = scratch.New<double>(match_arr2.size());
+            int num_scores = 0;
+            for (TideMatchSet::Arr2::iterator it = match_arr2.begin();
+              it != match_arr2.end();
+              ++it) {
+              scores[num_scores++] = (double)(it->first / XCORR_SCALING);
+            }
+            quantile_score = tailorQuantile(scores, num_scores);
+          }  //End of Tailor
+          TideMatchSet::Arr match_arr(nCandPeptide);
+
           for (TideMatchSet::Arr2::iterator it = match_arr2.begin();
-            it != match_arr2.end();
-            ++it) {
-            scores.push_back((double)(it->first / XCORR_SCALING));
-          }
-          sort(scores.begin(), scores.end(), greater<double>());  //sort in decreasing order
-          int quantile_pos = (int)(TAILOR_QUANTILE_TH*(double)scores.size()+0.5);
-
-          if (quantile_pos < 3) quantile_pos = 3;
-
-          if (quantile_pos >= scores.size()) { quantile_pos = scores.size()-1; }
-
-          quantile_score = scores[quantile_pos]+TAILOR_OFFSET; // Make sure scores positive
-        }  //End of Tailor
-        TideMatchSet::Arr match_arr(nCandPeptide);
-
-        for (TideMatchSet::Arr2::iterator it = match_arr2.begin();
-             it != match_arr2.end();
-             ++it) {
-          int peptide_idx = candidatePeptideStatusSize - (it->second);
-          if ((*candidatePeptideStatus)[peptide_idx]) {
-            TideMatchSet::Scores curScore;
-            curScore.xcorr_score = (double)(it->first / XCORR_SCALING);
-            curScore.rank = it->second;
-            //Added for tailor score calibration method by AKF
-            if (Params::GetBool("use-tailor-calibration")) {
-              curScore.tailor = ((double)(it->first / XCORR_SCALING) + TAILOR_OFFSET) / quantile_score;
-            }            
-            match_arr.push_back(curScore);
+               it != match_arr2.end();
+               ++it) {
+            int peptide_idx = candidatePeptideStatusSize - (it->second);
+            if ((*candidatePeptideStatus)[peptide_idx]) {
+              TideMatchSet::Scores curScore;
+              curScore.xcorr_score = (double)(it->first / XCORR_SCALING);
+              curScore.rank = it->second;
+              //Added for tailor score calibration method by AKF
+              if (GlobalParams::getUseTailorCalibration()) {
+                curScore.tailor = ((double)(it->first / XCORR_SCALING) + TAILOR_OFFSET) / quantile_score;
+              }            
+              match_arr.push_back(curScore);
+            }
           }
-        }
 
-        TideMatchSet matches(&match_arr, highest_mz);
+          TideMatchSet matches(&match_arr, highest_mz);
 
-        matches.exact_pval_search_ = exact_pval_search;
-        matches.cur_score_function_ = curScoreFunction;
+          matches.exact_pval_search_ = exact_pval_search;
+          matches.cur_score_function_ = curScoreFunction;
+          matches.psm_sink_ = my_data->psm_sink;
+          matches.psm_key_ = psmKey(*my_data, sc_pos);
 
-        matches.report(target_file, decoy_file, top_matches, numDecoys, spectrum_filename,
-                       spectrum, charge, active_peptide_queue, proteins,
-                       locations, compute_sp, true, locks_array[LOCK_RESULTS]);
+          matches.report(target_file, decoy_file, top_matches, numDecoys, spectrum_filename,
+                         spectrum, charge, active_peptide_queue, proteins,
+                         compute_sp, true);
 					   
-      }  //end peptide_centric == false
-    } else { //This runs curScoreFunction=BOTH_SCORE, curScoreFunction=RESIUDUE_EVIDENCE_MATRIX, and xcorr p-val
+        }  //end peptide_centric == false
+      } else { //This runs curScoreFunction=BOTH_SCORE, curScoreFunction=RESIUDUE_EVIDENCE_MATRIX, and xcorr p-val
 
-      int nCandPeptide = active_peptide_queue->SetActiveRangeBIons(min_mass, max_mass, min_range, max_range, candidatePeptideStatus);
-      int candidatePeptideStatusSize = candidatePeptideStatus->size();
-      if (nCandPeptide == 0) {
-        continue;
-      }
+        int nCandPeptide = active_peptide_queue->SetActiveRangeBIons(min_mass, max_mass, min_range, max_range, candidatePeptideStatus);
+        int candidatePeptideStatusSize = candidatePeptideStatus->size();
+        if (nCandPeptide == 0) {
+          continue;
+        }
 
-      locks_array[LOCK_CANDIDATES]->lock();
-      *total_candidate_peptides += (long)nCandPeptide;
-      locks_array[LOCK_CANDIDATES]->unlock();
+        counters->Add(thread_num, SearchCounters::CANDIDATES, nCandPeptide);
 
-      //TODO so this includes ALL amino acids seen (including modified, NTerm mod, CTerm Mod)
-      //as a result -- we will look for NTerm mod amino acids throughout spectrum instead of
-      //just amino acids without NTerm mod
-      if ( aaMassDouble.size() == 0)
-        carp(CARP_FATAL, "No amino acids were counted.\n");
+        //TODO so this includes ALL amino acids seen (including modified, NTerm mod, CTerm Mod)
+        //as a result -- we will look for NTerm mod amino acids throughout spectrum instead of
+        //just amino acids without NTerm mod
+        if ( aaMassDouble.size() == 0)
+          carp(CARP_FATAL, "No amino acids were counted.\n");
       
-      vector<int> aaMassInt;
-      for (int i = 0; i < aaMassDouble.size(); i++) {
-        int tmpMass = MassConstants::mass2bin(aaMassDouble[i]);
-        aaMassInt.push_back(tmpMass);
-      }
-      int maxPrecurMassBin = floor(MaxBin::Global().CacheBinEnd() + 50.0);
-      double fragTol = Params::GetDouble("fragment-tolerance");
-      int granularityScale = Params::GetInt("evidence-granularity");
-
-      //TODO look at this
-      int minDeltaMass;
-      int maxDeltaMass;
-      minDeltaMass = aaMassInt[0];
-      maxDeltaMass = aaMassInt[nAARes - 1];
-
-      TideMatchSet::Arr match_arr(nCandPeptide); // scored peptides will go here.
-
-      // iterators needed at multiple places in following code
-      deque<Peptide*>::const_iterator iter_ = active_peptide_queue->iter_;
-      deque<TheoreticalPeakSetBIons>::const_iterator iter1_ = active_peptide_queue->iter1_;
-
-      //************************************************************************
-      /* For one observed spectrum, calculates:
-       *  - vector of cleavage evidence
-       *  - score count vectors for a range of integer masses
-       *  - p-values of XCorr match scores between spectrum and all selected candidate target and decoy peptides
-       * Written by Jeff Howbert, October 2013.
-       * Ported to and integrated with Tide by Jeff Howbert, November 2013.
-       *
-       * In addition calculates:
-       *   - a residue evidence matrix for a range of int masses
-       *   - score count vectors for range of int masses (using res-ev matrix)
-       *   - p-values of residue-evidence match between spectrum and all selected target and decoy peptides
-       * Written by Jeff Howbert
-       * Ported to and integrated with Tide by Andy Lin, Nov 2016
-       */
-      int peidx, pe, ma;
-      vector<int> pepMassInt;
-      pepMassInt.reserve(nCandPeptide);
-      vector<int> pepMassIntUnique;
-      pepMassIntUnique.reserve(nCandPeptide);
-
-      //For each candidate peptide, determine which discretized mass bin it is in
-      //pepMassInt contains the corresponding mass bin for each candidate peptide
-      //pepMassIntUnique contains the unique set of mass bins that candidate peptides fall in
-      getMassBin(pepMassInt, pepMassIntUnique, active_peptide_queue, candidatePeptideStatus);
-      int nPepMassIntUniq = (int)pepMassIntUnique.size();
-
-      //XCORR
-      vector< vector<int> > evidenceObs(nPepMassIntUniq, vector<int>(maxPrecurMassBin, 0));
-      int* scoreOffsetObs = new int[nPepMassIntUniq];
-      double** pValueScoreObs = new double*[nPepMassIntUniq];
-      int* intensArrayTheor = new int[maxPrecurMassBin]; // initialized later in loop
-      //END XCORR
-
-      //RES-EV
-      //Creates a 3D vector representing 3D matrix
-      //nPepMassIntUniq: number of mass bins candidate are in
-      //nAARes: number of amino acids
-      //maxPrecurMassBin: max number of mass bins
-      vector<vector<vector<double> > > residueEvidenceMatrix(nPepMassIntUniq,
-         vector<vector<double> >(nAARes, vector<double>(maxPrecurMassBin, 0)));
-
-      //Stores the score offset needed calculating res-ev p-values
-      vector<int> scoreResidueOffsetObs(maxPrecurMassBin, -1);
-
-      //For each mass bin, a vector hold the p-values for each corresponding res-ev score
-      vector<vector<double> > pValuesResidueObs(maxPrecurMassBin);
-
-      //TODO assumption is that there is one nterm mod per peptide
-      int nTermMassBin;
-      double nTermMass;
-      if (nterm_mod_table.static_mod_size() > 0) {
-        nTermMassBin = MassConstants::mass2bin(
-                         MassConstants::mono_h + nterm_mod_table.static_mod(0).delta());
-        nTermMass = MassConstants::mono_h + nterm_mod_table.static_mod(0).delta();
-      } else {
-        nTermMassBin = MassConstants::mass2bin(MassConstants::mono_h);
-        nTermMass = MassConstants::mono_h;
-      }
+        vector<int> aaMassInt;
+        for (int i = 0; i < aaMassDouble.size(); i++) {
+          int tmpMass = MassConstants::mass2bin(aaMassDouble[i]);
+          aaMassInt.push_back(tmpMass);
+        }
+        int maxPrecurMassBin = floor(MaxBin::Global().CacheBinEnd() + 50.0);
+        double fragTol = GlobalParams::getFragmentTolerance();
+        int granularityScale = GlobalParams::getEvidenceGranularity();
 
-      //TODO assumption is that there is one cterm mod per peptide
-      int cTermMassBin;
-      double cTermMass;
-      if (cterm_mod_table.static_mod_size() > 0) {
-        cTermMassBin = MassConstants::mass2bin(MassConstants::mono_oh + cterm_mod_table.static_mod(0).delta());
-        cTermMass = MassConstants::mono_oh + cterm_mod_table.static_mod(0).delta();
-      } else {
-        cTermMassBin = MassConstants::mass2bin(MassConstants::mono_oh);
-        cTermMass = MassConstants::mono_oh;
-      }
+        //TODO look at this
+        int minDeltaMass;
+        int maxDeltaMass;
+        minDeltaMass = aaMassInt[0];
+        maxDeltaMass = aaMassInt[nAARes - 1];
+
+        TideMatchSet::Arr match_arr(nCandPeptide); // scored peptides will go here.
 
-      map<int, bool> calcDPMatrix; //for each precursor mass bin, bool determines whether to calc DP matrix
-      //END RES-EV
+        // iterators needed at multiple places in following code
+        deque<Peptide*>::const_iterator iter_ = active_peptide_queue->iter_;
+        deque<TheoreticalPeakSetBIons>::const_iterator iter1_ = active_peptide_queue->iter1_;
+
+        //************************************************************************
+        /* For one observed spectrum, calculates:
+         *  - vector of cleavage evidence
+         *  - score count vectors for a range of integer masses
+         *  - p-values of XCorr match scores between spectrum and all selected candidate target and decoy peptides
+         * Written by Jeff Howbert, October 2013.
+         * Ported to and integrated with Tide by Jeff Howbert, November 2013.
+         *
+         * In addition calculates:
+         *   - a residue evidence matrix for a range of int masses
+         *   - score count vectors for range of int masses (using res-ev matrix)
+         *   - p-values of residue-evidence match between spectrum and all selected target and decoy peptides
+         * Written by Jeff Howbert
+         * Ported to and integrated with Tide by Andy Lin, Nov 2016
+         */
+        int peidx, pe, ma;
+        vector<int> pepMassInt;
+        pepMassInt.reserve(nCandPeptide);
+        vector<int> pepMassIntUnique;
+        pepMassIntUnique.reserve(nCandPeptide);
+
+        //For each candidate peptide, determine which discretized mass bin it is in
+        //pepMassInt contains the corresponding mass bin for each candidate peptide
+        //pepMassIntUnique contains the unique set of mass bins that candidate peptides fall in
+        getMassBin(pepMassInt, pepMassIntUnique, active_peptide_queue, candidatePeptideStatus);
+        int nPepMassIntUniq = (int)pepMassIntUnique.size();
 
-      //Create a residue evidence matrix and evidence vector
-      //for each mass bin candidate peptides are in
-      for (pe = 0; pe < nPepMassIntUniq; pe++) {
         //XCORR
+        //evidenceObs and pValueScoreObs point into the memo of the mass bins
+        int** evidenceObs = scratch.New<int*>(nPepMassIntUniq);
+        int* scoreOffsetObs = scratch.New<int>(nPepMassIntUniq);
+        double** pValueScoreObs = scratch.New<double*>(nPepMassIntUniq);
+        ScoreCountCache::MassBin** memoBins = scratch.New<ScoreCountCache::MassBin*>(nPepMassIntUniq);
+        ScoreCountCache::Entry* memo = NULL;
         if (curScoreFunction != RESIDUE_EVIDENCE_MATRIX) {
-          scoreOffsetObs[pe] = 0;
-          int pepMaInt = pepMassIntUnique[pe]; // TODO should be accessed with an iterator
-
-          //preprocess to create one integerized evidence vector for each cluster of masses among selected peptides
-          double pepMassMonoMean = (pepMaInt - 0.5 + bin_offset_) * bin_width_;
-          evidenceObs[pe] = spectrum->CreateEvidenceVectorDiscretized(
-            bin_width, bin_offset, charge, pepMassMonoMean, maxPrecurMassBin,
-            &num_range_skipped, &num_precursors_skipped, &num_isotopes_skipped, &num_retained);
+          // The observed intensities are the same for all mass bins.
+          if (score_counts.Select(spectrum, charge)) {
+            counters->Add(thread_num, SearchCounters::INTENSITY_HITS, 1);
+          } else {
+            counters->Add(thread_num, SearchCounters::INTENSITY_MISSES, 1);
+          }
+          memo = &score_counts.Current();
+          if (memo->intensities.empty()) {
+            memo->intensities = spectrum->CreateObservedIntensities(
+              charge, maxPrecurMassBin, &memo->num_range_skipped, &memo->num_precursors_skipped,
+              &memo->num_isotopes_skipped, &memo->num_retained);
+          }
         }
         //END XCORR
 
         //RES-EV
+        //A 3D vector representing 3D matrix, zeroed here for reuse
+        //nPepMassIntUniq: number of mass bins candidate are in
+        //nAARes: number of amino acids
+        //maxPrecurMassBin: max number of mass bins
         if (curScoreFunction != XCORR_SCORE) {
-          // note: aaMassDouble differs from aaMass
-          // aaMassDouble contains amino acids masses in float form
-          // aaMass contains amino acid asses in integer form
-          // precursorMass is the neutral mass
-          observed.CreateResidueEvidenceMatrix(*spectrum, charge, maxPrecurMassBin, precursorMass,
-                                               nAARes, aaMassDouble, fragTol, granularityScale,
-                                               nTermMass, cTermMass, &num_range_skipped, 
-                                               &num_precursors_skipped, &num_isotopes_skipped, &num_retained,
-                                               residueEvidenceMatrix[pe]);
-          vector<vector<double> > curResidueEvidenceMatrix = residueEvidenceMatrix[pe];
-
-          //Get rid of values larger than curPepMassInt
-          int curPepMassInt = pepMassIntUnique[pe];
-          for (int i = 0; i < curResidueEvidenceMatrix.size(); i++) {
-            curResidueEvidenceMatrix[i].resize(curPepMassInt);
+          residueEvidenceMatrix.resize(nPepMassIntUniq);
+          for (pe = 0; pe < nPepMassIntUniq; pe++) {
+            residueEvidenceMatrix[pe].resize(nAARes);
+            for (int aa = 0; aa < nAARes; aa++) {
+              residueEvidenceMatrix[pe][aa].assign(maxPrecurMassBin, 0);
+            }
           }
-          residueEvidenceMatrix[pe] = curResidueEvidenceMatrix;
-          calcDPMatrix[curPepMassInt] = false;
         }
-        //END RES-Ev
-      }
 
-      //Calculates a residue evidence score and a xcorr score
-      //between a spectrum and all possible peptide candidates
-      //based upon the residue evidence matrix and the theoretical spectrum
-      int scoreResidueEvidence;
-      int scoreRefactInt;
-      vector<int> resEvScores;
-      vector<int> xcorrScores; //refactored xcorr scores
-      pe = 0;
-      for (peidx = 0; peidx < candidatePeptideStatusSize; peidx++) {
-        if ((*candidatePeptideStatus)[peidx]) {
-          int pepMassIntIdx = 0;
-          int curPepMassInt;
-          for (ma = 0; ma < nPepMassIntUniq; ma++ ) { //TODO should probably use iterator instead
-            if (pepMassIntUnique[ma] == pepMassInt[pe]) { //TODO pepMassIntUnique should be accessed with an interator
-              pepMassIntIdx = ma;
-              curPepMassInt = pepMassIntUnique[ma];
-              break;
-            }
-          }
+        //Stores the score offset needed calculating res-ev p-values
+        vector<int> scoreResidueOffsetObs(maxPrecurMassBin, -1);
+
+        //For each mass bin, a vector hold the p-values for each corresponding res-ev score
+        vector<vector<double> > pValuesResidueObs(maxPrecurMassBin);
+
+        //TODO assumption is that there is one nterm mod per peptide
+        int nTermMassBin;
+        double nTermMass;
+        if (nterm_mod_table.static_mod_size() > 0) {
+          nTermMassBin = MassConstants::mass2bin(
+                           MassConstants::mono_h + nterm_mod_table.static_mod(0).delta());
+          nTermMass = MassConstants::mono_h + nterm_mod_table.static_mod(0).delta();
+        } else {
+          nTermMassBin = MassConstants::mass2bin(MassConstants::mono_h);
+          nTermMass = MassConstants::mono_h;
+        }
+
+        //TODO assumption is that there is one cterm mod per peptide
+        int cTermMassBin;
+        double cTermMass;
+        if (cterm_mod_table.static_mod_size() > 0) {
+          cTermMassBin = MassConstants::mass2bin(MassConstants::mono_oh + cterm_mod_table.static_mod(0).delta());
+          cTermMass = MassConstants::mono_oh + cterm_mod_table.static_mod(0).delta();
+        } else {
+          cTermMassBin = MassConstants::mass2bin(MassConstants::mono_oh);
+          cTermMass = MassConstants::mono_oh;
+        }
 
+        map<int, bool> calcDPMatrix; //for each precursor mass bin, bool determines whether to calc DP matrix
+        //END RES-EV
+
+        //Create a residue evidence matrix and evidence vector
+        //for each mass bin candidate peptides are in
+        for (pe = 0; pe < nPepMassIntUniq; pe++) {
           //XCORR
-          // score XCorr for target peptide with integerized evidenceObs array
           if (curScoreFunction != RESIDUE_EVIDENCE_MATRIX) {
-            scoreRefactInt = 0;
-            for (vector<unsigned int>::const_iterator iter_uint = iter1_->unordered_peak_list_.begin();
-                 iter_uint != iter1_->unordered_peak_list_.end();
-                 iter_uint++) {
-              scoreRefactInt += evidenceObs[pepMassIntIdx][*iter_uint];
+            scoreOffsetObs[pe] = 0;
+            int pepMaInt = pepMassIntUnique[pe]; // TODO should be accessed with an iterator
+
+            //preprocess to create one integerized evidence vector for each cluster of masses among selected peptides
+            memoBins[pe] = memo->Find(pepMaInt);
+            if (memoBins[pe] == NULL) {
+              double pepMassMonoMean = (pepMaInt - 0.5 + bin_offset_) * bin_width_;
+              memoBins[pe] = &memo->Insert(pepMaInt);
+              memoBins[pe]->evidence = spectrum->CreateEvidenceVectorDiscretized(
+                memo->intensities, bin_width, bin_offset, charge, pepMassMonoMean, maxPrecurMassBin);
             }
-
-            xcorrScores.push_back(scoreRefactInt); //refactored xcorr scores
+            evidenceObs[pe] = &memoBins[pe]->evidence[0];
+            // Peaks are counted once per evidence vector, as they were when
+            // each one was computed from scratch.
+            num_range_skipped += memo->num_range_skipped;
+            num_precursors_skipped += memo->num_precursors_skipped;
+            num_isotopes_skipped += memo->num_isotopes_skipped;
+            num_retained += memo->num_retained;
           }
           //END XCORR
 
           //RES-EV
           if (curScoreFunction != XCORR_SCORE) {
-            vector<vector<double> > curResidueEvidenceMatrix = residueEvidenceMatrix[pepMassIntIdx];
-            Peptide* curPeptide = (*iter_);
-
-            vector<unsigned int> intensArrayTheorResEv;
-            for (vector<unsigned int>::const_iterator iter_uint = iter1_->unordered_peak_list_.begin();
-                 iter_uint != iter1_->unordered_peak_list_.end();
-                 iter_uint++) {
-              intensArrayTheorResEv.push_back(*iter_uint);
+            // note: aaMassDouble differs from aaMass
+            // aaMassDouble contains amino acids masses in float form
+            // aaMass contains amino acid asses in integer form
+            // precursorMass is the neutral mass
+            observed.CreateResidueEvidenceMatrix(*spectrum, charge, maxPrecurMassBin, precursorMass,
+                                                 nAARes, aaMassDouble, fragTol, granularityScale,
+                                                 nTermMass, cTermMass, &num_range_skipped, 
+                                                 &num_precursors_skipped, &num_isotopes_skipped, &num_retained,
+                                                 residueEvidenceMatrix[pe]);
+            vector<vector<double> >& curResidueEvidenceMatrix = residueEvidenceMatrix[pe];
+
+            //Get rid of values larger than curPepMassInt
+            int curPepMassInt = pepMassIntUnique[pe];
+            for (int i = 0; i < curResidueEvidenceMatrix.size(); i++) {
+              curResidueEvidenceMatrix[i].resize(curPepMassInt);
             }
+            calcDPMatrix[curPepMassInt] = false;
+          }
+          //END RES-Ev
+        }
 
-            scoreResidueEvidence = calcResEvScore(curResidueEvidenceMatrix, intensArrayTheorResEv, aaMassDouble, curPeptide);
-            resEvScores.push_back(scoreResidueEvidence);
+        //Calculates a residue evidence score and a xcorr score
+        //between a spectrum and all possible peptide candidates
+        //based upon the residue evidence matrix and the theoretical spectrum
+        int scoreResidueEvidence;
+        int scoreRefactInt;
+        vector<int> resEvScores;
+        vector<int> xcorrScores; //refactored xcorr scores
+        pe = 0;
+        for (peidx = 0; peidx < candidatePeptideStatusSize; peidx++) {
+          if ((*candidatePeptideStatus)[peidx]) {
+            int pepMassIntIdx = 0;
+            int curPepMassInt;
+            for (ma = 0; ma < nPepMassIntUniq; ma++ ) { //TODO should probably use iterator instead
+              if (pepMassIntUnique[ma] == pepMassInt[pe]) { //TODO pepMassIntUnique should be accessed with an interator
+                pepMassIntIdx = ma;
+                curPepMassInt = pepMassIntUnique[ma];
+                break;
+              }
+            }
 
-            if (scoreResidueEvidence > 0) { // if > 0, set bool to true to create DP matrix
-              calcDPMatrix[curPepMassInt] = true;
+            //XCORR
+            // score XCorr for target peptide with integerized evidenceObs array
+            if (curScoreFunction != RESIDUE_EVIDENCE_MATRIX) {
+              scoreRefactInt = 0;
+              for (vector<unsigned int>::const_iterator iter_uint = iter1_->unordered_peak_list_.begin();
+                   iter_uint != iter1_->unordered_peak_list_.end();
+                   iter_uint++) {
+                scoreRefactInt += evidenceObs[pepMassIntIdx][*iter_uint];
+              }
+
+              xcorrScores.push_back(scoreRefactInt); //refactored xcorr scores
+            }
+            //END XCORR
+
+            //RES-EV
+            if (curScoreFunction != XCORR_SCORE) {
+              const vector<vector<double> >& curResidueEvidenceMatrix = residueEvidenceMatrix[pepMassIntIdx];
+              Peptide* curPeptide = (*iter_);
+
+              vector<unsigned int> intensArrayTheorResEv;
+              for (vector<unsigned int>::const_iterator iter_uint = iter1_->unordered_peak_list_.begin();
+                   iter_uint != iter1_->unordered_peak_list_.end();
+                   iter_uint++) {
+                intensArrayTheorResEv.push_back(*iter_uint);
+              }
+
+              scoreResidueEvidence = calcResEvScore(curResidueEvidenceMatrix, intensArrayTheorResEv, aaMassDouble, curPeptide);
+              resEvScores.push_back(scoreResidueEvidence);
+
+              if (scoreResidueEvidence > 0) { // if > 0, set bool to true to create DP matrix
+                calcDPMatrix[curPepMassInt] = true;
+              }
             }
+            //END RES-EV
+            pe++;
           }
-          //END RES-EV
-          pe++;
+          ++iter_;
+          ++iter1_;
         }
-        ++iter_;
-        ++iter1_;
-      }
 
-      if (curScoreFunction == RESIDUE_EVIDENCE_MATRIX || curScoreFunction == BOTH_SCORE) {
-        assert(resEvScores.size() == nCandPeptide);
-      }
-      if (curScoreFunction == XCORR_SCORE || curScoreFunction == BOTH_SCORE) {
-        assert(xcorrScores.size() == nCandPeptide);
-      }
+        if (curScoreFunction == RESIDUE_EVIDENCE_MATRIX || curScoreFunction == BOTH_SCORE) {
+          assert(resEvScores.size() == nCandPeptide);
+        }
+        if (curScoreFunction == XCORR_SCORE || curScoreFunction == BOTH_SCORE) {
+          assert(xcorrScores.size() == nCandPeptide);
+        }
 
-      //XCORR
-      //Create a dynamic programming vector is there is a xcorr
-      //and if user specified as a score function either 'xcorr' or 'both'
+        //XCORR
+        //Create a dynamic programming vector is there is a xcorr
+        //and if user specified as a score function either 'xcorr' or 'both'
 
-      double bestDPPeptideTailor = -1000.0;  // Added by AKF
-      double bestDPPeptideScore = -1000.0;  // Added by AKF
-      string bestDPPeptide = "";  // Added by AKF
+        double bestDPPeptideTailor = -1000.0;  // Added by AKF
+        double bestDPPeptideScore = -1000.0;  // Added by AKF
+        string bestDPPeptide = "";  // Added by AKF
       
-      double* pValueDist = NULL; // Added by AKF 
-      int* nRows = new int[nPepMassIntUniq];  // Added by AKF
-      int max_offset = 0;   // Added by AKF for merging exact score distirbutinos
-      double dTailorQuantile = 1.0; //new double[nPepMassIntUniq]; //Added by AKF
-      double dp_time = 0.0;
-      dp_time = (double)clock();
-      if (curScoreFunction != RESIDUE_EVIDENCE_MATRIX) {
-        int pValueDistLen = 1; // Added by AKF
-        for (pe = 0; pe < nPepMassIntUniq; pe++) { // TODO should probably instead use iterator over pepMassIntUnique
-          int pepMaInt = pepMassIntUnique[pe]; // TODO should be accessed with an iterator
-
-          // NOTE: will have to go back to separate dynamic programming for
-          //       target and decoy if they have different probNI and probC
-          int maxEvidence = *std::max_element(evidenceObs[pe].begin(), evidenceObs[pe].end());
-          int minEvidence = *std::min_element(evidenceObs[pe].begin(), evidenceObs[pe].end());
-
-          // estimate maxScore and minScore
-          int maxNResidue = (int)floor((double)pepMaInt / (double)minDeltaMass);
-          vector<int> sortEvidenceObs(evidenceObs[pe].begin(), evidenceObs[pe].end());
-          std::sort(sortEvidenceObs.begin(), sortEvidenceObs.end(), greater<int>());
-          int maxScore = 0;
-          int minScore = 0;
-          for (int sc = 0; sc < maxNResidue; sc++) {
-            maxScore += sortEvidenceObs[sc];
-          }
+        double* pValueDist = NULL; // Added by AKF 
+        int* nRows = scratch.New<int>(nPepMassIntUniq);  // Added by AKF
+        int max_offset = 0;   // Added by AKF for merging exact score distirbutinos
+        double dTailorQuantile = 1.0; //new double[nPepMassIntUniq]; //Added by AKF
+        double dp_time = 0.0;
+        dp_time = (double)clock();
+        if (curScoreFunction != RESIDUE_EVIDENCE_MATRIX) {
+          int pValueDistLen = 1; // Added by AKF
+          for (pe = 0; pe < nPepMassIntUniq; pe++) { // TODO should probably instead use iterator over pepMassIntUnique
+            int pepMaInt = pepMassIntUnique[pe]; // TODO should be accessed with an iterator
+
+            // Score counts of a mass bin already computed for this spectrum
+            // and fragment charge are used again.
+            ScoreCountCache::MassBin* memoBin = memoBins[pe];
+            if (!memoBin->counts.empty()) {
+              counters->Add(thread_num, SearchCounters::SCORE_COUNT_HITS, 1);
+              nRows[pe] = (int)memoBin->counts.size();
+              pValueScoreObs[pe] = &memoBin->counts[0];
+              scoreOffsetObs[pe] = memoBin->offset;
+              if (nRows[pe] > pValueDistLen) {
+                pValueDistLen = nRows[pe];
+              }
+              continue;
+            }
+            counters->Add(thread_num, SearchCounters::SCORE_COUNT_MISSES, 1);
+
+            // NOTE: will have to go back to separate dynamic programming for
+            //       target and decoy if they have different probNI and probC
+            int maxEvidence = *std::max_element(evidenceObs[pe], evidenceObs[pe] + maxPrecurMassBin);
+            int minEvidence = *std::min_element(evidenceObs[pe], evidenceObs[pe] + maxPrecurMassBin);
+
+            // estimate maxScore and minScore
+            int maxNResidue = (int)floor((double)pepMaInt / (double)minDeltaMass);
+            vector<int> sortEvidenceObs(evidenceObs[pe], evidenceObs[pe] + maxPrecurMassBin);
+            std::sort(sortEvidenceObs.begin(), sortEvidenceObs.end(), greater<int>());
+            int maxScore = 0;
+            int minScore = 0;
+            for (int sc = 0; sc < maxNResidue; sc++) {
+              maxScore += sortEvidenceObs[sc];
+            }
 
-          for (int sc = maxPrecurMassBin - maxNResidue; sc < maxPrecurMassBin; sc++) {
-            minScore += sortEvidenceObs[sc];
-          }
+            for (int sc = maxPrecurMassBin - maxNResidue; sc < maxPrecurMassBin; sc++) {
+              minScore += sortEvidenceObs[sc];
+            }
 
-          int bottomRowBuffer = maxEvidence + 1;
-          int topRowBuffer = -minEvidence;
-          int nRowDynProg = bottomRowBuffer - minScore + 1 + maxScore + topRowBuffer;
-          pValueScoreObs[pe] = new double[nRowDynProg];
-          memset(pValueScoreObs[pe], 0.0, sizeof(double)*nRowDynProg);		  
+            int bottomRowBuffer = maxEvidence + 1;
+            int topRowBuffer = -minEvidence;
+            int nRowDynProg = bottomRowBuffer - minScore + 1 + maxScore + topRowBuffer;
+            pValueScoreObs[pe] = scratch.NewZeroed<double>(nRowDynProg);
           
-          if (nRowDynProg > pValueDistLen) {
-              pValueDistLen = nRowDynProg;              
-          }
-          nRows[pe] = nRowDynProg; //Added by AKF          
-
-          double pepMassDouble = ((double)pepMaInt - 0.5 + bin_offset) * bin_width;
-          if (bin_width > BIN_WIDTH_TH){
-            scoreOffsetObs[pe] = calcScoreCount(maxPrecurMassBin, &evidenceObs[pe][0], pepMaInt,
-                                   maxEvidence, minEvidence, maxScore, minScore,
-                                   nAARes, dAAFreqN, dAAFreqI, dAAFreqC, aaMassInt,
-                                   pValueScoreObs[pe]);
+            if (nRowDynProg > pValueDistLen) {
+                pValueDistLen = nRowDynProg;              
+            }
+            nRows[pe] = nRowDynProg; //Added by AKF          
+
+            double pepMassDouble = ((double)pepMaInt - 0.5 + bin_offset) * bin_width;
+            if (bin_width > BIN_WIDTH_TH){
+              scoreOffsetObs[pe] = calcScoreCount(maxPrecurMassBin, evidenceObs[pe], pepMaInt,
+                                     maxEvidence, minEvidence, maxScore, minScore,
+                                     nAARes, dAAFreqN, dAAFreqI, dAAFreqC, aaMassInt,
+                                     pValueScoreObs[pe], &scratch);
                                     
-          } else {
-            vector< pair <int,int> > vBacktracking;
-            scoreOffsetObs[pe] = calcScoreCountHighRes(maxPrecurMassBin, &evidenceObs[pe][0], pepMaInt, pepMassDouble,
-                                   maxEvidence, minEvidence, maxScore, minScore, fragmentIonMassRoundingPrecision, bin_width, bin_offset,
-                                   nAARes, dAAFreqN, dAAFreqI, dAAFreqC, aaMassDouble, &vBacktracking,
-                                   pValueScoreObs[pe]);
+            } else {
+              vector< pair <int,int> > vBacktracking;
+              scoreOffsetObs[pe] = calcScoreCountHighRes(maxPrecurMassBin, evidenceObs[pe], pepMaInt, pepMassDouble,
+                                     maxEvidence, minEvidence, maxScore, minScore, fragmentIonMassRoundingPrecision, bin_width, bin_offset,
+                                     nAARes, dAAFreqN, dAAFreqI, dAAFreqC, aaMassDouble, &vBacktracking,
+                                     pValueScoreObs[pe]);
                                    
-            if (Params::GetBool("seva") && !vBacktracking.empty()){
+              if (GlobalParams::getSeva() && !vBacktracking.empty()){
                 
-              vector< pair <int,int> >::iterator itrBackTrack;
-//              printf("getting the DP peptide Seq\n");
-
-              // Retrieve the DP peptide sequence from the backtracking path
-              int newCol, newRow, AAEvidence, diff, tempAAMass;
-              int iMinDiff;
-              string sDPPeptide = "";
-              string tempAA;
-
-              itrBackTrack = vBacktracking.begin();     
-              int row = itrBackTrack->first;
-              int col = itrBackTrack->second;
-              double aa_mass;
-              double DPPeptideScore = ((row - scoreOffsetObs[pe]) / RESCALE_FACTOR );
-
-              if (DPPeptideScore > bestDPPeptideScore){
+                vector< pair <int,int> >::iterator itrBackTrack;
+  //              printf("getting the DP peptide Seq\n");
+
+                // Retrieve the DP peptide sequence from the backtracking path
+                int newCol, newRow, AAEvidence, diff, tempAAMass;
+                int iMinDiff;
+                string sDPPeptide = "";
+                string tempAA;
+
+                itrBackTrack = vBacktracking.begin();     
+                int row = itrBackTrack->first;
+                int col = itrBackTrack->second;
+                double aa_mass;
+                double DPPeptideScore = ((row - scoreOffsetObs[pe]) / RESCALE_FACTOR );
+
+                if (DPPeptideScore > bestDPPeptideScore){
                              
-                  for (++itrBackTrack; itrBackTrack != vBacktracking.end(); ++itrBackTrack){
-                    newRow = itrBackTrack->first;
-                    newCol = itrBackTrack->second;
-                    AAEvidence = col - newCol;    
-//                    printf("%d,%d, %d\n",newCol, newRow, AAEvidence);
-                    iMinDiff = maxPrecurMassBin;                    
-                    for(std::map<double, std::string>::iterator iter = mMass2AA.begin(); iter != mMass2AA.end(); ++iter) {
-                      aa_mass = iter->first;
-                      tempAAMass = floor(aa_mass/bin_width+0.5);
-                      diff = abs(AAEvidence - tempAAMass);
+                    for (++itrBackTrack; itrBackTrack != vBacktracking.end(); ++itrBackTrack){
+                      newRow = itrBackTrack->first;
+                      newCol = itrBackTrack->second;
+                      AAEvidence = col - newCol;    
+  //                    printf("%d,%d, %d\n",newCol, newRow, AAEvidence);
+                      iMinDiff = maxPrecurMassBin;                    
+                      for(std::map<double, std::string>::iterator iter = mMass2AA.begin(); iter != mMass2AA.end(); ++iter) {
+                        aa_mass = iter->first;
+                        tempAAMass = floor(aa_mass/bin_width+0.5);
+                        diff = abs(AAEvidence - tempAAMass);
                         
-                      if (diff < iMinDiff ){
-                        iMinDiff = diff;
-                        tempAA = iter->second;
+                        if (diff < iMinDiff ){
+                          iMinDiff = diff;
+                          tempAA = iter->second;
+                        }
+  //                      printf("in loop: %lf, %d, %d, %s, %d\n", aa_mass, tempAAMass, iMinDiff, tempAA.c_str(), diff);
                       }
-//                      printf("in loop: %lf, %d, %d, %s, %d\n", aa_mass, tempAAMass, iMinDiff, tempAA.c_str(), diff);
+                      sDPPeptide = tempAA + sDPPeptide;
+                      col = newCol;
+                      row = newRow;
+  //                  printf("%s\n",sDPPeptide.c_str());
                     }
-                    sDPPeptide = tempAA + sDPPeptide;
-                    col = newCol;
-                    row = newRow;
-//                  printf("%s\n",sDPPeptide.c_str());
-                  }
-//                  printf("%s\n", sDPPeptide.c_str());
-//                  bestDPPeptideTailor = 1.0;
-                  bestDPPeptideScore = DPPeptideScore; //, DPPeptideTailor*dTailorQuantile[pe] - TAILOR_OFFSET;
-                  bestDPPeptide = sDPPeptide;
-              }           
+  //                  printf("%s\n", sDPPeptide.c_str());
+  //                  bestDPPeptideTailor = 1.0;
+                    bestDPPeptideScore = DPPeptideScore; //, DPPeptideTailor*dTailorQuantile[pe] - TAILOR_OFFSET;
+                    bestDPPeptide = sDPPeptide;
+                }           
+              }
+            }                               
+            // With SEVA the dynamic programming also finds the best scoring
+            // sequence for the spectrum-charge, so it has to run every time.
+            if (bin_width > BIN_WIDTH_TH || !GlobalParams::getSeva()) {
+              memoBin->counts.assign(pValueScoreObs[pe], pValueScoreObs[pe] + nRowDynProg);
+              memoBin->offset = scoreOffsetObs[pe];
             }
-          }                               
-        }
-        // Merge separate score distirbutions. The following lines added by AKF
-        for (pe = 0; pe < nPepMassIntUniq; ++pe) {
-          if (max_offset < scoreOffsetObs[pe] ) {
-            max_offset = scoreOffsetObs[pe];
           }
-        }
-        int row;
-        int score_idx;        
-        pValueDistLen += 1;
-        pValueDist = new double[pValueDistLen*2];
-        double *scoreCountBinAdjust = new double[pValueDistLen*2];
-        memset(pValueDist, 0.0, sizeof(double)*pValueDistLen*2);
-        memset(scoreCountBinAdjust, 0.0, sizeof(double)*pValueDistLen*2);
+          // Merge separate score distirbutions. The following lines added by AKF
+          for (pe = 0; pe < nPepMassIntUniq; ++pe) {
+            if (max_offset < scoreOffsetObs[pe] ) {
+              max_offset = scoreOffsetObs[pe];
+            }
+          }
+          int row;
+          int score_idx;        
+          pValueDistLen += 1;
+          pValueDist = scratch.NewZeroed<double>(pValueDistLen*2);
+          double *scoreCountBinAdjust = scratch.NewZeroed<double>(pValueDistLen*2);
         
-        // Merges the separated partial score histograms.
-        double totalCount = 0.0;
-        for (pe = 0 ; pe < nPepMassIntUniq; ++pe) {
-          int offset_diff = max_offset - scoreOffsetObs[pe];
-          for (score_idx = 0; score_idx < nRows[pe]; ++score_idx) {
-            pValueDist[score_idx + offset_diff] += pValueScoreObs[pe][score_idx];
-            totalCount += pValueScoreObs[pe][score_idx];
+          // Merges the separated partial score histograms.
+          double totalCount = 0.0;
+          for (pe = 0 ; pe < nPepMassIntUniq; ++pe) {
+            int offset_diff = max_offset - scoreOffsetObs[pe];
+            for (score_idx = 0; score_idx < nRows[pe]; ++score_idx) {
+              pValueDist[score_idx + offset_diff] += pValueScoreObs[pe][score_idx];
+              totalCount += pValueScoreObs[pe][score_idx];
+            }
           }
-        }
 
-        if (totalCount == 0.0) {
-          for (score_idx = 0; score_idx < pValueDistLen*2; score_idx++) {
-            pValueDist[score_idx] = 1.0;
-          }
-        } else {      
-          // Normalize the raw score histogram to get a probabilisitc distribution
-          double logTotalCount = log(totalCount);
-          for (score_idx = pValueDistLen*2-2; score_idx >= 0; --score_idx) {
-            scoreCountBinAdjust[score_idx] = pValueDist[score_idx]/2.0;
-            pValueDist[score_idx] += pValueDist[score_idx + 1];
-          }
-          for (score_idx = pValueDistLen*2-2; score_idx >= 0; --score_idx) {
-            pValueDist[score_idx] -= scoreCountBinAdjust[score_idx];
-          }
-          // normalize distribution; use exp( log ) to avoid potential underflow
-          for (score_idx = pValueDistLen*2-2; score_idx >= 0; --score_idx) {
-            if (pValueDist[score_idx] > 0.0) {
-              pValueDist[score_idx] = exp(log(pValueDist[score_idx]) - logTotalCount);
+          if (totalCount == 0.0) {
+            for (score_idx = 0; score_idx < pValueDistLen*2; score_idx++) {
+              pValueDist[score_idx] = 1.0;
+            }
+          } else {      
+            // Normalize the raw score histogram to get a probabilisitc distribution
+            double logTotalCount = log(totalCount);
+            for (score_idx = pValueDistLen*2-2; score_idx >= 0; --score_idx) {
+              scoreCountBinAdjust[score_idx] = pValueDist[score_idx]/2.0;
+              pValueDist[score_idx] += pValueDist[score_idx + 1];
+            }
+            for (score_idx = pValueDistLen*2-2; score_idx >= 0; --score_idx) {
+              pValueDist[score_idx] -= scoreCountBinAdjust[score_idx];
+            }
+            // normalize distribution; use exp( log ) to avoid potential underflow
+            for (score_idx = pValueDistLen*2-2; score_idx >= 0; --score_idx) {
+              if (pValueDist[score_idx] > 0.0) {
+                pValueDist[score_idx] = exp(log(pValueDist[score_idx]) - logTotalCount);
+              }
             }
           }
+          // Finished merging score distributions. 
+          // Tailor for XPV; Added by AKF
+          if (GlobalParams::getUseTailorCalibration()){
+            // Collect the scores for the score tail distribution
+            double* scores = scratch.New<double>(xcorrScores.size());
+            int num_scores = 0;
+            for (vector<int>::iterator it = xcorrScores.begin();
+              it != xcorrScores.end();
+              ++it) {
+              scores[num_scores++] = (double)((*it)/ RESCALE_FACTOR);
+            }
+            dTailorQuantile = tailorQuantile(scores, num_scores);
+          }  //End of Tailor
         }
-        delete [] scoreCountBinAdjust;  
-        // Finished merging score distributions. 
-        // Tailor for XPV; Added by AKF
-        if (Params::GetBool("use-tailor-calibration")){
-          vector<double> scores;
-          double quantile_th = TAILOR_QUANTILE_TH;
-          // Collect the scores for the score tail distribution
-          for (vector<int>::iterator it = xcorrScores.begin();
-            it != xcorrScores.end();
-            ++it) {
-            scores.push_back((double)((*it)/ RESCALE_FACTOR));
-          }
-          sort(scores.begin(), scores.end(), greater<double>());  //sort in decreasing order
-          int quantile_pos = (int)(quantile_th*(double)scores.size()+0.5);
+        //END XCORR
+        dp_time = (double)(clock() - dp_time)/CLOCKS_PER_SEC; 
 
-          if (quantile_pos < 3)
-            quantile_pos = 3;
-          if (quantile_pos >= scores.size()) 
-            quantile_pos = scores.size()-1;        
-        
-          dTailorQuantile = scores[quantile_pos]+TAILOR_OFFSET; // Make sure scores positive
-        }  //End of Tailor
-      }
-      //END XCORR
-      dp_time = (double)(clock() - dp_time)/CLOCKS_PER_SEC; 
-
-      //RES-EV
-      //Create dyanamic programming matrix if there is a res-ev score greater than 0
-      //and if user specified as a score function either 'residue-evidence matrix' or 'both'
-      if (curScoreFunction != XCORR_SCORE) {
-        for (pe=0 ; pe < nPepMassIntUniq ; pe++) {
-          int curPepMassInt = pepMassIntUnique[pe];
-          if (calcDPMatrix[curPepMassInt] == false) {
-            continue;
-          }
+        //RES-EV
+        //Create dyanamic programming matrix if there is a res-ev score greater than 0
+        //and if user specified as a score function either 'residue-evidence matrix' or 'both'
+        if (curScoreFunction != XCORR_SCORE) {
+          for (pe=0 ; pe < nPepMassIntUniq ; pe++) {
+            int curPepMassInt = pepMassIntUnique[pe];
+            if (calcDPMatrix[curPepMassInt] == false) {
+              continue;
+            }
 
-          vector<vector<double> > curResidueEvidenceMatrix = residueEvidenceMatrix[pe];
-          vector<int> maxColEvidence(curPepMassInt, 0);
+            vector<vector<double> >& curResidueEvidenceMatrix = residueEvidenceMatrix[pe];
+            vector<int> maxColEvidence(curPepMassInt, 0);
 
-          //maxColEvidence is edited by reference
-          int maxEvidence = getMaxColEvidence(curResidueEvidenceMatrix, maxColEvidence, curPepMassInt);
-          int maxNResidue = floor((double)curPepMassInt / 57.0);
+            //maxColEvidence is edited by reference
+            int maxEvidence = getMaxColEvidence(curResidueEvidenceMatrix, maxColEvidence, curPepMassInt);
+            int maxNResidue = floor((double)curPepMassInt / 57.0);
 
-          std::sort(maxColEvidence.begin(), maxColEvidence.end(), greater<int>());
-          int maxScore = 0;
-          for(int i = 0; i < maxNResidue; i++) { //maxColEvidence has been sorted
-            maxScore += maxColEvidence[i];
-          }
+            std::sort(maxColEvidence.begin(), maxColEvidence.end(), greater<int>());
+            int maxScore = 0;
+            for(int i = 0; i < maxNResidue; i++) { //maxColEvidence has been sorted
+              maxScore += maxColEvidence[i];
+            }
 
-          int scoreOffset;
-          vector<double> scoreResidueCount;
+            int scoreOffset;
+            vector<double> scoreResidueCount;
 
-          calcResidueScoreCount(nAARes, curPepMassInt, curResidueEvidenceMatrix, aaMassInt,
-                                dAAFreqN, dAAFreqI, dAAFreqC, nTermMassBin, cTermMassBin,
-                                minDeltaMass, maxDeltaMass, maxEvidence, maxScore,
-                                scoreResidueCount, scoreOffset);
-          scoreResidueOffsetObs[curPepMassInt] = scoreOffset;
+            calcResidueScoreCount(nAARes, curPepMassInt, curResidueEvidenceMatrix, aaMassInt,
+                                  dAAFreqN, dAAFreqI, dAAFreqC, nTermMassBin, cTermMassBin,
+                                  minDeltaMass, maxDeltaMass, maxEvidence, maxScore,
+                                  scoreResidueCount, scoreOffset, &scratch);
+            scoreResidueOffsetObs[curPepMassInt] = scoreOffset;
 
-          double totalCount = 0;
-          for (int i=scoreOffset ; i < scoreResidueCount.size() ; i++) {
-            totalCount += scoreResidueCount[i];
-          }
-          for (int i=scoreResidueCount.size()-2 ; i > -1; i--) {
-            scoreResidueCount[i] = scoreResidueCount[i] + scoreResidueCount[i+1];
-          }
-          for (int i = 0; i < scoreResidueCount.size(); i++) {
-            //Avoid potential underflow
-            scoreResidueCount[i] = exp(log(scoreResidueCount[i]) - log(totalCount));
+            double totalCount = 0;
+            for (int i=scoreOffset ; i < scoreResidueCount.size() ; i++) {
+              totalCount += scoreResidueCount[i];
+            }
+            for (int i=scoreResidueCount.size()-2 ; i > -1; i--) {
+              scoreResidueCount[i] = scoreResidueCount[i] + scoreResidueCount[i+1];
+            }
+            for (int i = 0; i < scoreResidueCount.size(); i++) {
+              //Avoid potential underflow
+              scoreResidueCount[i] = exp(log(scoreResidueCount[i]) - log(totalCount));
+            }
+            pValuesResidueObs[curPepMassInt] = scoreResidueCount;
           }
-          pValuesResidueObs[curPepMassInt] = scoreResidueCount;
         }
-      }
-      //END RES-EV
-
-      /************ calculate p-values for PSMs using residue evidence matrix ****************/
-      iter_ = active_peptide_queue->iter_;
-      iter1_ = active_peptide_queue->iter1_;
-      int curPepMassInt;
-      double pValue_xcorr;
-      double pValue_resEv;
-      double pValue_both;
-      pe = 0;
-      for (peidx = 0; peidx < candidatePeptideStatusSize; peidx++) {
-        if ((*candidatePeptideStatus)[peidx]) {
-          int pepMassIntIdx = 0;
-
-          for (ma = 0; ma < nPepMassIntUniq; ma++ ) { //TODO should probably use iterator instead
-            if (pepMassIntUnique[ma] == pepMassInt[pe]) { //TODO pepMassIntUnique should be accessed with an interator
-              pepMassIntIdx = ma;
-              curPepMassInt = pepMassIntUnique[ma];
-              break;
+        //END RES-EV
+
+        /************ calculate p-values for PSMs using residue evidence matrix ****************/
+        iter_ = active_peptide_queue->iter_;
+        iter1_ = active_peptide_queue->iter1_;
+        int curPepMassInt;
+        double pValue_xcorr;
+        double pValue_resEv;
+        double pValue_both;
+        pe = 0;
+        for (peidx = 0; peidx < candidatePeptideStatusSize; peidx++) {
+          if ((*candidatePeptideStatus)[peidx]) {
+            int pepMassIntIdx = 0;
+
+            for (ma = 0; ma < nPepMassIntUniq; ma++ ) { //TODO should probably use iterator instead
+              if (pepMassIntUnique[ma] == pepMassInt[pe]) { //TODO pepMassIntUnique should be accessed with an interator
+                pepMassIntIdx = ma;
+                curPepMassInt = pepMassIntUnique[ma];
+                break;
+              }
             }
-          }
 
-          int scoreCountIdx;
-          //XCORR
-          if (curScoreFunction != RESIDUE_EVIDENCE_MATRIX) {
-            scoreRefactInt = xcorrScores[pe];
-            pValue_xcorr = 0.0;
-            if ((int)(scoreRefactInt) + max_offset > 0) {
-              pValue_xcorr = pValueDist[(int)(scoreRefactInt) + max_offset];
+            int scoreCountIdx;
+            //XCORR
+            if (curScoreFunction != RESIDUE_EVIDENCE_MATRIX) {
+              scoreRefactInt = xcorrScores[pe];
+              pValue_xcorr = 0.0;
+              if ((int)(scoreRefactInt) + max_offset > 0) {
+                pValue_xcorr = pValueDist[(int)(scoreRefactInt) + max_offset];
+              }
+              if (pValue_xcorr == 0.0) {
+                pValue_xcorr = 1.0;
+              }            
             }
-            if (pValue_xcorr == 0.0) {
-              pValue_xcorr = 1.0;
-            }            
-          }
-          //END XCORR
-
-          //RES-EV
-          if (curScoreFunction != XCORR_SCORE) {
-            scoreResidueEvidence = resEvScores[pe];
-            if (calcDPMatrix[curPepMassInt]) {
-              scoreCountIdx = scoreResidueEvidence + scoreResidueOffsetObs[curPepMassInt];
-              pValue_resEv = pValuesResidueObs[curPepMassInt][scoreCountIdx];
-            } else {
-              pValue_resEv = 1.0;
+            //END XCORR
+
+            //RES-EV
+            if (curScoreFunction != XCORR_SCORE) {
+              scoreResidueEvidence = resEvScores[pe];
+              if (calcDPMatrix[curPepMassInt]) {
+                scoreCountIdx = scoreResidueEvidence + scoreResidueOffsetObs[curPepMassInt];
+                pValue_resEv = pValuesResidueObs[curPepMassInt][scoreCountIdx];
+              } else {
+                pValue_resEv = 1.0;
+              }
             }
-          }
-          //END RES-EV
+            //END RES-EV
 
-          //BOTH SCORE
-          if (curScoreFunction == BOTH_SCORE) {
-            double cPval = pValue_xcorr * pValue_resEv;
+            //BOTH SCORE
+            if (curScoreFunction == BOTH_SCORE) {
+              double cPval = pValue_xcorr * pValue_resEv;
 
-            double m = 1.2; // This value has been empircally determined
-            pValue_both = calcCombinedPval(m, cPval, 2); //2 is the # of p-values that are combined
-          }
-          //END BOTH_SCORE
-
-          if (curScoreFunction == XCORR_SCORE && pValue_xcorr == 0.0) {
-//            carp(CARP_FATAL, "PSM p-value should not be equal to 0.0");
-          } else if (curScoreFunction == RESIDUE_EVIDENCE_MATRIX && pValue_resEv == 0.0) {
-            carp(CARP_FATAL, "PSM p-value should not be equal to 0.0");
-          } else if (curScoreFunction == BOTH_SCORE && pValue_both == 0.0) {
-            carp(CARP_FATAL, "PSM p-value should not be equal to 0.0");
-          }
+              double m = 1.2; // This value has been empircally determined
+              pValue_both = calcCombinedPval(m, cPval, 2); //2 is the # of p-values that are combined
+            }
+            //END BOTH_SCORE
+
+            if (curScoreFunction == XCORR_SCORE && pValue_xcorr == 0.0) {
+  //            carp(CARP_FATAL, "PSM p-value should not be equal to 0.0");
+            } else if (curScoreFunction == RESIDUE_EVIDENCE_MATRIX && pValue_resEv == 0.0) {
+              carp(CARP_FATAL, "PSM p-value should not be equal to 0.0");
+            } else if (curScoreFunction == BOTH_SCORE && pValue_both == 0.0) {
+              carp(CARP_FATAL, "PSM p-value should not be equal to 0.0");
+            }
 
-          if (peptide_centric) {
-            carp(CARP_FATAL, "residue-evidence has not been implemented with 'peptide-centric-search T' yet.");
-          } else {
-            TideMatchSet::Scores curScore;
-            curScore.xcorr_score = (double)scoreRefactInt / RESCALE_FACTOR;
-            curScore.xcorr_pval = pValue_xcorr;
-            curScore.resEv_pval = pValue_resEv;
-            curScore.resEv_score = scoreResidueEvidence;
-            curScore.combinedPval = pValue_both;
-            if (Params::GetBool("use-tailor-calibration")) {
-              curScore.tailor = (curScore.xcorr_score + TAILOR_OFFSET)/dTailorQuantile;
-              //curScore.tailor = 1.0;//pValue_refact_xcorr;
-            }            
-            if (Params::GetBool("seva")) {
-                curScore.DPPeptideScore = bestDPPeptideScore;
-                curScore.DPPeptideTailor = (bestDPPeptideScore + TAILOR_OFFSET)/dTailorQuantile;
-                curScore.DPPeptideSeq = bestDPPeptide;
-                curScore.time = dp_time;
-            }            
+            if (peptide_centric) {
+              carp(CARP_FATAL, "residue-evidence has not been implemented with 'peptide-centric-search T' yet.");
+            } else {
+              TideMatchSet::Scores curScore;
+              curScore.xcorr_score = (double)scoreRefactInt / RESCALE_FACTOR;
+              curScore.xcorr_pval = pValue_xcorr;
+              curScore.resEv_pval = pValue_resEv;
+              curScore.resEv_score = scoreResidueEvidence;
+              curScore.combinedPval = pValue_both;
+              if (GlobalParams::getUseTailorCalibration()) {
+                curScore.tailor = (curScore.xcorr_score + TAILOR_OFFSET)/dTailorQuantile;
+                //curScore.tailor = 1.0;//pValue_refact_xcorr;
+              }            
+              if (GlobalParams::getSeva()) {
+                  curScore.DPPeptideScore = bestDPPeptideScore;
+                  curScore.DPPeptideTailor = (bestDPPeptideScore + TAILOR_OFFSET)/dTailorQuantile;
+                  curScore.DPPeptideSeq = bestDPPeptide;
+                  curScore.time = dp_time;
+              }            
             
-            //TODO ugly hack to conform with the way these indices are generated in standard tide-search
-            curScore.rank = candidatePeptideStatusSize - peidx;
-            match_arr.push_back(curScore);
+              //TODO ugly hack to conform with the way these indices are generated in standard tide-search
+              curScore.rank = candidatePeptideStatusSize - peidx;
+              match_arr.push_back(curScore);
+            }
+            pe++;
           }
-          pe++;
-        }
-        ++iter_;
-        ++iter1_;
-      }
-
-      //clean up
-      if (curScoreFunction != RESIDUE_EVIDENCE_MATRIX) {
-        for (pe = 0; pe < nPepMassIntUniq; pe++) {
-          delete [] pValueScoreObs[pe];
+          ++iter_;
+          ++iter1_;
         }
-      }
-      delete [] scoreOffsetObs;
-      delete [] pValueScoreObs;
-      delete [] intensArrayTheor;
-      if (pValueDist != NULL)
-        delete [] pValueDist;
-      delete [] nRows;
-      
 
-      if (!peptide_centric) {
-        // below text is copied from text above in the exact-p-value XCORR case
-        // matches will arrange the results in a heap by score, return the top
-        // few, and recover the association between counter and peptide. We output
-        // the top matches.
-        TideMatchSet matches(&match_arr, highest_mz);
-        matches.exact_pval_search_ = exact_pval_search_;
-        matches.cur_score_function_ = curScoreFunction;
 
-        if (curScoreFunction == RESIDUE_EVIDENCE_MATRIX && exact_pval_search_ == false) {
-          matches.report(target_file, decoy_file, top_matches, numDecoys, spectrum_filename,
-                         spectrum, charge, active_peptide_queue, proteins,
-                         locations, compute_sp, true, locks_array[LOCK_RESULTS]);
-        } else {
-          matches.report(target_file, decoy_file, top_matches, numDecoys, spectrum_filename,
-                         spectrum, charge, active_peptide_queue, proteins,
-                         locations, compute_sp, false, locks_array[LOCK_RESULTS]);
-        }
-      } //end peptide_centric == false
+        if (!peptide_centric) {
+          // below text is copied from text above in the exact-p-value XCORR case
+          // matches will arrange the results in a heap by score, return the top
+          // few, and recover the association between counter and peptide. We output
+          // the top matches.
+          TideMatchSet matches(&match_arr, highest_mz);
+          matches.exact_pval_search_ = exact_pval_search_;
+          matches.cur_score_function_ = curScoreFunction;
+          matches.psm_sink_ = my_data->psm_sink;
+          matches.psm_key_ = psmKey(*my_data, sc_pos);
+
+          if (curScoreFunction == RESIDUE_EVIDENCE_MATRIX && exact_pval_search_ == false) {
+            matches.report(target_file, decoy_file, top_matches, numDecoys, spectrum_filename,
+                           spectrum, charge, active_peptide_queue, proteins,
+                           compute_sp, true);
+          } else {
+            matches.report(target_file, decoy_file, top_matches, numDecoys, spectrum_filename,
+                           spectrum, charge, active_peptide_queue, proteins,
+                           compute_sp, false);
+          }
+        } //end peptide_centric == false
+      }
     }
-    delete min_mass;
-    delete max_mass;
-    delete candidatePeptideStatus;
-  }
 
-  if (!Params::GetBool("skip-preprocessing")) {
-    locks_array[LOCK_REPORTING]->lock();
-    if (curScoreFunction == BOTH_SCORE) {
-      num_precursors_skipped = num_precursors_skipped / 2;
-      num_isotopes_skipped = num_isotopes_skipped / 2;
-      num_range_skipped = num_range_skipped / 2;
-      num_retained = num_retained / 2;
+    // No thread may advance the window while others still search against it.
+    if (peptide_window != NULL) {
+      barrier->wait();
     }
+  }
+  // Times add up over the segments of a spectrum stream.
+  my_data->idle_time += chrono::duration<double>(chrono::steady_clock::now() - search_start).count() -
+                        (my_data->busy_time - busy_start);
+  for (size_t i = 0; i < target_buffers.size(); ++i) {
+    delete target_buffers[i];
+    delete decoy_buffers[i];
+  }
+  for (size_t i = 0; i < tile_observed.size(); ++i) {
+    delete tile_observed[i];
+  }
 
-    long int total_peaks = num_precursors_skipped + num_isotopes_skipped + num_range_skipped + num_retained;
-    if (total_peaks == 0) {
-      carp(CARP_INFO, "[Thread %d]: Warning: no peaks found.", thread_num);
-    } else {
-      carp(CARP_INFO,
-           "[Thread %d]: Deleted %d precursor, %d isotope and %d out-of-range peaks.",
-           thread_num, num_precursors_skipped, num_isotopes_skipped, num_range_skipped);
-    }
-    if (num_retained == 0) {
-      carp(CARP_INFO, "[Thread %d]: Warning: no peaks retained.", thread_num);
-    } else {
-      carp(CARP_INFO, "[Thread %d]: Retained %g%% of peaks.",
-           thread_num, (100.0 * num_retained) / total_peaks);
-    }
-    locks_array[LOCK_REPORTING]->unlock();
+  // BOTH_SCORE preprocesses every spectrum twice.
+  if (curScoreFunction == BOTH_SCORE) {
+    num_precursors_skipped = num_precursors_skipped / 2;
+    num_isotopes_skipped = num_isotopes_skipped / 2;
+    num_range_skipped = num_range_skipped / 2;
+    num_retained = num_retained / 2;
   }
+  counters->Add(thread_num, SearchCounters::PRECURSOR_PEAKS, num_precursors_skipped);
+  counters->Add(thread_num, SearchCounters::ISOTOPE_PEAKS, num_isotopes_skipped);
+  counters->Add(thread_num, SearchCounters::RANGE_PEAKS, num_range_skipped);
+  counters->Add(thread_num, SearchCounters::RETAINED_PEAKS, num_retained);
 }
 
 void TideSearchApplication::search(
-  const string& spectrum_filename,
+  const vector<SearchFile>& files,
   const vector<SpectrumCollection::SpecCharge>* spec_charges,
-  vector<ActivePeptideQueue*> active_peptide_queue,
-  ProteinVec& proteins,
-  vector<const pb::AuxLocation*>& locations,
+  const vector<int>* file_index,
+  SortedSpectrumStream* stream,
+  ActivePeptideQueue* active_peptide_queue,
+  const ProteinStore* proteins,
   double precursor_window,
   WINDOW_TYPE_T window_type,
   double spectrum_min_mz,
@@ -1315,7 +1677,6 @@ void TideSearchApplication::search(
   int min_peaks,
   int search_charge,
   int top_matches,
-  double highest_mz,
   ofstream* target_file,
   ofstream* decoy_file,
   bool compute_sp,
@@ -1339,75 +1700,489 @@ void TideSearchApplication::search(
   int elution_window = Params::GetInt("elution-window-size");
   bool peptide_centric = Params::GetBool("peptide-centric-search");
 
+  // A stream hands out its spectrum-charges in segments, which are searched
+  // in turn. The peptide window only moves forward from one to the next.
+  vector<SpectrumCollection::SpecCharge> segment;
+  if (stream != NULL) {
+    stream->NextSegment(&segment);
+    spec_charges = &segment;
+  }
+  size_t num_spec_charges = stream != NULL ? stream->NumSpecCharges() : spec_charges->size();
+
   // initialize fields required for output
-  int* sc_index = new int(-1);
-  long* total_candidate_peptides = new long(0);
-  FLOAT_T sc_total = (FLOAT_T)spec_charges->size();
+  SearchCounters counters(NUM_THREADS, num_spec_charges,
+                          Params::GetInt("print-search-progress"));
+  FLOAT_T sc_total = (FLOAT_T)num_spec_charges;
 
   if (peptide_centric == false) {
     elution_window = 0;
   }
 
-  for (int i = 0; i < NUM_THREADS; i++) {
-    active_peptide_queue[i]->setElutionWindow(elution_window);
-    active_peptide_queue[i]->setPeptideCentric(peptide_centric);
-  }
-
-  if (elution_window > 0 && elution_window % 2 == 0) {
+  // Every thread selects its candidates from one shared peptide window,
+  // through a view of its own. Peptide-centric search reports peptides as
+  // they leave the window, so it keeps the single-threaded queue.
+  vector<ActivePeptideQueue*> views;
+  ActivePeptideQueue* peptide_window = NULL;
+  if (peptide_centric) {
+    views.push_back(active_peptide_queue);
+  } else {
+    peptide_window = active_peptide_queue;
     for (int i = 0; i < NUM_THREADS; i++) {
-      active_peptide_queue[i]->setElutionWindow(elution_window+1);
+      views.push_back(new ActivePeptideQueue(peptide_window));
     }
   }
 
-  if (!peptide_centric || !exact_pval_search_) {
-    for (int i = 0; i < NUM_THREADS; i++) {
-      active_peptide_queue[i]->setElutionWindow(0);
-    }
+  if (elution_window > 0 && elution_window % 2 == 0) {
+    elution_window++;
   }
-
-  for (int i = 0; i < NUM_THREADS; i++) {
-    active_peptide_queue[i]->SetOutputs(
-      NULL, &locations, top_matches, compute_sp, target_file, decoy_file, highest_mz);
+  if (!peptide_centric || !exact_pval_search_) {
+    elution_window = 0;
   }
+  active_peptide_queue->setElutionWindow(elution_window);
+  active_peptide_queue->setPeptideCentric(peptide_centric);
+  PSMSink::Key psm_key;
+  psm_key.File = psm_file_base_;
+  active_peptide_queue->SetOutputs(
+    psm_sink_, psm_key, top_matches, compute_sp, target_file, decoy_file, files[0].HighestMz);
 
   // Creating structs to hold information required for each thread to search through
   // a spec charge
 
   vector<thread_data> thread_data_array;
   for (int i= 0; i < NUM_THREADS; i++) {
-      thread_data_array.push_back(thread_data(spectrum_filename, spec_charges, active_peptide_queue[i],
-      proteins, locations, precursor_window, window_type, spectrum_min_mz,
+      thread_data_array.push_back(thread_data(files[0].Name, spec_charges, views[i],
+      proteins, precursor_window, window_type, spectrum_min_mz,
       spectrum_max_mz, min_scan, max_scan, min_peaks, search_charge, top_matches,
-      highest_mz, target_file, decoy_file, compute_sp,
+      files[0].HighestMz, target_file, decoy_file, compute_sp,
       i, NUM_THREADS, 
       nAARes, &dAAFreqN, &dAAFreqI, &dAAFreqC, &dAAMass,
       &mod_table, &nterm_mod_table, &cterm_mod_table, numDecoys, locks_array, //TODO do I need to delete pointer somewhere?
-      bin_width_, bin_offset_, exact_pval_search_, spectrum_flag_, sc_index, total_candidate_peptides, negative_isotope_errors));
+      bin_width_, bin_offset_, exact_pval_search_, spectrum_flag_, &counters, negative_isotope_errors));
+  }
+
+  // The chunks are written in spectrum-charge order, whichever threads
+  // searched them. The results for the first spectrum file go straight to
+  // the output files, and those for the others to temporary files, which are
+  // appended in turn once all are done. The output is thus the same as if
+  // the files had been searched one after another.
+  vector<string> part_target_names, part_decoy_names;
+  vector<ofstream*> part_targets, part_decoys;
+  for (size_t i = 1; i < files.size(); i++) {
+    string suffix = ".part" + StringUtils::ToString(i) + ".tmp";
+    part_target_names.push_back(make_file_path("tide-search.target" + suffix));
+    part_decoy_names.push_back(make_file_path("tide-search.decoy" + suffix));
+    part_targets.push_back(new ofstream(part_target_names.back().c_str(), ios::binary));
+    part_decoys.push_back(decoy_file != NULL
+      ? new ofstream(part_decoy_names.back().c_str(), ios::binary) : NULL);
+    if (!part_targets.back()->good() || (part_decoys.back() && !part_decoys.back()->good())) {
+      carp(CARP_FATAL, "Couldn't open file %s for write.", part_target_names.back().c_str());
+    }
+  }
+
+  // The threads are started once and reused for later spectrum files.
+  if (thread_pool_ != NULL && thread_pool_->NumThreads() != NUM_THREADS) {
+    delete thread_pool_;
+    thread_pool_ = NULL;
+  }
+  if (thread_pool_ == NULL) {
+    thread_pool_ = new ThreadPool(NUM_THREADS);
+  }
+
+  size_t segment_num = 0;
+  do {
+    // Split the spectrum-charges into epochs, each searched against one fill
+    // of the peptide window.
+    vector<WindowEpoch> epochs;
+    if (peptide_centric) {
+      epochs.push_back(WindowEpoch(0, spec_charges->size(), 0.0, 0.0));
+    } else {
+      buildWindowEpochs(spec_charges, thread_data_array[0], &epochs);
+    }
+    boost::barrier barrier(NUM_THREADS);
+    ChunkScheduler scheduler(NUM_THREADS);
+    vector<OrderedWriter*> writers;
+    writers.push_back(new OrderedWriter(target_file, decoy_file, 0));
+    for (size_t i = 0; i < part_targets.size(); i++) {
+      writers.push_back(new OrderedWriter(part_targets[i], part_decoys[i], 0));
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+      thread_data_array[i].spec_charges = spec_charges;
+      thread_data_array[i].peptide_window = peptide_window;
+      thread_data_array[i].epochs = &epochs;
+      thread_data_array[i].barrier = &barrier;
+      thread_data_array[i].scheduler = &scheduler;
+      thread_data_array[i].files = &files;
+      thread_data_array[i].file_index = file_index;
+      thread_data_array[i].writers = &writers;
+      thread_data_array[i].psm_sink = psm_sink_;
+      thread_data_array[i].psm_file = psm_file_base_;
+      thread_data_array[i].psm_segment = segment_num;
+    }
+
+    // The search threads read parameters from GlobalParams only.
+    Params::DisallowLookups(true);
+    thread_pool_->Run(boost::bind(&TideSearchApplication::searchThread, this,
+                                  &thread_data_array, boost::placeholders::_1));
+    Params::DisallowLookups(false);
+    for (size_t i = 0; i < writers.size(); i++) {
+      writers[i]->Finish();
+      delete writers[i];
+    }
+    ++segment_num;
+  } while (stream != NULL && stream->NextSegment(&segment));
+  for (size_t i = 0; i < part_targets.size(); i++) {
+    delete part_targets[i];
+    appendAndRemove(part_target_names[i], target_file);
+    if (part_decoys[i] != NULL) {
+      delete part_decoys[i];
+      appendAndRemove(part_decoy_names[i], decoy_file);
+    }
   }
 
-  boost::thread_group threadgroup;
-
-  // Launch threads
-  for (int64_t t = 1; t < NUM_THREADS; t++) {
-    boost::thread * currthread = new boost::thread(boost::bind(&TideSearchApplication::search, this, (void *) &(thread_data_array[t])));
-    threadgroup.add_thread(currthread);
+  for (int i = 0; i < NUM_THREADS; i++) {
+    const thread_data& data = thread_data_array[i];
+    double total_time = data.busy_time + data.idle_time;
+    carp(CARP_INFO, "[Thread %d]: Busy %.2lf s, idle %.2lf s (%.0f%%); "
+         "searched %d chunks, %d of them stolen.",
+         i, data.busy_time, data.idle_time,
+         total_time > 0 ? 100.0 * data.idle_time / total_time : 0.0,
+         data.chunks, data.stolen_chunks);
+    if (GlobalParams::getSkipPreprocessing()) {
+      continue;
+    }
+    long num_precursors_skipped = counters.Get(i, SearchCounters::PRECURSOR_PEAKS);
+    long num_isotopes_skipped = counters.Get(i, SearchCounters::ISOTOPE_PEAKS);
+    long num_range_skipped = counters.Get(i, SearchCounters::RANGE_PEAKS);
+    long num_retained = counters.Get(i, SearchCounters::RETAINED_PEAKS);
+    long total_peaks = num_precursors_skipped + num_isotopes_skipped + num_range_skipped + num_retained;
+    if (total_peaks == 0) {
+      carp(CARP_INFO, "[Thread %d]: Warning: no peaks found.", i);
+    } else {
+      carp(CARP_INFO,
+           "[Thread %d]: Deleted %ld precursor, %ld isotope and %ld out-of-range peaks.",
+           i, num_precursors_skipped, num_isotopes_skipped, num_range_skipped);
+    }
+    if (num_retained == 0) {
+      carp(CARP_INFO, "[Thread %d]: Warning: no peaks retained.", i);
+    } else {
+      carp(CARP_INFO, "[Thread %d]: Retained %g%% of peaks.",
+           i, (100.0 * num_retained) / total_peaks);
+    }
   }
-
-  // Searches through part of the spec charge vector while waiting for threads are busy
-  search( (void *) &(thread_data_array[0]) );
-
-  // Join threads
-  threadgroup.join_all();
-
   carp(CARP_INFO, "Time per spectrum-charge combination: %lf s.", wall_clock() / (1e6*sc_total));
   carp(CARP_INFO, "Average number of candidates per spectrum-charge combination: %lf ",
-                  (*total_candidate_peptides) / sc_total);
+                  counters.Total(SearchCounters::CANDIDATES) / sc_total);
+  long score_count_hits = counters.Total(SearchCounters::SCORE_COUNT_HITS);
+  long score_count_lookups = score_count_hits + counters.Total(SearchCounters::SCORE_COUNT_MISSES);
+  if (score_count_lookups > 0) {
+    long intensity_hits = counters.Total(SearchCounters::INTENSITY_HITS);
+    long intensity_lookups = intensity_hits + counters.Total(SearchCounters::INTENSITY_MISSES);
+    carp(CARP_INFO, "Reused observed intensities for %ld of %ld spectrum-charges (%.1f%%) "
+         "and score counts for %ld of %ld mass bins (%.1f%%).",
+         intensity_hits, intensity_lookups,
+         intensity_lookups > 0 ? 100.0 * intensity_hits / intensity_lookups : 0.0,
+         score_count_hits, score_count_lookups,
+         100.0 * score_count_hits / score_count_lookups);
+  }
+  vector<string> names;
+  for (size_t i = 0; i < files.size(); i++) {
+    names.push_back(files[i].Name);
+  }
+  writeSearchStats(StringUtils::Join(names, ','), thread_data_array, counters);
   for (int i = 0; i < NUMBER_LOCK_TYPES; i++) {
     delete locks_array[i];
   }
-  delete sc_index;
-  delete total_candidate_peptides;
+  if (peptide_window != NULL) {
+    for (int i = 0; i < NUM_THREADS; i++) {
+      delete views[i];
+    }
+  }
+
+}
+
+void TideSearchApplication::searchThread(vector<thread_data>* thread_data_array, int thread_num) {
+  search((void*) &(*thread_data_array)[thread_num]);
+}
+
+/*
+ * Appends the counters of a search to the statistics file, one line per
+ * thread and one for all threads together.
+ */
+void TideSearchApplication::writeSearchStats(
+  const string& spectrum_filename,
+  const vector<thread_data>& thread_data_array,
+  const SearchCounters& counters
+) {
+  if (stats_file_ == NULL) {
+    return;
+  }
+  double seconds = counters.Seconds();
+  for (int i = 0; i <= counters.NumThreads(); i++) {
+    bool all = i == counters.NumThreads();
+    long values[SearchCounters::NUM_COUNTERS];
+    for (int c = 0; c < SearchCounters::NUM_COUNTERS; c++) {
+      values[c] = all ? counters.Total((SearchCounters::Counter)c)
+                      : counters.Get(i, (SearchCounters::Counter)c);
+    }
+    double busy = 0.0, idle = 0.0;
+    int chunks = 0, stolen_chunks = 0;
+    for (int t = all ? 0 : i; t < (all ? counters.NumThreads() : i + 1); t++) {
+      busy += thread_data_array[t].busy_time;
+      idle += thread_data_array[t].idle_time;
+      chunks += thread_data_array[t].chunks;
+      stolen_chunks += thread_data_array[t].stolen_chunks;
+    }
+    *stats_file_ << spectrum_filename << '\t';
+    if (all) {
+      *stats_file_ << "all";
+    } else {
+      *stats_file_ << i;
+    }
+    for (int c = 0; c < SearchCounters::NUM_COUNTERS; c++) {
+      *stats_file_ << '\t' << values[c];
+    }
+    *stats_file_ << '\t' << StringUtils::ToString(busy, 3)
+                 << '\t' << StringUtils::ToString(idle, 3)
+                 << '\t' << chunks
+                 << '\t' << stolen_chunks
+                 << '\t' << StringUtils::ToString(seconds, 3)
+                 << '\t' << StringUtils::ToString(
+                      seconds > 0 ? values[SearchCounters::SPECTRA] / seconds : 0.0, 1)
+                 << endl;
+  }
+}
+
+/*
+ * Moves *pos to the next spectrum-charge for a thread to search, taking a
+ * new chunk from the scheduler once *pos reaches *end. The output buffered
+ * for a finished chunk is passed on to the writer, and progress is reported.
+ * Start with both at 0.
+ * Returns false when the epoch has no work left.
+ */
+bool TideSearchApplication::nextSpecCharge(thread_data* data, size_t* pos, size_t* end) {
+  if (*end > 0 && ++(*pos) < *end) {
+    return true;
+  }
+  chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  if (*end > 0) {
+    data->busy_time += chrono::duration<double>(now - data->chunk_start).count();
+    // Every writer gets a block for every chunk, even if it is empty.
+    for (size_t i = 0; i < data->writers->size(); i++) {
+      string target = (*data->target_buffers)[i]->str();
+      string decoy = (*data->decoy_buffers)[i]->str();
+      (*data->target_buffers)[i]->str("");
+      (*data->decoy_buffers)[i]->str("");
+      (*data->writers)[i]->Submit(data->chunk_begin, *end, &target, &decoy);
+    }
+    data->counters->ReportProgress();
+  }
+  bool stolen;
+  if (!data->scheduler->Next(data->thread_num, pos, end, &stolen)) {
+    return false;
+  }
+  data->chunk_begin = *pos;
+  data->chunk_start = now;
+  ++data->chunks;
+  if (stolen) {
+    ++data->stolen_chunks;
+  }
+  return true;
+}
+
+bool TideSearchApplication::identifiedInCascade(
+  const SpectrumCollection::SpecCharge& sc,
+  const thread_data& data
+) {
+  if (data.spectrum_flag == NULL) {
+    return false;
+  }
+  data.locks_array[LOCK_CASCADE]->lock();
+  bool identified = data.spectrum_flag->find(pair<string, unsigned int>(
+    data.spectrum_filename, sc.spectrum->SpectrumNumber() * 10 + sc.charge)) !=
+    data.spectrum_flag->end();
+  data.locks_array[LOCK_CASCADE]->unlock();
+  return identified;
+}
+
+/*
+ * Neighbouring spectrum-charges mostly share their candidate peptides, so
+ * they are scored together: a tile holds up to one spectrum-charge for each
+ * of the observed peak sets, from [begin, end), that passes the filters and
+ * whose precursor window overlaps that of the others. The first one must
+ * pass the filters.
+ */
+void TideSearchApplication::buildXCorrTile(
+  const thread_data& data,
+  size_t begin,
+  size_t end,
+  int max_charge,
+  double max_spectrum_neutral_mass,
+  const vector<ObservedPeakSet*>& observed,
+  vector<TileSpectrum>* tile,
+  long int* num_range_skipped,
+  long int* num_precursors_skipped,
+  long int* num_isotopes_skipped,
+  long int* num_retained
+) {
+  tile->clear();
+  double tile_max_range = 0.0;
+  for (size_t pos = begin; pos < end && tile->size() < observed.size(); ++pos) {
+    const SpectrumCollection::SpecCharge& sc = (*data.spec_charges)[pos];
+    if (pos > begin && (identifiedInCascade(sc, data) ||
+        !passesFilters(sc, data, max_charge, max_spectrum_neutral_mass))) {
+      continue;
+    }
+    vector<double> min_mass, max_mass;
+    double min_range, max_range;
+    computeWindow(sc, data.window_type, data.precursor_window,
+                  data.negative_isotope_errors, &min_mass, &max_mass, &min_range, &max_range);
+    if (!tile->empty() && min_range > tile_max_range) {
+      break;
+    }
+    tile_max_range = max(tile_max_range, max_range);
+
+    tile->push_back(TileSpectrum());
+    TileSpectrum& entry = tile->back();
+    entry.sc_pos = pos;
+    entry.observed = observed[tile->size() - 1];
+    entry.observed->LimitBins(&(*data.files)[fileNum(data, pos)].Bins);
+    entry.observed->PreprocessSpectrum(*sc.spectrum, sc.charge, num_range_skipped,
+                                       num_precursors_skipped,
+                                       num_isotopes_skipped, num_retained);
+    entry.nCandPeptide = data.active_peptide_queue->SetActiveRange(
+      &min_mass, &max_mass, min_range, max_range, &entry.candidatePeptideStatus);
+    entry.selection = data.active_peptide_queue->GetSelection();
+  }
+  collectScoresTile(data.active_peptide_queue, data.spec_charges, tile);
+}
+
+void TideSearchApplication::collectScoresTile(
+  ActivePeptideQueue* active_peptide_queue,
+  const vector<SpectrumCollection::SpecCharge>* spec_charges,
+  vector<TileSpectrum>* tile
+) {
+#ifdef CPP_SCORING
+  // Each candidate's peaks are scored against the caches of all spectra of
+  // the tile that it is a candidate for while they are at hand, instead of
+  // being streamed through once per spectrum.
+  deque<Peptide*>::const_iterator begin, end;
+  bool any = false;
+  for (vector<TileSpectrum>::iterator t = tile->begin(); t != tile->end(); ++t) {
+    if (t->nCandPeptide == 0) {
+      continue;
+    }
+    t->scores.resize(t->candidatePeptideStatus.size());
+    if (!any || t->selection.iter < begin) {
+      begin = t->selection.iter;
+    }
+    if (!any || t->selection.end > end) {
+      end = t->selection.end;
+    }
+    any = true;
+  }
+  if (!any) {
+    return;
+  }
+  for (deque<Peptide*>::const_iterator peptide = begin; peptide != end; ++peptide) {
+    const vector<unsigned int>& peaks_0 = (*peptide)->peaks_0;
+    const vector<unsigned int>& peaks_1 = (*peptide)->peaks_1;
+    for (vector<TileSpectrum>::iterator t = tile->begin(); t != tile->end(); ++t) {
+      if (t->nCandPeptide == 0 || peptide < t->selection.iter || peptide >= t->selection.end) {
+        continue;
+      }
+      const int* cache = t->observed->GetCache();
+      int xcorr = 0;
+      // Score with single charged theoretical peaks
+      if (!peaks_0.empty()) {
+        xcorr += XCorrKernel::Dot(cache, &peaks_0[0], peaks_0.size());
+      }
+      // Score with double charged theoretical peaks
+      if ((*spec_charges)[t->sc_pos].charge > 2 && !peaks_1.empty()) {
+        xcorr += XCorrKernel::Dot(cache, &peaks_1[0], peaks_1.size());
+      }
+      int cnt = peptide - t->selection.iter;
+      t->scores[cnt] = TideMatchSet::Pair2(xcorr, t->scores.size() - cnt);
+    }
+  }
+#else
+  for (vector<TileSpectrum>::iterator t = tile->begin(); t != tile->end(); ++t) {
+    if (t->nCandPeptide == 0) {
+      continue;
+    }
+    const SpectrumCollection::SpecCharge& sc = (*spec_charges)[t->sc_pos];
+    int queue_size = t->candidatePeptideStatus.size();
+    TideMatchSet::Arr2 match_arr2(queue_size);
+    active_peptide_queue->SetSelection(t->selection);
+    collectScoresCompiled(active_peptide_queue, sc.spectrum, *t->observed, &match_arr2,
+                          queue_size, sc.charge);
+    t->scores.assign(match_arr2.begin(), match_arr2.end());
+  }
+#endif
+}
+
+bool TideSearchApplication::passesFilters(
+  const SpectrumCollection::SpecCharge& sc,
+  const thread_data& data,
+  int max_charge,
+  double max_spectrum_neutral_mass
+) {
+  const Spectrum* spectrum = sc.spectrum;
+  double precursor_mz = spectrum->PrecursorMZ();
+  int scan_num = spectrum->SpectrumNumber();
+  if (precursor_mz < data.spectrum_min_mz || precursor_mz > data.spectrum_max_mz ||
+      scan_num < data.min_scan || scan_num > data.max_scan ||
+      spectrum->Size() < data.min_peaks ||
+      (data.search_charge != 0 && sc.charge != data.search_charge) || sc.charge > max_charge) {
+    return false;
+  }
+  return sc.neutral_mass <= max_spectrum_neutral_mass;
+}
 
+/*
+ * Groups consecutive spectrum-charges into epochs. An epoch records the
+ * union of the peptide mass ranges of the spectrum-charges in it that pass
+ * the search filters; the epochs together cover all of spec_charges.
+ */
+void TideSearchApplication::buildWindowEpochs(
+  const vector<SpectrumCollection::SpecCharge>* spec_charges,
+  const thread_data& data,
+  vector<WindowEpoch>* epochs
+) {
+  int max_charge = Params::GetInt("max-precursor-charge");
+  double max_spectrum_neutral_mass = Params::GetDouble("max-spectrum_neutral-mass");
+  vector<double> min_mass, max_mass;
+  double min_range, max_range;
+  double epoch_start = 0.0;
+  int epoch_size = 0;
+
+  for (size_t i = 0; i < spec_charges->size(); ++i) {
+    const SpectrumCollection::SpecCharge& sc = (*spec_charges)[i];
+    if (!passesFilters(sc, data, max_charge, max_spectrum_neutral_mass)) {
+      continue;
+    }
+    min_mass.clear();
+    max_mass.clear();
+    computeWindow(sc, data.window_type, data.precursor_window, data.negative_isotope_errors,
+                  &min_mass, &max_mass, &min_range, &max_range);
+    if (epochs->empty() || epoch_size >= WINDOW_EPOCH_SPECTRA ||
+        min_range > epoch_start + WINDOW_EPOCH_SPAN) {
+      if (!epochs->empty()) {
+        epochs->back().end = i;
+      }
+      epochs->push_back(WindowEpoch(epochs->empty() ? 0 : i, i + 1, min_range, max_range));
+      epoch_start = min_range;
+      epoch_size = 0;
+    }
+    WindowEpoch& epoch = epochs->back();
+    epoch.min_range = min(epoch.min_range, min_range);
+    epoch.max_range = max(epoch.max_range, max_range);
+    ++epoch_size;
+  }
+  if (!epochs->empty()) {
+    epochs->back().end = spec_charges->size();
+  }
+  carp(CARP_DEBUG, "Searching %d spectrum-charges in %d peptide window epochs.",
+       spec_charges->size(), epochs->size());
 }
 
 #ifdef _WIN64
@@ -1431,18 +2206,14 @@ void TideSearchApplication::collectScoresCompiled(
     int xcorr = 0;
 
     // Score with single charged theoretical peaks
-    for (vector<unsigned int>::const_iterator iter_uint = (*iter_)->peaks_0.begin();
-      iter_uint != (*iter_)->peaks_0.end();
-      iter_uint++) {
-      xcorr += cache[*iter_uint];
+    const vector<unsigned int>& peaks_0 = (*iter_)->peaks_0;
+    if (!peaks_0.empty()) {
+      xcorr += XCorrKernel::Dot(cache, &peaks_0[0], peaks_0.size());
     }
     // Score with double charged theoretical peaks
-    if (charge > 2){
-      for (vector<unsigned int>::const_iterator iter_uint = (*iter_)->peaks_1.begin();
-        iter_uint != (*iter_)->peaks_1.end();
-        iter_uint++) {
-        xcorr += cache[*iter_uint];
-      }
+    const vector<unsigned int>& peaks_1 = (*iter_)->peaks_1;
+    if (charge > 2 && !peaks_1.empty()) {
+      xcorr += XCorrKernel::Dot(cache, &peaks_1[0], peaks_1.size());
     }
 
     it->first = xcorr;
@@ -1559,53 +2330,52 @@ void TideSearchApplication::collectScoresCompiled(
 #pragma optimize( "g", on )
 #endif
 
-void TideSearchApplication::convertResults() const {
-  PSMConvertApplication converter;
-  if (!Params::GetBool("concat")) {
-    string target_file_name = make_file_path("tide-search.target.txt");
-    if (Params::GetBool("pin-output")) {
-      converter.convertFile("tsv", "pin", target_file_name, "tide-search.target.", Params::GetString("protein-database"), true);
-    }
-    if (Params::GetBool("pepxml-output")) {
-      converter.convertFile("tsv", "pepxml", target_file_name, "tide-search.target.", Params::GetString("protein-database"), true);
-    }
-    if (Params::GetBool("mzid-output")) {
-      converter.convertFile("tsv", "mzidentml", target_file_name, "tide-search.target.", Params::GetString("protein-database"), true);
-    }
-    if (Params::GetBool("sqt-output")) {
-      converter.convertFile("tsv", "sqt", target_file_name, "tide-search.target.", Params::GetString("protein-database"), true);
-    }
+/**
+ * Writes the tab-delimited results in every other format that was asked for.
+ * Each results file is read once, and all formats are written from it. The
+ * time this takes is logged next to the elapsed time of the search, so that
+ * the timing test can tell whether the conversion is worth doing during the
+ * search instead.
+ */
+/*
+ * Returns the output formats other than tab-delimited that are enabled.
+ */
+vector<string> TideSearchApplication::getOutputFormats() {
+  vector<string> formats;
+  if (Params::GetBool("pin-output")) {
+    formats.push_back("pin");
+  }
+  if (Params::GetBool("pepxml-output")) {
+    formats.push_back("pepxml");
+  }
+  if (Params::GetBool("mzid-output")) {
+    formats.push_back("mzidentml");
+  }
+  if (Params::GetBool("sqt-output")) {
+    formats.push_back("sqt");
+  }
+  return formats;
+}
 
+/*
+ * Writes the matches that psm_sink_ collected in each of formats.
+ */
+void TideSearchApplication::writeResults(const vector<string>& formats) {
+  if (psm_sink_ == NULL) {
+    return;
+  }
+  double start = wall_clock();
+  carp(CARP_INFO, "Elapsed time starting writing results: %.3g s", start / 1e6);
+  string database = Params::GetString("protein-database");
+  if (!Params::GetBool("concat")) {
+    psm_sink_->write(false, this, formats, "tide-search.target.", database);
     if (HAS_DECOYS) {
-      string decoy_file_name = make_file_path("tide-search.decoy.txt");
-      if (Params::GetBool("pin-output")) {
-        converter.convertFile("tsv", "pin", decoy_file_name, "tide-search.decoy.", Params::GetString("protein-database"), true);
-      }
-      if (Params::GetBool("pepxml-output")) {
-        converter.convertFile("tsv", "pepxml", decoy_file_name, "tide-search.decoy.", Params::GetString("protein-database"), true);
-      }
-      if (Params::GetBool("mzid-output")) {
-        converter.convertFile("tsv", "mzidentml", decoy_file_name, "tide-search.decoy.", Params::GetString("protein-database"), true);
-      }
-      if (Params::GetBool("sqt-output")) {
-        converter.convertFile("tsv", "sqt", decoy_file_name, "tide-search.decoy.", Params::GetString("protein-database"), true);
-      }
+      psm_sink_->write(true, this, formats, "tide-search.decoy.", database);
     }
   } else {
-    string concat_file_name = make_file_path("tide-search.txt");
-    if (Params::GetBool("pin-output")) {
-      converter.convertFile("tsv", "pin", concat_file_name, "tide-search.", Params::GetString("protein-database"), true);
-    }
-    if (Params::GetBool("pepxml-output")) {
-      converter.convertFile("tsv", "pepxml", concat_file_name, "tide-search.", Params::GetString("protein-database"), true);
-    }
-    if (Params::GetBool("mzid-output")) {
-      converter.convertFile("tsv", "mzidentml", concat_file_name, "tide-search.", Params::GetString("protein-database"), true);
-    }
-    if (Params::GetBool("sqt-output")) {
-      converter.convertFile("tsv", "sqt", concat_file_name, "tide-search.", Params::GetString("protein-database"), true);
-    }
+    psm_sink_->write(false, this, formats, "tide-search.", database);
   }
+  carp(CARP_INFO, "Result writing time: %.3g s", (wall_clock() - start) / 1e6);
 }
 
 void TideSearchApplication::computeWindow(
@@ -1727,6 +2497,9 @@ vector<string> TideSearchApplication::getOptions() const {
     "mz-bin-width",
     "mzid-output",
     "num-threads",
+    "xcorr-kernel",
+    "max-merged-files",
+    "spectrum-memory-limit",
     "output-dir",
     "overwrite",
     "parameter-file",
@@ -1763,6 +2536,8 @@ vector<string> TideSearchApplication::getOptions() const {
     "sqt-output",
     "store-index",
     "store-spectra",
+    "spectrum-cache-dir",
+    "spectrum-cache-size",
     "top-match",
     "txt-output",
     "xpv-precision",  // Added by AKF    
@@ -1785,6 +2560,12 @@ vector< pair<string, string> > TideSearchApplication::getOutputs() const {
   outputs.push_back(make_pair("tide-search.decoy.txt",
     "a tab-delimited text file containing the decoy PSMs. This file will only "
     "be created if the index was created with decoys."));
+  outputs.push_back(make_pair("tide-search.stats.txt",
+    "a tab-delimited text file with statistics of the search of each spectrum "
+    "file: for every thread and for all threads together, the number of "
+    "spectrum-charges searched, candidate peptides scored and observed peaks "
+    "removed or retained, the time spent and the spectrum-charges searched per "
+    "second."));
   outputs.push_back(make_pair("tide-search.params.txt",
     "a file containing the name and value of all parameters/options for the "
     "current operation. Not all parameters in the file may have been used in "
@@ -1803,6 +2584,37 @@ COMMAND_T TideSearchApplication::getCommand() const {
   return TIDE_SEARCH_COMMAND;
 }
 
+/*
+ * Adds factor * src[row] to dst[row] for row in [first, last]. The columns
+ * of the DP tables never overlap, so the loop is compiled to vector
+ * instructions.
+ */
+static inline void addScaledColumn(
+  double* __restrict dst,
+  const double* __restrict src,
+  double factor,
+  int first,
+  int last
+) {
+  for (int row = first; row <= last; ++row) {
+    dst[row] += src[row] * factor;
+  }
+}
+
+/*
+ * Narrows [*first, *last] to the rows of a DP column that hold a count.
+ * Returns false if there are none.
+ */
+static inline bool nonzeroRows(const double* column, int* first, int* last) {
+  while (*first <= *last && column[*first] == 0.0) {
+    ++(*first);
+  }
+  while (*last >= *first && column[*last] == 0.0) {
+    --(*last);
+  }
+  return *first <= *last;
+}
+
 /* Calculates counts of peptides with various XCorr scores, given a preprocessed
  * MS2 spectrum, using dynamic programming.
  * Written by Jeff Howbert, October, 2012 (as function calcScoreCount).
@@ -1813,6 +2625,10 @@ COMMAND_T TideSearchApplication::getCommand() const {
  * B. The for loops to fill the DP table has been rearranged in order to 
  *    avoid the processing of the cells of the DP table with 0 values. This
  *    changes made the code ~3 times faster.
+ * The live columns of the DP table are kept in one buffer from the thread's
+ * scratch arena, column col in slot col % ringSize, and each amino acid adds
+ * a whole column at a time. The counts are added up in the same order as
+ * before, so the results are unchanged.
  */
 int TideSearchApplication::calcScoreCount(
   int numelEvidenceObs,
@@ -1827,7 +2643,8 @@ int TideSearchApplication::calcScoreCount(
   const vector<double>& aaFreqI,
   const vector<double>& aaFreqC,
   const vector<int>& aaMass,
-  double* pValueScoreObs
+  double* pValueScoreObs,
+  ScratchArena* scratch
 ) {
   const int nDeltaMass = nAA;
   int minDeltaMass = aaMass[0];
@@ -1837,90 +2654,65 @@ int TideSearchApplication::calcScoreCount(
   int row;
   int col;
   int ma;
-  int evidence;
   int de;
-  int evidenceRow;
-  double sumScore;
 
   int bottomRowBuffer = maxEvidence + 1;
   int topRowBuffer = -minEvidence;
-  int colBuffer = maxDeltaMass;
   int colStart = MassConstants::mass2bin(MassConstants::mono_h);
   int scoreOffsetObs = bottomRowBuffer - minScore;
 
   int nRow = bottomRowBuffer - minScore + 1 + maxScore + topRowBuffer;
-  int nCol = colBuffer + pepMassInt;
   int rowFirst = bottomRowBuffer;
   int rowLast = rowFirst - minScore + maxScore;
   int colFirst = colStart + MassConstants::mass2bin(MassConstants::mono_h);
   int colLast = MassConstants::mass2bin(MassConstants::bin2mass(pepMassInt)
     - MassConstants::mono_oh);
   int initCountRow = bottomRowBuffer - minScore;
-  int initCountCol = maxDeltaMass + colStart;
 
-  double** dynProgArray = new double*[nCol];
-  for (col = 0; col < colFirst+maxDeltaMass; col++) {
-    dynProgArray[col] = new double[nRow];
-    memset(dynProgArray[col], 0.0, nRow*sizeof(double));
-  }
-  
-  double* scoreCountBinAdjust = new double[nRow];
-  memset(scoreCountBinAdjust, 0.0, nRow*sizeof(double));
-  
-  // This part, below, is added by AKF. This must provide exactly the 
-  // same results as the original XPV implementation by Jeff Howbert, 
-  // albeit 2-3 times faster.
-  
-  dynProgArray[colStart][initCountRow] = 1.0; // initial count of peptides with mass = 1   // Modified by AKF
-  vector<int> deltaMassCol(nDeltaMass);
+  // Columns up to col + maxDeltaMass are filled while column col is read, and
+  // the first ones, up to colFirst + maxDeltaMass, are all live at the start.
+  int ringSize = colFirst + maxDeltaMass + 1;
+  ScratchArena::Mark mark = scratch->GetMark();
+  double* dynProgArray = scratch->NewZeroed<double>((size_t)ringSize * nRow);
+#define DP_COLUMN(col) (dynProgArray + (size_t)((col) % ringSize) * nRow)
+
+  DP_COLUMN(colStart)[initCountRow] = 1.0; // initial count of peptides with mass = 1   // Modified by AKF
   // populate matrix with scores for first (i.e. N-terminal) amino acid in sequence
   for (de = 0; de < nDeltaMass; de++) {
     ma = aaMass[de];
     col = colStart + ma;
     row = initCountRow + evidenceObs[col];
     if (col <= maxDeltaMass + colLast) {
-      dynProgArray[col][row] += dynProgArray[colStart][initCountRow] * aaFreqN[de];
+      DP_COLUMN(col)[row] += DP_COLUMN(colStart)[initCountRow] * aaFreqN[de];
     }
   }
-  for (ma = 0; ma < colFirst; ++ma )
-      delete dynProgArray[ma];
   for (ma = colFirst; ma < colLast; ma++) {
-    dynProgArray[ma+maxDeltaMass ] = new double[nRow];
-    memset(dynProgArray[ma+maxDeltaMass], 0.0, nRow*sizeof(double));
-    
-    for (de = 0; de < nDeltaMass; de++) {
-      deltaMassCol[de] = ma + aaMass[de];
+    // The slot of the column entering the table belonged to a column left behind.
+    memset(DP_COLUMN(ma + maxDeltaMass), 0, nRow * sizeof(double));
+
+    const double* counts = DP_COLUMN(ma);
+    int first = rowFirst;
+    int last = rowLast;
+    if (!nonzeroRows(counts, &first, &last)) {
+      continue;
     }
-    for (row = rowFirst; row <= rowLast; row++) {
-      if (dynProgArray[ma][row] == 0.0) {
-        continue;
-      }
-      for (de = 0; de < nDeltaMass; de++) {
-        col = deltaMassCol[de];
-        if (col < colLast) {
-          evidenceRow = row + evidenceObs[col];
-          dynProgArray[col][evidenceRow] += dynProgArray[ma][row]*aaFreqI[de]; 
-        } else if (col == colLast) { 
-          evidenceRow = row;
-          dynProgArray[col][evidenceRow] += dynProgArray[ma][row]*aaFreqC[de]; 
-        }
+    for (de = 0; de < nDeltaMass; de++) {
+      col = ma + aaMass[de];
+      if (col < colLast) {
+        addScaledColumn(DP_COLUMN(col) + evidenceObs[col], counts, aaFreqI[de], first, last);
+      } else if (col == colLast) {
+        addScaledColumn(DP_COLUMN(col), counts, aaFreqC[de], first, last);
       }
     }
-    delete dynProgArray[ma];
-  }
- 
-  for (row = 0; row < nRow; ++row) {
-    pValueScoreObs[row] = dynProgArray[colLast][row];
   }
+
+  memcpy(pValueScoreObs, DP_COLUMN(colLast), nRow * sizeof(double));
+#undef DP_COLUMN
   // The calculation of the null distribution has been removed from here,
   // and now the partial raw distribtuion is merged in the main code
   // in order to use a single/unique/merged null distribution.
   // clean up
-  for (col = colLast; col < colLast+maxDeltaMass; ++col) {
-    delete [] dynProgArray[col];    
-  }
-  delete [] dynProgArray;
-  delete [] scoreCountBinAdjust;
+  scratch->Release(mark);
 
   return scoreOffsetObs;
 }
@@ -2364,6 +3156,9 @@ int TideSearchApplication::calcScoreCount(
  *
  * Added by Andy Lin, March 2-16
  * Edited to work within Crux code instead of with original MATLAB code
+ *
+ * Only the live columns of the DP table are stored, in one buffer from the
+ * thread's scratch arena, and each amino acid adds a whole column at a time.
  */
 void TideSearchApplication::calcResidueScoreCount (
   int nAa,
@@ -2380,7 +3175,8 @@ void TideSearchApplication::calcResidueScoreCount (
   int maxEvidence,
   int maxScore,
   vector<double>& scoreCount, //this is returned for later use
-  int& scoreOffset //this is returned for later use
+  int& scoreOffset, //this is returned for later use
+  ScratchArena* scratch
 ) {
   int minEvidence  = 0;
   int minScore     = 0;
@@ -2390,15 +3186,12 @@ void TideSearchApplication::calcResidueScoreCount (
   int ma;
   int evid;
   int de;
-  int evidRow;
   double sumScore;
 
   int bottomRowBuffer = maxEvidence;
   int topRowBuffer = -minEvidence;
-  int colBuffer = maxAaMass;
   int colStart = nTermMass;
   int nRow = bottomRowBuffer - minScore + 1 + maxScore + topRowBuffer;
-  int nCol = colBuffer + pepMassInt + maxAaMass;
   int rowFirst = bottomRowBuffer + 1;
   int rowLast = rowFirst - minScore + maxScore;
   int colFirst = colStart + 1;
@@ -2414,19 +3207,17 @@ void TideSearchApplication::calcResidueScoreCount (
   initCountRow = initCountRow - 1;
   initCountCol = initCountCol - 1;
 
-  double** dynProgArray = 0;
-  dynProgArray = new double*[nRow];
-  for (row = 0; row < nRow; row++) {
-    dynProgArray[row] = new double[nCol];
-    for (col = 0; col < nCol; col++) {
-      dynProgArray[row][col] = 0.0;
-    }
-  }
+  // Column col of the DP table is kept in slot col % ringSize of one buffer
+  // from the scratch arena; columns up to col + maxAaMass are filled while
+  // column col is read.
+  int ringSize = maxAaMass + 1;
+  ScratchArena::Mark mark = scratch->GetMark();
+  double* dynProgArray = scratch->NewZeroed<double>((size_t)ringSize * nRow);
+#define DP_COLUMN(col) (dynProgArray + (size_t)((col) % ringSize) * nRow)
 
   // initial count of peptides with mass = nTermMass
-  dynProgArray[initCountRow][initCountCol] = 1.0;
+  DP_COLUMN(initCountCol)[initCountRow] = 1.0;
 
-  int* aaMassCol = new int[nAa];
   // populate matrix with scores for first (i.e. N-terminal) amino acid in sequence
   for (de = 0; de < nAa; de++) {
     ma = aaMass[de];
@@ -2445,50 +3236,46 @@ void TideSearchApplication::calcResidueScoreCount (
 //    if ( col <= maxAaMass + colLast ) { //original
     if (col <= maxAaMass + colLast && col >= initCountCol) { //TODO not sure if below or above is correct
       //dynProgArray[ row ][ col ] += dynProgArray[ initCountRow ][ initCountCol ];
-      dynProgArray[row][col] += dynProgArray[initCountRow][initCountCol] * aaFreqN[de];
+      DP_COLUMN(col)[row] += DP_COLUMN(initCountCol)[initCountRow] * aaFreqN[de];
     }
   }
 
   //set to zero now that score counts for first amino acid are in matrix
-  dynProgArray[initCountRow][initCountCol] = 0.0;
+  DP_COLUMN(initCountCol)[initCountRow] = 0.0;
 
 //The following code was added by AKF to make the DP calculation faster
   int newCol;
   for (ma = initCountCol+1; ma < colLast; ++ma) {
-    col = ma;  
-    for (de = 0; de < nAa; de++) {
-      aaMassCol[de] = col + aaMass[de];
+    // The slot of the column entering the table belonged to a column left behind.
+    memset(DP_COLUMN(ma + maxAaMass), 0, nRow * sizeof(double));
+
+    const double* counts = DP_COLUMN(ma);
+    int first = rowFirst;
+    int last = rowLast;
+    if (!nonzeroRows(counts, &first, &last)) {
+      continue;
     }
-    for (row = rowFirst; row <= rowLast; ++row) {
-      if (dynProgArray[row][col] == 0.0) {
-        continue;
+    for (de = 0; de < nAa; de++) {
+      newCol = ma + aaMass[de];
+      if (newCol < colLast) {
+        evid = (int)residueEvidenceMatrix[de][newCol];
+        addScaledColumn(DP_COLUMN(newCol) + evid, counts, aaFreqI[de], first, last);
+      } else if (newCol == colLast) {
+        addScaledColumn(DP_COLUMN(newCol), counts, aaFreqC[de], first, last);
       }
-      for (de = 0; de < nAa; de++) {
-        newCol = aaMassCol[de];
-        if (newCol < colLast) {
-          evidRow = row + residueEvidenceMatrix[de][newCol];
-          dynProgArray[evidRow][newCol] += dynProgArray[row][col] * aaFreqI[de];
-        } else if (newCol == colLast) {
-          evidRow = row;
-          dynProgArray[evidRow][newCol] += dynProgArray[row][col] * aaFreqC[de];            
-        } 
-      }        
-    }      
-  } 
+    }
+  }
   int colScoreCount = colLast;
 
-  scoreCount.resize(nRow);
-  for (int row = 0; row < nRow; row++) {
-    scoreCount[row] = dynProgArray[row][colScoreCount];
+  scoreCount.assign(nRow, 0.0);
+  if (colScoreCount >= initCountCol) {
+    memcpy(&scoreCount[0], DP_COLUMN(colScoreCount), nRow * sizeof(double));
   }
+#undef DP_COLUMN
   scoreOffset = initCountRow;
 
   // clean up
-  for (int row = 0; row < nRow; row++) {
-    delete [] dynProgArray[row];
-  }
-  delete [] dynProgArray;
-  delete [] aaMassCol;
+  scratch->Release(mark);
 }
 
 void TideSearchApplication::processParams() {
@@ -2578,6 +3365,10 @@ void TideSearchApplication::setSpectrumFlag(map<pair<string, unsigned int>, bool
   spectrum_flag_ = spectrum_flag;
 }
 
+void TideSearchApplication::setSpectrumCacheDir(const string& dir) {
+  spectrum_cache_dir_ = dir;
+}
+
 string TideSearchApplication::getOutputFileName() {
   return output_file_name_;
 }
@@ -7,23 +7,28 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <sstream>
+#include <chrono>
 #include <gflags/gflags.h>
 #include "peptides.pb.h"
 #include "spectrum.pb.h"
 #include "tide/theoretical_peak_set.h"
 #include "tide/max_mz.h"
+#include "tide/scratch_arena.h"
+#include "tide/search_threads.h"
+#include "tide/sorted_spectrum_stream.h"
 #include "util/MathUtil.h"
 
 using namespace std;
 
+class MatchCollectionSink;
+class SpectrumCache;
+
 /**
  * Locks for multi-threading in Tide.
  */
 enum _tide_search_lock {
-  LOCK_RESULTS,       // Results file output
   LOCK_CASCADE,       // Only used by cascade-search on spectrum_flag (map)
-  LOCK_CANDIDATES,    // Updating # of candidate peptides
-  LOCK_REPORTING,     // Updating sc_index and reporting progress
   NUMBER_LOCK_TYPES   // always keep this last so the value
                       // changes as cmds are added
 };
@@ -35,10 +40,57 @@ struct InputFile {
   std::string OriginalName;
   std::string SpectrumRecords;
   bool Keep;
+  // Set if OriginalName is not a spectrumrecords file, and is converted when
+  // it is searched. The spectrumrecords file is then only written if it is
+  // kept or needed.
+  bool Convert;
+  // Set if SpectrumRecords is an entry of the spectrum cache.
+  bool Cached;
   InputFile(const std::string& name,
             const std::string& spectrumrecords,
-            bool keep):
-    OriginalName(name), SpectrumRecords(spectrumrecords), Keep(keep) {}
+            bool keep,
+            bool convert = false,
+            bool cached = false):
+    OriginalName(name), SpectrumRecords(spectrumrecords), Keep(keep), Convert(convert),
+    Cached(cached) {}
+};
+
+/**
+ * A spectrum file of a batch that is searched in one pass over the index.
+ */
+struct SearchFile {
+  std::string Name;  // reported in the file column
+  double HighestMz;  // highest m/z of its spectra
+  MaxBin Bins;       // bins its spectra are preprocessed up to
+  SearchFile(const std::string& name, double highest_mz):
+    Name(name), HighestMz(highest_mz) {}
+};
+
+/**
+ * A run of consecutive spectrum-charges, [begin, end) in search order, that
+ * are searched against one fill of the shared peptide window, which then
+ * covers peptide masses from min_range to max_range.
+ */
+struct WindowEpoch {
+  size_t begin;
+  size_t end;
+  double min_range;
+  double max_range;
+  WindowEpoch(size_t begin_, size_t end_, double min_range_, double max_range_):
+    begin(begin_), end(end_), min_range(min_range_), max_range(max_range_) {}
+};
+
+/**
+ * A spectrum-charge that is preprocessed, matched to its candidate peptides
+ * and scored ahead of its turn, together with its neighbours in a tile.
+ */
+struct TileSpectrum {
+  size_t sc_pos;                          // position in the spectrum-charges
+  ObservedPeakSet* observed;
+  vector<bool> candidatePeptideStatus;
+  int nCandPeptide;
+  ActivePeptideQueue::Selection selection;
+  vector<TideMatchSet::Pair2> scores;     // as from collectScoresCompiled()
 };
 
 struct ScSortByMz {
@@ -96,12 +148,33 @@ class TideSearchApplication : public CruxApplication {
   */
   map<pair<string, unsigned int>, bool>* spectrum_flag_;
   string output_file_name_;
+  // Spectrum cache used when spectrum-cache-dir is not set; set by Cascade Search.
+  string spectrum_cache_dir_;
 
   static bool HAS_DECOYS;
   static bool PROTEIN_LEVEL_DECOYS;
 
-  vector<InputFile> getInputFiles(const vector<string>& filepaths) const;
+  vector<InputFile> getInputFiles(const vector<string>& filepaths, SpectrumCache* cache) const;
   static SpectrumCollection* loadSpectra(const std::string& file);
+  static void sortSpectra(SpectrumCollection* spectra);
+  // Sorts the spectrum-charges of file in runs of at most half of
+  // memory_limit bytes, for searching in segments.
+  static SortedSpectrumStream* loadSpectraStream(const std::string& file, size_t memory_limit);
+
+  /**
+   * Merges the spectrum-charges of several spectrum files into search order,
+   * noting the file each one comes from.
+   */
+  static void mergeSpecCharges(
+    const vector<SpectrumCollection*>& spectra,
+    vector<SpectrumCollection::SpecCharge>* merged,
+    vector<int>* file_index
+  );
+
+  /**
+   * Appends the contents of file to out, and removes it.
+   */
+  static void appendAndRemove(const string& file, ofstream* out);
 
   /**
    * Function that contains the search algorithm and performs the search
@@ -119,13 +192,17 @@ class TideSearchApplication : public CruxApplication {
     *                 |
     *                 -> Per Thread:
     *                           -> search(void* threadarg)
+    *
+    * If stream is not NULL, spec_charges is ignored, and the spectrum-charges
+    * of the stream are searched one segment at a time.
     */
   void search(
-    const string& spectrum_filename,
+    const vector<SearchFile>& files,
     const vector<SpectrumCollection::SpecCharge>* spec_charges,
-    vector<ActivePeptideQueue*> active_peptide_queue,
-    ProteinVec& proteins,
-    vector<const pb::AuxLocation*>& locations,
+    const vector<int>* file_index,
+    SortedSpectrumStream* stream,
+    ActivePeptideQueue* active_peptide_queue,
+    const ProteinStore* proteins,
     double precursor_window,
     WINDOW_TYPE_T window_type,
     double spectrum_min_mz,
@@ -135,7 +212,6 @@ class TideSearchApplication : public CruxApplication {
     int min_peaks,
     int search_charge,
     int top_matches,
-    double highest_mz,
     ofstream* target_file,
     ofstream* decoy_file,
     bool compute_sp,
@@ -153,7 +229,15 @@ class TideSearchApplication : public CruxApplication {
 
 
 
-  void convertResults() const;
+  /**
+   * Returns the output formats other than tab-delimited that are enabled.
+   */
+  static vector<string> getOutputFormats();
+
+  /**
+   * Writes the matches of the search in each of formats.
+   */
+  void writeResults(const vector<string>& formats);
 
   double bin_width_;
   double bin_offset_;
@@ -165,6 +249,18 @@ class TideSearchApplication : public CruxApplication {
   // the SpectrumCollection must be sorted
   std::map<std::string, SpectrumCollection*> spectra_;
 
+  // Search threads, kept alive across spectrum files; created on first use.
+  ThreadPool* thread_pool_;
+
+  // Search statistics, written while main() runs.
+  ofstream* stats_file_;
+
+  // Keeps the matches for the formats other than tab-delimited while main()
+  // runs, or NULL if there are none. The spectrum files of the batch being
+  // searched are numbered from psm_file_base_ on.
+  MatchCollectionSink* psm_sink_;
+  size_t psm_file_base_;
+
  public:
 
   // See TideSearchApplication.cpp for descriptions of these two constants
@@ -258,8 +354,7 @@ class TideSearchApplication : public CruxApplication {
     string spectrum_filename;
     const vector<SpectrumCollection::SpecCharge>* spec_charges;
     ActivePeptideQueue* active_peptide_queue;
-    ProteinVec proteins;
-    vector<const pb::AuxLocation*> locations;
+    const ProteinStore* proteins;
     double precursor_window;
     WINDOW_TYPE_T window_type;
     double spectrum_min_mz;
@@ -289,13 +384,37 @@ class TideSearchApplication : public CruxApplication {
     double bin_offset;
     bool exact_pval_search;
     map<pair<string, unsigned int>, bool>* spectrum_flag;
-    int* sc_index;
-    long* total_candidate_peptides;
+    SearchCounters* counters;
     vector<int>* negative_isotope_errors;
+    ActivePeptideQueue* peptide_window; // owner of the shared window; NULL if not shared
+    const vector<WindowEpoch>* epochs;
+    boost::barrier* barrier;
+    ChunkScheduler* scheduler;
+    // The spectrum files of the search, the file of each spectrum-charge, or
+    // NULL if there is only one, and a writer for each file.
+    const vector<SearchFile>* files;
+    const vector<int>* file_index;
+    const vector<OrderedWriter*>* writers;
+    // Output of the current chunk for each file, owned by the thread's
+    // search().
+    vector<ostringstream*>* target_buffers;
+    vector<ostringstream*>* decoy_buffers;
+    size_t chunk_begin;
+    // Receives the reported matches as well, if not NULL, under keys
+    // starting from psm_file and psm_segment.
+    PSMSink* psm_sink;
+    size_t psm_file;
+    size_t psm_segment;
+    // Per-thread load statistics, in seconds and chunks.
+    double busy_time;
+    double idle_time;
+    int chunks;
+    int stolen_chunks;
+    std::chrono::steady_clock::time_point chunk_start;
 
     thread_data (const string& spectrum_filename_, const vector<SpectrumCollection::SpecCharge>* spec_charges_,
-            ActivePeptideQueue* active_peptide_queue_, ProteinVec proteins_,
-            vector<const pb::AuxLocation*> locations_, double precursor_window_,
+            ActivePeptideQueue* active_peptide_queue_, const ProteinStore* proteins_,
+            double precursor_window_,
             WINDOW_TYPE_T window_type_, double spectrum_min_mz_, double spectrum_max_mz_,
             int min_scan_, int max_scan_, int min_peaks_, int search_charge_, int top_matches_,
             double highest_mz_, ofstream* target_file_,
@@ -304,10 +423,10 @@ class TideSearchApplication : public CruxApplication {
             const vector<double>* dAAFreqC_, const vector<double>* dAAMass_,
             const pb::ModTable* mod_table_, const pb::ModTable* nterm_mod_table_, const pb::ModTable* cterm_mod_table_, const int decoysPerTarget_,
             vector<boost::mutex*> locks_array_, double bin_width_, double bin_offset_, bool exact_pval_search_,
-            map<pair<string, unsigned int>, bool>* spectrum_flag_, int* sc_index_, long* total_candidate_peptides_,
+            map<pair<string, unsigned int>, bool>* spectrum_flag_, SearchCounters* counters_,
             vector<int>* negative_isotope_errors_) :
             spectrum_filename(spectrum_filename_), spec_charges(spec_charges_), active_peptide_queue(active_peptide_queue_),
-            proteins(proteins_), locations(locations_), precursor_window(precursor_window_), window_type(window_type_),
+            proteins(proteins_), precursor_window(precursor_window_), window_type(window_type_),
             spectrum_min_mz(spectrum_min_mz_), spectrum_max_mz(spectrum_max_mz_), min_scan(min_scan_), max_scan(max_scan_),
             min_peaks(min_peaks_), search_charge(search_charge_), top_matches(top_matches_), highest_mz(highest_mz_),
             target_file(target_file_), decoy_file(decoy_file_), compute_sp(compute_sp_),
@@ -315,9 +434,108 @@ class TideSearchApplication : public CruxApplication {
             nAARes(nAARes_), dAAFreqN(dAAFreqN_), dAAFreqI(dAAFreqI_), dAAFreqC(dAAFreqC_), dAAMass(dAAMass_),
             mod_table(mod_table_), nterm_mod_table(nterm_mod_table_), cterm_mod_table(cterm_mod_table_), decoysPerTarget(decoysPerTarget_),
             locks_array(locks_array_), bin_width(bin_width_), bin_offset(bin_offset_), exact_pval_search(exact_pval_search_),
-            spectrum_flag(spectrum_flag_), sc_index(sc_index_), total_candidate_peptides(total_candidate_peptides_), negative_isotope_errors(negative_isotope_errors_) {}
+            spectrum_flag(spectrum_flag_), counters(counters_), negative_isotope_errors(negative_isotope_errors_),
+            peptide_window(NULL), epochs(NULL), barrier(NULL), scheduler(NULL),
+            files(NULL), file_index(NULL), writers(NULL),
+            target_buffers(NULL), decoy_buffers(NULL), chunk_begin(0),
+            psm_sink(NULL), psm_file(0), psm_segment(0),
+            busy_time(0.0), idle_time(0.0), chunks(0), stolen_chunks(0) {}
   };
 
+  /**
+   * Runs the search for one thread of a pool job.
+   */
+  void searchThread(vector<thread_data>* thread_data_array, int thread_num);
+
+  /**
+   * Advances a search thread to its next spectrum-charge.
+   */
+  static bool nextSpecCharge(thread_data* data, size_t* pos, size_t* end);
+
+  /**
+   * Returns the number of the spectrum file of the spectrum-charge at pos.
+   */
+  static int fileNum(const thread_data& data, size_t pos) {
+    return data.file_index != NULL ? (*data.file_index)[pos] : 0;
+  }
+
+  /**
+   * Returns the key under which the matches of the spectrum-charge at pos go
+   * to the PSM sink.
+   */
+  static PSMSink::Key psmKey(const thread_data& data, size_t pos) {
+    PSMSink::Key key;
+    key.File = data.psm_file + fileNum(data, pos);
+    key.Segment = data.psm_segment;
+    key.Item = pos;
+    return key;
+  }
+
+  /**
+   * Writes the counters of a search to the statistics file.
+   */
+  void writeSearchStats(
+    const string& spectrum_filename,
+    const vector<thread_data>& thread_data_array,
+    const SearchCounters& counters
+  );
+
+  /**
+   * Returns true if a spectrum-charge passes the m/z, scan, peak count,
+   * charge and mass filters of a search.
+   */
+  static bool passesFilters(
+    const SpectrumCollection::SpecCharge& sc,
+    const thread_data& data,
+    int max_charge,
+    double max_spectrum_neutral_mass
+  );
+
+  /**
+   * Returns true if cascade-search already identified a spectrum-charge.
+   */
+  static bool identifiedInCascade(
+    const SpectrumCollection::SpecCharge& sc,
+    const thread_data& data
+  );
+
+  /**
+   * Preprocesses, selects candidates for and scores a tile of
+   * spectrum-charges, beginning with the one at begin.
+   */
+  static void buildXCorrTile(
+    const thread_data& data,
+    size_t begin,
+    size_t end,
+    int max_charge,
+    double max_spectrum_neutral_mass,
+    const vector<ObservedPeakSet*>& observed,
+    vector<TileSpectrum>* tile,
+    long int* num_range_skipped,
+    long int* num_precursors_skipped,
+    long int* num_isotopes_skipped,
+    long int* num_retained
+  );
+
+  /**
+   * Scores every spectrum-charge of a tile against its candidates, in one
+   * pass over the peptides.
+   */
+  static void collectScoresTile(
+    ActivePeptideQueue* active_peptide_queue,
+    const vector<SpectrumCollection::SpecCharge>* spec_charges,
+    vector<TileSpectrum>* tile
+  );
+
+  /**
+   * Splits the spectrum-charges into epochs for the shared peptide window.
+   */
+  static void buildWindowEpochs(
+    const vector<SpectrumCollection::SpecCharge>* spec_charges,
+    const thread_data& data,
+    vector<WindowEpoch>* epochs
+  );
+
   int calcScoreCount(
     int numelEvidenceObs,
     int* evidenceObs,
@@ -331,7 +549,8 @@ class TideSearchApplication : public CruxApplication {
     const vector<double>& aaFreqI,
     const vector<double>& aaFreqC,
     const vector<int>& aaMass,
-    double* pValueScoreObs
+    double* pValueScoreObs,
+    ScratchArena* scratch
   );
   // Added by AKF
   map<double, std::string> mMass2AA;  
@@ -372,7 +591,8 @@ class TideSearchApplication : public CruxApplication {
     int maxEvidence,
     int maxScore,
     vector<double>& scoreCount, //this is returned for later use
-    int& scoreOffSet //this is returned for later use
+    int& scoreOffSet, //this is returned for later use
+    ScratchArena* scratch
   );
 
   double calcCombinedPval( //calculates combined p-value
@@ -382,6 +602,7 @@ class TideSearchApplication : public CruxApplication {
   );
 
   void setSpectrumFlag(map<pair<string, unsigned int>, bool>* spectrum_flag);
+  void setSpectrumCacheDir(const string& dir);
   virtual void processParams();
   string getOutputFileName();
 };
@@ -3,6 +3,7 @@
 #include <deque>
 #include <gflags/gflags.h>
 #include "records.h"
+#include "mass_index.h"
 #include "peptides.pb.h"
 #include "peptide.h"
 #include "active_peptide_queue.h"
@@ -10,46 +11,125 @@
 #include "theoretical_peak_set.h"
 #include "compiler.h"
 #include "app/TideMatchSet.h"
+#include "util/GlobalParams.h"
 #include <map> //Added by Andy Lin
+#include <algorithm>
 #define CHECK(x) GOOGLE_CHECK((x))
 
 DEFINE_int32(fifo_page_size, 1, "Page size for FIFO allocator, in megs");
 
+// The scoring programs are executed only when they are compiled to machine
+// code; the C++ scoring keeps the peaks with the peptides instead.
+#ifdef CPP_SCORING
+#define PROG_PAGES_EXECUTABLE false
+#else
+#define PROG_PAGES_EXECUTABLE true
+#endif
+
 ActivePeptideQueue::ActivePeptideQueue(RecordReader* reader,
-                                       const vector<const pb::Protein*>&
-                                       proteins)
-  : reader_(reader),
+                                       const ProteinStore& proteins)
+  : ActivePeptideQueue(reader, NULL, proteins) {
+}
+
+ActivePeptideQueue::ActivePeptideQueue(MassIndexReader* reader,
+                                       const ProteinStore& proteins)
+  : ActivePeptideQueue(NULL, reader, proteins) {
+}
+
+ActivePeptideQueue::ActivePeptideQueue(RecordReader* reader,
+                                       MassIndexReader* mass_reader,
+                                       const ProteinStore& proteins)
+  : window_(this),
+    reader_(reader),
+    mass_reader_(mass_reader),
     proteins_(proteins),
     theoretical_peak_set_(1000),   // probably overkill, but no harm
     theoretical_b_peak_set_(200),  // probably overkill, but no harm
-    active_targets_(0), active_decoys_(0),
-    fifo_alloc_peptides_(FLAGS_fifo_page_size << 20),
-    fifo_alloc_prog1_(FLAGS_fifo_page_size << 20), 
-    fifo_alloc_prog2_(FLAGS_fifo_page_size << 20) {
-  CHECK(reader_->OK());
-  compiler_prog1_ = new TheoreticalPeakCompiler(&fifo_alloc_prog1_);
-  compiler_prog2_ = new TheoreticalPeakCompiler(&fifo_alloc_prog2_);
+    compute_begin_(0), compute_end_(0), b_ions_only_(false), use_stored_peaks_(false),
+    peptide_pool_(new PeptidePool()),
+    fifo_alloc_peptides_(new FifoAllocator(FLAGS_fifo_page_size << 20)),
+    fifo_alloc_prog1_(new FifoAllocator(FLAGS_fifo_page_size << 20, PROG_PAGES_EXECUTABLE)),
+    fifo_alloc_prog2_(new FifoAllocator(FLAGS_fifo_page_size << 20, PROG_PAGES_EXECUTABLE)),
+    compiler_prog1_(new TheoreticalPeakCompiler(fifo_alloc_prog1_)),
+    compiler_prog2_(new TheoreticalPeakCompiler(fifo_alloc_prog2_)),
+    active_targets_(0), active_decoys_(0) {
+  CHECK(mass_reader_ != NULL ? mass_reader_->OK() : reader_->OK());
+  peptide_centric_ = false;
+  elution_window_ = 0;
+  exact_pval_search_ = false;
+  psm_sink_ = NULL;
+}
+
+// A view only needs the workspace for computing theoretical peaks; the
+// peptides, the reader and the allocators all belong to the window.
+ActivePeptideQueue::ActivePeptideQueue(ActivePeptideQueue* window)
+  : window_(window),
+    reader_(NULL),
+    mass_reader_(NULL),
+    proteins_(window->proteins_),
+    theoretical_peak_set_(1000),
+    theoretical_b_peak_set_(200),
+    compute_begin_(0), compute_end_(0), b_ions_only_(false), use_stored_peaks_(false),
+    peptide_pool_(NULL),
+    fifo_alloc_peptides_(NULL),
+    fifo_alloc_prog1_(NULL),
+    fifo_alloc_prog2_(NULL),
+    compiler_prog1_(NULL),
+    compiler_prog2_(NULL),
+    active_targets_(0), active_decoys_(0) {
+  theoretical_b_peak_set_.binWidth_ = window->theoretical_b_peak_set_.binWidth_;
+  theoretical_b_peak_set_.binOffset_ = window->theoretical_b_peak_set_.binOffset_;
   peptide_centric_ = false;
   elution_window_ = 0;
   exact_pval_search_ = false;
+  psm_sink_ = NULL;
+}
+
+bool ActivePeptideQueue::ReaderDone() {
+  return mass_reader_ != NULL ? mass_reader_->Done() : reader_->Done();
+}
+
+void ActivePeptideQueue::ReadPeptide() {
+  if (mass_reader_ != NULL) {
+    mass_reader_->Read(&current_pb_peptide_);
+  } else {
+    reader_->Read(&current_pb_peptide_);
+  }
+}
+
+void ActivePeptideQueue::SeekReader(double min_range) {
+  if (mass_reader_ != NULL) {
+    mass_reader_->Seek(min_range);
+  }
 }
 
 ActivePeptideQueue::~ActivePeptideQueue() {
-  deque<Peptide*>::iterator i = queue_.begin();
+  if (IsView()) {
+    return;
+  }
+  // The pool destroys the peptides still in the queue.
+  delete peptide_pool_;
 
-  fifo_alloc_peptides_.ReleaseAll();
-  fifo_alloc_prog1_.ReleaseAll();
-  fifo_alloc_prog2_.ReleaseAll();
+  fifo_alloc_peptides_->ReleaseAll();
+  fifo_alloc_prog1_->ReleaseAll();
+  fifo_alloc_prog2_->ReleaseAll();
 
   delete compiler_prog1_;
   delete compiler_prog2_;
+  delete fifo_alloc_peptides_;
+  delete fifo_alloc_prog1_;
+  delete fifo_alloc_prog2_;
 }
 
 // Compute the theoretical peaks of the peptide in the "back" of the queue
 // (i.e. the one most recently read from disk -- the heaviest).
 void ActivePeptideQueue::ComputeTheoreticalPeaksBack(bool dia_mode) {
-  theoretical_peak_set_.Clear();
   Peptide* peptide = queue_.back();
+  if (use_stored_peaks_ && !dia_mode) {
+    peptide->SetStoredPeaks(current_pb_peptide_);
+    return;
+  }
+  theoretical_peak_set_.Clear();
   peptide->ComputeTheoreticalPeaks(&theoretical_peak_set_, current_pb_peptide_,
                                    compiler_prog1_, compiler_prog2_, dia_mode);
 }
@@ -67,8 +147,12 @@ bool ActivePeptideQueue::isWithinIsotope(vector<double>* min_mass, vector<double
 }
 
 int ActivePeptideQueue::SetActiveRange(vector<double>* min_mass, vector<double>* max_mass, double min_range, double max_range, vector<bool>* candidatePeptideStatus, bool dia_mode) {
+  if (IsView()) {
+    return SelectActiveRange(min_mass, max_mass, min_range, max_range, candidatePeptideStatus);
+  }
+  bool tailor = GlobalParams::getUseTailorCalibration();
   int min_candidates = 0;  //Added for tailor score calibration method by AKF
-  if (Params::GetBool("use-tailor-calibration")) {
+  if (tailor) {
     min_candidates = 30;
   }
   //min_range and max_range have been introduced to fix a bug
@@ -87,48 +171,39 @@ int ActivePeptideQueue::SetActiveRange(vector<double>* min_mass, vector<double>*
     vector<Peptide::spectrum_matches>().swap(peptide->spectrum_matches_array);
     // would delete peptide's underlying pb::Peptide;
     queue_.pop_front();
-    delete peptide;
+    peptide_pool_->Free(peptide);
   }
   if (queue_.empty()) {
-    //cerr << "Releasing All\n";
-//    fifo_alloc_peptides_.ReleaseAll();
 #ifndef CPP_SCORING
-    fifo_alloc_prog1_.ReleaseAll();
-    fifo_alloc_prog2_.ReleaseAll();
+    fifo_alloc_prog1_->ReleaseAll();
+    fifo_alloc_prog2_->ReleaseAll();
 #endif
-    //cerr << "Prog1: ";
-    //fifo_alloc_prog1_.Show();
-    //cerr << "Prog2: ";
-    //fifo_alloc_prog2_.Show();
   } else {
-    // Free all peptides up to, but not including peptide.
-    // fifo_alloc_peptides_.Release(peptide);
+    // Free the programs of all peptides up to, but not including peptide.
 #ifndef CPP_SCORING	
     Peptide* peptide = queue_.front();
-    peptide->ReleaseFifo(&fifo_alloc_prog1_, &fifo_alloc_prog2_);
+    peptide->ReleaseFifo(fifo_alloc_prog1_, fifo_alloc_prog2_);
 #endif
   }
 
   // Enqueue all peptides that are not yet queued but are lighter than
   // max_range. For each new enqueued peptide compute the corresponding
-  // theoretical peaks. Data associated with each peptide is allocated by
-  // fifo_alloc_peptides_.
+  // theoretical peaks. Peptides are taken from peptide_pool_.
   bool done = false;
   //Modified for tailor score calibration method by AKF
   if (queue_.empty() || queue_.back()->Mass() <= max_range || queue_.size() < min_candidates) {
     if (!queue_.empty()) {
       ComputeTheoreticalPeaksBack(dia_mode);
     }
-    while (!(done = reader_->Done())) {
+    SeekReader(min_range);
+    while (!(done = ReaderDone())) {
       // read all peptides lighter than max_range
-      reader_->Read(&current_pb_peptide_);
+      ReadPeptide();
       if (current_pb_peptide_.mass() < min_range) {
         // we would delete current_pb_peptide_;
         continue; // skip peptides that fall below min_range
       }
-/*      Peptide* peptide = new(&fifo_alloc_peptides_)
-        Peptide(current_pb_peptide_, proteins_, &fifo_alloc_peptides_);
-  */    Peptide* peptide = new Peptide(current_pb_peptide_, proteins_, NULL);        
+      Peptide* peptide = peptide_pool_->New(current_pb_peptide_, proteins_);
       assert(peptide != NULL);
       queue_.push_back(peptide);
       //Modified for tailor score calibration method by AKF
@@ -151,12 +226,12 @@ int ActivePeptideQueue::SetActiveRange(vector<double>* min_mass, vector<double>*
   iter_ = queue_.begin();
   while (iter_ != queue_.end() && (*iter_)->Mass() < min_mass->front()) {
     ++iter_;
-    if (Params::GetBool("use-tailor-calibration")) { //Added by AKF
+    if (tailor) { //Added by AKF
       candidatePeptideStatus->push_back(false);  
     }
   }
   end_ = iter_;
-  if (Params::GetBool("use-tailor-calibration")) { //Added by AKF
+  if (tailor) { //Added by AKF
     iter_ = queue_.begin();
   }
   int* isotope_idx = new int(0);
@@ -181,7 +256,7 @@ int ActivePeptideQueue::SetActiveRange(vector<double>* min_mass, vector<double>*
     return 0;
   }
   //Added for tailor score calibration method by AKF
-  if (Params::GetBool("use-tailor-calibration")) {
+  if (tailor) {
     while (end_ != queue_.end()) {  //Added by AKF
       if ((*end_)->Prog(1) == NULL || candidatePeptideStatus->size() >= min_candidates-1) {
         break;
@@ -204,6 +279,9 @@ void ActivePeptideQueue::ComputeBTheoreticalPeaksBack() {
 }
 
 int ActivePeptideQueue::SetActiveRangeBIons(vector<double>* min_mass, vector<double>* max_mass, double min_range, double max_range, vector<bool>* candidatePeptideStatus) {
+  if (IsView()) {
+    return SelectActiveRangeBIons(min_mass, max_mass, min_range, candidatePeptideStatus);
+  }
     exact_pval_search_ = true;
   // queue front() is lightest; back() is heaviest
 
@@ -216,32 +294,22 @@ int ActivePeptideQueue::SetActiveRangeBIons(vector<double>* min_mass, vector<dou
     vector<Peptide::spectrum_matches>().swap(peptide->spectrum_matches_array);
     queue_.pop_front();
     b_ion_queue_.pop_front();
-    delete peptide;
-  }
-/*  if (queue_.empty()) {
-    fifo_alloc_peptides_.ReleaseAll();
-  } else {
-    Peptide* peptide = queue_.front();
-    // Free all peptides up to, but not including peptide.
-    // fifo_alloc_peptides_.Release(peptide);
+    peptide_pool_->Free(peptide);
   }
-*/
   // Enqueue all peptides that are not yet queued but are lighter than
   // max_range. For each new enqueued peptide compute the corresponding
-  // theoretical peaks. Data associated with each peptide is allocated by
-  // fifo_alloc_peptides_.
+  // theoretical peaks. Peptides are taken from peptide_pool_.
   bool done;
   if (queue_.empty() || queue_.back()->Mass() <= max_range) {
-    while (!(done = reader_->Done())) {
+    SeekReader(min_range);
+    while (!(done = ReaderDone())) {
       // read all peptides lighter than max_range
-      reader_->Read(&current_pb_peptide_);
+      ReadPeptide();
       if (current_pb_peptide_.mass() < min_range) {
         // we would delete current_pb_peptide_;
         continue; // skip peptides that fall below min_range
       }
-/*      Peptide* peptide = new(&fifo_alloc_peptides_)
-        Peptide(current_pb_peptide_, proteins_, &fifo_alloc_peptides_);
-*/      Peptide* peptide = new Peptide(current_pb_peptide_, proteins_, NULL);                
+      Peptide* peptide = peptide_pool_->New(current_pb_peptide_, proteins_);
       queue_.push_back(peptide);
       ComputeBTheoreticalPeaksBack();
       if (peptide->Mass() > max_range) {
@@ -288,6 +356,234 @@ int ActivePeptideQueue::SetActiveRangeBIons(vector<double>* min_mass, vector<dou
   return active;
 }
 
+void ActivePeptideQueue::PopFront() {
+  Peptide* peptide = queue_.front();
+  //print hits in peptide-centric search
+  ReportPeptideHits(peptide);
+  queue_.pop_front();
+  if (b_ions_only_) {
+    b_ion_queue_.pop_front();
+  }
+  peptide_pool_->Free(peptide);
+}
+
+// Unlike SetActiveRange(), the window keeps at least min_candidates + 1
+// peptides heavier than max_range when Tailor calibration is used, so that
+// any view can extend its candidate list to min_candidates peptides (see
+// SelectActiveRange()), and it leaves every peptide it reads for
+// ComputeWindowPeaks() instead of computing the peaks itself.
+void ActivePeptideQueue::AdvanceWindow(double min_range, double max_range) {
+  assert(!IsView());
+  int min_candidates = GlobalParams::getUseTailorCalibration() ? 30 : 0;
+
+  while (!queue_.empty() && queue_.front()->Mass() < min_range) {
+    PopFront();
+  }
+#ifndef CPP_SCORING
+  if (queue_.empty()) {
+    fifo_alloc_prog1_->ReleaseAll();
+    fifo_alloc_prog2_->ReleaseAll();
+  } else {
+    queue_.front()->ReleaseFifo(fifo_alloc_prog1_, fifo_alloc_prog2_);
+  }
+#endif
+  // Count the peptides already loaded beyond max_range.
+  int heavier = 0;
+  for (deque<Peptide*>::const_reverse_iterator i = queue_.rbegin();
+       i != queue_.rend() && (*i)->Mass() > max_range && heavier <= min_candidates; ++i) {
+    ++heavier;
+  }
+  compute_begin_ = compute_end_ = queue_.size();
+  if (heavier > min_candidates) {
+    return;
+  }
+  SeekReader(min_range);
+  while (!ReaderDone()) {
+    ReadPeptide();
+    if (current_pb_peptide_.mass() < min_range) {
+      continue; // skip peptides that fall below min_range
+    }
+    Peptide* peptide = peptide_pool_->New(current_pb_peptide_, proteins_);
+    if (use_stored_peaks_) {
+      peptide->SetStoredPeaks(current_pb_peptide_);
+    }
+    queue_.push_back(peptide);
+    if (peptide->Mass() > max_range && ++heavier > min_candidates) {
+      break;
+    }
+  }
+  compute_end_ = queue_.size();
+}
+
+void ActivePeptideQueue::AdvanceWindowBIons(double min_range, double max_range) {
+  assert(!IsView());
+  exact_pval_search_ = true;
+  b_ions_only_ = true;
+
+  while (!queue_.empty() && queue_.front()->Mass() < min_range) {
+    PopFront();
+  }
+  compute_begin_ = compute_end_ = queue_.size();
+  if (!queue_.empty() && queue_.back()->Mass() > max_range) {
+    return;
+  }
+  SeekReader(min_range);
+  while (!ReaderDone()) {
+    ReadPeptide();
+    if (current_pb_peptide_.mass() < min_range) {
+      continue; // skip peptides that fall below min_range
+    }
+    Peptide* peptide = peptide_pool_->New(current_pb_peptide_, proteins_);
+    queue_.push_back(peptide);
+    // placeholder, filled in by ComputeWindowPeaks()
+    b_ion_queue_.push_back(TheoreticalPeakSetBIons());
+    if (peptide->Mass() > max_range) {
+      break;
+    }
+  }
+  compute_end_ = queue_.size();
+}
+
+// Views split the new peptides between them by position. The peptides are
+// already in the window, so each peptide's peaks are written in place and
+// nothing in the window is reallocated.
+void ActivePeptideQueue::ComputeWindowPeaks(int part, int num_parts) {
+  ActivePeptideQueue* window = window_;
+#ifndef CPP_SCORING
+  // The compiled programs must be laid out in queue order by the window's
+  // own compilers.
+  if (part != 0) {
+    return;
+  }
+  num_parts = 1;
+  TheoreticalPeakCompiler* compiler_prog1 = window->compiler_prog1_;
+  TheoreticalPeakCompiler* compiler_prog2 = window->compiler_prog2_;
+#else
+  TheoreticalPeakCompiler* compiler_prog1 = NULL;
+  TheoreticalPeakCompiler* compiler_prog2 = NULL;
+#endif
+  for (int i = window->compute_begin_ + part; i < window->compute_end_; i += num_parts) {
+    Peptide* peptide = window->queue_[i];
+    if (window->b_ions_only_) {
+      TheoreticalPeakSetBIons* peaks = &window->b_ion_queue_[i];
+      peaks->binWidth_ = theoretical_b_peak_set_.binWidth_;
+      peaks->binOffset_ = theoretical_b_peak_set_.binOffset_;
+      peptide->ComputeBTheoreticalPeaks(peaks);
+    } else if (!window->use_stored_peaks_) {
+      theoretical_peak_set_.Clear();
+      peptide->ComputeTheoreticalPeaks(&theoretical_peak_set_, window->current_pb_peptide_,
+                                       compiler_prog1, compiler_prog2);
+    }
+  }
+}
+
+void ActivePeptideQueue::SetUseStoredPeaks(bool use_stored_peaks) {
+#ifdef CPP_SCORING
+  use_stored_peaks_ = use_stored_peaks;
+#else
+  // The compiled programs are generated from the workspace.
+  use_stored_peaks_ = false;
+#endif
+}
+
+static bool MassLess(const Peptide* peptide, double mass) {
+  return peptide->Mass() < mass;
+}
+
+// Candidate selection against the shared window. The result is the same as
+// that of SetActiveRange() on a queue that was empty before the call: the
+// candidates start from the lightest peptide not lighter than min_range, and
+// with Tailor calibration the extra non-candidate peptides stop where such a
+// queue would have stopped reading.
+int ActivePeptideQueue::SelectActiveRange(vector<double>* min_mass, vector<double>* max_mass, double min_range, double max_range, vector<bool>* candidatePeptideStatus) {
+  const deque<Peptide*>& queue = window_->queue_;
+  bool tailor = GlobalParams::getUseTailorCalibration();
+  int min_candidates = tailor ? 30 : 0;
+  deque<Peptide*>::const_iterator start =
+    lower_bound(queue.begin(), queue.end(), min_range, MassLess);
+  if (start == queue.end()) {
+    return 0;
+  }
+
+  iter_ = start;
+  while (iter_ != queue.end() && (*iter_)->Mass() < min_mass->front()) {
+    ++iter_;
+    if (tailor) {
+      candidatePeptideStatus->push_back(false);
+    }
+  }
+  end_ = iter_;
+  if (tailor) {
+    iter_ = start;
+  }
+  int isotope_idx = 0;
+  int active = 0;
+  active_targets_ = active_decoys_ = 0;
+  while (end_ != queue.end() && (*end_)->Mass() < max_mass->back()) {
+    if (isWithinIsotope(min_mass, max_mass, (*end_)->Mass(), &isotope_idx)) {
+      ++active;
+      candidatePeptideStatus->push_back(true);
+      if (!(*end_)->IsDecoy()) {
+        ++active_targets_;
+      } else {
+        ++active_decoys_;
+      }
+    } else {
+      candidatePeptideStatus->push_back(false);
+    }
+    ++end_;
+  }
+  if (active == 0) {
+    return 0;
+  }
+  if (tailor) {
+    while (end_ != queue.end()) {
+      if ((*end_)->Prog(1) == NULL || candidatePeptideStatus->size() >= min_candidates-1 ||
+          ((*end_)->Mass() > max_range && end_ - start >= min_candidates)) {
+        break;
+      }
+      candidatePeptideStatus->push_back(false);
+      ++end_;
+    }
+  }
+  return active;
+}
+
+int ActivePeptideQueue::SelectActiveRangeBIons(vector<double>* min_mass, vector<double>* max_mass, double min_range, vector<bool>* candidatePeptideStatus) {
+  const deque<Peptide*>& queue = window_->queue_;
+  deque<Peptide*>::const_iterator start =
+    lower_bound(queue.begin(), queue.end(), min_range, MassLess);
+
+  iter_ = start;
+  iter1_ = window_->b_ion_queue_.begin() + (start - queue.begin());
+  while (iter_ != queue.end() && (*iter_)->Mass() < min_mass->front()) {
+    ++iter_;
+    ++iter1_;
+  }
+
+  int isotope_idx = 0;
+  end_ = iter_;
+  end1_ = iter1_;
+  int active = 0;
+  active_targets_ = active_decoys_ = 0;
+  while (end_ != queue.end() && (*end_)->Mass() < max_mass->back()) {
+    if (isWithinIsotope(min_mass, max_mass, (*end_)->Mass(), &isotope_idx)) {
+      ++active;
+      candidatePeptideStatus->push_back(true);
+      if (!(*end_)->IsDecoy()) {
+        ++active_targets_;
+      } else {
+        ++active_decoys_;
+      }
+    } else {
+      candidatePeptideStatus->push_back(false);
+    }
+    ++end_;
+    ++end1_;
+  }
+  return active;
+}
+
 int ActivePeptideQueue::CountAAFrequency(
   vector<double>& dAAFreqN,
   vector<double>& dAAFreqI,
@@ -318,13 +614,13 @@ int ActivePeptideQueue::CountAAFrequency(
   memset(nvAAMassCounterI, 0, MaxModifiedAAMassBin * sizeof(unsigned int));
 
   
-  while (!(reader_->Done())) { // read all peptides in index
-    reader_->Read(&current_pb_peptide_);
+  while (!ReaderDone()) { // read all peptides in index
+    ReadPeptide();
 	  len = current_pb_peptide_.length();
     first_loc_protein_id = current_pb_peptide_.first_location().protein_id(),
     first_loc_pos = current_pb_peptide_.first_location().pos(),	  
 //    peptide_seq = proteins_[first_loc_protein_id]->residues().data() + first_loc_pos;
-	  protein_length = proteins_[first_loc_protein_id]->residues().length();
+	  protein_length = proteins_.Length(first_loc_protein_id);
  /*   Peptide* peptide = new Peptide(current_pb_peptide_, proteins_, NULL);     
     printf("%s\t", peptide->SeqWithMods().c_str());
     if (peptide->IsDecoy()){
@@ -338,7 +634,7 @@ int ActivePeptideQueue::CountAAFrequency(
       residues_ = current_pb_peptide_.decoy_sequence().data();  // Make a copy of the string, because pb::Peptide will be reused.
       // residues_ = decoy_seq_.data();
     } else {  //old tide-index format
-      residues_ = proteins_[first_loc_protein_id]->residues().data() + first_loc_pos;
+      residues_ = proteins_.Residues(first_loc_protein_id) + first_loc_pos;
     }
     // printf("%s\n", string(residues_, len).c_str());
     peptide_seq = residues_;
@@ -446,10 +742,10 @@ int ActivePeptideQueue::CountAAFrequency(
     memset(nvAAMassCounterC, 0, MaxModifiedAAMassBin * sizeof(unsigned int));
     memset(nvAAMassCounterI, 0, MaxModifiedAAMassBin * sizeof(unsigned int));
 
-    while (!(reader_->Done())) { // read all peptides in index
-      reader_->Read(&current_pb_peptide_);
+    while (!ReaderDone()) { // read all peptides in index
+      ReadPeptide();
 	  
-      Peptide* peptide = new(&fifo_alloc_peptides_) Peptide(current_pb_peptide_, proteins_, &fifo_alloc_peptides_);
+      Peptide* peptide = peptide_pool_->New(current_pb_peptide_, proteins_);
 
       vector<double> dAAResidueMass = peptide->getAAMasses(); //retrieves the amino acid masses, modifications included
 
@@ -462,7 +758,7 @@ int ActivePeptideQueue::CountAAFrequency(
       ++nvAAMassCounterC[(unsigned int)(dAAResidueMass[nLen - 1] / binWidth + 1.0 - binOffset)];
       ++cntTerm;
 
-      fifo_alloc_peptides_.ReleaseAll();
+      peptide_pool_->Free(peptide);
     }
 
   //calculate the unique masses
@@ -517,9 +813,9 @@ int ActivePeptideQueue::CountAAFrequencyRes(
   map<double, int> cMap; //Cterm residues
   map<double, int> allMap; //all residues
 
-  while (!(reader_->Done())) { //read all peptides in index
-    reader_->Read(&current_pb_peptide_);
-    Peptide* peptide = new(&fifo_alloc_peptides_) Peptide(current_pb_peptide_, proteins_, &fifo_alloc_peptides_);
+  while (!ReaderDone()) { //read all peptides in index
+    ReadPeptide();
+    Peptide* peptide = new(fifo_alloc_peptides_->New(sizeof(Peptide))) Peptide(current_pb_peptide_, proteins_, fifo_alloc_peptides_);
 
     vector<double> dAAResidueMass = peptide->getAAMasses(); //retrieves the amino acid massses, modifications included
 
@@ -579,7 +875,7 @@ int ActivePeptideQueue::CountAAFrequencyRes(
     }
 
     //release memory
-    fifo_alloc_peptides_.ReleaseAll();
+    fifo_alloc_peptides_->ReleaseAll();
   }
 
   //determine the unique masses for all residues
@@ -606,9 +902,10 @@ void ActivePeptideQueue::ReportPeptideHits(Peptide* peptide) {
     matches.exact_pval_search_ = exact_pval_search_;
     matches.elution_window_ = elution_window_;
 
-    if (!output_files_) { //only tab-delimited output is supported
-        matches.report(target_file_, decoy_file_, top_matches_,
-                       this, proteins_, *locations_, compute_sp_);
-    }
+    matches.psm_sink_ = psm_sink_;
+    matches.psm_key_ = psm_key_;
+    ++psm_key_.Item;
+    matches.report(target_file_, decoy_file_, top_matches_,
+                   this, proteins_, compute_sp_);
 }
 
@@ -12,12 +12,14 @@
 // 
 // iterator supplied to match vector<> template usage.
 //
-// Init() will permit optional use of a FifoAllocator for allocation.
+// Init() will permit optional use of a FifoAllocator or a ScratchArena for
+// allocation.
 
 #ifndef FIXED_CAP_ARRAY_H
 #define FIXED_CAP_ARRAY_H
 
 #include "fifo_alloc.h"
+#include "scratch_arena.h"
 
 template <class C>
 class FixedCapacityArray {
@@ -45,6 +47,12 @@ class FixedCapacityArray {
     del_ = false;
   }
 
+  // The array lives until the arena is reset.
+  void Init(ScratchArena* arena, int capacity) {
+    data_ = arena->New<C>(capacity);
+    del_ = false;
+  }
+
   ~FixedCapacityArray() { if (del_) delete[] data_; }
   
   void clear() { size_ = 0; }
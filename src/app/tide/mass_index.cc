@@ -0,0 +1,317 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef _MSC_VER
+#include <io.h>
+#include "mman.h"
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include "mass_index.h"
+#include "records.h"
+#include "header.pb.h"
+#include "io/carp.h"
+#include "util/FileUtils.h"
+
+using namespace std;
+
+static const char MASS_INDEX_MAGIC[8] = { 'm', 'a', 's', 's', 'i', 'x', '\0', '\0' };
+static const uint32_t MASS_INDEX_VERSION = 3;
+
+// Rounds a pool size in bytes up to a multiple of 8, so that what follows
+// the pool stays aligned for doubles.
+static uint64_t padded(uint64_t bytes) {
+  return (bytes + 7) & ~(uint64_t) 7;
+}
+
+static uint64_t expectedLength(const MassIndexHeader& header) {
+  return sizeof(MassIndexHeader)
+    + header.num_peptides * sizeof(MassIndexRecord)
+    + padded(header.num_ints * sizeof(int32_t))
+    + padded(header.num_chars)
+    + header.num_table_entries * sizeof(double);
+}
+
+static bool headerValid(const MassIndexHeader& header) {
+  uint64_t stride = MassIndexReader::kTableStride;
+  return memcmp(header.magic, MASS_INDEX_MAGIC, sizeof(MASS_INDEX_MAGIC)) == 0 &&
+    header.version == MASS_INDEX_VERSION &&
+    header.record_size == sizeof(MassIndexRecord) &&
+    header.table_stride == stride &&
+    header.num_table_entries == (header.num_peptides + stride - 1) / stride;
+}
+
+// Returns the size of a file, or -1 if it cannot be read.
+static int64_t fileSize(const string& filename) {
+  struct stat info;
+  if (stat(filename.c_str(), &info) != 0) {
+    return -1;
+  }
+  return info.st_size;
+}
+
+// Returns the modification time of a file, or -1 if it cannot be read.
+static int64_t fileMtime(const string& filename) {
+  struct stat info;
+  if (stat(filename.c_str(), &info) != 0) {
+    return -1;
+  }
+  return info.st_mtime;
+}
+
+void MassIndexWriter::Convert(const string& source, const string& filename) {
+  pb::Header header;
+  HeadedRecordReader reader(source, &header);
+  if (!reader.OK() || header.file_type() != pb::Header::PEPTIDES) {
+    carp(CARP_FATAL, "Error reading index (%s)", source.c_str());
+  }
+  MassIndexWriter writer(filename, source);
+  pb::Peptide peptide;
+  while (!reader.Done()) {
+    if (!reader.Read(&peptide)) {
+      carp(CARP_FATAL, "Error reading index (%s)", source.c_str());
+    }
+    writer.Write(peptide);
+  }
+  writer.Close();
+}
+
+MassIndexWriter::MassIndexWriter(const string& filename, const string& source)
+  : filename_(filename),
+    out_(filename.c_str(), ios::binary | ios::trunc),
+    ints_filename_(filename + ".ints.tmp"),
+    chars_filename_(filename + ".chars.tmp"),
+    ints_out_(ints_filename_.c_str(), ios::binary | ios::trunc),
+    chars_out_(chars_filename_.c_str(), ios::binary | ios::trunc),
+    last_mass_(-numeric_limits<double>::infinity()),
+    closed_(false) {
+  if (!out_ || !ints_out_ || !chars_out_) {
+    carp(CARP_FATAL, "Couldn't open file %s for write.", filename.c_str());
+  }
+  memset(&header_, 0, sizeof(header_));
+  memcpy(header_.magic, MASS_INDEX_MAGIC, sizeof(MASS_INDEX_MAGIC));
+  header_.version = MASS_INDEX_VERSION;
+  header_.record_size = sizeof(MassIndexRecord);
+  header_.source_size = fileSize(source);
+  header_.source_mtime = fileMtime(source);
+  header_.table_stride = MassIndexReader::kTableStride;
+  // placeholder, rewritten by Close()
+  out_.write((const char*) &header_, sizeof(header_));
+}
+
+MassIndexWriter::~MassIndexWriter() {
+  Close();
+}
+
+void MassIndexWriter::Write(const pb::Peptide& peptide) {
+  if (peptide.mass() < last_mass_) {
+    carp(CARP_FATAL, "The peptides written to %s are not sorted by mass.",
+         filename_.c_str());
+  }
+  last_mass_ = peptide.mass();
+
+  MassIndexRecord record;
+  memset(&record, 0, sizeof(record));
+  record.mass = peptide.mass();
+  record.id = peptide.id();
+  record.protein_id = peptide.first_location().protein_id();
+  record.pos = peptide.first_location().pos();
+  record.length = peptide.length();
+  if (peptide.has_aux_locations_index()) {
+    record.flags |= MassIndexRecord::HAS_AUX_LOCATIONS_INDEX;
+    record.aux_locations_index = peptide.aux_locations_index();
+  }
+  if (peptide.has_decoy_index()) {
+    record.flags |= MassIndexRecord::HAS_DECOY_INDEX;
+    record.decoy_index = peptide.decoy_index();
+  }
+  if (peptide.has_decoy_sequence()) {
+    const string& sequence = peptide.decoy_sequence();
+    if (sequence.length() != (size_t) peptide.length()) {
+      carp(CARP_FATAL, "Decoy sequence %s of peptide %lld does not have the length "
+           "of its target.", sequence.c_str(), (long long) peptide.id());
+    }
+    record.flags |= MassIndexRecord::HAS_DECOY_SEQUENCE;
+    record.chars_offset = header_.num_chars;
+    chars_out_.write(sequence.data(), sequence.length());
+    header_.num_chars += sequence.length();
+  }
+  record.ints_offset = header_.num_ints;
+  AppendInts(peptide.modifications(), &record.num_mods);
+  AppendInts(peptide.peak1(), &record.num_peak1);
+  AppendInts(peptide.peak2(), &record.num_peak2);
+  AppendInts(peptide.neg_peak1(), &record.num_neg_peak1);
+  AppendInts(peptide.neg_peak2(), &record.num_neg_peak2);
+
+  if (header_.num_peptides % MassIndexReader::kTableStride == 0) {
+    table_.push_back(record.mass);
+  }
+  out_.write((const char*) &record, sizeof(record));
+  ++header_.num_peptides;
+}
+
+void MassIndexWriter::AppendInts(
+  const google::protobuf::RepeatedField<google::protobuf::int32>& ints,
+  uint16_t* count) {
+  if (ints.size() > numeric_limits<uint16_t>::max()) {
+    carp(CARP_FATAL, "Too many values in a peptide for %s.", filename_.c_str());
+  }
+  *count = ints.size();
+  if (ints.size() > 0) {
+    ints_out_.write((const char*) ints.data(), ints.size() * sizeof(int32_t));
+    header_.num_ints += ints.size();
+  }
+}
+
+void MassIndexWriter::Close() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  ints_out_.close();
+  chars_out_.close();
+  static const char zeros[8] = { 0 };
+  uint64_t ints_bytes = header_.num_ints * sizeof(int32_t);
+  if (header_.num_ints > 0) {
+    ifstream ints_in(ints_filename_.c_str(), ios::binary);
+    out_ << ints_in.rdbuf();
+  }
+  out_.write(zeros, padded(ints_bytes) - ints_bytes);
+  if (header_.num_chars > 0) {
+    ifstream chars_in(chars_filename_.c_str(), ios::binary);
+    out_ << chars_in.rdbuf();
+  }
+  out_.write(zeros, padded(header_.num_chars) - header_.num_chars);
+  if (!table_.empty()) {
+    out_.write((const char*) &table_[0], table_.size() * sizeof(double));
+  }
+  header_.num_table_entries = table_.size();
+  out_.seekp(0);
+  out_.write((const char*) &header_, sizeof(header_));
+  out_.close();
+  FileUtils::Remove(ints_filename_);
+  FileUtils::Remove(chars_filename_);
+  if (!out_) {
+    carp(CARP_FATAL, "Error writing %s.", filename_.c_str());
+  }
+}
+
+MassIndexReader::MassIndexReader(const string& filename)
+  : length_(0), data_(NULL), header_(NULL), records_(NULL), ints_(NULL),
+    chars_(NULL), table_(NULL), size_(0), next_(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(MassIndexHeader)) {
+    close(fd);
+    return;
+  }
+  length_ = info.st_size;
+  // Read-only and shared, so every reader of the index uses the same pages.
+  void* data = mmap(NULL, length_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return;
+  }
+  data_ = data;
+  header_ = (const MassIndexHeader*) data_;
+  if (!headerValid(*header_) || expectedLength(*header_) != length_) {
+    carp(CARP_ERROR, "%s is not a valid mass index.", filename.c_str());
+    Unmap();
+    return;
+  }
+  records_ = (const MassIndexRecord*) (header_ + 1);
+  ints_ = (const int32_t*) (records_ + header_->num_peptides);
+  chars_ = (const char*) ints_ + padded(header_->num_ints * sizeof(int32_t));
+  table_ = (const double*) (chars_ + padded(header_->num_chars));
+  size_ = header_->num_peptides;
+}
+
+MassIndexReader::~MassIndexReader() {
+  Unmap();
+}
+
+void MassIndexReader::Unmap() {
+  if (data_ != NULL) {
+    munmap(data_, length_);
+    data_ = NULL;
+  }
+}
+
+bool MassIndexReader::Usable(const string& filename, const string& source) {
+  ifstream in(filename.c_str(), ios::binary);
+  MassIndexHeader header;
+  if (!in.read((char*) &header, sizeof(header))) {
+    return false;
+  }
+  return headerValid(header) &&
+    (int64_t) header.source_size == fileSize(source) &&
+    header.source_mtime == fileMtime(source) &&
+    (int64_t) expectedLength(header) == fileSize(filename);
+}
+
+static void copyInts(const int32_t* begin, uint16_t count,
+                     google::protobuf::RepeatedField<google::protobuf::int32>* ints) {
+  ints->Reserve(count);
+  for (uint16_t i = 0; i < count; ++i) {
+    ints->Add(begin[i]);
+  }
+}
+
+bool MassIndexReader::Read(pb::Peptide* peptide) {
+  if (Done()) {
+    return false;
+  }
+  const MassIndexRecord& record = records_[next_++];
+  peptide->Clear();
+  peptide->set_id(record.id);
+  peptide->set_mass(record.mass);
+  peptide->set_length(record.length);
+  pb::Location* location = peptide->mutable_first_location();
+  location->set_protein_id(record.protein_id);
+  location->set_pos(record.pos);
+  if (record.flags & MassIndexRecord::HAS_AUX_LOCATIONS_INDEX) {
+    peptide->set_aux_locations_index(record.aux_locations_index);
+  }
+  if (record.flags & MassIndexRecord::HAS_DECOY_INDEX) {
+    peptide->set_decoy_index(record.decoy_index);
+  }
+  if (record.flags & MassIndexRecord::HAS_DECOY_SEQUENCE) {
+    peptide->set_decoy_sequence(chars_ + record.chars_offset, record.length);
+  }
+  const int32_t* ints = ints_ + record.ints_offset;
+  copyInts(ints, record.num_mods, peptide->mutable_modifications());
+  ints += record.num_mods;
+  copyInts(ints, record.num_peak1, peptide->mutable_peak1());
+  ints += record.num_peak1;
+  copyInts(ints, record.num_peak2, peptide->mutable_peak2());
+  ints += record.num_peak2;
+  copyInts(ints, record.num_neg_peak1, peptide->mutable_neg_peak1());
+  ints += record.num_neg_peak1;
+  copyInts(ints, record.num_neg_peak2, peptide->mutable_neg_peak2());
+  return true;
+}
+
+static bool recordLighter(const MassIndexRecord& record, double mass) {
+  return record.mass < mass;
+}
+
+void MassIndexReader::Seek(double min_mass) {
+  if (Done() || records_[next_].mass >= min_mass) {
+    return;
+  }
+  // The first table entry not lighter than min_mass bounds the search from
+  // above; the entry before it, from below.
+  uint64_t num_entries = header_->num_table_entries;
+  uint64_t entry = lower_bound(table_, table_ + num_entries, min_mass) - table_;
+  uint64_t begin = entry > 0 ? (entry - 1) * kTableStride : 0;
+  uint64_t end = entry < num_entries ? entry * kTableStride : size_;
+  begin = max(begin, next_);
+  next_ = lower_bound(records_ + begin, records_ + end, min_mass, recordLighter) - records_;
+}
@@ -0,0 +1,161 @@
+// Mass-indexed peptide file.
+//
+// The peptides of a tide index are stored in pepix as length-prefixed
+// protocol buffer records, which can only be read front to back. A search
+// thus has to decode every peptide lighter than its first spectrum, and
+// every peptide in any gap between the mass ranges of its spectra.
+//
+// massix holds the same peptides, in the same order, as fixed-width records
+// of MassIndexRecord. The variable-length parts of a peptide (modification
+// codes, stored peak corrections and decoy sequences) go to two pools that
+// follow the records, and a sparse table holds the mass of every
+// kTableStride-th record. The file is memory mapped for reading, so the
+// records are never copied or parsed, a reader can jump to the first peptide
+// of a mass with a binary search, and the pages are shared by every thread
+// and process that reads the same index.
+//
+// File layout, all in native byte order:
+//   MassIndexHeader
+//   MassIndexRecord[num_peptides]
+//   int32[num_ints]            modifications, then peak1, peak2, neg_peak1
+//                              and neg_peak2 of each record, padded with
+//                              zeros to a multiple of 8 bytes
+//   char[num_chars]            decoy sequences, length characters each,
+//                              padded with zeros to a multiple of 8 bytes
+//   double[num_table_entries]  mass of records 0, kTableStride, ...
+//
+// tide-index writes massix next to pepix, which stays the reference for the
+// header and for the programs that have not been taught the new format. The
+// header of massix records the size and modification time of the pepix it
+// was made from, so a massix that is out of date is not used.
+//
+// Example usage:
+// if (MassIndexReader::Usable(massix_file, pepix_file)) {
+//   MassIndexReader reader(massix_file);
+//   pb::Peptide peptide;
+//   for (reader.Seek(min_mass); !reader.Done(); ) {
+//     reader.Read(&peptide);
+//     ...
+//   }
+// }
+
+#ifndef MASS_INDEX_H
+#define MASS_INDEX_H
+
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "peptides.pb.h"
+
+struct MassIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;        // sizeof(MassIndexRecord), as a sanity check
+  uint64_t source_size;        // size of the pepix file the peptides came from
+  int64_t source_mtime;        // and its modification time
+  uint64_t num_peptides;
+  uint64_t num_ints;
+  uint64_t num_chars;
+  uint64_t num_table_entries;
+  uint64_t table_stride;
+};
+
+struct MassIndexRecord {
+  enum Flags {
+    HAS_AUX_LOCATIONS_INDEX = 1,
+    HAS_DECOY_INDEX = 2,
+    HAS_DECOY_SEQUENCE = 4
+  };
+
+  double mass;
+  int64_t id;
+  uint64_t ints_offset;        // first int of the peptide in the int pool
+  uint64_t chars_offset;       // decoy sequence in the char pool
+  int32_t protein_id;          // first location
+  int32_t pos;
+  int32_t length;
+  int32_t aux_locations_index;
+  int32_t decoy_index;
+  uint16_t flags;
+  uint16_t num_mods;
+  uint16_t num_peak1;
+  uint16_t num_peak2;
+  uint16_t num_neg_peak1;
+  uint16_t num_neg_peak2;
+  uint16_t padding[4];
+};
+
+class MassIndexWriter {
+ public:
+  // Writes to filename the peptides of the pepix file source, which must be
+  // sorted by mass.
+  static void Convert(const std::string& source, const std::string& filename);
+
+  // source is the pepix file the peptides come from.
+  MassIndexWriter(const std::string& filename, const std::string& source);
+  // Calls Close().
+  ~MassIndexWriter();
+
+  // Appends a peptide. Peptides must be written in order of mass.
+  void Write(const pb::Peptide& peptide);
+
+  // Appends the pools and the mass table, and completes the header.
+  void Close();
+
+ private:
+  void AppendInts(const google::protobuf::RepeatedField<google::protobuf::int32>& ints,
+                  uint16_t* count);
+
+  std::string filename_;
+  std::ofstream out_;
+  std::string ints_filename_, chars_filename_;
+  std::ofstream ints_out_, chars_out_;
+  MassIndexHeader header_;
+  std::vector<double> table_;
+  double last_mass_;
+  bool closed_;
+};
+
+class MassIndexReader {
+ public:
+  explicit MassIndexReader(const std::string& filename);
+  ~MassIndexReader();
+
+  // True if filename is a complete massix made from the pepix file source
+  // as it is now.
+  static bool Usable(const std::string& filename, const std::string& source);
+
+  // client should check once after construction
+  bool OK() const { return data_ != NULL; }
+
+  bool Done() const { return next_ >= size_; }
+
+  // Fills peptide with the next record. Returns false at the end.
+  bool Read(pb::Peptide* peptide);
+
+  // Skips forward to the first peptide not lighter than min_mass. Never
+  // moves back.
+  void Seek(double min_mass);
+
+  uint64_t Size() const { return size_; }
+  uint64_t Position() const { return next_; }
+  double Mass(uint64_t i) const { return records_[i].mass; }
+
+  static const uint64_t kTableStride = 1024;
+
+ private:
+  void Unmap();
+
+  size_t length_;
+  void* data_;
+  const MassIndexHeader* header_;
+  const MassIndexRecord* records_;
+  const int32_t* ints_;
+  const char* chars_;
+  const double* table_;
+  uint64_t size_;
+  uint64_t next_;
+};
+
+#endif // MASS_INDEX_H
@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <limits>
+#include <new>
 #include <gflags/gflags.h>
 #include "mass_constants.h"
 #include "max_mz.h"
@@ -75,7 +76,7 @@ void Peptide::AddIons(W* workspace, bool dia_mode) {
   // Use workspace to assemble all B and Y ions. workspace will determine
   // which, if any, associated ions will be represented.
   double max_possible_peak = numeric_limits<double>::infinity();
-  if (MaxBin::Global().MaxBinEnd() > 0)
+  if (W::LIMITED_BY_MAX_BIN && MaxBin::Global().MaxBinEnd() > 0)
     max_possible_peak = MaxBin::Global().CacheBinEnd();
 
   vector<double> aa_masses = getAAMasses();
@@ -212,6 +213,58 @@ void Peptide::ComputeTheoreticalPeaks(TheoreticalPeakSetBYSparse* workspace, boo
 #endif
 }
 
+void Peptide::ComputeTheoreticalPeaks(TheoreticalPeakSetBYAll* workspace) {
+  AddIons<TheoreticalPeakSetBYAll>(workspace);
+}
+
+// The index stores, for each charge, the sorted codes (bin * 2, plus 1 for
+// charge 2) of all theoretical peaks as deltas. A search keeps only the peaks
+// below the cache limit, which are the ones TheoreticalPeakSetBYSparse would
+// have produced; see StoredPeaksUsable().
+void Peptide::SetStoredPeaks(const pb::Peptide& pb_peptide) {
+  unsigned int code_end = 2 * (MaxBin::Global().CacheBinEnd() - 1);
+  unsigned int code = 0;
+  peaks_0.clear();
+  peaks_1.clear();
+  for (int i = 0; i < pb_peptide.peak1_size(); ++i) {
+    code += pb_peptide.peak1(i);
+    if (code >= code_end) {
+      break;
+    }
+    peaks_0.push_back(code);
+  }
+  code = 0;
+  for (int i = 0; i < pb_peptide.peak2_size(); ++i) {
+    code += pb_peptide.peak2(i);
+    if (code >= code_end) {
+      break;
+    }
+    peaks_1.push_back(code);
+  }
+  prog1_ = (void*)3;  //Mark the peptide that it contains theoretical peaks to score
+}
+
+// TheoreticalPeakSetBYSparse drops each peak at or beyond bin
+// CacheBinEnd() - 1, so that filter is reproduced exactly, including which
+// ion claims a bin first. But Peptide::AddIons() also stops each ion series
+// once the fragment mass exceeds CacheBinEnd() (charge 1) or 2 * CacheBinEnd()
+// + 2 (charge 2). The stored peaks are exact only if every ion cut off this
+// way would have been dropped anyway, which depends on the bin width.
+bool Peptide::StoredPeaksUsable(const pb::Header_PeptidesHeader& header) {
+  if (!header.has_peaks_bin_width() ||
+      header.peaks_bin_width() != MassConstants::bin_width_ ||
+      header.peaks_bin_offset() != MassConstants::bin_offset_ ||
+      MaxBin::Global().MaxBinEnd() <= 0) {
+    return false;
+  }
+  int cache_bin_end = MaxBin::Global().CacheBinEnd();
+  // B ions are the lightest ions of a given fragment.
+  double max_charge_1 = cache_bin_end + MassConstants::B + MASS_PROTON;
+  double max_charge_2 = 2.0 * cache_bin_end + 2 + MassConstants::B + MASS_PROTON;
+  return MassConstants::mass2bin(max_charge_1, 1) >= cache_bin_end - 1 &&
+         MassConstants::mass2bin(max_charge_2, 2) >= cache_bin_end - 1;
+}
+
 void Peptide::ComputeBTheoreticalPeaks(TheoreticalPeakSetBIons* workspace) const {
   AddBIonsOnly<TheoreticalPeakSetBIons>(workspace);   // workspace for b ion only peak set
 #ifdef DEBUG
@@ -276,6 +329,36 @@ vector<double> Peptide::getAAMasses() const {
   return masses_charge;
 }
 
+PeptidePool::~PeptidePool() {
+  for (size_t i = 0; i < slabs_.size(); ++i) {
+    Peptide* slab = (Peptide*) slabs_[i];
+    int constructed = (i + 1 < slabs_.size()) ? slab_peptides_ : slab_used_;
+    for (int j = 0; j < constructed; ++j) {
+      slab[j].~Peptide();
+    }
+    delete[] slabs_[i];
+  }
+}
+
+Peptide* PeptidePool::New(const pb::Peptide& peptide,
+                          const ProteinStore& proteins) {
+  if (!free_.empty()) {
+    Peptide* result = free_.front();
+    free_.pop_front();
+    result->Reset(peptide, proteins);
+    return result;
+  }
+  if (slab_used_ == slab_peptides_) {
+    // new[] of char aligns for any type of the size requested.
+    slabs_.push_back(new char[sizeof(Peptide) * slab_peptides_]);
+    slab_used_ = 0;
+  }
+  Peptide* result = (Peptide*) slabs_.back() + slab_used_;
+  new(result) Peptide(peptide, proteins);
+  ++slab_used_;
+  return result;
+}
+
 // Probably defunct, uses old calling format.
 /*
 int NoInlineDotProd(Peptide* peptide, const int* cache, int charge) {
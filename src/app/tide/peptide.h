@@ -23,6 +23,7 @@
 #ifndef PEPTIDE_H
 #define PEPTIDE_H
 
+#include <deque>
 #include <iostream>
 #include <vector>
 #include "raw_proteins.pb.h"
@@ -30,8 +31,10 @@
 #include "theoretical_peak_set.h"
 #include "fifo_alloc.h"
 #include "mod_coder.h"
+#include "protein_store.h"
 #include "sp_scorer.h"
 #include "util/Params.h"
+#include "util/GlobalParams.h"
 
 #include "spectrum_collection.h"
 //#include "TideMatchSet.h"
@@ -47,6 +50,7 @@ class SpScorer;
 // different subclass  of TheoreticalPeakSet in a final version, pending more
 // tests. See Bugzilla #253.
 class TheoreticalPeakSetBYSparse;
+class TheoreticalPeakSetBYAll;
 //typedef TheoreticalPeakSetBYSparse ST_TheoreticalPeakSet; // ST="search time"
 // This is an alternative TheoreticalPeakSet
 // class TheoreticalPeakSetBYSparseOrdered;
@@ -61,8 +65,9 @@ class TheoreticalPeakCompiler;
 // to get called!! We actually RELY on the fact that when we use FIFO
 // allocation, the destructor won't get called. We expect the destructor to 
 // get called only when the object is created using the normal system memory
-// allocation. This way, we can use the destructor to clean up the system 
-// memory allocated for mods_ when FIFO allocation is NOT used.
+// allocation, or by a PeptidePool. This way, we can use the destructor to
+// clean up the system memory allocated for mods_ when FIFO allocation is NOT
+// used.
 class Peptide {
  public:
 
@@ -71,44 +76,32 @@ class Peptide {
   Peptide(const pb::Peptide& peptide,
           const vector<const pb::Protein*>& proteins,
           FifoAllocator* fifo_alloc = NULL)
-    : len_(peptide.length()), mass_(peptide.mass()), id_(peptide.id()),
-    first_loc_protein_id_(peptide.first_location().protein_id()),
-    first_loc_pos_(peptide.first_location().pos()), 
-    protein_length_(proteins[first_loc_protein_id_]->residues().length()),
-    has_aux_locations_index_(peptide.has_aux_locations_index()),
-    aux_locations_index_(peptide.aux_locations_index()),
-    mods_(NULL), num_mods_(0), decoyIdx_(peptide.has_decoy_index() ? peptide.decoy_index() : -1),
-    prog1_(NULL), prog2_(NULL) {
-      
-    // Here we make sure that tide-search is compatible with old and new tide-index protocol buffers.
-    // Set residues_ by pointing to the first occurrence in proteins.
-    if (peptide.has_decoy_sequence() == true){  //new tide-index format
-      decoy_seq_ = peptide.decoy_sequence();  // Make a copy of the string, because pb::Peptide will be reused.
-      residues_ = decoy_seq_.data();
-      target_residues_ = proteins[first_loc_protein_id_]->residues().data() 
-                        + first_loc_pos_;
-    } else {  //old tide-index format
-      residues_ = proteins[first_loc_protein_id_]->residues().data() 
-                      + first_loc_pos_;
-      if (IsDecoy()) {
-        target_residues_ = proteins[first_loc_protein_id_]->residues().data() 
-                          + first_loc_pos_+len_+1;
-      } else {
-        target_residues_ = residues_;
-      }
-    }
-                      
-    if (peptide.modifications_size() > 0) {
-      num_mods_ = peptide.modifications_size();
-      if (fifo_alloc) {
-        mods_ = (ModCoder::Mod*) fifo_alloc->New(sizeof(mods_[0]) * num_mods_);
-      } else {
-        mods_ = new ModCoder::Mod[num_mods_];
-      }
-      for (int i = 0; i < num_mods_; ++i)
-        mods_[i] = ModCoder::Mod(peptide.modifications(i));
-    }
-    mod_precision_ = Params::GetInt("mod-precision");    
+    : mods_storage_(NULL), mods_capacity_(0) {
+    const string& residues = proteins[peptide.first_location().protein_id()]->residues();
+    Init(peptide, residues.data(), residues.length(), fifo_alloc);
+  }
+
+  Peptide(const pb::Peptide& peptide,
+          const ProteinStore& proteins,
+          FifoAllocator* fifo_alloc = NULL)
+    : mods_storage_(NULL), mods_capacity_(0) {
+    int protein_id = peptide.first_location().protein_id();
+    Init(peptide, proteins.Residues(protein_id), proteins.Length(protein_id), fifo_alloc);
+  }
+
+  // Turns this Peptide into one for another pb::Peptide, as if it were newly
+  // constructed without a FifoAllocator, but keeps the memory of its arrays
+  // for the new peptide. Used by PeptidePool.
+  void Reset(const pb::Peptide& peptide, const ProteinStore& proteins) {
+    peaks_0.clear();
+    peaks_1.clear();
+    ion_mzbins_.clear();
+    b_ion_mzbins_.clear();
+    y_ion_mzbins_.clear();
+    ion_mzs_.clear();
+    spectrum_matches_array.clear();
+    int protein_id = peptide.first_location().protein_id();
+    Init(peptide, proteins.Residues(protein_id), proteins.Length(protein_id), NULL);
   }
   class spectrum_matches {
    public:
@@ -169,7 +162,7 @@ class Peptide {
   // is used for allocation. Please see the BIG CAUTION message at the top 
   // of the class definition for details.
   ~Peptide() {
-    delete[] mods_;
+    delete[] mods_storage_;
   }
 
   // Allocation by FifoAllocator
@@ -208,6 +201,17 @@ class Peptide {
                                TheoreticalPeakCompiler* compiler_prog2,
                                bool dia_mode = false);
   void ComputeBTheoreticalPeaks(TheoreticalPeakSetBIons* workspace) const;
+  // All theoretical peaks, for storing in the index.
+  void ComputeTheoreticalPeaks(TheoreticalPeakSetBYAll* workspace);
+
+  // Takes the theoretical peaks from those stored in the index with
+  // pb_peptide instead of computing them. Use only if StoredPeaksUsable().
+  void SetStoredPeaks(const pb::Peptide& pb_peptide);
+
+  // True if the theoretical peaks stored in an index with the given header
+  // are, after SetStoredPeaks(), exactly those ComputeTheoreticalPeaks() gives
+  // with the current bin settings and MaxBin::Global().
+  static bool StoredPeaksUsable(const pb::Header_PeptidesHeader& header);
 
   // Return the appropriate program depending on the precursor charge.
   // TODO 257: fix the unfortunate use of max_charge.
@@ -261,6 +265,60 @@ class Peptide {
   
 
  private:
+  // protein_residues and protein_length describe the protein of the first
+  // location of peptide.
+  void Init(const pb::Peptide& peptide,
+            const char* protein_residues,
+            int protein_length,
+            FifoAllocator* fifo_alloc) {
+    len_ = peptide.length();
+    mass_ = peptide.mass();
+    id_ = peptide.id();
+    first_loc_protein_id_ = peptide.first_location().protein_id();
+    first_loc_pos_ = peptide.first_location().pos();
+    protein_length_ = protein_length;
+    has_aux_locations_index_ = peptide.has_aux_locations_index();
+    aux_locations_index_ = peptide.aux_locations_index();
+    mods_ = NULL;
+    num_mods_ = 0;
+    decoyIdx_ = peptide.has_decoy_index() ? peptide.decoy_index() : -1;
+    prog1_ = NULL;
+    prog2_ = NULL;
+
+    // Here we make sure that tide-search is compatible with old and new tide-index protocol buffers.
+    // Set residues_ by pointing to the first occurrence in proteins.
+    if (peptide.has_decoy_sequence() == true){  //new tide-index format
+      decoy_seq_ = peptide.decoy_sequence();  // Make a copy of the string, because pb::Peptide will be reused.
+      residues_ = decoy_seq_.data();
+      target_residues_ = protein_residues + first_loc_pos_;
+    } else {  //old tide-index format
+      decoy_seq_.clear();
+      residues_ = protein_residues + first_loc_pos_;
+      if (IsDecoy()) {
+        target_residues_ = protein_residues + first_loc_pos_+len_+1;
+      } else {
+        target_residues_ = residues_;
+      }
+    }
+                      
+    if (peptide.modifications_size() > 0) {
+      num_mods_ = peptide.modifications_size();
+      if (fifo_alloc) {
+        mods_ = (ModCoder::Mod*) fifo_alloc->New(sizeof(mods_[0]) * num_mods_);
+      } else {
+        if (num_mods_ > mods_capacity_) {
+          delete[] mods_storage_;
+          mods_storage_ = new ModCoder::Mod[num_mods_];
+          mods_capacity_ = num_mods_;
+        }
+        mods_ = mods_storage_;
+      }
+      for (int i = 0; i < num_mods_; ++i)
+        mods_[i] = ModCoder::Mod(peptide.modifications(i));
+    }
+    mod_precision_ = GlobalParams::getModPrecision();
+  }
+
   template<class W> void AddIons(W* workspace, bool dia_mode = false) ;
   template<class W> void AddBIonsOnly(W* workspace) const;
 
@@ -284,6 +342,8 @@ class Peptide {
   const char* target_residues_;
   int num_mods_;
   ModCoder::Mod* mods_;
+  ModCoder::Mod* mods_storage_;  // owned memory for mods_, if not FIFO allocated
+  int mods_capacity_;
   int decoyIdx_;
   string decoy_seq_;
   int mod_precision_;
@@ -297,4 +357,39 @@ class Peptide {
   vector<double> ion_mzs_; // added for debug purpose
 };
 
+// Memory for the Peptides of an ActivePeptideQueue. Peptides leave the queue
+// in the order they entered it, so the pool constructs Peptides in slabs of
+// consecutive memory, takes back the ones that left the queue without
+// destroying them, and hands them out again oldest first. A recycled Peptide
+// is Reset() to the peptide just read and keeps the memory of its theoretical
+// peaks and other arrays, so a search does not allocate and free a Peptide
+// and its arrays for every peptide read, and neighbouring peptides of the
+// queue tend to be neighbours in memory as well.
+//
+// The pool destroys all of its Peptides when it is destroyed, including any
+// still in use. Not thread safe.
+//
+// Example usage:
+// PeptidePool pool;
+// Peptide* peptide = pool.New(pb_peptide, proteins);
+// ...
+// pool.Free(peptide);  // may come back from the next pool.New()
+class PeptidePool {
+ public:
+  explicit PeptidePool(int slab_peptides = 1024)
+    : slab_peptides_(slab_peptides < 1 ? 1 : slab_peptides),
+      slab_used_(slab_peptides_) {
+  }
+  ~PeptidePool();
+
+  Peptide* New(const pb::Peptide& peptide, const ProteinStore& proteins);
+  void Free(Peptide* peptide) { free_.push_back(peptide); }
+
+ private:
+  int slab_peptides_;
+  vector<char*> slabs_;
+  int slab_used_;        // Peptides constructed in slabs_.back()
+  deque<Peptide*> free_; // oldest first
+};
+
 #endif // PEPTIDE_H
@@ -0,0 +1,220 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef _MSC_VER
+#include <io.h>
+#include "mman.h"
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <cstring>
+#include <fstream>
+#include "protein_store.h"
+#include "records.h"
+#include "io/carp.h"
+#include "util/FileUtils.h"
+
+using namespace std;
+
+static const char PROTEIN_STORE_MAGIC[8] = { 'p', 'r', 'o', 't', 's', 't', 'o', 'r' };
+static const uint32_t PROTEIN_STORE_VERSION = 2;
+
+static uint64_t expectedLength(const ProteinStoreHeader& header) {
+  return sizeof(ProteinStoreHeader)
+    + header.num_proteins * sizeof(ProteinStoreRecord)
+    + (header.num_aux + 1) * sizeof(uint64_t)
+    + header.num_aux_locations * 2 * sizeof(int32_t)
+    + header.num_residues
+    + header.num_name_chars;
+}
+
+static bool headerValid(const ProteinStoreHeader& header) {
+  return memcmp(header.magic, PROTEIN_STORE_MAGIC, sizeof(PROTEIN_STORE_MAGIC)) == 0 &&
+    header.version == PROTEIN_STORE_VERSION &&
+    header.record_size == sizeof(ProteinStoreRecord);
+}
+
+// Returns the size of a file, or 0 if it does not exist.
+static uint64_t fileSize(const string& filename) {
+  struct stat info;
+  if (stat(filename.c_str(), &info) != 0) {
+    return 0;
+  }
+  return info.st_size;
+}
+
+// Returns the modification time of a file, or 0 if it does not exist.
+static int64_t fileMtime(const string& filename) {
+  struct stat info;
+  if (stat(filename.c_str(), &info) != 0) {
+    return 0;
+  }
+  return info.st_mtime;
+}
+
+// Appends the contents of the file filename to out, and removes the file.
+static void appendFile(ofstream* out, const string& filename, uint64_t size) {
+  if (size > 0) {
+    ifstream in(filename.c_str(), ios::binary);
+    *out << in.rdbuf();
+  }
+  FileUtils::Remove(filename);
+}
+
+ProteinStore::ProteinStore(const vector<const pb::Protein*>& proteins,
+                           const vector<const pb::AuxLocation*>* locations)
+  : proteins_(&proteins), locations_(locations),
+    length_(0), data_(NULL), records_(NULL), aux_offsets_(NULL),
+    aux_locations_(NULL), residues_(NULL), names_(NULL),
+    num_proteins_(proteins.size()), num_aux_(locations ? locations->size() : 0) {
+}
+
+ProteinStore::ProteinStore(const string& filename)
+  : proteins_(NULL), locations_(NULL),
+    length_(0), data_(NULL), records_(NULL), aux_offsets_(NULL),
+    aux_locations_(NULL), residues_(NULL), names_(NULL),
+    num_proteins_(0), num_aux_(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(ProteinStoreHeader)) {
+    close(fd);
+    return;
+  }
+  length_ = info.st_size;
+  // Read-only and shared, so every reader of the index uses the same pages.
+  void* data = mmap(NULL, length_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return;
+  }
+  const ProteinStoreHeader* header = (const ProteinStoreHeader*) data;
+  if (!headerValid(*header) || expectedLength(*header) != length_) {
+    carp(CARP_ERROR, "%s is not a valid protein store.", filename.c_str());
+    munmap(data, length_);
+    return;
+  }
+  data_ = data;
+  records_ = (const ProteinStoreRecord*) (header + 1);
+  aux_offsets_ = (const uint64_t*) (records_ + header->num_proteins);
+  aux_locations_ = (const int32_t*) (aux_offsets_ + header->num_aux + 1);
+  residues_ = (const char*) (aux_locations_ + 2 * header->num_aux_locations);
+  names_ = residues_ + header->num_residues;
+  num_proteins_ = header->num_proteins;
+  num_aux_ = header->num_aux;
+}
+
+ProteinStore::~ProteinStore() {
+  if (data_ != NULL) {
+    munmap(data_, length_);
+  }
+}
+
+void ProteinStore::Write(const string& proteins_file, const string& auxlocs_file,
+                         const string& filename) {
+  string residues_file = filename + ".residues.tmp";
+  string names_file = filename + ".names.tmp";
+  string locations_file = filename + ".locations.tmp";
+  ofstream out(filename.c_str(), ios::binary | ios::trunc);
+  ofstream residues_out(residues_file.c_str(), ios::binary | ios::trunc);
+  ofstream names_out(names_file.c_str(), ios::binary | ios::trunc);
+  ofstream locations_out(locations_file.c_str(), ios::binary | ios::trunc);
+  if (!out || !residues_out || !names_out || !locations_out) {
+    carp(CARP_FATAL, "Couldn't open file %s for write.", filename.c_str());
+  }
+
+  ProteinStoreHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PROTEIN_STORE_MAGIC, sizeof(PROTEIN_STORE_MAGIC));
+  header.version = PROTEIN_STORE_VERSION;
+  header.record_size = sizeof(ProteinStoreRecord);
+  header.proteins_size = fileSize(proteins_file);
+  header.proteins_mtime = fileMtime(proteins_file);
+  // placeholder, rewritten at the end
+  out.write((const char*) &header, sizeof(header));
+
+  // Records go straight to the file; residues and names wait in temporary
+  // files until the records are complete.
+  {
+    HeadedRecordReader reader(proteins_file);
+    if (!reader.OK()) {
+      carp(CARP_FATAL, "Error reading index (%s)", proteins_file.c_str());
+    }
+    pb::Protein protein;
+    while (!reader.Done()) {
+      if (!reader.Read(&protein)) {
+        carp(CARP_FATAL, "Error reading index (%s)", proteins_file.c_str());
+      }
+      ProteinStoreRecord record;
+      memset(&record, 0, sizeof(record));
+      record.residues_offset = header.num_residues;
+      record.length = protein.residues().length();
+      record.name_offset = header.num_name_chars;
+      record.name_length = protein.name().length();
+      record.target_pos = protein.has_target_pos() ? protein.target_pos() : -1;
+      residues_out.write(protein.residues().data(), record.length);
+      names_out.write(protein.name().data(), record.name_length);
+      header.num_residues += record.length;
+      header.num_name_chars += record.name_length;
+      out.write((const char*) &record, sizeof(record));
+      ++header.num_proteins;
+    }
+  }
+
+  // Offsets go straight to the file; locations wait in a temporary file.
+  uint64_t offset = 0;
+  if (FileUtils::Exists(auxlocs_file)) {
+    header.auxlocs_size = fileSize(auxlocs_file);
+    header.auxlocs_mtime = fileMtime(auxlocs_file);
+    HeadedRecordReader reader(auxlocs_file);
+    if (!reader.OK()) {
+      carp(CARP_FATAL, "Error reading index (%s)", auxlocs_file.c_str());
+    }
+    pb::AuxLocation aux;
+    while (!reader.Done()) {
+      if (!reader.Read(&aux)) {
+        carp(CARP_FATAL, "Error reading index (%s)", auxlocs_file.c_str());
+      }
+      out.write((const char*) &offset, sizeof(offset));
+      for (int i = 0; i < aux.location_size(); ++i) {
+        int32_t location[2] = { aux.location(i).protein_id(), aux.location(i).pos() };
+        locations_out.write((const char*) location, sizeof(location));
+      }
+      offset += aux.location_size();
+      ++header.num_aux;
+    }
+  }
+  out.write((const char*) &offset, sizeof(offset));
+  header.num_aux_locations = offset;
+
+  residues_out.close();
+  names_out.close();
+  locations_out.close();
+  appendFile(&out, locations_file, header.num_aux_locations);
+  appendFile(&out, residues_file, header.num_residues);
+  appendFile(&out, names_file, header.num_name_chars);
+  out.seekp(0);
+  out.write((const char*) &header, sizeof(header));
+  out.close();
+  if (!out) {
+    carp(CARP_FATAL, "Error writing %s.", filename.c_str());
+  }
+}
+
+bool ProteinStore::Usable(const string& filename, const string& proteins_file,
+                          const string& auxlocs_file) {
+  ifstream in(filename.c_str(), ios::binary);
+  ProteinStoreHeader header;
+  if (!in.read((char*) &header, sizeof(header))) {
+    return false;
+  }
+  return headerValid(header) &&
+    header.proteins_size == fileSize(proteins_file) &&
+    header.auxlocs_size == fileSize(auxlocs_file) &&
+    header.proteins_mtime == fileMtime(proteins_file) &&
+    header.auxlocs_mtime == fileMtime(auxlocs_file) &&
+    expectedLength(header) == fileSize(filename);
+}
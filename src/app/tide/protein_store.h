@@ -0,0 +1,164 @@
+// Proteins of a tide index.
+//
+// A search needs three things of each protein: the residues, which peptides
+// point into, the name, and for decoy proteins the position in the target
+// protein. It also needs the other locations of peptides found in several
+// proteins. Reading protix into pb::Protein objects allocates every name and
+// sequence separately before searching can start, which for large databases
+// takes a lot of memory and time. auxlocs is costly in the same way.
+//
+// protstore holds the same data in flat arrays, memory mapped for reading, so
+// a page is only read when it is used and is shared by every process that
+// reads the index. The file has a ProteinStoreRecord for each protein,
+// pointing into one block of residues and one block of names, and the
+// auxiliary locations as offsets into one array of (protein id, position)
+// pairs.
+//
+// File layout, all in native byte order:
+//   ProteinStoreHeader
+//   ProteinStoreRecord[num_proteins]
+//   uint64[num_aux + 1]              first location of each auxlocs entry,
+//                                    and the number of locations
+//   int32[2 * num_aux_locations]     protein id and position of each location
+//   char[num_residues]               residues of all proteins
+//   char[num_name_chars]             names of all proteins
+//
+// A ProteinStore can also be a view of proteins and auxiliary locations that
+// have been read into protocol buffers, for programs that read them anyway
+// and for indexes made before protstore was added.
+//
+// Example usage:
+// ProteinStore proteins(protstore_file);
+// const char* residues = proteins.Residues(id);
+// string name = proteins.Name(id);
+// for (int i = 0; i < proteins.NumAuxLocations(aux_index); ++i) {
+//   proteins.AuxLocation(aux_index, i, &protein_id, &pos);
+// }
+
+#ifndef PROTEIN_STORE_H
+#define PROTEIN_STORE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "peptides.pb.h"
+#include "raw_proteins.pb.h"
+
+struct ProteinStoreHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;         // sizeof(ProteinStoreRecord), as a sanity check
+  uint64_t proteins_size;       // size of the protix file the proteins came from
+  uint64_t auxlocs_size;        // size of the auxlocs file, or 0 if none
+  int64_t proteins_mtime;       // modification times of the same files,
+  int64_t auxlocs_mtime;        // or 0 if none
+  uint64_t num_proteins;
+  uint64_t num_aux;
+  uint64_t num_aux_locations;
+  uint64_t num_residues;
+  uint64_t num_name_chars;
+};
+
+struct ProteinStoreRecord {
+  uint64_t residues_offset;
+  uint64_t name_offset;
+  int32_t length;
+  int32_t name_length;
+  int32_t target_pos;           // -1 if the protein has none
+  int32_t padding;
+};
+
+class ProteinStore {
+ public:
+  // A view of proteins indexed by id, and of the auxiliary locations, which
+  // may be NULL. Both must outlive the store.
+  explicit ProteinStore(const std::vector<const pb::Protein*>& proteins,
+                        const std::vector<const pb::AuxLocation*>* locations = NULL);
+
+  // Maps a protstore file.
+  explicit ProteinStore(const std::string& filename);
+
+  ~ProteinStore();
+
+  // Writes to filename the proteins of protix file proteins_file and the
+  // auxiliary locations of auxlocs_file, which may be missing.
+  static void Write(const std::string& proteins_file, const std::string& auxlocs_file,
+                    const std::string& filename);
+
+  // True if filename is a complete protstore made from proteins_file and
+  // auxlocs_file as they are now.
+  static bool Usable(const std::string& filename, const std::string& proteins_file,
+                     const std::string& auxlocs_file);
+
+  // client should check once after construction
+  bool OK() const { return proteins_ != NULL || data_ != NULL; }
+
+  size_t Size() const { return num_proteins_; }
+
+  const char* Residues(int id) const {
+    return proteins_ ? (*proteins_)[id]->residues().data()
+                     : residues_ + records_[id].residues_offset;
+  }
+
+  int Length(int id) const {
+    return proteins_ ? (*proteins_)[id]->residues().length() : records_[id].length;
+  }
+
+  std::string Name(int id) const {
+    return proteins_ ? (*proteins_)[id]->name()
+                     : std::string(names_ + records_[id].name_offset,
+                                   records_[id].name_length);
+  }
+
+  bool HasTargetPos(int id) const {
+    return proteins_ ? (*proteins_)[id]->has_target_pos() : records_[id].target_pos >= 0;
+  }
+
+  int TargetPos(int id) const {
+    return proteins_ ? (*proteins_)[id]->target_pos() : records_[id].target_pos;
+  }
+
+  // Number of other locations of a peptide with aux_locations_index index.
+  // 0 if the store has no auxiliary locations.
+  int NumAuxLocations(int index) const {
+    if (proteins_) {
+      return locations_ && (size_t) index < locations_->size()
+        ? (*locations_)[index]->location_size() : 0;
+    }
+    return (size_t) index < num_aux_ ? aux_offsets_[index + 1] - aux_offsets_[index] : 0;
+  }
+
+  void AuxLocation(int index, int i, int* protein_id, int* pos) const {
+    if (proteins_) {
+      const pb::Location& location = (*locations_)[index]->location(i);
+      *protein_id = location.protein_id();
+      *pos = location.pos();
+    } else {
+      const int32_t* location = aux_locations_ + 2 * (aux_offsets_[index] + i);
+      *protein_id = location[0];
+      *pos = location[1];
+    }
+  }
+
+ private:
+  ProteinStore(const ProteinStore&);  // not copyable; owns the mapping
+  ProteinStore& operator=(const ProteinStore&);
+
+  // Protocol buffer view; NULL if mapped.
+  const std::vector<const pb::Protein*>* proteins_;
+  const std::vector<const pb::AuxLocation*>* locations_;
+
+  // Mapped file.
+  size_t length_;
+  void* data_;
+  const ProteinStoreRecord* records_;
+  const uint64_t* aux_offsets_;
+  const int32_t* aux_locations_;
+  const char* residues_;
+  const char* names_;
+
+  size_t num_proteins_;
+  size_t num_aux_;
+};
+
+#endif // PROTEIN_STORE_H
@@ -0,0 +1,106 @@
+// Memo of the exact p-value computations of a search thread.
+//
+// With exact-p-value T, each spectrum-charge needs an integerized evidence
+// vector and a score-count distribution for every integer mass bin of its
+// candidate peptides. These only depend on the charge through the fragment
+// charges, which stop at 3, and through the peaks that are below the m/z
+// cutoff of the charge. ScoreCountCache keeps them, keyed by the spectrum,
+// the fragment charge, the number of peaks in range and the mass bin, for the
+// last few spectra a thread has searched. A spectrum-charge that shares its
+// key with an earlier one, such as the 3+ and 4+ of a scan whose peaks are
+// all in range, or a mass bin reached again through an isotope-shifted
+// window, reuses them instead of running the dynamic programming again. The
+// observed intensities, which do not depend on the mass bin, are kept once
+// per key.
+//
+// Entries hold pointers to spectra, so a cache must not outlive the spectrum
+// collection it was used with. Not thread safe.
+//
+// Example usage:
+// ScoreCountCache cache;
+// bool hit = cache.Select(spectrum, charge);
+// ScoreCountCache::Entry& entry = cache.Current();
+// if (!hit) {
+//   entry.intensities = spectrum->CreateObservedIntensities(charge, ...);
+// }
+// ScoreCountCache::MassBin* bin = entry.Find(mass_bin);
+// if (bin == NULL) {
+//   bin = &entry.Insert(mass_bin);
+//   bin->evidence = spectrum->CreateEvidenceVectorDiscretized(entry.intensities, ...);
+// }
+
+#ifndef SCORE_COUNT_CACHE_H
+#define SCORE_COUNT_CACHE_H
+
+#include <list>
+#include <map>
+#include <vector>
+#include "spectrum_collection.h"
+
+class ScoreCountCache {
+ public:
+  struct MassBin {
+    MassBin() : offset(0) {}
+    std::vector<int> evidence;
+    std::vector<double> counts;  // score counts; empty until computed
+    int offset;                  // score offset of counts
+  };
+
+  struct Entry {
+    Entry(const Spectrum* spectrum_, int charge_, int peaks_in_range_)
+      : spectrum(spectrum_), charge(charge_), peaks_in_range(peaks_in_range_),
+        num_range_skipped(0), num_precursors_skipped(0),
+        num_isotopes_skipped(0), num_retained(0) {
+    }
+
+    MassBin* Find(int mass_bin) {
+      std::map<int, MassBin>::iterator i = mass_bins.find(mass_bin);
+      return i == mass_bins.end() ? NULL : &i->second;
+    }
+
+    MassBin& Insert(int mass_bin) { return mass_bins[mass_bin]; }
+
+    const Spectrum* spectrum;
+    int charge;          // fragment charge, at most 3
+    int peaks_in_range;
+    std::vector<double> intensities;  // observed intensities; empty until computed
+    // Peaks filtered out and kept when computing the intensities.
+    long num_range_skipped;
+    long num_precursors_skipped;
+    long num_isotopes_skipped;
+    long num_retained;
+    std::map<int, MassBin> mass_bins;
+  };
+
+  explicit ScoreCountCache(size_t max_entries = 16)
+    : max_entries_(max_entries < 1 ? 1 : max_entries) {
+  }
+
+  // Makes the entry of spectrum searched at charge the current one, creating
+  // an empty entry if there is none. Returns true if the entry was there.
+  // Entries other than the current one may be dropped.
+  bool Select(const Spectrum* spectrum, int charge) {
+    int fragment_charge = charge > 3 ? 3 : charge;
+    int peaks_in_range = spectrum->NumPeaksInRange(charge);
+    for (std::list<Entry>::iterator i = entries_.begin(); i != entries_.end(); ++i) {
+      if (i->spectrum == spectrum && i->charge == fragment_charge &&
+          i->peaks_in_range == peaks_in_range) {
+        entries_.splice(entries_.begin(), entries_, i);
+        return true;
+      }
+    }
+    if (entries_.size() >= max_entries_) {
+      entries_.pop_back();
+    }
+    entries_.push_front(Entry(spectrum, fragment_charge, peaks_in_range));
+    return false;
+  }
+
+  Entry& Current() { return entries_.front(); }
+
+ private:
+  size_t max_entries_;
+  std::list<Entry> entries_;  // most recently selected first
+};
+
+#endif // SCORE_COUNT_CACHE_H
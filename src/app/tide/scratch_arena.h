@@ -0,0 +1,127 @@
+// Scratch memory for the search of one spectrum-charge.
+//
+// ScratchArena hands out uninitialized arrays of trivially destructible
+// types from large blocks, and takes everything back at once with Reset().
+// Each search thread keeps one arena and resets it for every spectrum-charge,
+// so the temporary arrays of the search do not go through the heap at all
+// once the arena has grown to the size they need. If the arrays of one
+// spectrum-charge did not fit in a single block, the blocks are merged into
+// one at the next Reset().
+//
+// GetMark() and Release() free the arrays allocated after a mark, for
+// temporaries of a function that is called several times per
+// spectrum-charge.
+//
+// Not thread safe.
+//
+// Example usage:
+// ScratchArena arena;
+// for (...) {
+//   arena.Reset();
+//   int* offsets = arena.New<int>(n);
+//   double* counts = arena.NewZeroed<double>(m);
+//   ScratchArena::Mark mark = arena.GetMark();
+//   double* tmp = arena.New<double>(k);
+//   arena.Release(mark);  // frees tmp, keeps offsets and counts
+// }
+
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+class ScratchArena {
+ public:
+  struct Mark {
+    size_t block;
+    size_t used;
+  };
+
+  explicit ScratchArena(size_t block_size = 1 << 20)
+    : block_size_(block_size), current_(0), used_(0) {
+  }
+
+  ~ScratchArena() {
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+      delete[] blocks_[i].data;
+    }
+  }
+
+  // Returns room for n elements of type T, uninitialized.
+  template <class T>
+  T* New(size_t n) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "ScratchArena never runs destructors");
+    return (T*) Allocate(n * sizeof(T));
+  }
+
+  // Returns room for n elements of type T, set to all-zero bytes.
+  template <class T>
+  T* NewZeroed(size_t n) {
+    T* result = New<T>(n);
+    memset(result, 0, n * sizeof(T));
+    return result;
+  }
+
+  Mark GetMark() const {
+    Mark mark = { current_, used_ };
+    return mark;
+  }
+
+  // Frees everything allocated since mark was taken.
+  void Release(const Mark& mark) {
+    current_ = mark.block;
+    used_ = mark.used;
+  }
+
+  // Frees everything.
+  void Reset() {
+    if (blocks_.size() > 1) {
+      size_t total = 0;
+      for (size_t i = 0; i < blocks_.size(); ++i) {
+        total += blocks_[i].size;
+        delete[] blocks_[i].data;
+      }
+      blocks_.assign(1, Block(new char[total], total));
+    }
+    current_ = 0;
+    used_ = 0;
+  }
+
+ private:
+  struct Block {
+    Block(char* data_, size_t size_) : data(data_), size(size_) {}
+    char* data;
+    size_t size;
+  };
+
+  // Every allocation is a multiple of kAlign bytes, so, as new[] aligns the
+  // blocks, every array is aligned for any scalar type.
+  static const size_t kAlign = 16;
+
+  void* Allocate(size_t bytes) {
+    bytes = (bytes + kAlign - 1) & ~(kAlign - 1);
+    for (; current_ < blocks_.size(); ++current_, used_ = 0) {
+      if (used_ + bytes <= blocks_[current_].size) {
+        void* result = blocks_[current_].data + used_;
+        used_ += bytes;
+        return result;
+      }
+    }
+    size_t size = std::max(block_size_, bytes);
+    blocks_.push_back(Block(new char[size], size));
+    current_ = blocks_.size() - 1;
+    used_ = bytes;
+    return blocks_.back().data;
+  }
+
+  size_t block_size_;
+  std::vector<Block> blocks_;
+  size_t current_;  // block the next array is taken from
+  size_t used_;     // bytes used in blocks_[current_]
+};
+
+#endif // SCRATCH_ARENA_H
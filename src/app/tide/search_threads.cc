@@ -0,0 +1,268 @@
+#include <boost/bind.hpp>
+#include "search_threads.h"
+#include "io/carp.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int num_threads)
+  : num_threads_(num_threads < 1 ? 1 : num_threads),
+    generation_(0), running_(0), shutdown_(false) {
+  for (int t = 1; t < num_threads_; ++t) {
+    threads_.create_thread(boost::bind(&ThreadPool::WorkerLoop, this, t));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    shutdown_ = true;
+  }
+  start_cond_.notify_all();
+  threads_.join_all();
+}
+
+void ThreadPool::Run(const boost::function<void (int)>& job) {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    job_ = job;
+    running_ = num_threads_ - 1;
+    ++generation_;
+  }
+  start_cond_.notify_all();
+
+  job(0);
+
+  boost::mutex::scoped_lock lock(mutex_);
+  while (running_ > 0) {
+    done_cond_.wait(lock);
+  }
+  job_.clear();
+}
+
+void ThreadPool::WorkerLoop(int thread_num) {
+  unsigned long seen = 0;
+  while (true) {
+    boost::function<void (int)> job;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (!shutdown_ && generation_ == seen) {
+        start_cond_.wait(lock);
+      }
+      if (shutdown_) {
+        return;
+      }
+      seen = generation_;
+      job = job_;
+    }
+    job(thread_num);
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (--running_ == 0) {
+        done_cond_.notify_all();
+      }
+    }
+  }
+}
+
+ChunkScheduler::ChunkScheduler(int num_threads) {
+  for (int i = 0; i < num_threads; ++i) {
+    queues_.push_back(new WorkQueue());
+  }
+}
+
+ChunkScheduler::~ChunkScheduler() {
+  for (size_t i = 0; i < queues_.size(); ++i) {
+    delete queues_[i];
+  }
+}
+
+void ChunkScheduler::Reset(size_t begin, size_t end, size_t chunk_size) {
+  if (chunk_size < 1) {
+    chunk_size = 1;
+  }
+  size_t num_queues = queues_.size();
+  size_t num_chunks = (end - begin + chunk_size - 1) / chunk_size;
+  // The first (num_chunks % num_queues) queues get one chunk more than the
+  // others.
+  size_t pos = begin;
+  for (size_t q = 0; q < num_queues; ++q) {
+    queues_[q]->chunks.clear();
+    size_t share = num_chunks / num_queues + (q < num_chunks % num_queues ? 1 : 0);
+    for (size_t c = 0; c < share; ++c) {
+      size_t chunk_end = min(pos + chunk_size, end);
+      queues_[q]->chunks.push_back(make_pair(pos, chunk_end));
+      pos = chunk_end;
+    }
+  }
+}
+
+bool ChunkScheduler::Next(int thread_num, size_t* begin, size_t* end, bool* stolen) {
+  WorkQueue* own = queues_[thread_num];
+  {
+    boost::mutex::scoped_lock lock(own->mutex);
+    if (!own->chunks.empty()) {
+      *begin = own->chunks.front().first;
+      *end = own->chunks.front().second;
+      own->chunks.pop_front();
+      if (stolen) {
+        *stolen = false;
+      }
+      return true;
+    }
+  }
+  // Steal the heaviest chunk of the next thread that has any work left.
+  // Chunks never move to another queue, so once every queue has been seen
+  // empty, all work has been handed out.
+  int num_queues = queues_.size();
+  for (int i = 1; i < num_queues; ++i) {
+    WorkQueue* victim = queues_[(thread_num + i) % num_queues];
+    boost::mutex::scoped_lock lock(victim->mutex);
+    if (!victim->chunks.empty()) {
+      *begin = victim->chunks.back().first;
+      *end = victim->chunks.back().second;
+      victim->chunks.pop_back();
+      if (stolen) {
+        *stolen = true;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+OrderedWriter::OrderedWriter(ostream* target, ostream* decoy, size_t first,
+                             size_t flush_bytes)
+  : target_(target), decoy_(decoy), flush_bytes_(flush_bytes), next_(first),
+    finished_(false) {
+  thread_ = boost::thread(boost::bind(&OrderedWriter::WriterLoop, this));
+}
+
+OrderedWriter::~OrderedWriter() {
+  Finish();
+}
+
+void OrderedWriter::Submit(size_t begin, size_t end, string* target, string* decoy) {
+  bool ready;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    Block& block = pending_[begin];
+    block.end = end;
+    block.target.swap(*target);
+    block.decoy.swap(*decoy);
+    ready = begin == next_;
+  }
+  target->clear();
+  decoy->clear();
+  if (ready) {
+    cond_.notify_one();
+  }
+}
+
+void OrderedWriter::Finish() {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (finished_) {
+      return;
+    }
+    finished_ = true;
+  }
+  cond_.notify_one();
+  thread_.join();
+}
+
+void OrderedWriter::WriterLoop() {
+  Block block;
+  boost::mutex::scoped_lock lock(mutex_);
+  while (true) {
+    map<size_t, Block>::iterator i = pending_.begin();
+    if (i == pending_.end() || (i->first != next_ && !finished_)) {
+      if (finished_) {
+        break;
+      }
+      cond_.wait(lock);
+      continue;
+    }
+    // Once finished, a gap can only mean items without a block.
+    next_ = i->second.end;
+    block.target.swap(i->second.target);
+    block.decoy.swap(i->second.decoy);
+    pending_.erase(i);
+    lock.unlock();
+    Append(&block);
+    lock.lock();
+  }
+  lock.unlock();
+  Flush(true);
+}
+
+void OrderedWriter::Append(Block* block) {
+  target_out_ += block->target;
+  decoy_out_ += block->decoy;
+  block->target.clear();
+  block->decoy.clear();
+  Flush(false);
+}
+
+void OrderedWriter::Flush(bool all) {
+  if (target_ && (all || target_out_.size() >= flush_bytes_)) {
+    target_->write(target_out_.data(), target_out_.size());
+    target_out_.clear();
+  }
+  if (decoy_ && (all || decoy_out_.size() >= flush_bytes_)) {
+    decoy_->write(decoy_out_.data(), decoy_out_.size());
+    decoy_out_.clear();
+  }
+  if (all) {
+    if (target_) {
+      target_->flush();
+    }
+    if (decoy_) {
+      decoy_->flush();
+    }
+  }
+}
+
+SearchCounters::Slot::Slot() {
+  for (int i = 0; i < NUM_COUNTERS; ++i) {
+    counts[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+SearchCounters::SearchCounters(int num_threads, size_t total, int print_interval)
+  : slots_(num_threads < 1 ? 1 : num_threads), total_(total),
+    print_interval_(print_interval > 0 ? print_interval : 0),
+    next_report_(print_interval > 0 ? print_interval : 0),
+    start_(chrono::steady_clock::now()) {
+}
+
+long SearchCounters::Total(Counter counter) const {
+  long total = 0;
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    total += slots_[i].counts[counter].load(memory_order_relaxed);
+  }
+  return total;
+}
+
+double SearchCounters::Seconds() const {
+  return chrono::duration<double>(chrono::steady_clock::now() - start_).count();
+}
+
+void SearchCounters::ReportProgress() {
+  if (print_interval_ == 0) {
+    return;
+  }
+  long next = next_report_.load(memory_order_relaxed);
+  long searched = Total(SPECTRA);
+  if (searched < next) {
+    return;
+  }
+  // Only the thread that moves the threshold on prints the message.
+  long after = (searched / print_interval_ + 1) * print_interval_;
+  if (!next_report_.compare_exchange_strong(next, after)) {
+    return;
+  }
+  double seconds = Seconds();
+  carp(CARP_INFO, "%ld spectrum-charge combinations searched, %.0f%% complete, "
+       "%.0f per second", searched, total_ > 0 ? 100.0 * searched / total_ : 100.0,
+       seconds > 0 ? searched / seconds : 0.0);
+}
@@ -0,0 +1,206 @@
+// Threading support for tide-search.
+//
+// ThreadPool keeps a fixed set of threads alive for the whole run, so that
+// searching several spectrum files does not create and join a new set of
+// threads for each file. The calling thread takes part in every job as
+// thread 0.
+//
+// ChunkScheduler hands out contiguous chunks of a range of spectrum-charges.
+// Since spectrum-charges are sorted by neutral mass, a chunk covers a narrow
+// mass range. Each thread owns a deque of chunks, initially a contiguous
+// share of the range. A thread takes chunks from the front of its own deque,
+// and once that is empty it steals from the back of another thread's deque,
+// so that threads that happen to get dense mass regions do not hold up the
+// others.
+//
+// OrderedWriter puts the output of the chunks back in spectrum-charge order.
+// Each thread formats the results of a chunk into buffers of its own and
+// hands them over once the chunk is done. A writer thread appends the blocks
+// to the output streams in order of their first spectrum-charge, so the
+// output does not depend on the number of threads or on which thread searched
+// which chunk.
+//
+// SearchCounters keeps statistics of the search for each thread. A thread
+// only ever writes its own counters, which are padded to separate cache
+// lines, so counting takes no lock and does not slow down other threads.
+// Totals are summed up when needed, which is at the end of a chunk for the
+// progress messages.
+//
+// Example usage:
+// ThreadPool pool(4);
+// ChunkScheduler scheduler(pool.NumThreads());
+// scheduler.Reset(0, items.size(), 16);
+// pool.Run(boost::bind(&Worker, &scheduler, _1));
+// where Worker(scheduler, thread_num) calls
+// scheduler->Next(thread_num, &begin, &end) until it returns false, and
+// passes the output for each chunk to writer->Submit(begin, end, ...) of an
+// OrderedWriter writer(&target_stream, &decoy_stream, 0);
+// and adds to counters->Add(thread_num, SearchCounters::SPECTRA, 1) as it
+// goes.
+
+#ifndef SEARCH_THREADS_H
+#define SEARCH_THREADS_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+
+class ThreadPool {
+ public:
+  // Starts num_threads - 1 threads; the caller of Run() is the last one.
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  int NumThreads() const { return num_threads_; }
+
+  // Calls job(thread_num) once on each thread of the pool, with thread_num
+  // running from 0 to NumThreads() - 1, and returns when all calls have
+  // returned. Thread 0 is the calling thread.
+  void Run(const boost::function<void (int)>& job);
+
+ private:
+  void WorkerLoop(int thread_num);
+
+  int num_threads_;
+  boost::thread_group threads_;
+  boost::mutex mutex_;
+  boost::condition_variable start_cond_;
+  boost::condition_variable done_cond_;
+  boost::function<void (int)> job_;
+  unsigned long generation_;  // incremented for every job
+  int running_;               // worker threads still busy with the job
+  bool shutdown_;
+};
+
+class ChunkScheduler {
+ public:
+  explicit ChunkScheduler(int num_threads);
+  ~ChunkScheduler();
+
+  // Splits [begin, end) into chunks of at most chunk_size items, dealing out
+  // contiguous runs of chunks to the threads. Must not be called while any
+  // thread is calling Next().
+  void Reset(size_t begin, size_t end, size_t chunk_size);
+
+  // Gets the next chunk for thread_num. Returns false when no work is left
+  // anywhere. stolen is set when the chunk came from another thread.
+  bool Next(int thread_num, size_t* begin, size_t* end, bool* stolen = NULL);
+
+ private:
+  struct WorkQueue {
+    boost::mutex mutex;
+    std::deque<std::pair<size_t, size_t> > chunks;
+  };
+
+  std::vector<WorkQueue*> queues_;
+};
+
+class OrderedWriter {
+ public:
+  // Writes blocks covering [first, ...) to target and decoy; decoy may be
+  // NULL. Output is written to the streams in pieces of at least
+  // flush_bytes, except for the last one.
+  OrderedWriter(std::ostream* target, std::ostream* decoy, size_t first,
+                size_t flush_bytes = 1 << 20);
+  // Calls Finish().
+  ~OrderedWriter();
+
+  // Hands over the output for the items [begin, end). The contents of target
+  // and decoy are taken, leaving both empty. Every item after the first must
+  // be covered by exactly one block, but blocks may come in any order.
+  void Submit(size_t begin, size_t end, std::string* target, std::string* decoy);
+
+  // Writes all blocks submitted so far and stops the writer thread. Blocks
+  // missing from the sequence are skipped over.
+  void Finish();
+
+ private:
+  struct Block {
+    size_t end;
+    std::string target;
+    std::string decoy;
+  };
+
+  void WriterLoop();
+  void Append(Block* block);
+  void Flush(bool all);
+
+  std::ostream* target_;
+  std::ostream* decoy_;
+  size_t flush_bytes_;
+  size_t next_;                         // first item not yet written
+  std::map<size_t, Block> pending_;     // blocks waiting for earlier ones
+  std::string target_out_, decoy_out_;  // written blocks not yet flushed
+  bool finished_;
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  boost::thread thread_;
+};
+
+class SearchCounters {
+ public:
+  enum Counter {
+    SPECTRA,             // spectrum-charges taken
+    CANDIDATES,          // candidate peptides scored
+    PRECURSOR_PEAKS,     // observed peaks removed as precursor peaks
+    ISOTOPE_PEAKS,       // observed peaks removed by deisotoping
+    RANGE_PEAKS,         // observed peaks outside the m/z range
+    RETAINED_PEAKS,      // observed peaks kept
+    INTENSITY_HITS,      // exact p-value intensities taken from the memo
+    INTENSITY_MISSES,    // exact p-value intensities computed
+    SCORE_COUNT_HITS,    // exact p-value score counts taken from the memo
+    SCORE_COUNT_MISSES,  // exact p-value score counts computed
+    NUM_COUNTERS
+  };
+
+  // Counters for num_threads threads searching total spectrum-charges.
+  // Progress is reported every print_interval spectrum-charges, or never if
+  // print_interval is 0.
+  SearchCounters(int num_threads, size_t total, int print_interval);
+
+  // Adds n to a counter of thread_num. Must only be called by that thread.
+  void Add(int thread_num, Counter counter, long n) {
+    std::atomic<long>& count = slots_[thread_num].counts[counter];
+    count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  long Get(int thread_num, Counter counter) const {
+    return slots_[thread_num].counts[counter].load(std::memory_order_relaxed);
+  }
+
+  // Sum of a counter over all threads. Counts still being added by other
+  // threads may or may not be included.
+  long Total(Counter counter) const;
+
+  // Seconds since the counters were created.
+  double Seconds() const;
+
+  // Prints a progress message if another print interval has been completed
+  // since the last one. May be called by any thread.
+  void ReportProgress();
+
+  int NumThreads() const { return slots_.size(); }
+
+ private:
+  struct Slot {
+    Slot();
+    std::atomic<long> counts[NUM_COUNTERS];
+    // Keeps the counters of neighbouring threads off each other's cache
+    // lines, wherever the slots start.
+    char padding[64];
+  };
+
+  std::vector<Slot> slots_;
+  size_t total_;
+  long print_interval_;
+  std::atomic<long> next_report_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#endif // SEARCH_THREADS_H
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include "sorted_spectrum_stream.h"
+#include "records.h"
+#include "io/carp.h"
+#include "util/FileUtils.h"
+#include "util/StringUtils.h"
+#include "util/mass.h"
+
+using namespace std;
+using google::protobuf::uint64;
+
+// Approximate memory taken by a spectrum with num_peaks peaks, as a
+// pb::Spectrum or as a Spectrum, and by its spectrum-charges.
+static size_t spectrumBytes(int num_peaks, int num_charges) {
+  return sizeof(Spectrum) + num_peaks * 2 * sizeof(double)
+    + num_charges * (sizeof(int) + sizeof(SpectrumCollection::SpecCharge));
+}
+
+SortedSpectrumStream::SortedSpectrumStream(
+  const string& filename,
+  const string& run_prefix,
+  size_t memory_limit,
+  double mz_offset
+) : run_prefix_(run_prefix), run_limit_(max(memory_limit / 2, (size_t) 1)),
+    mz_offset_(mz_offset), ok_(false), num_spectra_(0), num_spec_charges_(0),
+    highest_mz_(0.0), last_neutral_mass_(0.0), last_key_(0.0), buffer_bytes_(0),
+    next_entry_(0), merging_(false), next_index_(0) {
+  HeadedRecordReader reader(filename, &header_);
+  if (!reader.OK() || header_.file_type() != pb::Header::SPECTRA) {
+    return;
+  }
+  while (!reader.Done()) {
+    pb::Spectrum* spectrum = new pb::Spectrum;
+    if (!reader.Read(spectrum)) {
+      delete spectrum;
+      return;
+    }
+    buffer_.push_back(spectrum);
+    ++num_spectra_;
+    int num_peaks = spectrum->peak_m_z_size();
+    if (num_peaks == 0) {
+      carp(CARP_FATAL, "ERROR: spectrum %d has no peaks.", spectrum->spectrum_number());
+    }
+    // deltas of m/z are stored
+    uint64 total = 0;
+    for (int i = 0; i < num_peaks; ++i) {
+      total += spectrum->peak_m_z(i);
+    }
+    highest_mz_ = max(highest_mz_, total / (double) spectrum->peak_m_z_denominator());
+
+    for (int i = 0; i < spectrum->charge_state_size(); ++i) {
+      Entry entry;
+      entry.charge = spectrum->charge_state(i);
+      entry.key = Key(spectrum->precursor_m_z(), entry.charge);
+      entry.spectrum = spectrum;
+      entries_.push_back(entry);
+      if (num_spec_charges_++ == 0 || entry.key >= last_key_) {
+        last_key_ = entry.key;
+        last_neutral_mass_ = (spectrum->precursor_m_z() - MASS_PROTON) * entry.charge;
+      }
+    }
+    buffer_bytes_ += spectrumBytes(num_peaks, spectrum->charge_state_size());
+    if (buffer_bytes_ >= run_limit_) {
+      Spill();
+    }
+  }
+  if (!reader.OK()) {
+    return;
+  }
+  // The last run stays in memory.
+  stable_sort(entries_.begin(), entries_.end());
+  ok_ = true;
+}
+
+SortedSpectrumStream::~SortedSpectrumStream() {
+  for (size_t i = 0; i < segment_.size(); ++i) {
+    delete segment_[i];
+  }
+  for (size_t i = 0; i < heads_.size(); ++i) {
+    delete heads_[i].spectrum;
+  }
+  ClearBuffer();
+  for (size_t i = 0; i < readers_.size(); ++i) {
+    delete readers_[i];
+  }
+  for (size_t i = 0; i < run_files_.size(); ++i) {
+    FileUtils::Remove(run_files_[i]);
+  }
+}
+
+double SortedSpectrumStream::Key(double precursor_m_z, int charge) const {
+  return (precursor_m_z - MASS_PROTON - mz_offset_) * charge;
+}
+
+/*
+ * Writes the spectrum-charges collected so far to a new run, in order, and
+ * frees their spectra.
+ */
+void SortedSpectrumStream::Spill() {
+  stable_sort(entries_.begin(), entries_.end());
+  string run_file = run_prefix_ + StringUtils::ToString(run_files_.size()) + ".tmp";
+  run_files_.push_back(run_file);
+  carp(CARP_DEBUG, "Writing %d spectrum-charges to %s.", (int) entries_.size(),
+       run_file.c_str());
+  {
+    HeadedRecordWriter writer(run_file, header_);
+    pb::Spectrum spectrum;
+    for (vector<Entry>::const_iterator i = entries_.begin(); i != entries_.end(); ++i) {
+      spectrum = *i->spectrum;
+      for (int j = 1; j < spectrum.charge_state_size(); ++j) {
+        if (spectrum.charge_state(j) == i->charge) {
+          spectrum.mutable_charge_state()->SwapElements(0, j);
+          break;
+        }
+      }
+      if (!writer.Write(&spectrum)) {
+        carp(CARP_FATAL, "Error writing %s.", run_file.c_str());
+      }
+    }
+  }
+  ClearBuffer();
+}
+
+void SortedSpectrumStream::ClearBuffer() {
+  for (size_t i = 0; i < buffer_.size(); ++i) {
+    delete buffer_[i];
+  }
+  buffer_.clear();
+  entries_.clear();
+  buffer_bytes_ = 0;
+  next_entry_ = 0;
+}
+
+/*
+ * Puts the next spectrum-charge of a run on the heap. Runs 0 to
+ * run_files_.size() - 1 are read from their files; the last one is the run
+ * kept in memory. Returns false once the run is used up.
+ */
+bool SortedSpectrumStream::ReadHead(int run) {
+  Head head;
+  head.run = run;
+  if ((size_t) run < readers_.size()) {
+    HeadedRecordReader* reader = readers_[run];
+    if (reader->Done()) {
+      return false;
+    }
+    pb::Spectrum spectrum;
+    if (!reader->Read(&spectrum)) {
+      carp(CARP_FATAL, "Error reading %s.", run_files_[run].c_str());
+    }
+    head.spectrum = new Spectrum(spectrum);
+    head.charge = head.spectrum->ChargeState(0);
+    head.key = Key(spectrum.precursor_m_z(), head.charge);
+  } else {
+    if (next_entry_ >= entries_.size()) {
+      return false;
+    }
+    const Entry& entry = entries_[next_entry_++];
+    head.spectrum = new Spectrum(*entry.spectrum);
+    head.charge = entry.charge;
+    head.key = entry.key;
+  }
+  heads_.push_back(head);
+  push_heap(heads_.begin(), heads_.end());
+  return true;
+}
+
+bool SortedSpectrumStream::NextSegment(vector<SpectrumCollection::SpecCharge>* spec_charges) {
+  for (size_t i = 0; i < segment_.size(); ++i) {
+    delete segment_[i];
+  }
+  segment_.clear();
+  spec_charges->clear();
+  if (!merging_) {
+    merging_ = true;
+    for (size_t i = 0; i < run_files_.size(); ++i) {
+      readers_.push_back(new HeadedRecordReader(run_files_[i]));
+      if (!readers_.back()->OK()) {
+        carp(CARP_FATAL, "Error reading %s.", run_files_[i].c_str());
+      }
+    }
+    for (size_t i = 0; i <= run_files_.size(); ++i) {
+      ReadHead(i);
+    }
+  }
+
+  size_t bytes = 0;
+  while (!heads_.empty() && (spec_charges->empty() || bytes < run_limit_)) {
+    pop_heap(heads_.begin(), heads_.end());
+    Head head = heads_.back();
+    heads_.pop_back();
+    segment_.push_back(head.spectrum);
+    double neutral_mass = (head.spectrum->PrecursorMZ() - MASS_PROTON) * head.charge;
+    spec_charges->push_back(SpectrumCollection::SpecCharge(
+      neutral_mass, head.charge, head.spectrum, next_index_++));
+    bytes += spectrumBytes(head.spectrum->Size(), head.spectrum->NumChargeStates());
+    ReadHead(head.run);
+  }
+  return !spec_charges->empty();
+}
@@ -0,0 +1,124 @@
+// Spectrum-charges of a spectrumrecords file, sorted on disk.
+//
+// SpectrumCollection::ReadSpectrumRecords() holds every spectrum of a file in
+// memory before sorting, so the memory needed for a search grows with the
+// size of the spectrum file. SortedSpectrumStream sorts the spectrum-charges
+// of a file with an external merge sort instead, and hands them out in order
+// in segments of bounded size.
+//
+// The file is read once. Spectra are collected until they take half of the
+// memory limit, and their spectrum-charges are sorted and written to a
+// temporary spectrumrecords file, a run, with one record per
+// spectrum-charge. The charge state of a record is moved to the front of its
+// charge states; the others are kept, since preprocessing looks at the
+// highest of them. The last run is kept in memory. NextSegment() merges the
+// runs into spectrum-charges that take up to the other half of the limit.
+//
+// Spectrum-charges are ordered by (precursor m/z - proton - mz_offset) *
+// charge, which is the neutral mass for an mz_offset of 0, as in
+// SpectrumCollection::Sort(), and the order of ScSortByMz for an mz_offset
+// of the precursor window. Ties are kept in file order.
+//
+// Example usage:
+// SortedSpectrumStream stream(filename, run_prefix, memory_limit, 0.0);
+// vector<SpectrumCollection::SpecCharge> segment;
+// while (stream.NextSegment(&segment)) {
+//   ... search segment ...
+// }
+
+#ifndef SORTED_SPECTRUM_STREAM_H
+#define SORTED_SPECTRUM_STREAM_H
+
+#include <string>
+#include <vector>
+#include "header.pb.h"
+#include "spectrum.pb.h"
+#include "spectrum_collection.h"
+
+class HeadedRecordReader;
+
+class SortedSpectrumStream {
+ public:
+  // Reads filename and writes the runs that do not fit in memory to
+  // run_prefix<n>.tmp. memory_limit is in bytes.
+  SortedSpectrumStream(const std::string& filename, const std::string& run_prefix,
+                       size_t memory_limit, double mz_offset);
+  // Deletes the spectra of the last segment and removes the runs.
+  ~SortedSpectrumStream();
+
+  // client should check once after construction
+  bool OK() const { return ok_; }
+
+  int NumSpectra() const { return num_spectra_; }
+  size_t NumSpecCharges() const { return num_spec_charges_; }
+  int NumRuns() const { return run_files_.size() + (entries_.empty() ? 0 : 1); }
+
+  // The highest peak m/z of all spectra, as SpectrumCollection::FindHighestMZ().
+  double HighestMZ() const { return highest_mz_; }
+  // Neutral mass of the last spectrum-charge in order.
+  double LastNeutralMass() const { return last_neutral_mass_; }
+
+  // Fills spec_charges with the next spectrum-charges in order, at least one,
+  // and deletes the spectra of the previous segment. Returns false when all
+  // spectrum-charges have been handed out.
+  bool NextSegment(std::vector<SpectrumCollection::SpecCharge>* spec_charges);
+
+ private:
+  // A spectrum-charge of a run that is being collected or kept in memory.
+  struct Entry {
+    double key;
+    int charge;
+    const pb::Spectrum* spectrum;
+
+    bool operator<(const Entry& other) const { return key < other.key; }
+  };
+
+  // The next spectrum-charge of a run while merging.
+  struct Head {
+    double key;
+    int run;
+    Spectrum* spectrum;
+    int charge;
+
+    // Orders a heap with the lowest key, then the earliest run, on top.
+    bool operator<(const Head& other) const {
+      return key > other.key || (key == other.key && run > other.run);
+    }
+  };
+
+  SortedSpectrumStream(const SortedSpectrumStream&);  // not copyable; owns the runs
+  SortedSpectrumStream& operator=(const SortedSpectrumStream&);
+
+  double Key(double precursor_m_z, int charge) const;
+  void Spill();
+  void ClearBuffer();
+  bool ReadHead(int run);
+
+  std::string run_prefix_;
+  size_t run_limit_;
+  double mz_offset_;
+  bool ok_;
+  pb::Header header_;
+
+  int num_spectra_;
+  size_t num_spec_charges_;
+  double highest_mz_;
+  double last_neutral_mass_;
+  double last_key_;
+
+  // Spectra of the run being collected, or of the run kept in memory.
+  std::vector<pb::Spectrum*> buffer_;
+  std::vector<Entry> entries_;
+  size_t buffer_bytes_;
+  size_t next_entry_;
+
+  std::vector<std::string> run_files_;
+  std::vector<HeadedRecordReader*> readers_;
+  std::vector<Head> heads_;
+  bool merging_;
+
+  std::vector<Spectrum*> segment_;
+  size_t next_index_;
+};
+
+#endif // SORTED_SPECTRUM_STREAM_H
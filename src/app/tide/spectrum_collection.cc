@@ -14,7 +14,7 @@
 #include "records.h"
 #include "records_to_vector-inl.h"
 #include "util/mass.h"
-#include "util/Params.h"
+#include "util/GlobalParams.h"
 
 using namespace std;
 using google::protobuf::uint64;
@@ -197,25 +197,40 @@ vector<double> Spectrum::CreateEvidenceVector(
   long int* num_precursors_skipped,
   long int* num_isotopes_skipped,
   long int* num_retained
+) const {
+  vector<double> intensObs =
+    CreateObservedIntensities(charge, maxPrecurMass, num_range_skipped,
+                              num_precursors_skipped, num_isotopes_skipped, num_retained);
+  return CreateEvidenceVector(intensObs, binWidth, binOffset, charge, pepMassMonoMean,
+                              maxPrecurMass);
+}
+
+/* Observed peak heights used for the evidence vector: peaks out of range,
+ * precursor peaks and isotope peaks are removed, and the rest are normalized
+ * by region and background subtracted. Does not depend on the peptide mass,
+ * so it can be computed once for all candidate masses of a spectrum-charge.
+ */
+vector<double> Spectrum::CreateObservedIntensities(
+  int charge,
+  int maxPrecurMass,
+  long int* num_range_skipped,
+  long int* num_precursors_skipped,
+  long int* num_isotopes_skipped,
+  long int* num_retained
 ) const {
   // TODO need to review these constants, decide which can be moved to parameter file
   const double maxIntensPerRegion = 50.0;
-  const double BYHeight = 50.0;
-  const double NH3LossHeight = 10.0;
-  const double COLossHeight = 10.0;    // for creating a ions on the fly from b ions
-  const double H2OLossHeight = 10.0;
-  const double FlankingHeight = BYHeight / 2;;
   // TODO end need to review
   int numPeaks = Size();
-  double experimentalMassCutoff = PrecursorMZ() * charge + 50.0;
+  double experimentalMassCutoff = RangeCutoff(charge);
   double maxIonMass = 0.0;
   double maxIonIntens = 0.0;
 
   // Find max ion mass and max ion intensity
-  bool skipPreprocess = Params::GetBool("skip-preprocessing");
-  bool remove_precursor = !skipPreprocess && Params::GetBool("remove-precursor-peak");
-  double precursorMZExclude = Params::GetDouble("remove-precursor-tolerance");
-  double deisotope_threshold = Params::GetDouble("deisotope");
+  bool skipPreprocess = GlobalParams::getSkipPreprocessing();
+  bool remove_precursor = !skipPreprocess && GlobalParams::getRemovePrecursorPeak();
+  double precursorMZExclude = GlobalParams::getRemovePrecursorTolerance();
+  double deisotope_threshold = GlobalParams::getDeisotope();
   set<int> peakSkip;
   for (int ion = 0; ion < numPeaks; ion++) {
     double ionMass = M_Z(ion);
@@ -310,9 +325,26 @@ vector<double> Spectrum::CreateEvidenceVector(
     int left = std::max(0, i - MAX_XCORR_OFFSET - 1);
     intensObs[i] -= multiplier * (partial_sums[right] - partial_sums[left] - intensObs[i]);
   }
+  return intensObs;
+}
 
-  bool flankingPeaks = Params::GetBool("use-flanking-peaks");
-  bool nlPeaks = Params::GetBool("use-neutral-loss-peaks");
+vector<double> Spectrum::CreateEvidenceVector(
+  const vector<double>& intensObs,
+  double binWidth,
+  double binOffset,
+  int charge,
+  double pepMassMonoMean,
+  int maxPrecurMass
+) const {
+  // TODO need to review these constants, decide which can be moved to parameter file
+  const double BYHeight = 50.0;
+  const double NH3LossHeight = 10.0;
+  const double COLossHeight = 10.0;    // for creating a ions on the fly from b ions
+  const double H2OLossHeight = 10.0;
+  const double FlankingHeight = BYHeight / 2;;
+  // TODO end need to review
+  bool flankingPeaks = GlobalParams::getUseFlankingPeaks();
+  bool nlPeaks = GlobalParams::getUseNeutralLossPeaks();
   int binFirst = MassConstants::mass2bin(30);
   int binLast = MassConstants::mass2bin(pepMassMonoMean - 47);
   if (charge > 3){
@@ -397,10 +429,24 @@ vector<int> Spectrum::CreateEvidenceVectorDiscretized(
   long int* num_precursors_skipped,
   long int* num_isotopes_skipped,
   long int* num_retained
+) const {
+  vector<double> intensObs =
+    CreateObservedIntensities(charge, maxPrecurMass, num_range_skipped,
+                              num_precursors_skipped, num_isotopes_skipped, num_retained);
+  return CreateEvidenceVectorDiscretized(intensObs, binWidth, binOffset, charge,
+                                         pepMassMonoMean, maxPrecurMass);
+}
+
+vector<int> Spectrum::CreateEvidenceVectorDiscretized(
+  const vector<double>& intensObs,
+  double binWidth,
+  double binOffset,
+  int charge,
+  double pepMassMonoMean,
+  int maxPrecurMass
 ) const {
   vector<double> evidence =
-    CreateEvidenceVector(binWidth, binOffset, charge, pepMassMonoMean, maxPrecurMass,
-                         num_range_skipped, num_precursors_skipped, num_isotopes_skipped, num_retained);
+    CreateEvidenceVector(intensObs, binWidth, binOffset, charge, pepMassMonoMean, maxPrecurMass);
   vector<int> discretized;
   discretized.reserve(evidence.size());
   for (vector<double>::const_iterator i = evidence.begin(); i != evidence.end(); i++) {
@@ -409,6 +455,21 @@ vector<int> Spectrum::CreateEvidenceVectorDiscretized(
   return discretized;
 }
 
+double Spectrum::RangeCutoff(int charge) const {
+  return PrecursorMZ() * charge + 50.0;
+}
+
+int Spectrum::NumPeaksInRange(int charge) const {
+  double cutoff = RangeCutoff(charge);
+  int count = 0;
+  for (int ion = 0; ion < Size(); ion++) {
+    if (M_Z(ion) < cutoff) {
+      count++;
+    }
+  }
+  return count;
+}
+
 /// added by Yang
 int Spectrum::MS1SpectrumNum() const { return ms1_spectrum_number_; }
 
@@ -589,5 +650,5 @@ double SpectrumCollection::FindHighestMZ() const {
 
 void SpectrumCollection::Sort() {
   MakeSpecCharges();
-  sort(spec_charges_.begin(), spec_charges_.end());
+  stable_sort(spec_charges_.begin(), spec_charges_.end());
 }
@@ -20,6 +20,7 @@
 #ifndef SPECTRUM_COLLECTION_H
 #define SPECTRUM_COLLECTION_H
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include "header.pb.h"
@@ -88,6 +89,37 @@ class Spectrum {
     long int* num_isotopes_skipped = NULL,
     long int* num_retained = NULL) const;
 
+  // The two steps of CreateEvidenceVector(). The observed intensities only
+  // depend on the spectrum and on the peaks in range for the charge, so they
+  // can be shared by all peptide masses searched against the spectrum.
+  std::vector<double> CreateObservedIntensities(
+    int charge,
+    int maxPrecurMass,
+    long int* num_range_skipped = NULL,
+    long int* num_precursors_skipped = NULL,
+    long int* num_isotopes_skipped = NULL,
+    long int* num_retained = NULL) const;
+  std::vector<double> CreateEvidenceVector(
+    const std::vector<double>& intensObs,
+    double binWidth,
+    double binOffset,
+    int charge,
+    double pepMassMonoMean,
+    int maxPrecurMass) const;
+  std::vector<int> CreateEvidenceVectorDiscretized(
+    const std::vector<double>& intensObs,
+    double binWidth,
+    double binOffset,
+    int charge,
+    double pepMassMonoMean,
+    int maxPrecurMass) const;
+
+  // Peaks at or above RangeCutoff(charge) are left out of the evidence
+  // vector. Spectrum-charges with the same NumPeaksInRange() keep the same
+  // peaks.
+  double RangeCutoff(int charge) const;
+  int NumPeaksInRange(int charge) const;
+
   int MaxCharge() const;
   double MaxPeakInRange( double min_range, double max_range ) const;
   
@@ -128,13 +160,17 @@ class SpectrumCollection {
 
   void ReadMS(istream& in, bool ms1);
   bool ReadSpectrumRecords(const string& filename, pb::Header* header = NULL);
+  // Adds a spectrum as ReadSpectrumRecords() would read it.
+  void AddSpectrum(const pb::Spectrum& spec) { spectra_.push_back(new Spectrum(spec)); }
+  // Sorts spectrum-charges by neutral mass. Ties are kept in file order, as
+  // SortedSpectrumStream keeps them.
   void Sort();
   int Size() const { return(spectra_.size()); } // number of spectra
 
   template<typename BinaryPredicate>
   void Sort(BinaryPredicate Predicate) {
     MakeSpecCharges();
-    sort(spec_charges_.begin(), spec_charges_.end(), Predicate);
+    stable_sort(spec_charges_.begin(), spec_charges_.end(), Predicate);
   }
 
   double FindHighestMZ() const;
@@ -121,7 +121,8 @@ class ObservedPeakSet {
      double bin_offset = MassConstants::bin_offset_,
      bool NL = false, bool FP = false)
     : peaks_(new double[MaxBin::Global().BackgroundBinEnd()]),
-    cache_(new int[MaxBin::Global().CacheBinEnd()*NUM_PEAK_TYPES]) {
+    cache_(new int[MaxBin::Global().CacheBinEnd()*NUM_PEAK_TYPES]),
+    max_bin_(&MaxBin::Global()) {
 
     bin_width_  = bin_width;
     bin_offset_ = bin_offset;
@@ -133,6 +134,11 @@ class ObservedPeakSet {
 
   const int* GetCache() const { return cache_; } //TODO 261: access restriction?
 
+  // Preprocesses spectra up to the bins of max_bin rather than those of
+  // MaxBin::Global(), which must be at least as large. Used when spectra from
+  // files with different highest m/z are searched together.
+  void LimitBins(const MaxBin* max_bin) { max_bin_ = max_bin; }
+
   void PreprocessSpectrum(const Spectrum& spectrum, int charge) {
     long int dummy1, dummy2, dummy3, dummy4;
     PreprocessSpectrum(spectrum, charge, &dummy1, &dummy2, &dummy3, &dummy4);
@@ -226,6 +232,7 @@ void addEvidToResEvMatrix(vector<double>& ionMass,
   double bin_offset_;
 
 //  MaxBin max_mz_;
+  const MaxBin* max_bin_;
   int cache_end_;
 
   // added by Yang
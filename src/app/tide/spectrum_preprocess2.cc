@@ -24,6 +24,7 @@
 #include "max_mz.h"
 #include "util/mass.h"
 #include "util/Params.h"
+#include "util/GlobalParams.h"
 #include "util/StringUtils.h"
 #include <cmath>
 
@@ -86,7 +87,8 @@ void ObservedPeakSet::PreprocessSpectrum(const Spectrum& spectrum, int charge,
   smallest_mzbin_ = MassConstants::mass2bin(max_peak_mz);
   dyn_filtered_peak_tuples_.clear();
 
-  if (Params::GetBool("skip-preprocessing")) {
+  bool denoising = GlobalParams::getSpectraDenoising();
+  if (GlobalParams::getSkipPreprocessing()) {
     for (int i = 0; i < spectrum.Size(); ++i) {
       double peak_location = spectrum.M_Z(i);
       if (peak_location >= experimental_mass_cut_off) {
@@ -95,7 +97,7 @@ void ObservedPeakSet::PreprocessSpectrum(const Spectrum& spectrum, int charge,
       }
 
       //denoising-related, added by Yang
-      if (Params::GetBool("spectra-denoising") && !spectrum.Is_supported(i)) { continue; }
+      if (denoising && !spectrum.Is_supported(i)) { continue; }
 
       int mz = MassConstants::mass2bin(peak_location);
       double intensity = spectrum.Intensity(i);
@@ -104,9 +106,9 @@ void ObservedPeakSet::PreprocessSpectrum(const Spectrum& spectrum, int charge,
       }
     }
   } else {
-    bool remove_precursor = Params::GetBool("remove-precursor-peak");
-    double precursor_tolerance = Params::GetDouble("remove-precursor-tolerance");
-    double deisotope_threshold = Params::GetDouble("deisotope");
+    bool remove_precursor = GlobalParams::getRemovePrecursorPeak();
+    double precursor_tolerance = GlobalParams::getRemovePrecursorTolerance();
+    double deisotope_threshold = GlobalParams::getDeisotope();
     int max_charge = spectrum.MaxCharge();
 
     // Fill peaks
@@ -120,7 +122,7 @@ void ObservedPeakSet::PreprocessSpectrum(const Spectrum& spectrum, int charge,
         continue;
       }
       //denoising-related, added by Yang
-      if (Params::GetBool("spectra-denoising") && !spectrum.Is_supported(i)) { continue; }
+      if (denoising && !spectrum.Is_supported(i)) { continue; }
 
       // Remove precursor peaks.
       if (remove_precursor && fabs(peak_location - precursor_mz) <= precursor_tolerance ) {
@@ -196,7 +198,7 @@ void ObservedPeakSet::PreprocessSpectrum(const Spectrum& spectrum, int charge,
         sort(region_peaks.begin(), region_peaks.end(), [](const pair<int, double> &left, const pair<int, double> &right) { return left.second > right.second; });
         // save the top samanda-regional-topk peaks per region
         for (int peak_idx=0; peak_idx<region_peaks.size(); ++peak_idx) {
-          if (peak_idx >= Params::GetInt("msamanda-regional-topk")) { break; }
+          if (peak_idx >= GlobalParams::getMsamandaRegionalTopk()) { break; }
           dyn_filtered_peak_tuples_.push_back(region_peaks[peak_idx]);
         }
       }
@@ -216,7 +218,7 @@ void ObservedPeakSet::PreprocessSpectrum(const Spectrum& spectrum, int charge,
     }
 #endif
   }
-  int largest_mz = min(MaxBin::Global().BackgroundBinEnd(), largest_mzbin_ + MAX_XCORR_OFFSET+1);
+  int largest_mz = min(max_bin_->BackgroundBinEnd(), largest_mzbin_ + MAX_XCORR_OFFSET+1);
   SubtractBackground(peaks_, largest_mz);
   
   // The cache has been modified. It is used to keep track of the types of 
@@ -231,7 +233,7 @@ void ObservedPeakSet::PreprocessSpectrum(const Spectrum& spectrum, int charge,
   int nh3_bin = int(MassConstants::BIN_NH3);
   int h2o_bin = int(MassConstants::BIN_H2O);
   int j;
-  largest_mz = min(largest_mz+h2o_bin, MaxBin::Global().BackgroundBinEnd())-1;    // This line is added to make this code equivalent
+  largest_mz = min(largest_mz+h2o_bin, max_bin_->BackgroundBinEnd())-1;    // This line is added to make this code equivalent
   // to the previous tide.xcorr, athough this is incorrect, and it seems to be a bug. AKF
   for(int i = 1; i < largest_mz; ++i) {
     j = i+i;
@@ -366,10 +368,10 @@ void ObservedPeakSet::CreateResidueEvidenceMatrix(
   const double maxIntensPerRegion = 50.0;
 
   // Determining max ion mass and max ion intensity
-  bool skipPreprocess = Params::GetBool("skip-preprocessing");
-  bool remove_precursor = !skipPreprocess && Params::GetBool("remove-precursor-peak");
-  double precursorMZExclude = Params::GetDouble("remove-precursor-tolerance");
-  double deisotope_threshold = Params::GetDouble("deisotope");
+  bool skipPreprocess = GlobalParams::getSkipPreprocessing();
+  bool remove_precursor = !skipPreprocess && GlobalParams::getRemovePrecursorPeak();
+  double precursorMZExclude = GlobalParams::getRemovePrecursorTolerance();
+  double deisotope_threshold = GlobalParams::getDeisotope();
   double maxIonIntens = 0.0;
   double maxIonMass = 0.0;
   set<int> peakSkip;
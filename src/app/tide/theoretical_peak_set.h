@@ -64,6 +64,9 @@ typedef FixedCapacityArray<int> TheoreticalPeakArr;
 
 class TheoreticalPeakSetBYSparse {
  public:
+  // Peptide::AddIons() stops at the m/z limit of MaxBin::Global().
+  static const bool LIMITED_BY_MAX_BIN = true;
+
   explicit TheoreticalPeakSetBYSparse(int capacity) {
     peaks_[0].Init(capacity);
     peaks_[1].Init(capacity);
@@ -73,7 +76,7 @@ class TheoreticalPeakSetBYSparse {
     memset(peak_mask, 0,  sizeof(int)*peak_mask_end);
   }
 
-  virtual ~TheoreticalPeakSetBYSparse() {}
+  virtual ~TheoreticalPeakSetBYSparse() { delete[] peak_mask; }
 
   void Clear() {
     TheoreticalPeakArr::iterator itr; 
@@ -129,6 +132,54 @@ class TheoreticalPeakSetBYSparse {
     TheoreticalPeakArr peaks_[2];
 };
 
+// The same peaks as TheoreticalPeakSetBYSparse, without the limit on m/z
+// that applies at search time. Used to store the theoretical peaks of each
+// peptide in the index; see peptide_peaks.cc.
+class TheoreticalPeakSetBYAll {
+ public:
+  static const bool LIMITED_BY_MAX_BIN = false;
+
+  TheoreticalPeakSetBYAll() {}
+
+  void Clear() {
+    for (int i = 0; i < NUM_PEAK_TYPES; ++i) {
+      for (vector<int>::const_iterator itr = peaks_[i].begin(); itr != peaks_[i].end(); ++itr) {
+        peak_mask_[*itr / 2] = false;
+      }
+      peaks_[i].clear();
+    }
+  }
+
+  void AddYIon(double mass, int charge) {
+    assert(charge <= 2);
+    Add(MassConstants::mass2bin(mass + MassConstants::Y + MASS_PROTON, charge), charge);
+  }
+
+  void AddBIon(double mass, int charge) {
+    assert(charge <= 2);
+    Add(MassConstants::mass2bin(mass + MassConstants::B + MASS_PROTON, charge), charge);
+  }
+
+  const vector<int>* GetPeaks() const { return peaks_; }
+
+ private:
+  void Add(int index, int charge) {
+    if (index < 0) {
+      return;
+    }
+    if (index >= peak_mask_.size()) {
+      peak_mask_.resize(index + 1, false);
+    }
+    if (!peak_mask_[index]) {
+      peak_mask_[index] = true;
+      peaks_[charge-1].push_back(index + index + (charge == 2 ? 1 : 0));
+    }
+  }
+
+  vector<bool> peak_mask_;
+  vector<int> peaks_[NUM_PEAK_TYPES];
+};
+
 // This class is used to store theoretical b ions only
 // for use in exact p-value calculations.
 class TheoreticalPeakSetBIons {
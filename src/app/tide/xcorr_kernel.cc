@@ -0,0 +1,89 @@
+#include "xcorr_kernel.h"
+
+// The vector kernels are compiled for their instruction sets through function
+// attributes, so the rest of the program keeps the default target and runs on
+// any x86 CPU; the kernels are only called once the CPU is known to have them.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define XCORR_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+static int DotScalar(const int* cache, const unsigned int* peaks, int num_peaks) {
+  int sum = 0;
+  for (int i = 0; i < num_peaks; ++i) {
+    sum += cache[peaks[i]];
+  }
+  return sum;
+}
+
+#ifdef XCORR_KERNEL_X86
+__attribute__((target("avx2")))
+static int DotAVX2(const int* cache, const unsigned int* peaks, int num_peaks) {
+  __m256i acc = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 8 <= num_peaks; i += 8) {
+    __m256i index = _mm256_loadu_si256((const __m256i*) (peaks + i));
+    acc = _mm256_add_epi32(acc, _mm256_i32gather_epi32(cache, index, 4));
+  }
+  __m128i sum4 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  sum4 = _mm_add_epi32(sum4, _mm_shuffle_epi32(sum4, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum4 = _mm_add_epi32(sum4, _mm_shuffle_epi32(sum4, _MM_SHUFFLE(2, 3, 0, 1)));
+  int sum = _mm_cvtsi128_si32(sum4);
+  for (; i < num_peaks; ++i) {
+    sum += cache[peaks[i]];
+  }
+  return sum;
+}
+
+__attribute__((target("avx512f")))
+static int DotAVX512(const int* cache, const unsigned int* peaks, int num_peaks) {
+  __m512i acc = _mm512_setzero_si512();
+  int i = 0;
+  for (; i + 16 <= num_peaks; i += 16) {
+    __m512i index = _mm512_loadu_si512((const void*) (peaks + i));
+    acc = _mm512_add_epi32(acc, _mm512_i32gather_epi32(index, cache, 4));
+  }
+  if (i < num_peaks) {
+    // Masked-off lanes are neither loaded nor gathered, and stay zero.
+    __mmask16 mask = (__mmask16) ((1u << (num_peaks - i)) - 1);
+    __m512i index = _mm512_maskz_loadu_epi32(mask, peaks + i);
+    acc = _mm512_add_epi32(acc, _mm512_mask_i32gather_epi32(
+      _mm512_setzero_si512(), mask, index, cache, 4));
+  }
+  return _mm512_reduce_add_epi32(acc);
+}
+#endif
+
+XCorrKernel::DotFunction XCorrKernel::global_dot_ = DotScalar;
+const char* XCorrKernel::global_name_ = "scalar";
+
+bool XCorrKernel::SetGlobal(const string& name) {
+  bool avx2 = false;
+  bool avx512 = false;
+#ifdef XCORR_KERNEL_X86
+  __builtin_cpu_init();
+  avx2 = __builtin_cpu_supports("avx2");
+  avx512 = __builtin_cpu_supports("avx512f");
+#endif
+
+  if (name == "scalar" || (name == "auto" && !avx2 && !avx512)) {
+    global_dot_ = DotScalar;
+    global_name_ = "scalar";
+    return true;
+  }
+#ifdef XCORR_KERNEL_X86
+  if ((name == "avx512" || name == "auto") && avx512) {
+    global_dot_ = DotAVX512;
+    global_name_ = "avx512";
+    return true;
+  }
+  if ((name == "avx2" || name == "auto") && avx2) {
+    global_dot_ = DotAVX2;
+    global_name_ = "avx2";
+    return true;
+  }
+#endif
+  return false;
+}
@@ -0,0 +1,46 @@
+// Vectorized XCorr dot products.
+//
+// The XCorr of a candidate peptide is the sum of the entries of the observed
+// peak cache indexed by the peptide's theoretical peaks. XCorrKernel::Dot()
+// computes this sum with AVX-512 or AVX2 gathers where the CPU supports them,
+// and with a plain loop otherwise. The sums are over 32-bit integers, so every
+// kernel gives exactly the same score as the scalar loop and the compiled
+// programs of compiler.h.
+//
+// The kernel is chosen once per run, by name:
+// auto   : the widest kernel supported by the CPU
+// scalar : the portable loop
+// avx2   : 8-wide gathers
+// avx512 : 16-wide gathers
+//
+// Example usage:
+// XCorrKernel::SetGlobal("auto");
+// int xcorr = XCorrKernel::Dot(observed.GetCache(), &peaks[0], peaks.size());
+
+#ifndef XCORR_KERNEL_H
+#define XCORR_KERNEL_H
+
+#include <string>
+
+class XCorrKernel {
+ public:
+  typedef int (*DotFunction)(const int* cache, const unsigned int* peaks, int num_peaks);
+
+  // Sum of cache[peaks[i]] for i in [0, num_peaks).
+  static int Dot(const int* cache, const unsigned int* peaks, int num_peaks) {
+    return global_dot_(cache, peaks, num_peaks);
+  }
+
+  // Selects the kernel used by Dot(). Returns false, leaving the selection
+  // unchanged, if the name is unknown or the CPU cannot run that kernel.
+  static bool SetGlobal(const std::string& name);
+
+  // Name of the kernel used by Dot().
+  static const char* GlobalName() { return global_name_; }
+
+ private:
+  static DotFunction global_dot_;
+  static const char* global_name_;
+};
+
+#endif // XCORR_KERNEL_H
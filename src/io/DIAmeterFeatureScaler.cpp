@@ -40,7 +40,7 @@ void DIAmeterFeatureScaler::writeScaledFile(const char* output_file_name) {
       	old_score = StringUtils::FromString<double>(output_vec.at(curr_column_idx));
       }
       double new_score = (old_score - quantile_low_score) / (quantile_high_score - quantile_low_score);
-      output_vec[curr_column_idx] = StringUtils::ToString<double>(new_score, 6);
+      output_vec[curr_column_idx] = StringUtils::ToString(new_score, 6);
     }
 
     *output_file << StringUtils::Join(output_vec, '\t').c_str() << endl;
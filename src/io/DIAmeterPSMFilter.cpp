@@ -116,7 +116,7 @@ void DIAmeterPSMFilter::loadAndFilter(const char* output_file_name, bool filter)
       double curr_column_coeff = toagg_column_coeffs_.at(idx);
       ensemble += column_val * curr_column_coeff;
     }
-    data[agg_idx_] = StringUtils::ToString<double>(ensemble, 6);
+    data[agg_idx_] = StringUtils::ToString(ensemble, 6);
 
     map<int, boost::tuple<double, double>>::iterator baselineIter = scan_charge_scores_map.find(key);
     if (baselineIter == scan_charge_scores_map.end()) { carp(CARP_FATAL, "The key must exist in scan_charge_scores_map! %d", key); }
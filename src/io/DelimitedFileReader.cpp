@@ -7,8 +7,18 @@
 
 #include <fstream>
 
+#include <cctype>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
 #include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "carp.h"
 #include "DelimitedFile.h"
@@ -20,7 +30,8 @@ using namespace std;
  * \returns a DelimitedFileReader object
  */  
 DelimitedFileReader::DelimitedFileReader():
-  num_rows_valid_(false), istream_ptr_(NULL), delimiter_('\t'), owns_stream_(false) {
+  map_(NULL), map_size_(0), delimiter_('\t'), owns_stream_(false), istream_ptr_(NULL),
+  num_rows_valid_(false) {
 }
 
 /**
@@ -31,7 +42,8 @@ DelimitedFileReader::DelimitedFileReader(
   const char *file_name, ///< the path of the file to read
   bool has_header, ///< indicates whether the header exists (default true).
   char delimiter ///< the delimiter to use (default tab).
-): istream_ptr_(NULL), num_rows_valid_(false), delimiter_(delimiter) {
+): map_(NULL), map_size_(0), delimiter_(delimiter), owns_stream_(false), istream_ptr_(NULL),
+  num_rows_valid_(false) {
   loadData(file_name, has_header);
 }
 
@@ -43,7 +55,7 @@ DelimitedFileReader::DelimitedFileReader(
   const std::string& file_name, ///< the path of the file  to read
   bool has_header, ///< indicates whether the header exists (default true).
   char delimiter ///< the delimiter to use (default tab)
-): istream_ptr_(NULL), delimiter_(delimiter) {
+): map_(NULL), map_size_(0), delimiter_(delimiter), owns_stream_(false), istream_ptr_(NULL) {
   loadData(file_name, has_header);
 }
 
@@ -55,8 +67,8 @@ DelimitedFileReader::DelimitedFileReader(
   std::istream* istream_ptr, ///< the stream to be read
   bool has_header, ///<indicates whether header exists
   char delimiter ///< the delimiter to use (default tab)
-): istream_ptr_(istream_ptr), istream_begin_(istream_ptr->tellg()), delimiter_(delimiter),
-has_header_(has_header), owns_stream_(false) {
+): map_(NULL), map_size_(0), delimiter_(delimiter), has_header_(has_header),
+  owns_stream_(false), istream_ptr_(istream_ptr), istream_begin_(istream_ptr->tellg()) {
   loadData();
 }
 
@@ -65,16 +77,129 @@ has_header_(has_header), owns_stream_(false) {
  * Destructor
  */
 DelimitedFileReader::~DelimitedFileReader() {
+  closeFile();
+}
+
+/**
+ * memory maps file_name_.
+ *\returns false if it is not a regular file or cannot be mapped, in
+ * which case it is read as a stream.
+ */
+bool DelimitedFileReader::mapFile() {
+  struct stat file_info;
+  if (stat(file_name_.c_str(), &file_info) != 0 ||
+      (file_info.st_mode & S_IFMT) != S_IFREG || file_info.st_size == 0) {
+    return false;
+  }
+#ifdef _MSC_VER
+  void* map = stub_mmap(file_name_.c_str(), &unmap_info_);
+  if (map == NULL) {
+    return false;
+  }
+#else
+  int fd = open(file_name_.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  void* map = mmap(NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  madvise(map, file_info.st_size, MADV_SEQUENTIAL);
+#endif
+  map_ = (const char*)map;
+  map_size_ = file_info.st_size;
+  return true;
+}
+
+/**
+ * releases the memory mapped file and the stream, if owned.
+ */
+void DelimitedFileReader::closeFile() {
+  if (map_ != NULL) {
+#ifdef _MSC_VER
+    stub_unmmap(&unmap_info_);
+#else
+    if (munmap((void*)map_, map_size_) != 0) {
+      carp(CARP_ERROR, "Failed to unmap %s", file_name_.c_str());
+    }
+#endif
+    map_ = NULL;
+    map_size_ = 0;
+  }
   if (istream_ptr_ != NULL && owns_stream_) {
     delete istream_ptr_;
   }
+  istream_ptr_ = NULL;
+  owns_stream_ = false;
+}
+
+/**
+ * reads the next line of the memory mapped file into next_row_.
+ *\returns false at the end of the file, as getline does.
+ */
+bool DelimitedFileReader::readMappedLine() {
+  const char* end = map_ + map_size_;
+  if (map_next_ >= end) {
+    return false;
+  }
+  const char* newline = (const char*)memchr(map_next_, '\n', end - map_next_);
+  if (newline == NULL) {
+    newline = end;
+  }
+  next_row_ = map_next_;
+  next_row_length_ = newline - map_next_;
+  map_next_ = newline + 1;
+  return true;
+}
+
+/**
+ * finds the cells of the row.
+ */
+void DelimitedFileReader::splitRow(
+  const char* row, ///< the text of the row
+  size_t length ///< the length of the row
+  ) {
+  row_ = row;
+  row_length_ = length;
+  cell_begins_.clear();
+  cell_begins_.push_back(0);
+  const char* end = row + length;
+  for (const char* i = row;
+       (i = (const char*)memchr(i, delimiter_, end - i)) != NULL;
+       ++i) {
+    cell_begins_.push_back(i - row + 1);
+  }
+  num_cells_ = cell_begins_.size();
+  cell_begins_.push_back(length + 1);
+  if (num_cells_ < column_names_.size()) {
+    num_cells_ = column_names_.size();
+  }
+  data_.resize(num_cells_);
+  data_rows_.resize(num_cells_, 0);
 }
 
 /**
  * \returns the number of rows, assuming a square matrix
  */
 unsigned int DelimitedFileReader::numRows() {
-  if (!num_rows_valid_) {
+  if (!num_rows_valid_ && map_ != NULL) {
+    num_rows_ = 0;
+    const char* end = map_ + map_size_;
+    for (const char* i = map_;
+         (i = (const char*)memchr(i, '\n', end - i)) != NULL;
+         ++i) {
+      num_rows_++;
+    }
+    if (map_[map_size_ - 1] != '\n') {
+      num_rows_++;
+    }
+    if (has_header_) {
+      num_rows_--;
+    }
+    num_rows_valid_ = true;
+  } else if (!num_rows_valid_) {
     num_rows_ = 0;
 
     streampos last_pos = istream_ptr_->tellg();
@@ -140,6 +265,39 @@ string DelimitedFileReader::getHeaderString() {
 
 
 void DelimitedFileReader::loadData() {
+  current_row_ = 0;
+  num_rows_valid_ = false;
+  has_current_ = false;
+  column_mismatch_warned_ = false;
+  data_rows_.clear();
+
+  if (map_ != NULL) {
+    map_next_ = map_;
+    has_next_ = readMappedLine();
+    // trim the first line, as for a stream
+    while (next_row_length_ > 0 && isspace((unsigned char)*next_row_)) {
+      ++next_row_;
+      --next_row_length_;
+    }
+    while (next_row_length_ > 0 &&
+           isspace((unsigned char)next_row_[next_row_length_ - 1])) {
+      --next_row_length_;
+    }
+    if (has_header_) {
+      if (has_next_) {
+        column_names_ = StringUtils::Split(string(next_row_, next_row_length_), delimiter_);
+        has_next_ = readMappedLine();
+      } else {
+        carp(CARP_WARNING, "No data/headers found!");
+        return;
+      }
+    }
+    if (has_next_) {
+      next();
+    }
+    return;
+  }
+
   if (!istream_ptr_->good()) {
     carp(CARP_ERROR, "Stream is not good!");
     carp(CARP_ERROR, "Filename:%s", file_name_.c_str());
@@ -148,10 +306,6 @@ void DelimitedFileReader::loadData() {
     carp(CARP_ERROR, "Bad:%i", istream_ptr_ -> bad());
     carp(CARP_FATAL, "Exiting....");
   }
-  current_row_ = 0;
-  num_rows_valid_ = false;
-  has_current_ = false;
-  column_mismatch_warned_ = false;
   istream_begin_ = istream_ptr_->tellg(); 
 
   has_next_ = !getline(*istream_ptr_, next_data_string_).fail();
@@ -183,6 +337,7 @@ void DelimitedFileReader::loadData(
   bool has_header ///< header indicator
   ) {
 
+  closeFile();
   file_name_ = string(file_name);
   has_header_ = has_header;
 
@@ -190,6 +345,9 @@ void DelimitedFileReader::loadData(
   if (file_name_ == "-") {
     istream_ptr_ = &cin;
     owns_stream_ = false;
+  } else if (mapFile()) {
+    istream_ptr_ = NULL;
+    owns_stream_ = false;
   } else {
     istream_ptr_ = new ifstream(file_name, ios::in);
     owns_stream_ = true;
@@ -251,6 +409,9 @@ const vector<string>& DelimitedFileReader::getColumnNames() {
 
 const std::vector<std::string>& DelimitedFileReader::getCurrentRowData() {
   if (!has_current_) { carp(CARP_FATAL, "End of file!"); }
+  for (unsigned int col_idx = 0; col_idx < data_.size(); col_idx++) {
+    getString(col_idx);
+  }
   return data_;
 }
 
@@ -270,20 +431,48 @@ const string& DelimitedFileReader::getString() {
   if (!has_current_) {
     carp(CARP_FATAL, "End of file!");
   }
+  if (!current_data_valid_) {
+    current_data_string_.assign(row_, row_length_);
+    current_data_valid_ = true;
+  }
   return current_data_string_;
 }
 
 /**
- *\returns the string value of the cell
+ * \returns the text of the cell using the current row, in place.
  */
-const string& DelimitedFileReader::getString(
-  unsigned int col_idx ///< the column index
+const char* DelimitedFileReader::getCell(
+  unsigned int col_idx, ///< the column index
+  size_t* length ///< set to the length of the cell
   ) {
   if (col_idx >= data_.size()) {
     carp(CARP_FATAL, "col idx:%i is out of bounds! (0,%i,%i)",
          col_idx, (column_names_.size()-1), (data_.size()-1));
   }
-  return data_.at(col_idx);
+  if (col_idx + 1 >= cell_begins_.size()) {
+    // missing from a short row
+    *length = 0;
+    return row_ + row_length_;
+  }
+  size_t begin = cell_begins_[col_idx];
+  *length = cell_begins_[col_idx + 1] - 1 - begin;
+  return row_ + begin;
+}
+
+/**
+ *\returns the string value of the cell
+ */
+const string& DelimitedFileReader::getString(
+  unsigned int col_idx ///< the column index
+  ) {
+  if (col_idx < data_rows_.size() && data_rows_[col_idx] == current_row_) {
+    return data_[col_idx];
+  }
+  size_t length;
+  const char* cell = getCell(col_idx, &length);
+  data_[col_idx].assign(cell, length);
+  data_rows_[col_idx] = current_row_;
+  return data_[col_idx];
 }
 
 /** 
@@ -308,7 +497,33 @@ template<typename TValue>
 TValue DelimitedFileReader::getValue(
   unsigned int col_idx ///< the column index 
   ) {
-  return StringUtils::FromString<TValue>(getString(col_idx));
+  size_t length;
+  const char* cell = getCell(col_idx, &length);
+  TValue value;
+  if (!StringUtils::TryFromString(cell, length, &value)) {
+    throw runtime_error("Could not convert string '" + string(cell, length) + "'");
+  }
+  return value;
+}
+
+/**
+ * \returns whether the cell is text, ignoring case if ignore_case is true.
+ */
+static bool cellEquals(
+  const char* cell, ///< the text of the cell
+  size_t length, ///< the length of the cell
+  const char* text, ///< the text to compare with
+  bool ignore_case = false ///< whether to ignore case
+  ) {
+  if (length != strlen(text)) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (ignore_case ? tolower((unsigned char)cell[i]) != text[i] : cell[i] != text[i]) {
+      return false;
+    }
+  }
+  return true;
 }
 
 /**
@@ -317,10 +532,11 @@ TValue DelimitedFileReader::getValue(
 FLOAT_T DelimitedFileReader::getFloat(
   unsigned int col_idx ///< the column index
   ) {
-  const string& string_ans = getString(col_idx);
-  if (string_ans == "Inf") {
+  size_t length;
+  const char* cell = getCell(col_idx, &length);
+  if (cellEquals(cell, length, "Inf")) {
     return numeric_limits<FLOAT_T>::infinity();
-  } else if (string_ans == "-Inf") {
+  } else if (cellEquals(cell, length, "-Inf")) {
     return -numeric_limits<FLOAT_T>::infinity();
   } else {
     return getValue<FLOAT_T>(col_idx);
@@ -350,14 +566,15 @@ FLOAT_T DelimitedFileReader::getFloat(
 double DelimitedFileReader::getDouble(
   unsigned int col_idx ///< the column index 
   ) {
-  const string& string_ans = getString(col_idx);
-  if (string_ans == "") {
+  size_t length;
+  const char* cell = getCell(col_idx, &length);
+  if (length == 0) {
     return 0.0;
-  } else if (string_ans == "Inf") {
+  } else if (cellEquals(cell, length, "Inf")) {
     return numeric_limits<double>::infinity();
-  } else if (string_ans == "-Inf") {
+  } else if (cellEquals(cell, length, "-Inf")) {
     return -numeric_limits<double>::infinity();
-  } else if (StringUtils::ToLower(string_ans) == "nan") {
+  } else if (cellEquals(cell, length, "nan", true)) {
 	return 0.0;
   } else {
     return getValue<double>(col_idx);
@@ -466,8 +683,10 @@ void DelimitedFileReader::getDoubleVectorFromCell(
  * resets the file pointer to the beginning of the file.
  */
 void DelimitedFileReader::reset() {
-  istream_ptr_->clear();
-  istream_ptr_->seekg(istream_begin_, ios::beg);
+  if (map_ == NULL) {
+    istream_ptr_->clear();
+    istream_ptr_->seekg(istream_begin_, ios::beg);
+  }
   loadData();
 }
 
@@ -477,26 +696,31 @@ void DelimitedFileReader::reset() {
 void DelimitedFileReader::next() {
   if (has_next_) {
     current_row_++;
-    current_data_string_ = next_data_string_;
-    //parse next_data_string_ into data_
-    data_ = StringUtils::Split(current_data_string_, delimiter_);
+    //find the cells of the next row; they are copied into data_ on demand
+    if (map_ != NULL) {
+      splitRow(next_row_, next_row_length_);
+      current_data_valid_ = false;
+    } else {
+      current_data_string_.swap(next_data_string_);
+      splitRow(current_data_string_.data(), current_data_string_.length());
+      current_data_valid_ = true;
+    }
+    has_current_ = true;
     //make sure data has the right number of columns for the header.
-    if (data_.size() < column_names_.size()) {
-      if (!column_mismatch_warned_) {
-        carp(CARP_WARNING, "Column count %d for line %d is less than header %d",
-             data_.size(), current_row_, column_names_.size());
-        carp(CARP_WARNING, "%s", current_data_string_.c_str());
-        carp(CARP_WARNING, "Suppressing warnings, other mismatches may exist!");
-        column_mismatch_warned_ = true;
-      }
-      while (data_.size() < column_names_.size()) {
-        data_.push_back("");
-      }
+    if (cell_begins_.size() - 1 < column_names_.size() && !column_mismatch_warned_) {
+      carp(CARP_WARNING, "Column count %d for line %d is less than header %d",
+           cell_begins_.size() - 1, current_row_, column_names_.size());
+      carp(CARP_WARNING, "%s", getString().c_str());
+      carp(CARP_WARNING, "Suppressing warnings, other mismatches may exist!");
+      column_mismatch_warned_ = true;
     }
 
     //read next line
-    has_next_ = !getline(*istream_ptr_, next_data_string_).fail();
-    has_current_ = true;
+    if (map_ != NULL) {
+      has_next_ = readMappedLine();
+    } else {
+      has_next_ = !getline(*istream_ptr_, next_data_string_).fail();
+    }
   } else {
     has_current_ = false;
   }
@@ -9,7 +9,9 @@
  * Types from each cell of the table.  This class also provides function
  * for reading a list of integers or string from a cell using a delimiter
  * that is different from the column delimiter (default is comma ',').
- * This class reads the data in line by line
+ * This class reads the data in line by line. A file given by name is
+ * memory mapped; each row is split into cells in place, and a cell is
+ * copied or converted only when it is asked for.
  ****************************************************************************/
 #ifndef DELIMITEDFILEREADER_H
 #define DELIMITEDFILEREADER_H
@@ -26,6 +28,10 @@
 #include "parameter.h"
 #include "util/Params.h"
 
+#ifdef _MSC_VER
+#include "util/WinCrux.h"
+#endif
+
 class DelimitedFileReader {
 
  protected:
@@ -36,9 +42,25 @@ class DelimitedFileReader {
 
   std::string next_data_string_; ///<the next data string.
   std::string current_data_string_; ///<the current data string.
-  std::vector<std::string> data_; ///<the current vectorized data.
+  bool current_data_valid_; ///<indicator of whether current_data_string_ holds the current row
+  std::vector<std::string> data_; ///<the current vectorized data, filled on demand.
+  std::vector<unsigned int> data_rows_; ///<the row each cell of data_ was filled for.
   std::vector<std::string> column_names_; ///<the column names.
 
+  const char* row_; ///<the text of the current row
+  size_t row_length_; ///<the length of the current row
+  std::vector<size_t> cell_begins_; ///<offsets of the cells in the current row, then row_length_ + 1
+  unsigned int num_cells_; ///<number of cells in the current row, at least the number of columns
+
+  const char* map_; ///<the memory mapped file, NULL if reading a stream
+  size_t map_size_; ///<the size of the memory mapped file
+#ifdef _MSC_VER
+  SIMPLE_UNMMAP unmap_info_; ///<handles of the memory mapped file
+#endif
+  const char* map_next_; ///<the start of the next unread line of the memory mapped file
+  const char* next_row_; ///<the next line of the memory mapped file
+  size_t next_row_length_; ///<the length of the next line of the memory mapped file
+
   char delimiter_; ///<the delimiter to use.
 
   unsigned int current_row_; ///<current row count
@@ -78,6 +100,32 @@ class DelimitedFileReader {
     bool has_header = true ///< header indicator
   );
 
+  /**
+   * memory maps file_name_.
+   *\returns false if it is not a regular file or cannot be mapped, in
+   * which case it is read as a stream.
+   */
+  bool mapFile();
+
+  /**
+   * releases the memory mapped file and the stream, if owned.
+   */
+  void closeFile();
+
+  /**
+   * reads the next line of the memory mapped file into next_row_.
+   *\returns false at the end of the file, as getline does.
+   */
+  bool readMappedLine();
+
+  /**
+   * finds the cells of the row.
+   */
+  void splitRow(
+    const char* row, ///< the text of the row
+    size_t length ///< the length of the row
+  );
+
  public:
   /**
    * \returns a blank DelimitedFileReader object 
@@ -192,6 +240,15 @@ class DelimitedFileReader {
     unsigned int col_idx ///< the column index
   );
 
+  /**
+   * \returns the text of the cell using the current row, in place. It is
+   * not null terminated, and is valid until the next row is parsed.
+   */
+  const char* getCell(
+    unsigned int col_idx, ///< the column index
+    size_t* length ///< set to the length of the cell
+  );
+
   /**
    * \returns the value of the cell
    * using the current row
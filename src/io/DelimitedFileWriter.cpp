@@ -114,13 +114,15 @@ void DelimitedFileWriter::writeRow() {
   }
   // TODO? warning if row is longer than non-empty header?
 
-  // print each value separated by delimiter
-  *file_ptr_ << current_row_[0];
+  // print each value separated by delimiter, ending with newline, in
+  // one write
+  row_buffer_ = current_row_[0];
   for(size_t idx = 1; idx < current_row_.size(); idx++) {
-    *file_ptr_ << delimiter_ << current_row_[idx];
+    row_buffer_ += delimiter_;
+    row_buffer_ += current_row_[idx];
   }
-  // end with newline
-  *file_ptr_ << endl;
+  row_buffer_ += '\n';
+  file_ptr_->write(row_buffer_.data(), row_buffer_.size());
 
   // clear the current_row and refill with blanks
   // if there is a header, that is the min length
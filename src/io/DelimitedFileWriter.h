@@ -33,6 +33,7 @@ class DelimitedFileWriter {
   char delimiter_; ///< separate columns with this character
   std::vector<std::string> column_names_; ///< one entry per column
   std::vector<std::string> current_row_; ///< values for next row to write
+  std::string row_buffer_; ///< current row joined for writing
 
  public:
   /**
@@ -151,7 +151,9 @@ bool MatchFileReader::empty(
   if (idx == -1) {
     return true;
   }
-  return DelimitedFileReader::getString(idx).empty();
+  size_t length;
+  getCell(idx, &length);
+  return length == 0;
 }
 
 /**
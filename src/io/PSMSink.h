@@ -0,0 +1,74 @@
+/*
+Abstract class for receivers of the peptide-spectrum matches of a search, as
+they are reported. A sink gets each match alongside its tab-delimited row,
+built from the values already in memory, so that other formats are written
+without reading the tab-delimited file back.
+*/
+
+#ifndef PSMSINK_H
+#define PSMSINK_H
+
+#include "model/Match.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * A protein location of a reported peptide, as the tab-delimited output
+ * gives it: the protein id, with the decoy prefix for decoys, the position
+ * of the peptide in the protein, counting from 1, and the residues flanking
+ * it, '-' at a protein terminus.
+ */
+struct PSMLocation {
+  std::string ProteinId;
+  int Pos;
+  std::string FlankingAAs;
+  PSMLocation(const std::string& protein_id, int pos, const std::string& flanking_aas):
+    ProteinId(protein_id), Pos(pos), FlankingAAs(flanking_aas) {}
+};
+
+class PSMSink {
+
+ public:
+  /**
+   * The place of a match in the output: by spectrum file, segment of the
+   * spectrum-charges searched in one pass, spectrum-charge (or reported
+   * peptide) within it, and row of the spectrum-charge.
+   */
+  struct Key {
+    size_t File;
+    size_t Segment;
+    size_t Item;
+    size_t Row;
+    Key(): File(0), Segment(0), Item(0), Row(0) {}
+    bool operator<(const Key& other) const {
+      if (File != other.File) {
+        return File < other.File;
+      } else if (Segment != other.Segment) {
+        return Segment < other.Segment;
+      } else if (Item != other.Item) {
+        return Item < other.Item;
+      }
+      return Row < other.Row;
+    }
+  };
+
+  // Destructor
+  virtual ~PSMSink() {}
+
+  /**
+   * Takes a reported match, which the sink owns from then on. Its peptide
+   * has no protein sources yet; locations gives them. decoy is set if the
+   * match goes to the decoy output. Matches may be added from several
+   * threads at once, in any order.
+   */
+  virtual void add(
+    Crux::Match* match,
+    const std::vector<PSMLocation>& locations,
+    const std::string& file_path,
+    bool decoy,
+    const Key& key
+  ) = 0;
+};
+
+#endif
@@ -350,17 +350,20 @@ void PinWriter::printPSM(
       carp(CARP_FATAL, "Unknown feature: '%s'", feature.c_str());
     }
   }
-  *out_ << StringUtils::Join(fields, '\t') << endl;
+  string row = StringUtils::Join(fields, '\t');
+  row += '\n';
+  out_->write(row.data(), row.size());
 }
 
 string PinWriter::getPeptide(Peptide* pep) {
-  stringstream sequence;
-  sequence << pep->getNTermFlankingAA() << '.'
-           << (Params::GetBool("mod-symbols")
-                ? pep->getModifiedSequenceWithSymbols()
-                : pep->getModifiedSequenceWithMasses())
-           << '.' << pep->getCTermFlankingAA();
-  return sequence.str();
+  string sequence(1, pep->getNTermFlankingAA());
+  sequence += '.';
+  sequence += Params::GetBool("mod-symbols")
+    ? pep->getModifiedSequenceWithSymbols()
+    : pep->getModifiedSequenceWithMasses();
+  sequence += '.';
+  sequence += pep->getCTermFlankingAA();
+  return sequence;
 }
 
 string PinWriter::getId(Match* match, int scan_number) {
@@ -368,15 +371,20 @@ string PinWriter::getId(Match* match, int scan_number) {
     ? FileUtils::Stem(match->getFilePath())
     : "";
 
-  stringstream psm_id; 
+  string psm_id;
   if (prefix.empty()) {
-    psm_id << (match->getNullPeptide() ? "decoy" : "target")
-           << '_' << match->getFileIndex();
+    psm_id = match->getNullPeptide() ? "decoy" : "target";
+    psm_id += '_';
+    StringUtils::AppendInt(&psm_id, match->getFileIndex());
   } else {
-    psm_id << prefix;
+    psm_id = prefix;
   }
-  psm_id << '_' << scan_number << '_' << match->getCharge() << '_'
-         << match->getRank(XCORR);
-  return psm_id.str();   
+  psm_id += '_';
+  StringUtils::AppendInt(&psm_id, scan_number);
+  psm_id += '_';
+  StringUtils::AppendInt(&psm_id, match->getCharge());
+  psm_id += '_';
+  StringUtils::AppendInt(&psm_id, match->getRank(XCORR));
+  return psm_id;
 }
 
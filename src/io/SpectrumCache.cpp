@@ -0,0 +1,474 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+#define BOOST_NO_CXX11_SCOPED_ENUMS
+#include <boost/filesystem.hpp>
+#undef BOOST_NO_CXX11_SCOPED_ENUMS
+#include <boost/thread.hpp>
+
+#include "SpectrumCache.h"
+#include "io/carp.h"
+#include "util/FileUtils.h"
+#include "util/Params.h"
+
+namespace fs = boost::filesystem;
+
+// Changes whenever the spectrumrecords written for the same input and
+// parameters change, so that older entries are not used.
+static const int CACHE_FORMAT_VERSION = 1;
+static const char ENTRY_EXTENSION[] = ".spectrumrecords";
+static const char TEMP_EXTENSION[] = ".tmp";
+static const char LOCK_EXTENSION[] = ".lock";
+
+/**
+ * A 64-bit hash of a stream of bytes, taking 8 bytes at a time in four
+ * independent lanes so that large files hash at about the speed they are
+ * read. The cache only needs to tell inputs apart, not to withstand an
+ * attacker.
+ */
+class ContentHash {
+ public:
+  ContentHash() : length_(0) {
+    lanes_[0] = 0x243F6A8885A308D3ULL;
+    lanes_[1] = 0x13198A2E03707344ULL;
+    lanes_[2] = 0xA4093822299F31D0ULL;
+    lanes_[3] = 0x082EFA98EC4E6C89ULL;
+  }
+
+  // Only the last call may pass a size that is not a multiple of 32.
+  void update(const char* data, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+      for (int lane = 0; lane < 4; lane++) {
+        uint64_t word;
+        memcpy(&word, data + i + 8 * lane, sizeof(word));
+        lanes_[lane] = mix(lanes_[lane] ^ word);
+      }
+    }
+    for (; i < size; i++) {
+      lanes_[0] = mix(lanes_[0] ^ (unsigned char)data[i]);
+    }
+    length_ += size;
+  }
+
+  uint64_t final() const {
+    uint64_t hash = length_;
+    for (int lane = 0; lane < 4; lane++) {
+      hash = mix(hash ^ lanes_[lane]);
+    }
+    return hash;
+  }
+
+ private:
+  static uint64_t mix(uint64_t x) {
+    x *= 0x9E3779B97F4A7C15ULL;
+    return x ^ (x >> 29);
+  }
+
+  uint64_t lanes_[4];
+  uint64_t length_;
+};
+
+static uint64_t hashString(const string& s) {
+  ContentHash hash;
+  hash.update(s.data(), s.length());
+  return hash.final();
+}
+
+static uint64_t hashFile(const string& path) {
+  ifstream stream(path.c_str(), ios::binary);
+  if (!stream) {
+    carp(CARP_FATAL, "Could not read %s.", path.c_str());
+  }
+  ContentHash hash;
+  vector<char> buffer(1 << 20);
+  while (stream) {
+    stream.read(&buffer[0], buffer.size());
+    hash.update(&buffer[0], stream.gcount());
+  }
+  if (!stream.eof()) {
+    carp(CARP_FATAL, "Error reading %s.", path.c_str());
+  }
+  return hash.final();
+}
+
+static string toHex(uint64_t value) {
+  char buffer[17];
+  sprintf(buffer, "%016llx", (unsigned long long)value);
+  return buffer;
+}
+
+static bool endsWith(const string& s, const string& suffix) {
+  return s.length() >= suffix.length() &&
+    s.compare(s.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+/**
+ * Returns a new cache, or NULL on Windows. Entries could be locked there
+ * with LockFileEx, but an exclusive lock cannot become a shared one without
+ * being released, which would let another process evict a new entry.
+ */
+SpectrumCache* SpectrumCache::create(
+  const string& dir,
+  uint64_t max_size
+) {
+#ifdef _MSC_VER
+  carp(CARP_WARNING, "The spectrum cache is not available on Windows; "
+       "spectra are converted into the output directory instead of %s.", dir.c_str());
+  return NULL;
+#else
+  return new SpectrumCache(dir, max_size);
+#endif
+}
+
+/**
+ * Opens the cache in directory dir, creating it if needed.
+ */
+SpectrumCache::SpectrumCache(
+  const string& dir,
+  uint64_t max_size
+) : dir_(dir), max_size_(max_size) {
+  boost::system::error_code error;
+  fs::create_directories(dir_, error);
+  if (!FileUtils::IsDir(dir_)) {
+    carp(CARP_FATAL, "Could not create spectrum cache directory %s.", dir_.c_str());
+  }
+  trim();
+}
+
+/**
+ * Releases the locks held on entries, and removes the temporary files of
+ * entries that were reserved but not committed.
+ */
+SpectrumCache::~SpectrumCache() {
+  for (map<string, string>::iterator i = temp_files_.begin(); i != temp_files_.end(); i++) {
+    FileUtils::Remove(i->second);
+  }
+  for (map<string, int>::iterator i = locks_.begin(); i != locks_.end(); i++) {
+    unlock(i->second);
+  }
+}
+
+/**
+ * Returns the path of the entry for spectra file infile. The name is the
+ * hash of the file contents followed by the hash of everything else that
+ * decides what the conversion writes.
+ */
+string SpectrumCache::entry(
+  const string& infile,
+  int ms_level,
+  bool dia_mode
+) {
+  map<string, uint64_t>::iterator i = content_hashes_.find(infile);
+  if (i == content_hashes_.end()) {
+    i = content_hashes_.insert(make_pair(infile, hashContents(infile))).first;
+  }
+  ostringstream settings;
+  settings << "version=" << CACHE_FORMAT_VERSION
+           << " spectrum-parser=" << Params::GetString("spectrum-parser")
+           << " ms-level=" << ms_level
+           << " dia-mode=" << dia_mode
+           << " scan-number=" << Params::GetString("scan-number")
+           << " use-z-line=" << Params::GetBool("use-z-line");
+  if (dia_mode) {
+    settings << " max-precursor-charge=" << Params::GetInt("max-precursor-charge");
+  }
+  string name = toHex(i->second) + "-" + toHex(hashString(settings.str())) + ENTRY_EXTENSION;
+  return FileUtils::Join(dir_, name);
+}
+
+/**
+ * If entry exists, marks it used, locks it for reading and returns true.
+ */
+bool SpectrumCache::use(
+  const string& entry
+) {
+  if (locks_.find(entry) != locks_.end()) {
+    touch(entry);
+    return true;
+  }
+  if (!FileUtils::Exists(entry)) {
+    return false;
+  }
+  // Only held exclusively for a moment, while an entry is renamed or evicted.
+  int fd = lock(entry, false, true);
+  if (!FileUtils::Exists(entry)) {
+    unlock(fd);
+    return false;
+  }
+  locks_[entry] = fd;
+  touch(entry);
+  carp(CARP_DEBUG, "Using cached spectra %s", entry.c_str());
+  return true;
+}
+
+/**
+ * Waits until entry may be written by this process. Another process may be
+ * converting the same spectra; its entry is used once it is made. The
+ * waiting is done by polling, so that a process never waits on a lock while
+ * holding one that the other process needs, as long as processes reserve
+ * the entries they convert together in order of their names.
+ */
+bool SpectrumCache::reserve(
+  const string& entry
+) {
+  bool waiting = false;
+  while (true) {
+    if (use(entry)) {
+      return false;
+    }
+    int fd = lock(entry, true, false);
+    if (fd >= 0) {
+      if (FileUtils::Exists(entry)) {
+        unlock(fd);
+        continue;
+      }
+      locks_[entry] = fd;
+      temp_files_[entry] = entry + "." + fs::unique_path().string() + TEMP_EXTENSION;
+      return true;
+    }
+    if (!waiting) {
+      carp(CARP_INFO, "Waiting for another process to write %s.", entry.c_str());
+      waiting = true;
+    }
+    boost::this_thread::sleep(boost::posix_time::seconds(1));
+  }
+}
+
+/**
+ * Returns the temporary file that a reserved entry is converted to.
+ */
+string SpectrumCache::tempFile(
+  const string& entry
+) {
+  map<string, string>::const_iterator i = temp_files_.find(entry);
+  if (i == temp_files_.end()) {
+    carp(CARP_FATAL, "Spectrum cache entry %s was not reserved.", entry.c_str());
+  }
+  return i->second;
+}
+
+/**
+ * Moves the temporary file of a reserved entry to the entry if ok is true.
+ * The rename is atomic, so other processes never see a partial entry.
+ */
+void SpectrumCache::commit(
+  const string& entry,
+  bool ok
+) {
+  string temp = tempFile(entry);
+  temp_files_.erase(entry);
+  if (ok) {
+    boost::system::error_code error;
+    fs::rename(temp, entry, error);
+    if (error) {
+      carp(CARP_WARNING, "Could not add %s to the spectrum cache: %s", entry.c_str(),
+           error.message().c_str());
+      ok = false;
+    }
+  }
+  int fd = locks_[entry];
+  if (ok) {
+    touch(entry);
+    downgrade(fd);
+    carp(CARP_DEBUG, "Added %s to the spectrum cache", entry.c_str());
+  } else {
+    FileUtils::Remove(temp);
+    unlock(fd);
+    locks_.erase(entry);
+  }
+  trim();
+}
+
+/**
+ * Removes the least recently used entries that are not locked until the
+ * entries take at most the size limit. Lock files are never removed, so
+ * every process always locks the same file for an entry.
+ */
+void SpectrumCache::trim() {
+  struct CacheFile {
+    time_t used;
+    uint64_t size;
+    string path;
+    bool operator<(const CacheFile& other) const {
+      return used < other.used || (used == other.used && path < other.path);
+    }
+  };
+  vector<CacheFile> entries;
+  uint64_t total = 0;
+  boost::system::error_code error;
+  for (fs::directory_iterator i(dir_, error), end; !error && i != end; i.increment(error)) {
+    if (!fs::is_regular_file(i->status())) {
+      continue;
+    }
+    string path = i->path().string();
+    if (endsWith(path, TEMP_EXTENSION)) {
+      // A temporary file is left behind if its entry can be locked.
+      size_t pos = path.rfind(ENTRY_EXTENSION);
+      if (pos == string::npos) {
+        continue;
+      }
+      string entry = path.substr(0, pos + strlen(ENTRY_EXTENSION));
+      // Locking an entry this process holds would succeed, and unlocking
+      // it would release the lock held.
+      if (locks_.find(entry) != locks_.end()) {
+        continue;
+      }
+      int fd = lock(entry, true, false);
+      if (fd >= 0) {
+        carp(CARP_DEBUG, "Removing unfinished spectrum cache file %s", path.c_str());
+        FileUtils::Remove(path);
+        unlock(fd);
+      }
+    } else if (endsWith(path, ENTRY_EXTENSION)) {
+      boost::system::error_code stat_error;
+      CacheFile file;
+      file.used = fs::last_write_time(i->path(), stat_error);
+      file.size = fs::file_size(i->path(), stat_error);
+      file.path = path;
+      if (!stat_error) {
+        entries.push_back(file);
+        total += file.size;
+      }
+    }
+  }
+  if (max_size_ == 0 || total <= max_size_) {
+    return;
+  }
+  sort(entries.begin(), entries.end());
+  for (vector<CacheFile>::const_iterator i = entries.begin();
+       i != entries.end() && total > max_size_;
+       i++) {
+    if (locks_.find(i->path) != locks_.end()) {
+      continue;
+    }
+    int fd = lock(i->path, true, false);
+    if (fd < 0) {
+      continue;
+    }
+    carp(CARP_DEBUG, "Evicting %s from the spectrum cache", i->path.c_str());
+    FileUtils::Remove(i->path);
+    unlock(fd);
+    total -= i->size;
+  }
+  if (total > max_size_) {
+    carp(CARP_DEBUG, "The spectrum cache takes %llu bytes; the rest is in use.",
+         (unsigned long long)total);
+  }
+}
+
+#ifndef _MSC_VER
+/**
+ * Locks the whole of file fd with a lock of the given type (F_RDLCK,
+ * F_WRLCK or F_UNLCK), replacing any lock this process holds on it. Returns
+ * false if the lock was not taken.
+ */
+static bool setLock(
+  int fd,
+  short type,
+  bool block
+) {
+  struct flock region;
+  memset(&region, 0, sizeof(region));
+  region.l_type = type;
+  region.l_whence = SEEK_SET;
+  region.l_start = 0;
+  region.l_len = 0;  // to the end of the file, however long
+  while (fcntl(fd, block ? F_SETLKW : F_SETLK, &region) != 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+#endif
+
+int SpectrumCache::lock(
+  const string& entry,
+  bool exclusive,
+  bool block
+) {
+#ifdef _MSC_VER
+  // Not reached; create() makes no cache on Windows.
+  return 0;
+#else
+  string path = entry + LOCK_EXTENSION;
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+  if (fd < 0) {
+    carp(CARP_FATAL, "Could not open lock file %s.", path.c_str());
+  }
+  if (!setLock(fd, exclusive ? F_WRLCK : F_RDLCK, block)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+#endif
+}
+
+void SpectrumCache::downgrade(
+  int fd
+) {
+#ifndef _MSC_VER
+  // A POSIX lock is replaced in place, so no other lock fits in between.
+  if (fd >= 0 && !setLock(fd, F_RDLCK, true)) {
+    carp(CARP_FATAL, "Could not lock a spectrum cache entry for reading.");
+  }
+#endif
+}
+
+void SpectrumCache::unlock(
+  int fd
+) {
+#ifndef _MSC_VER
+  if (fd >= 0) {
+    setLock(fd, F_UNLCK, false);
+    close(fd);
+  }
+#endif
+}
+
+void SpectrumCache::touch(
+  const string& entry
+) {
+  boost::system::error_code error;
+  fs::last_write_time(entry, time(NULL), error);
+}
+
+uint64_t SpectrumCache::hashContents(
+  const string& path
+) {
+  if (!FileUtils::IsDir(path)) {
+    return hashFile(path);
+  }
+  // Vendor formats such as Bruker .d are directories.
+  vector<string> files;
+  boost::system::error_code error;
+  for (fs::recursive_directory_iterator i(path, error), end; !error && i != end;
+       i.increment(error)) {
+    if (fs::is_regular_file(i->status())) {
+      files.push_back(i->path().string());
+    }
+  }
+  sort(files.begin(), files.end());
+  ostringstream listing;
+  for (vector<string>::const_iterator i = files.begin(); i != files.end(); i++) {
+    listing << i->substr(path.length()) << '\t' << toHex(hashFile(*i)) << '\n';
+  }
+  return hashString(listing.str());
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 2
+ * End:
+ */
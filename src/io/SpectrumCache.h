@@ -0,0 +1,175 @@
+#ifndef SPECTRUM_CACHE_H
+#define SPECTRUM_CACHE_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+
+using namespace std;
+
+/**
+ * A directory of spectra files converted to spectrumrecords format, shared
+ * by runs of tide-search, cascade-search and diameter.
+ *
+ * An entry is named after a hash of the contents of the spectra file and of
+ * the parameters that change its conversion, so the same spectra are
+ * converted once, whatever the name of the file they are read from.
+ *
+ * Several processes may use the cache at once. Each entry has a lock file.
+ * A process converting a file holds an exclusive lock on its entry, writes
+ * a temporary file and renames it to the entry, so an entry is always
+ * complete. It then turns its lock into a shared one. A process reading an
+ * entry holds a shared lock on it until the cache object is deleted, which
+ * keeps it from being evicted.
+ *
+ * The locks are POSIX record locks, so that an exclusive lock becomes a
+ * shared one without being released in between. They belong to the process,
+ * not to the cache object, so a process uses at most one cache object at a
+ * time. The cache is not available on Windows; see create().
+ *
+ * The last modification time of an entry is set whenever it is used. When
+ * the entries take more than the size limit, the least recently used ones
+ * that nobody holds a lock on are removed.
+ */
+class SpectrumCache {
+
+ public:
+
+  /**
+   * Returns a new cache in directory dir as the constructor does, or NULL
+   * with a warning where the cache is not available.
+   */
+  static SpectrumCache* create(
+    const string& dir,
+    uint64_t max_size
+  );
+
+  /**
+   * Opens the cache in directory dir, creating it if needed. max_size is in
+   * bytes; 0 means no limit.
+   */
+  SpectrumCache(
+    const string& dir,
+    uint64_t max_size
+  );
+
+  /**
+   * Releases the locks held on entries.
+   */
+  ~SpectrumCache();
+
+  /**
+   * Returns the path of the entry for spectra file infile, converted with
+   * ms_level and dia_mode and the current parser parameters.
+   */
+  string entry(
+    const string& infile,
+    int ms_level = 2,
+    bool dia_mode = false
+  );
+
+  /**
+   * If entry exists, marks it used, locks it for reading and returns true.
+   * An entry that this process has reserved counts as existing, since it is
+   * committed before it is read.
+   */
+  bool use(
+    const string& entry
+  );
+
+  /**
+   * Waits until entry may be written by this process and returns true, with
+   * an exclusive lock on it. Returns false instead if the entry has been made
+   * in the meantime; it is then used as by use().
+   */
+  bool reserve(
+    const string& entry
+  );
+
+  /**
+   * Returns the temporary file that a reserved entry is converted to.
+   */
+  string tempFile(
+    const string& entry
+  );
+
+  /**
+   * Moves the temporary file of a reserved entry to the entry if ok is true,
+   * or removes it otherwise, and trims the cache. The entry stays locked for
+   * reading if it was made.
+   */
+  void commit(
+    const string& entry,
+    bool ok
+  );
+
+  /**
+   * Removes the least recently used entries that are not locked until the
+   * entries take at most the size limit, and removes temporary files left
+   * behind by conversions that did not finish.
+   */
+  void trim();
+
+ protected:
+
+  /**
+   * Opens the lock file of entry and takes a lock on it, waiting if block
+   * is true. Returns the descriptor, or -1 if the lock was not taken.
+   */
+  static int lock(
+    const string& entry,
+    bool exclusive,
+    bool block
+  );
+
+  /**
+   * Turns the exclusive lock fd taken by lock() into a shared one, without
+   * letting another process take a lock in between.
+   */
+  static void downgrade(
+    int fd
+  );
+
+  /**
+   * Releases a lock taken by lock().
+   */
+  static void unlock(
+    int fd
+  );
+
+  /**
+   * Sets the last modification time of entry to now.
+   */
+  static void touch(
+    const string& entry
+  );
+
+  /**
+   * Returns a hash of the contents of a file, or of all files under a
+   * directory and their relative paths.
+   */
+  static uint64_t hashContents(
+    const string& path
+  );
+
+  string dir_;
+  uint64_t max_size_;
+  map<string, uint64_t> content_hashes_;  ///< by spectra file
+  map<string, int> locks_;  ///< lock file descriptors by entry
+  map<string, string> temp_files_;  ///< temporary files by reserved entry
+
+ private:
+
+  SpectrumCache(const SpectrumCache&);  // not copyable; holds locks
+  SpectrumCache& operator=(const SpectrumCache&);
+
+};
+
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 2
+ * End:
+ */
@@ -1,7 +1,10 @@
 #include <cmath>
+#include <exception>
 #include <memory>
+#include <boost/thread.hpp>
 #include "app/tide/records.h"
 #include "app/tide/mass_constants.h"
+#include "app/tide/spectrum_collection.h"
 
 #include "model/Peak.h"
 #include "SpectrumCollectionFactory.h"
@@ -15,7 +18,14 @@
 #include <inttypes.h>
 #endif
 
-int SpectrumRecordWriter::scanCounter_ = 0;
+// Spectra encoded together by one thread.
+static const size_t ENCODE_BLOCK_SPECTRA = 256;
+// Encoded blocks allowed to wait for the writer, for each encoding thread.
+static const size_t ENCODE_BLOCKS_AHEAD = 4;
+// Held while a spectra file is opened and parsed. pwiz and MSToolkit are not
+// known to be thread safe, so only one file is parsed at a time; the other
+// loaders encode and write the files they have parsed meanwhile.
+static boost::mutex parse_mutex;
 
 /**
  * Converts a spectra file to spectrumrecords format for use with tide-search.
@@ -25,17 +35,39 @@ bool SpectrumRecordWriter::convert(
   const string& infile, ///< spectra file to convert
   string outfile,  ///< spectrumrecords file to output
   int ms_level,   /// MS level to extract (1 or 2)
-  bool dia_mode  /// whether it's used in DIAmeter
+  bool dia_mode,  /// whether it's used in DIAmeter
+  int num_threads  /// threads encoding the spectra
+) {
+  return load(infile, outfile, NULL, ms_level, dia_mode, num_threads);
+}
+
+/**
+ * Reads a spectra file with pwiz into spectra, and writes it to the
+ * spectrumrecords file outfile unless that is empty. Returns true on success.
+ *
+ * The spectra are encoded a block at a time by num_threads threads, and
+ * written by the calling thread in order of the blocks. An exception thrown
+ * while encoding is rethrown on the calling thread.
+ */
+bool SpectrumRecordWriter::load(
+  const string& infile, ///< spectra file to read
+  const string& outfile,  ///< spectrumrecords file to output, or empty
+  SpectrumCollection* spectra_out,  ///< tide spectra to add to, or NULL
+  int ms_level,   /// MS level to extract (1 or 2)
+  bool dia_mode,  /// whether it's used in DIAmeter
+  int num_threads  /// threads encoding the spectra
 ) {
   carp(CARP_INFO, "Converting ms_level %d ... ", ms_level);
-  auto_ptr<Crux::SpectrumCollection> spectra(SpectrumCollectionFactory::create(infile.c_str()));
 
   // added by Yang
   if ( ms_level < 1 || ms_level > 2 ) { carp(CARP_FATAL, "ms_level must be 1 or 2 instead of %d.", ms_level); }
 
 
   // Open infile
+  auto_ptr<Crux::SpectrumCollection> spectra;
   try {
+    boost::lock_guard<boost::mutex> lock(parse_mutex);
+    spectra.reset(SpectrumCollectionFactory::create(infile.c_str()));
     if (!spectra->parse(ms_level, dia_mode)) {
       return false;
     }
@@ -58,34 +90,222 @@ bool SpectrumRecordWriter::convert(
 
   header.mutable_spectra_header()->set_sorted(false);
 
-  HeadedRecordWriter writer(outfile, header);
-  if (!writer.OK()) {
-    return false;
+  auto_ptr<HeadedRecordWriter> writer;
+  if (!outfile.empty()) {
+    writer.reset(new HeadedRecordWriter(outfile, header));
+    if (!writer->OK()) {
+      return false;
+    }
   }
 
-  scanCounter_ = 0;
+  // Scan numbers depend on the spectra before, so they are assigned up front.
+  vector<Crux::Spectrum*> in(spectra->begin(), spectra->end());
+  vector<int> scan_nums;
+  scan_nums.reserve(in.size());
+  int scan_counter = 0;
+  for (vector<Crux::Spectrum*>::const_iterator i = in.begin(); i != in.end(); ++i) {
+    int scan_num = 0;
+    if ((*i)->getNumZStates() > 0 && (*i)->getNumPeaks() > 0) {
+      scan_num = (*i)->getFirstScan();
+      if (scan_counter > 0 || scan_num <= 0) {
+        carp_once(CARP_INFO, "Parser could not determine scan numbers for this "
+                             "file, using ordinal numbers as scan numbers.");
+        scan_num = ++scan_counter;
+      }
+    }
+    scan_nums.push_back(scan_num);
+  }
+
+  size_t num_blocks = (in.size() + ENCODE_BLOCK_SPECTRA - 1) / ENCODE_BLOCK_SPECTRA;
+  num_threads = max(1, min(num_threads, (int) num_blocks));
+  vector<vector<pb::Spectrum> > blocks(num_blocks);
+  vector<bool> encoded(num_blocks, false);
+  size_t next_block = 0;     // next block to encode
+  size_t written = 0;        // blocks written so far
+  std::exception_ptr error;  // first exception of any thread
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  boost::thread_group threads;
   carp(CARP_DETAILED_DEBUG, "Starting to convert spectrum to pb..." );
+  if (num_threads > 1) {
+    size_t max_ahead = ENCODE_BLOCKS_AHEAD * num_threads;
+    for (int t = 0; t < num_threads; t++) {
+      threads.create_thread([&]() {
+        while (true) {
+          size_t block;
+          {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            block = next_block++;
+            if (block >= num_blocks) {
+              return;
+            }
+            while (block >= written + max_ahead && !error) {
+              cond.wait(lock);
+            }
+            if (error) {
+              return;
+            }
+          }
+          vector<pb::Spectrum> out;
+          try {
+            size_t begin = block * ENCODE_BLOCK_SPECTRA;
+            encode(in, scan_nums, begin, min(in.size(), begin + ENCODE_BLOCK_SPECTRA), &out);
+          } catch (...) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if (!error) {
+              error = std::current_exception();
+            }
+            cond.notify_all();
+            return;
+          }
+          boost::lock_guard<boost::mutex> lock(mutex);
+          blocks[block].swap(out);
+          encoded[block] = true;
+          cond.notify_all();
+        }
+      });
+    }
+  }
+
   // Go through the spectrum list and write each spectrum
-  for (SpectrumIterator i = spectra->begin(); i != spectra->end(); ++i) {
-	(*i)->sortPeaks(_PEAK_LOCATION); // Sort by m/z
-
-    vector<pb::Spectrum> pb_spectra = getPbSpectra(*i);
-    for (vector<pb::Spectrum>::const_iterator j = pb_spectra.begin();
-         j != pb_spectra.end();
-         ++j) { 
-      writer.Write(&*j);
+  try {
+    for (size_t block = 0; block < num_blocks; block++) {
+      vector<pb::Spectrum> out;
+      if (num_threads > 1) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!encoded[block] && !error) {
+          cond.wait(lock);
+        }
+        if (error) {
+          break;
+        }
+        out.swap(blocks[block]);
+      } else {
+        size_t begin = block * ENCODE_BLOCK_SPECTRA;
+        encode(in, scan_nums, begin, min(in.size(), begin + ENCODE_BLOCK_SPECTRA), &out);
+      }
+      for (vector<pb::Spectrum>::const_iterator j = out.begin(); j != out.end(); ++j) {
+        if (writer.get() != NULL) {
+          writer->Write(&*j);
+        }
+        if (spectra_out != NULL) {
+          spectra_out->AddSpectrum(*j);
+        }
+      }
+      if (num_threads > 1) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        written = block + 1;
+        cond.notify_all();
+      }
+    }
+  } catch (...) {
+    // Stop the encoding threads, which refer to this frame.
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (!error) {
+      error = std::current_exception();
     }
+    cond.notify_all();
+  }
+  threads.join_all();
+  if (error) {
+    std::rethrow_exception(error);
   }
 
   return true;
 }
 
+/**
+ * Loads several spectra files, each on a thread of its own. The threads
+ * left over encode spectra. Files are parsed one at a time (see
+ * parse_mutex). The first exception of a loader is rethrown on the calling
+ * thread once the other loaders have finished their files.
+ */
+bool SpectrumRecordWriter::load(
+  const vector<string>& infiles, ///< spectra files to read
+  const vector<string>& outfiles,  ///< spectrumrecords files to output
+  const vector<SpectrumCollection*>& spectra,  ///< tide spectra to add to
+  int num_threads  /// threads in all
+) {
+  size_t num_files = infiles.size();
+  if (num_files == 1 || num_threads <= 1) {
+    bool ok = true;
+    for (size_t i = 0; i < num_files; i++) {
+      if (!load(infiles[i], outfiles[i], spectra[i], 2, false, num_threads)) {
+        carp(CARP_ERROR, "Error converting %s to spectrumrecords format", infiles[i].c_str());
+        ok = false;
+      }
+    }
+    return ok;
+  }
+  int num_loaders = min(num_threads, (int) num_files);
+  int encode_threads = max(1, num_threads / num_loaders);
+  size_t next_file = 0;
+  bool ok = true;
+  std::exception_ptr error;
+  boost::mutex mutex;
+  boost::thread_group threads;
+  for (int t = 0; t < num_loaders; t++) {
+    threads.create_thread([&]() {
+      while (true) {
+        size_t i;
+        {
+          boost::lock_guard<boost::mutex> lock(mutex);
+          if (next_file >= num_files || error) {
+            return;
+          }
+          i = next_file++;
+        }
+        try {
+          if (!load(infiles[i], outfiles[i], spectra[i], 2, false, encode_threads)) {
+            carp(CARP_ERROR, "Error converting %s to spectrumrecords format", infiles[i].c_str());
+            boost::lock_guard<boost::mutex> lock(mutex);
+            ok = false;
+          }
+        } catch (...) {
+          boost::lock_guard<boost::mutex> lock(mutex);
+          if (!error) {
+            error = std::current_exception();
+          }
+          return;
+        }
+      }
+    });
+  }
+  threads.join_all();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return ok;
+}
+
+/**
+ * Sorts the peaks of spectra [begin, end) by m/z and appends their
+ * pb::Spectrum records to out.
+ */
+void SpectrumRecordWriter::encode(
+  const vector<Crux::Spectrum*>& spectra,
+  const vector<int>& scan_nums,
+  size_t begin,
+  size_t end,
+  vector<pb::Spectrum>* out
+) {
+  for (size_t i = begin; i < end; i++) {
+    spectra[i]->sortPeaks(_PEAK_LOCATION); // Sort by m/z
+    vector<pb::Spectrum> pb_spectra = getPbSpectra(spectra[i], scan_nums[i]);
+    for (vector<pb::Spectrum>::iterator j = pb_spectra.begin(); j != pb_spectra.end(); ++j) {
+      out->push_back(pb::Spectrum());
+      out->back().Swap(&*j);
+    }
+  }
+}
+
 /**
  * Return a pb::Spectrum from a pwiz SpectrumPtr
  * If spectrum is ms1, or has no precursors/peaks then return empty pb::Spectrum
  */
 vector<pb::Spectrum> SpectrumRecordWriter::getPbSpectra(
-  const Crux::Spectrum* s
+  const Crux::Spectrum* s,
+  int scan_num
 ) {
   vector<pb::Spectrum> spectra;
 
@@ -94,13 +314,9 @@ vector<pb::Spectrum> SpectrumRecordWriter::getPbSpectra(
     return spectra;
   }
 
-  // Get scan number
-  int scan_num = s->getFirstScan();
-  if (scanCounter_ > 0 || scan_num <= 0) {
-    carp_once(CARP_INFO, "Parser could not determine scan numbers for this "
-                         "file, using ordinal numbers as scan numbers.");
-    scan_num = ++scanCounter_;
-  }
+  // The precision is the same for every charge state.
+  int mz_denom, intensity_denom;
+  getDenoms(s, &mz_denom, &intensity_denom);
 
   const vector<SpectrumZState>& zStates = s->getZStates();
   for (vector<SpectrumZState>::const_iterator i = zStates.begin(); i != zStates.end(); ++i) {
@@ -115,7 +331,7 @@ vector<pb::Spectrum> SpectrumRecordWriter::getPbSpectra(
     newSpectrum.set_spectrum_number(scan_num);
     newSpectrum.set_precursor_m_z(i->getMZ());
     newSpectrum.mutable_charge_state()->Add(i->getCharge());
-    addPeaks(&newSpectrum, s);
+    addPeaks(&newSpectrum, s, mz_denom, intensity_denom);
     if (newSpectrum.peak_m_z_size() == 0) {
       spectra.pop_back();
     }
@@ -129,12 +345,14 @@ vector<pb::Spectrum> SpectrumRecordWriter::getPbSpectra(
  */
 void SpectrumRecordWriter::addPeaks(
   pb::Spectrum* spectrum,
-  const Crux::Spectrum* s
+  const Crux::Spectrum* s,
+  int mz_denom,
+  int intensity_denom
 ) {
-  int mz_denom, intensity_denom;
-  getDenoms(s, &mz_denom, &intensity_denom);
   spectrum->set_peak_m_z_denominator(mz_denom);
   spectrum->set_peak_intensity_denominator(intensity_denom);
+  spectrum->mutable_peak_m_z()->Reserve(s->getNumPeaks());
+  spectrum->mutable_peak_intensity()->Reserve(s->getNumPeaks());
   uint64_t last = 0;
   int last_index = -1;
   uint64_t intensity_sum = 0;
@@ -160,7 +378,9 @@ void SpectrumRecordWriter::addPeaks(
 }
 
 /**
- * See how much precision is given in the peak data
+ * See how much precision is given in the peak data: the lowest power of ten
+ * up to kMaxPrecision that renders all values as integers, to within 0.001.
+ * All candidate precisions are checked in a single pass over the peaks.
  */
 void SpectrumRecordWriter::getDenoms(
   const Crux::Spectrum* s,  ///< spectra with peaks to check
@@ -168,36 +388,38 @@ void SpectrumRecordWriter::getDenoms(
   int* intensityDenom ///< out parameter for intensity denom
 ) {
   const int kMaxPrecision = 10000; // store at most 4 digits of precision
-  *mzDenom = kMaxPrecision;
-  *intensityDenom = kMaxPrecision;
-  for (int precision = 1; precision < kMaxPrecision; precision *= 10) {
-    bool mzDenomOk = (*mzDenom == kMaxPrecision);
-    bool intensityDenomOk = (*intensityDenom == kMaxPrecision);
-    if (!mzDenomOk && !intensityDenomOk) {
-      return;
-    }
-    for (PeakIterator i = s->begin(); i != s->end(); ++i) {
-      if (mzDenomOk) {
-        double mzX = (*i)->getLocation() * precision;
+  const int kNumPrecisions = 4;    // 1, 10, 100 and 1000
+  const int precisions[kNumPrecisions] = { 1, 10, 100, 1000 };
+  // Bit p is set while precisions[p] still works.
+  unsigned int mzOk = (1u << kNumPrecisions) - 1;
+  unsigned int intensityOk = mzOk;
+  for (PeakIterator i = s->begin(); i != s->end() && (mzOk | intensityOk) != 0; ++i) {
+    FLOAT_T mz = (*i)->getLocation();
+    FLOAT_T intensity = (*i)->getIntensity();
+    for (int p = 0; p < kNumPrecisions; p++) {
+      unsigned int bit = 1u << p;
+      if (mzOk & bit) {
+        double mzX = mz * precisions[p];
         if (fabs(mzX - google::protobuf::uint64(mzX + 0.5)) >= 0.001) {
-          mzDenomOk = false;
+          mzOk &= ~bit;
         }
       }
-      if (intensityDenomOk) {
-        double intensityX = (*i)->getIntensity() * precision;
+      if (intensityOk & bit) {
+        double intensityX = intensity * precisions[p];
         if (fabs(intensityX - google::protobuf::uint64(intensityX + 0.5)) >= 0.001) {
-          intensityDenomOk = false;
+          intensityOk &= ~bit;
         }
       }
-      if (!mzDenomOk && !intensityDenomOk) {
-        break;
-      }
     }
-    if (mzDenomOk) {
-      *mzDenom = precision;
+  }
+  *mzDenom = kMaxPrecision;
+  *intensityDenom = kMaxPrecision;
+  for (int p = kNumPrecisions - 1; p >= 0; p--) {
+    if (mzOk & (1u << p)) {
+      *mzDenom = precisions[p];
     }
-    if (intensityDenomOk) {
-      *intensityDenom = precision;
+    if (intensityOk & (1u << p)) {
+      *intensityDenom = precisions[p];
     }
   }
 }
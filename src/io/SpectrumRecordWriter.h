@@ -6,6 +6,8 @@
 
 using namespace std;
 
+class SpectrumCollection;
+
 /**
  * A class for converting spectra file to the spectrumrecords format for use
  * with tide-search.
@@ -22,19 +24,48 @@ class SpectrumRecordWriter {
     const string& infile, ///< spectra file to convert
     string outfile,  ///< spectrumrecords file to output
     int ms_level = 2,  /// MS level to extract (1 or 2)
-    bool dia_mode = false  /// whether it's used in DIAmeter
+    bool dia_mode = false,  /// whether it's used in DIAmeter
+    int num_threads = 1  /// threads encoding the spectra
   );
 
- protected:
+  /**
+   * Reads a spectra file with pwiz into spectra, which get the same spectra
+   * as if the spectrumrecords file written by convert() were read. The
+   * spectrumrecords file is written as well, unless outfile is empty.
+   * Returns true on success.
+   */
+  static bool load(
+    const string& infile, ///< spectra file to read
+    const string& outfile,  ///< spectrumrecords file to output, or empty
+    SpectrumCollection* spectra,  ///< tide spectra to add to, or NULL
+    int ms_level = 2,  /// MS level to extract (1 or 2)
+    bool dia_mode = false,  /// whether it's used in DIAmeter
+    int num_threads = 1  /// threads encoding the spectra
+  );
 
-  static int scanCounter_;
+  /**
+   * Loads several spectra files as load() does, each on a thread of its
+   * own, with num_threads threads in all. An outfile may be empty and a
+   * collection NULL. Returns true if all files were loaded. An exception
+   * thrown on a loading thread is rethrown on the calling thread.
+   */
+  static bool load(
+    const vector<string>& infiles, ///< spectra files to read
+    const vector<string>& outfiles,  ///< spectrumrecords files to output
+    const vector<SpectrumCollection*>& spectra,  ///< tide spectra to add to
+    int num_threads  /// threads in all
+  );
+
+ protected:
 
   /**
-   * Return a pb::Spectrum from a Crux::Spectrum
-   * Returns a default instance if there is a problem
+   * Return a pb::Spectrum from a Crux::Spectrum for each of its charge
+   * states, numbered scan_num.
+   * Returns none if there is a problem
    */
   static std::vector<pb::Spectrum> getPbSpectra(
-    const Crux::Spectrum* s
+    const Crux::Spectrum* s,
+    int scan_num
   );
 
   /**
@@ -42,7 +73,9 @@ class SpectrumRecordWriter {
    */
   static void addPeaks(
     pb::Spectrum* spectrum,
-    const Crux::Spectrum* s
+    const Crux::Spectrum* s,
+    int mz_denom,
+    int intensity_denom
   );
 
   /**
@@ -54,6 +87,17 @@ class SpectrumRecordWriter {
     int* intensityDenom ///< out parameter for intensity denom
   );
 
+  /**
+   * Sorts the peaks of spectra [begin, end) and encodes them.
+   */
+  static void encode(
+    const vector<Crux::Spectrum*>& spectra,
+    const vector<int>& scan_nums,
+    size_t begin,
+    size_t end,
+    vector<pb::Spectrum>* out
+  );
+
 };
 
 #endif
@@ -1194,16 +1194,6 @@ vector< pair<FLOAT_T, FLOAT_T> > MatchCollection::calculateDeltaCns(
   vector<FLOAT_T> scores,
   SCORER_TYPE_T type
 ) {
-  vector< pair<FLOAT_T, FLOAT_T> > deltaCns(scores.size(), make_pair(0, 0));
-  if (scores.empty()) {
-    return deltaCns;
-  }
-
-  map< const FLOAT_T*, pair<FLOAT_T, FLOAT_T>* > scorePtrs;
-  for (size_t i = 0; i < scores.size(); i++) {
-    scorePtrs[&scores[i]] = &deltaCns[i];
-  }
-
   if (type == XCORR || type == RESIDUE_EVIDENCE_SCORE) {
     // Higher is better - sort descending
     std::sort(scores.begin(), scores.end(), std::greater<FLOAT_T>());
@@ -1212,11 +1202,23 @@ vector< pair<FLOAT_T, FLOAT_T> > MatchCollection::calculateDeltaCns(
     std::sort(scores.begin(), scores.end(), std::less<FLOAT_T>());
   }
   
-  int top_match = Params::GetInt("top-match");
+  return calculateSortedDeltaCns(scores, type, Params::GetInt("top-match"));
+}
+
+vector< pair<FLOAT_T, FLOAT_T> > MatchCollection::calculateSortedDeltaCns(
+  const vector<FLOAT_T>& scores,
+  SCORER_TYPE_T type,
+  int top_match
+) {
+  vector< pair<FLOAT_T, FLOAT_T> > deltaCns(scores.size(), make_pair(0, 0));
+  if (scores.empty()) {
+    return deltaCns;
+  }
 
 //  FLOAT_T last = scores.back();
   FLOAT_T last = scores[min(top_match, (int) scores.size()) - 1];
-  for (vector<FLOAT_T>::const_iterator i = scores.begin(); i != scores.end(); i++) {
+  vector< pair<FLOAT_T, FLOAT_T> >::iterator out = deltaCns.begin();
+  for (vector<FLOAT_T>::const_iterator i = scores.begin(); i != scores.end(); i++, out++) {
     vector<FLOAT_T>::const_iterator next = (i != scores.end() - 1) ? i + 1 : i;
     FLOAT_T deltaCn, deltaLCn;
     switch (type) {
@@ -1237,8 +1239,8 @@ vector< pair<FLOAT_T, FLOAT_T> > MatchCollection::calculateDeltaCns(
         deltaLCn = -log10(*i) + log10(last);
         break;
     }
-    scorePtrs[&*i]->first = deltaCn;
-    scorePtrs[&*i]->second = deltaLCn;
+    out->first = deltaCn;
+    out->second = deltaLCn;
   }
   return deltaCns;
 }
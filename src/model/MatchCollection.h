@@ -196,6 +196,11 @@ class MatchCollection {
   static std::vector< std::pair<FLOAT_T, FLOAT_T> > calculateDeltaCns(
     std::vector<FLOAT_T>, SCORER_TYPE_T type);
 
+  // Same for scores already sorted best first, in a single pass. The scores
+  // past top_match are only used for the deltaCn of their predecessors.
+  static std::vector< std::pair<FLOAT_T, FLOAT_T> > calculateSortedDeltaCns(
+    const std::vector<FLOAT_T>& scores, SCORER_TYPE_T type, int top_match);
+
   /**
    * \brief Add a single match to a collection.
    * Only puts a copy of the pointer to the match in the
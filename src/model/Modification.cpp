@@ -1,6 +1,7 @@
 #include "Modification.h"
 #include "io/carp.h"
 #include "util/AminoAcidUtil.h"
+#include "util/GlobalParams.h"
 #include "util/MathUtil.h"
 #include "util/Params.h"
 #include "util/StringUtils.h"
@@ -281,7 +282,7 @@ const ModificationDefinition* ModificationDefinition::Find(
        i != mods->end();
        i++) {
     if ((position == UNKNOWN || position == (*i)->Position()) &&
-        MathUtil::AlmostEqual((*i)->deltaMass_, deltaMass, Params::GetInt("mod-precision"))) {
+        MathUtil::AlmostEqual((*i)->deltaMass_, deltaMass, GlobalParams::getModPrecision())) {
       return *i;
     }
   }
@@ -440,7 +441,7 @@ string Modification::String() const {
   sprintf(buffer, "%d_%c_%.*f%s",
           index_ + 1,
           mod_->Static() ? 'S' : 'V',
-          Params::GetInt("mod-precision"), mod_->DeltaMass(),
+          GlobalParams::getModPrecision(), mod_->DeltaMass(),
           positionStr.c_str());
   return string(buffer);
 }
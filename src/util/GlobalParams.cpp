@@ -21,12 +21,42 @@ MASS_TYPE_T GlobalParams::fragment_mass_;
 bool GlobalParams::precursor_ions_;
 ENZYME_T GlobalParams::enzyme_;
 DIGEST_T GlobalParams::digestion_;
-FLOAT_T GlobalParams::remove_precursor_tolerance_;
+double GlobalParams::remove_precursor_tolerance_;
 OBSERVED_PREPROCESS_STEP_T GlobalParams::stop_after_;
 int GlobalParams::mod_precision_;
 vector<int> GlobalParams::isotope_windows_;
 FLOAT_T GlobalParams::fraction_to_fit_;
 MASS_FORMAT_T GlobalParams::mod_mass_format_;
+bool GlobalParams::use_tailor_calibration_;
+bool GlobalParams::concat_;
+bool GlobalParams::brief_output_;
+bool GlobalParams::file_column_;
+bool GlobalParams::peptide_centric_search_;
+bool GlobalParams::exact_p_value_;
+SCORE_FUNCTION_T GlobalParams::score_function_;
+int GlobalParams::elution_window_size_;
+int GlobalParams::mass_precision_;
+int GlobalParams::precision_;
+int GlobalParams::top_match_;
+bool GlobalParams::compute_sp_;
+int GlobalParams::print_search_progress_;
+bool GlobalParams::skip_preprocessing_;
+bool GlobalParams::remove_precursor_peak_;
+double GlobalParams::deisotope_;
+bool GlobalParams::spectra_denoising_;
+int GlobalParams::msamanda_regional_topk_;
+bool GlobalParams::use_neutral_loss_peaks_;
+bool GlobalParams::use_flanking_peaks_;
+int GlobalParams::max_precursor_charge_;
+double GlobalParams::max_spectrum_neutral_mass_;
+double GlobalParams::xpv_precision_;
+double GlobalParams::fragment_tolerance_;
+int GlobalParams::evidence_granularity_;
+bool GlobalParams::seva_;
+int GlobalParams::frag_ppm_;
+int GlobalParams::prec_ppm_;
+int GlobalParams::coelution_topk_;
+int GlobalParams::coelution_oneside_scans_;
 
 void GlobalParams::set() {
   isotopic_mass_ = get_mass_type_parameter("isotopic-mass");
@@ -49,6 +79,36 @@ void GlobalParams::set() {
   mod_precision_ = Params::GetInt("mod-precision");
   fraction_to_fit_ = Params::GetDouble("fraction-top-scores-to-fit");
   mod_mass_format_ = get_mass_format_type_parameter("mod-mass-format");
+  use_tailor_calibration_ = Params::GetBool("use-tailor-calibration");
+  concat_ = Params::GetBool("concat");
+  brief_output_ = Params::GetBool("brief-output");
+  file_column_ = Params::GetBool("file-column");
+  peptide_centric_search_ = Params::GetBool("peptide-centric-search");
+  exact_p_value_ = Params::GetBool("exact-p-value");
+  score_function_ = string_to_score_function_type(Params::GetString("score-function"));
+  elution_window_size_ = Params::GetInt("elution-window-size");
+  mass_precision_ = Params::GetInt("mass-precision");
+  precision_ = Params::GetInt("precision");
+  top_match_ = Params::GetInt("top-match");
+  compute_sp_ = Params::GetBool("compute-sp");
+  print_search_progress_ = Params::GetInt("print-search-progress");
+  skip_preprocessing_ = Params::GetBool("skip-preprocessing");
+  remove_precursor_peak_ = Params::GetBool("remove-precursor-peak");
+  deisotope_ = Params::GetDouble("deisotope");
+  spectra_denoising_ = Params::GetBool("spectra-denoising");
+  msamanda_regional_topk_ = Params::GetInt("msamanda-regional-topk");
+  use_neutral_loss_peaks_ = Params::GetBool("use-neutral-loss-peaks");
+  use_flanking_peaks_ = Params::GetBool("use-flanking-peaks");
+  max_precursor_charge_ = Params::GetInt("max-precursor-charge");
+  max_spectrum_neutral_mass_ = Params::GetDouble("max-spectrum_neutral-mass");
+  xpv_precision_ = Params::GetDouble("xpv-precision");
+  fragment_tolerance_ = Params::GetDouble("fragment-tolerance");
+  evidence_granularity_ = Params::GetInt("evidence-granularity");
+  seva_ = Params::GetBool("seva");
+  frag_ppm_ = Params::GetInt("frag-ppm");
+  prec_ppm_ = Params::GetInt("prec-ppm");
+  coelution_topk_ = Params::GetInt("coelution-topk");
+  coelution_oneside_scans_ = Params::GetInt("coelution-oneside-scans");
 }
 
 const MASS_TYPE_T& GlobalParams::getIsotopicMass() {
@@ -111,7 +171,7 @@ const DIGEST_T& GlobalParams::getDigestion() {
   return digestion_;
 }
 
-const FLOAT_T& GlobalParams::getRemovePrecursorTolerance() {
+const double& GlobalParams::getRemovePrecursorTolerance() {
   return remove_precursor_tolerance_;
 }
 
@@ -136,3 +196,122 @@ const MASS_FORMAT_T& GlobalParams::getModMassFormat() {
   return mod_mass_format_;
 }
 
+const bool& GlobalParams::getUseTailorCalibration() {
+  return use_tailor_calibration_;
+}
+
+const bool& GlobalParams::getConcat() {
+  return concat_;
+}
+
+const bool& GlobalParams::getBriefOutput() {
+  return brief_output_;
+}
+
+const bool& GlobalParams::getFileColumn() {
+  return file_column_;
+}
+
+const bool& GlobalParams::getPeptideCentricSearch() {
+  return peptide_centric_search_;
+}
+
+const bool& GlobalParams::getExactPValue() {
+  return exact_p_value_;
+}
+
+const SCORE_FUNCTION_T& GlobalParams::getScoreFunction() {
+  return score_function_;
+}
+
+const int& GlobalParams::getElutionWindowSize() {
+  return elution_window_size_;
+}
+
+const int& GlobalParams::getMassPrecision() {
+  return mass_precision_;
+}
+
+const int& GlobalParams::getPrecision() {
+  return precision_;
+}
+
+const int& GlobalParams::getTopMatch() {
+  return top_match_;
+}
+
+const bool& GlobalParams::getComputeSp() {
+  return compute_sp_;
+}
+
+const int& GlobalParams::getPrintSearchProgress() {
+  return print_search_progress_;
+}
+
+const bool& GlobalParams::getSkipPreprocessing() {
+  return skip_preprocessing_;
+}
+
+const bool& GlobalParams::getRemovePrecursorPeak() {
+  return remove_precursor_peak_;
+}
+
+const double& GlobalParams::getDeisotope() {
+  return deisotope_;
+}
+
+const bool& GlobalParams::getSpectraDenoising() {
+  return spectra_denoising_;
+}
+
+const int& GlobalParams::getMsamandaRegionalTopk() {
+  return msamanda_regional_topk_;
+}
+
+const bool& GlobalParams::getUseNeutralLossPeaks() {
+  return use_neutral_loss_peaks_;
+}
+
+const bool& GlobalParams::getUseFlankingPeaks() {
+  return use_flanking_peaks_;
+}
+
+const int& GlobalParams::getMaxPrecursorCharge() {
+  return max_precursor_charge_;
+}
+
+const double& GlobalParams::getMaxSpectrumNeutralMass() {
+  return max_spectrum_neutral_mass_;
+}
+
+const double& GlobalParams::getXpvPrecision() {
+  return xpv_precision_;
+}
+
+const double& GlobalParams::getFragmentTolerance() {
+  return fragment_tolerance_;
+}
+
+const int& GlobalParams::getEvidenceGranularity() {
+  return evidence_granularity_;
+}
+
+const bool& GlobalParams::getSeva() {
+  return seva_;
+}
+
+const int& GlobalParams::getFragPpm() {
+  return frag_ppm_;
+}
+
+const int& GlobalParams::getPrecPpm() {
+  return prec_ppm_;
+}
+
+const int& GlobalParams::getCoelutionTopk() {
+  return coelution_topk_;
+}
+
+const int& GlobalParams::getCoelutionOnesideScans() {
+  return coelution_oneside_scans_;
+}
@@ -32,12 +32,43 @@ class GlobalParams {
   static bool precursor_ions_;
   static ENZYME_T enzyme_;
   static DIGEST_T digestion_;
-  static FLOAT_T remove_precursor_tolerance_;
+  static double remove_precursor_tolerance_;
   static OBSERVED_PREPROCESS_STEP_T stop_after_;
   static int mod_precision_;
   static std::vector<int> isotope_windows_;
   static FLOAT_T fraction_to_fit_;
   static MASS_FORMAT_T mod_mass_format_;
+  // Read in the inner loops of tide-search and DIAmeter
+  static bool use_tailor_calibration_;
+  static bool concat_;
+  static bool brief_output_;
+  static bool file_column_;
+  static bool peptide_centric_search_;
+  static bool exact_p_value_;
+  static SCORE_FUNCTION_T score_function_;
+  static int elution_window_size_;
+  static int mass_precision_;
+  static int precision_;
+  static int top_match_;
+  static bool compute_sp_;
+  static int print_search_progress_;
+  static bool skip_preprocessing_;
+  static bool remove_precursor_peak_;
+  static double deisotope_;
+  static bool spectra_denoising_;
+  static int msamanda_regional_topk_;
+  static bool use_neutral_loss_peaks_;
+  static bool use_flanking_peaks_;
+  static int max_precursor_charge_;
+  static double max_spectrum_neutral_mass_;
+  static double xpv_precision_;
+  static double fragment_tolerance_;
+  static int evidence_granularity_;
+  static bool seva_;
+  static int frag_ppm_;
+  static int prec_ppm_;
+  static int coelution_topk_;
+  static int coelution_oneside_scans_;
   
  public:
   /**
@@ -64,12 +95,42 @@ class GlobalParams {
   static const bool& getPrecursorIons();
   static const ENZYME_T& getEnzyme();
   static const DIGEST_T& getDigestion();
-  static const FLOAT_T& getRemovePrecursorTolerance();
+  static const double& getRemovePrecursorTolerance();
   static const OBSERVED_PREPROCESS_STEP_T& getStopAfter();
   static const int& getModPrecision();
   static const std::vector<int>& getIsotopeWindows();
   static const FLOAT_T& getFractionToFit();
   static const MASS_FORMAT_T& getModMassFormat();
+  static const bool& getUseTailorCalibration();
+  static const bool& getConcat();
+  static const bool& getBriefOutput();
+  static const bool& getFileColumn();
+  static const bool& getPeptideCentricSearch();
+  static const bool& getExactPValue();
+  static const SCORE_FUNCTION_T& getScoreFunction();
+  static const int& getElutionWindowSize();
+  static const int& getMassPrecision();
+  static const int& getPrecision();
+  static const int& getTopMatch();
+  static const bool& getComputeSp();
+  static const int& getPrintSearchProgress();
+  static const bool& getSkipPreprocessing();
+  static const bool& getRemovePrecursorPeak();
+  static const double& getDeisotope();
+  static const bool& getSpectraDenoising();
+  static const int& getMsamandaRegionalTopk();
+  static const bool& getUseNeutralLossPeaks();
+  static const bool& getUseFlankingPeaks();
+  static const int& getMaxPrecursorCharge();
+  static const double& getMaxSpectrumNeutralMass();
+  static const double& getXpvPrecision();
+  static const double& getFragmentTolerance();
+  static const int& getEvidenceGranularity();
+  static const bool& getSeva();
+  static const int& getFragPpm();
+  static const int& getPrecPpm();
+  static const int& getCoelutionTopk();
+  static const int& getCoelutionOnesideScans();
 };
 
 #endif
@@ -62,7 +62,7 @@ using namespace std;
 
 static Params paramContainer_;
 
-Params::Params() : finalized_(false) {
+Params::Params() : finalized_(false), lookupsDisallowed_(false) {
   /* generate_peptide arguments */
   InitArgParam("protein fasta file",
     "The name of the file in FASTA format from which to retrieve proteins.");
@@ -759,6 +759,20 @@ Params::Params() : finalized_(false) {
     "the current working directory, not the Crux output directory (as specified by "
     "--output-dir). This option is not valid if multiple input spectrum files are given.",
     "Available for tide-search", true);
+  InitStringParam("spectrum-cache-dir", "",
+    "Directory of a cache of spectrum files converted to the binary format used by "
+    "tide-search, shared by runs of tide-search, cascade-search and diameter. A "
+    "spectrum file is converted once and read from the cache afterwards, as long as "
+    "its contents and the parameters used to convert it (spectrum-parser, "
+    "scan-number and use-z-line) are the same, whatever its name. Several runs may "
+    "use the cache at once. Leave empty to convert the spectra into the output "
+    "directory and delete them afterwards. The cache is not available on Windows.",
+    "Available for tide-search, cascade-search and diameter.", true);
+  InitIntParam("spectrum-cache-size", 0, 0, BILLION,
+    "Maximum size, in megabytes, of the spectrum cache. When the cache grows beyond "
+    "it, the least recently used files that no running search is reading are "
+    "removed. 0 means no limit.",
+    "Available for tide-search, cascade-search and diameter.", true);
   InitBoolParam("exact-p-value", false,
     "Enable the calculation of exact p-values for the XCorr score[[html: as described in "
     "<a href=\"http://www.ncbi.nlm.nih.gov/pubmed/24895379\">this article</a>]]. Calculation "
@@ -824,6 +838,12 @@ Params::Params() : finalized_(false) {
     "the database without checking for duplication. This option reduces the memory requirements "
     "significantly.",
     "Available for tide-index.", true);
+  InitBoolParam("precompute-peaks", false,
+    "Store the theoretical b- and y-ion peaks of every peptide in the index, "
+    "computed with the given mz-bin-width and mz-bin-offset. tide-search then "
+    "reads the peaks instead of computing them, as long as it is run with the "
+    "same bin settings. This makes the index larger.",
+    "Available for tide-index.", true);
   InitBoolParam("use-neutral-loss-peaks", true,
     "Controls whether neutral loss ions are considered in the search. "
     "For XCorr, the loss of ammonia (NH3, 17.0086343 Da) is applied to singly "
@@ -880,7 +900,27 @@ Params::Params() : finalized_(false) {
                   "Available for tide-search", true);
   InitIntParam("num-threads", 1, 0, 64,
                "0=poll CPU to set num threads; else specify num threads directly.",
-               "Available for tide-search tab-delimited files only.", true);
+               "Available for tide-search and assign-confidence.", true);
+  InitStringParam("xcorr-kernel", "auto", "auto|scalar|avx2|avx512",
+    "Implementation of the XCorr dot product. 'auto' uses the widest vector "
+    "instructions supported by the CPU; 'scalar' uses none; 'avx2' and 'avx512' "
+    "require a CPU with those instructions. All give identical scores.",
+    "Available for tide-search and diameter.", true);
+  InitIntParam("max-merged-files", 1, 1, BILLION,
+    "Maximum number of spectrum files to search together, in a single pass over "
+    "the peptide index. Searching several files together saves reading the index "
+    "once for each file, but holds the spectra of all of them in memory at once. "
+    "The output is the same as when the files are searched one after another. "
+    "Only spectrum-centric XCorr searches without exact p-values merge files.",
+    "Available for tide-search.", true);
+  InitIntParam("spectrum-memory-limit", 0, 0, BILLION,
+    "Maximum memory, in megabytes, to hold the spectra of a spectrum file while "
+    "searching it. The spectra are sorted by precursor mass in runs that fit in half "
+    "of this limit, which are written to temporary files in the output directory, "
+    "and the runs are merged while searching, half of the limit at a time. The "
+    "output is the same as when the file is read into memory at once. 0 means no "
+    "limit. Applies to spectrum-centric searches only.",
+    "Available for tide-search.", true);
   InitBoolParam("brief-output", false,
     "Output in tab-delimited text only the file name, scan number, charge, score and peptide."
     "Incompatible with mzid-output=T, pin-output=T, pepxml-output=T or txt-output=F.",
@@ -2255,6 +2295,9 @@ void Params::Categorize() {
   items.insert("use-flanking-peaks");
   items.insert("use-neutral-loss-peaks");
   items.insert("score-function");
+  items.insert("xcorr-kernel");
+  items.insert("max-merged-files");
+  items.insert("spectrum-memory-limit");
   items.insert("fragment-tolerance");
   items.insert("evidence-granularity");
   items.insert("top_count");
@@ -2499,6 +2542,8 @@ void Params::Categorize() {
   items.insert("sqt-output");
   items.insert("store-index");
   items.insert("store-spectra");
+  items.insert("spectrum-cache-dir");
+  items.insert("spectrum-cache-size");
   items.insert("temp-dir");
   items.insert("top-match");
   items.insert("txt-output");
@@ -2624,6 +2669,10 @@ void Params::Finalize() {
   paramContainer_.FinalizeParams();
 }
 
+void Params::DisallowLookups(bool disallow) {
+  paramContainer_.lookupsDisallowed_ = disallow;
+}
+
 void Params::Write(ostream* out, bool defaults) {
   if (out == NULL || !out->good()) {
     throw runtime_error("Bad file stream for writing parameter file");
@@ -2875,6 +2924,11 @@ void Params::InitArgParam(
 }
 
 Param* Params::Require(const string& name) {
+#ifdef DEBUG
+  if (paramContainer_.lookupsDisallowed_) {
+    throw runtime_error("Parameter '" + name + "' looked up where lookups are disallowed");
+  }
+#endif
   Param* param = paramContainer_.Get(name);
   if (param == NULL) {
     throw runtime_error("Parameter '" + name + "' does not exist");
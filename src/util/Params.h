@@ -72,6 +72,11 @@ class Params {
   // Lock parameters and prevent them from being modified
   static void Finalize();
 
+  // In DEBUG builds, make any lookup of a parameter by name throw while
+  // disallowed. Used around code that must read GlobalParams instead, such as
+  // the tide-search threads.
+  static void DisallowLookups(bool disallow);
+
   // Write all contents of the ordered parameter list to file
   static void Write(std::ostream* out, bool defaults = false);
 
@@ -185,6 +190,7 @@ class Params {
   std::vector<const Param*> paramsOrdered_;
   std::vector<ParamCategory> categories_;
   bool finalized_;
+  bool lookupsDisallowed_;
 };
 
 class Param {
@@ -0,0 +1,373 @@
+#include "QValues.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdint.h>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+namespace {
+
+const int RADIX_BITS = 11;
+const size_t NUM_BUCKETS = (size_t)1 << RADIX_BITS;
+const int NUM_PASSES = (64 + RADIX_BITS - 1) / RADIX_BITS;
+// Inputs smaller than this are sorted on one thread.
+const size_t MIN_PARALLEL_SORT = 1 << 16;
+
+// Scores that are not numbers, or are infinite, become the worst finite score.
+inline FLOAT_T normalize(FLOAT_T x, bool ascending) {
+  if (isnan(x) || isinf(x)) {
+    return ascending ? numeric_limits<FLOAT_T>::max() : -numeric_limits<FLOAT_T>::max();
+  }
+  return x;
+}
+
+// An unsigned key that orders as the score ranks, best first.
+inline uint64_t sortKey(FLOAT_T x, bool ascending) {
+  double d = normalize(x, ascending);
+  if (d == 0) {
+    d = 0;  // -0 and 0 tie
+  }
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  bits = (bits >> 63) ? ~bits : bits | ((uint64_t)1 << 63);
+  return ascending ? bits : ~bits;
+}
+
+// Calls work(0) .. work(numThreads - 1), each on its own thread if there is
+// more than one.
+template<typename F>
+void runThreads(int numThreads, F work) {
+  if (numThreads <= 1) {
+    work(0);
+    return;
+  }
+  boost::thread_group threads;
+  for (int i = 0; i < numThreads; i++) {
+    threads.create_thread([&work, i]() { work(i); });
+  }
+  threads.join_all();
+}
+
+}
+
+bool QValues::Better(FLOAT_T x, FLOAT_T y, bool ascending) {
+  x = normalize(x, ascending);
+  y = normalize(y, ascending);
+  return ascending ? x < y : x > y;
+}
+
+void QValues::SortByScore(
+  const vector<FLOAT_T>& scores,
+  bool ascending,
+  int numThreads,
+  vector<size_t>* items
+) {
+  const size_t n = items->size();
+  if (n < 2) {
+    return;
+  }
+  const int threads = n < MIN_PARALLEL_SORT ? 1 : max(1, numThreads);
+  vector<size_t> bounds(threads + 1);
+  for (int i = 0; i <= threads; i++) {
+    bounds[i] = n * i / threads;
+  }
+
+  vector<uint64_t> keys(n), keysOut(n);
+  vector<size_t> itemsOut(n);
+  runThreads(threads, [&](int t) {
+    for (size_t i = bounds[t]; i < bounds[t + 1]; i++) {
+      keys[i] = sortKey(scores[(*items)[i]], ascending);
+    }
+  });
+
+  // Least significant digit first. Each thread counts and then places its
+  // own chunk; within a bucket, earlier chunks go first, so the sort is stable.
+  vector<size_t> counts(threads * NUM_BUCKETS);
+  for (int pass = 0; pass < NUM_PASSES; pass++) {
+    const int shift = pass * RADIX_BITS;
+    fill(counts.begin(), counts.end(), 0);
+    runThreads(threads, [&](int t) {
+      size_t* count = &counts[t * NUM_BUCKETS];
+      for (size_t i = bounds[t]; i < bounds[t + 1]; i++) {
+        count[(keys[i] >> shift) & (NUM_BUCKETS - 1)]++;
+      }
+    });
+
+    // Skip digits that every key shares, such as the sign and the high
+    // exponent bits.
+    size_t firstBucket = (keys[0] >> shift) & (NUM_BUCKETS - 1);
+    size_t inFirstBucket = 0;
+    for (int t = 0; t < threads; t++) {
+      inFirstBucket += counts[t * NUM_BUCKETS + firstBucket];
+    }
+    if (inFirstBucket == n) {
+      continue;
+    }
+
+    size_t offset = 0;
+    for (size_t bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+      for (int t = 0; t < threads; t++) {
+        size_t count = counts[t * NUM_BUCKETS + bucket];
+        counts[t * NUM_BUCKETS + bucket] = offset;
+        offset += count;
+      }
+    }
+    runThreads(threads, [&](int t) {
+      size_t* next = &counts[t * NUM_BUCKETS];
+      for (size_t i = bounds[t]; i < bounds[t + 1]; i++) {
+        size_t j = next[(keys[i] >> shift) & (NUM_BUCKETS - 1)]++;
+        keysOut[j] = keys[i];
+        itemsOut[j] = (*items)[i];
+      }
+    });
+    keys.swap(keysOut);
+    items->swap(itemsOut);
+  }
+}
+
+void QValues::SortScores(
+  vector<FLOAT_T>* scores,
+  bool ascending,
+  int numThreads
+) {
+  vector<size_t> order(scores->size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  SortByScore(*scores, ascending, numThreads, &order);
+  vector<FLOAT_T> sorted(scores->size());
+  for (size_t i = 0; i < order.size(); i++) {
+    sorted[i] = (*scores)[order[i]];
+  }
+  scores->swap(sorted);
+}
+
+void QValues::FdrToQValues(vector<FLOAT_T>* fdrs) {
+  if (fdrs->empty()) {
+    return;
+  }
+  for (size_t i = fdrs->size() - 1; i-- > 0; ) {
+    if ((*fdrs)[i + 1] < (*fdrs)[i]) {
+      (*fdrs)[i] = (*fdrs)[i + 1];
+    }
+  }
+}
+
+void QValues::Tdc(
+  const vector<FLOAT_T>& targets,
+  const vector<FLOAT_T>& decoys,
+  bool ascending,
+  vector<FLOAT_T>* qvalues
+) {
+  qvalues->resize(targets.size());
+  size_t decoy = 0;
+  for (size_t target = 0; target < targets.size(); ) {
+    FLOAT_T score = targets[target];
+    while (decoy < decoys.size() && Better(decoys[decoy], score, ascending)) {
+      decoy++;
+    }
+    FLOAT_T fdr = min((FLOAT_T)1.0, (FLOAT_T)(decoy + 1) / (FLOAT_T)(target + 1));
+    // Targets with the same score share an FDR.
+    do {
+      (*qvalues)[target++] = fdr;
+    } while (target < targets.size() && targets[target] == score);
+  }
+  FdrToQValues(qvalues);
+}
+
+void QValues::MixMax(
+  const vector<FLOAT_T>& targets,
+  const vector<FLOAT_T>& decoys,
+  bool ascending,
+  FLOAT_T piZero,
+  vector<FLOAT_T>* qvalues
+) {
+  const int numTargets = targets.size();
+  const int numDecoys = decoys.size();
+  // Whether score x ranks at or before score y.
+  auto notWorse = [ascending](FLOAT_T x, FLOAT_T y) {
+    x = normalize(x, ascending);
+    y = normalize(y, ascending);
+    return ascending ? x <= y : x >= y;
+  };
+
+  // Cumulative counts of targets (w) and decoys (z) at or below each decoy.
+  vector<double> hWLeZ(numDecoys + 1, 0);
+  vector<double> hZLeZ(numDecoys + 1, 0);
+  int idx = 0;
+  for (int i = 0; i < numDecoys; ++i) {
+    while (idx < numTargets && notWorse(decoys[i], targets[idx])) {
+      ++idx;
+    }
+    hWLeZ[i] = (double)idx;
+  }
+  idx = 0;
+  for (int i = 0; i < numDecoys; ++i) {
+    while (idx < numDecoys && notWorse(decoys[i], decoys[idx])) {
+      ++idx;
+    }
+    hZLeZ[i] = (double)idx;
+  }
+  hWLeZ[numDecoys] = (double)numTargets;
+  hZLeZ[numDecoys] = (double)numDecoys;
+
+  qvalues->assign(numTargets, 0);
+  double estPxLtZj = 0.0;
+  double eF1ModRunTot = 0.0;
+  int j = numDecoys - 1;
+  int k = numTargets - 1;
+  int nZGeW = 0;
+  int nWGeW = 0;
+  double prevFdr = -1;
+  for (int i = numTargets - 1; i >= 0; --i) {
+    while (j >= 0 && notWorse(decoys[j], targets[i])) {
+      double cntW = hWLeZ[j + 1];
+      double cntZ = hZLeZ[j + 1];
+      estPxLtZj = (cntW - piZero * cntZ) / ((1.0 - piZero) * cntZ);
+      estPxLtZj = estPxLtZj > 1 ? 1 : estPxLtZj;
+      estPxLtZj = estPxLtZj < 0 ? 0 : estPxLtZj;
+      eF1ModRunTot += estPxLtZj * (1.0 - piZero);
+      ++nZGeW;
+      --j;
+    }
+    while (k >= 0 && notWorse(targets[k], targets[i])) {
+      ++nWGeW;
+      --k;
+    }
+    double fdr = ((double)nZGeW * piZero + eF1ModRunTot) / (double)nWGeW;
+    (*qvalues)[i] = fdr > 1.0 ? 1.0 : fdr;
+    // Targets are worst first, so the running maximum from the best target
+    // is the q-value.
+    if (prevFdr > (*qvalues)[i]) {
+      (*qvalues)[i] = prevFdr;
+    }
+    prevFdr = (*qvalues)[i];
+  }
+}
+
+void QValues::Atdc(
+  const vector<FLOAT_T>& targets,
+  const vector<FLOAT_T>& decoys,
+  size_t numDecoySets,
+  bool ascending,
+  bool oldAtdc,
+  int (*randomLimit)(int),
+  vector<FLOAT_T>* fdrs
+) {
+  const size_t numScores = targets.size();
+  fdrs->assign(numScores, 0);
+  if (numScores == 0 || numDecoySets == 0) {
+    return;
+  }
+  const FLOAT_T bc1 = -1/(FLOAT_T)numDecoySets;
+
+  // Negate descending scores so that smaller is always better.
+  vector<FLOAT_T> scores(numScores);
+  for (size_t i = 0; i < numScores; i++) {
+    scores[i] = ascending ? targets[i] : -targets[i];
+  }
+
+  vector<size_t> optIdxCnt(numScores, 0);
+  vector<FLOAT_T> sumNtds(numScores, 0);
+  vector<FLOAT_T>& sumNdds = *fdrs;
+  vector<int> ntds(numScores);
+  vector<int> ndds(numScores);
+  for (size_t i = 0; i < numDecoySets; i++) {
+    fill(ntds.begin(), ntds.end(), 0);
+    fill(ndds.begin(), ndds.end(), 0);
+    const FLOAT_T* decoySet = &decoys[i * numScores];
+    for (size_t j = 0; j < numScores; j++) {
+      FLOAT_T scoreTarget = scores[j];
+      FLOAT_T scoreDecoy = ascending ? decoySet[j] : -decoySet[j];
+      bool targetBetter = scoreTarget != scoreDecoy ? scoreTarget < scoreDecoy : randomLimit(2) == 0;
+      FLOAT_T x = targetBetter ? scoreTarget : scoreDecoy;
+      vector<int>& hist = targetBetter ? ntds : ndds;
+      if (targetBetter) {
+        optIdxCnt[j]++;
+      }
+      // x is in bin n if scores[n - 1] < x <= scores[n]. Scores that are not
+      // numbers sort last and are skipped by the scan after the search.
+      if (isnan(x)) {
+        continue;
+      }
+      size_t bin = lower_bound(scores.begin(), scores.end(), x) - scores.begin();
+      while (bin < numScores && !(x <= scores[bin])) {
+        bin++;
+      }
+      if (bin < numScores) {
+        hist[bin]++;
+      }
+    }
+
+    int ntdsTotal = 0, nddsTotal = 0;
+    for (size_t j = 0; j < numScores; j++) {
+      sumNtds[j] += (ntdsTotal += ntds[j]);
+      sumNdds[j] += (nddsTotal += ndds[j]);
+    }
+  }
+
+  if (oldAtdc) {
+    for (size_t i = 0; i < numScores; i++) {
+      sumNtds[i] /= numDecoySets;
+      sumNdds[i] /= numDecoySets;
+    }
+  }
+
+  vector<bool> isTargetPsm(numScores, true);
+  int numTargetPsms = 0;
+  vector< vector<int> > optIdxCntMat(numDecoySets + 1, vector<int>(numScores, 0));
+  vector<size_t> currentOptIdx(numDecoySets + 1, 0);
+  size_t lowestOptIdx = numDecoySets + 1;
+  const int denominator = oldAtdc ? 1 : numDecoySets;
+  for (size_t i = 0; i < numScores; i++) {
+    size_t idx = optIdxCnt[i];
+    size_t idx2 = oldAtdc ? currentOptIdx[idx]++ : ++currentOptIdx[idx];
+    optIdxCntMat[idx][idx2] = i;
+    if (idx < lowestOptIdx) {
+      lowestOptIdx = idx;
+    }
+    if ((FLOAT_T)numTargetPsms <= (sumNtds[i] / denominator) - 0.5) {
+      numTargetPsms++;
+      continue;
+    }
+    if (oldAtdc) {
+      isTargetPsm[optIdxCntMat[lowestOptIdx][--currentOptIdx[lowestOptIdx]]] = false;
+    } else {
+      isTargetPsm[optIdxCntMat[lowestOptIdx][currentOptIdx[lowestOptIdx]--]] = false;
+    }
+    for ( ; lowestOptIdx < numDecoySets + 1 && currentOptIdx[lowestOptIdx] == 0; lowestOptIdx++);
+  }
+
+  int targetPsmsTotal = 0;
+  if (oldAtdc) {
+    for (size_t i = 0; i < numScores; i++) {
+      if (isTargetPsm[i]) {
+        targetPsmsTotal++;
+      }
+      sumNdds[i] = (1 + sumNdds[i]) / max(1, targetPsmsTotal);
+    }
+  } else if (bc1 >= 0) {
+    for (size_t i = 0; i < numScores; i++) {
+      if (isTargetPsm[i]) {
+        targetPsmsTotal++;
+      }
+      sumNdds[i] = (bc1 + sumNdds[i] / numDecoySets) / max(1, targetPsmsTotal);
+    }
+  } else {
+    // Each step of sumNdds is the number of decoys in that bin.
+    FLOAT_T prev = 0;
+    for (size_t i = 0; i < numScores; i++) {
+      FLOAT_T current = sumNdds[i];
+      FLOAT_T nddsI = current - prev;
+      prev = current;
+      if (isTargetPsm[i]) {
+        targetPsmsTotal++;
+      }
+      sumNdds[i] = ((min((FLOAT_T)numDecoySets, max((FLOAT_T)1, nddsI)) + sumNdds[i]) / numDecoySets) /
+        max(1, targetPsmsTotal);
+    }
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef QVALUES_H
+#define QVALUES_H
+
+#include <vector>
+#include "utils.h"
+
+// Q-value procedures over flat arrays of scores. Scores are "best first"
+// when sorted by SortScores: smallest first if ascending, else largest first.
+// Scores that are not numbers, or are infinite, are ranked worst, as
+// Match::ScoreLess and Match::ScoreGreater rank them.
+class QValues {
+ public:
+  // Stable sort of items, which index into scores, best score first. Large
+  // inputs are radix sorted on numThreads threads.
+  static void SortByScore(const std::vector<FLOAT_T>& scores, bool ascending, int numThreads,
+                          std::vector<size_t>* items);
+
+  // Sorts scores best first.
+  static void SortScores(std::vector<FLOAT_T>* scores, bool ascending, int numThreads);
+
+  // Whether score x ranks before score y.
+  static bool Better(FLOAT_T x, FLOAT_T y, bool ascending);
+
+  // Turns FDRs, best score first, into q-values in one pass from the worst
+  // score: each becomes the smallest FDR at or after it.
+  static void FdrToQValues(std::vector<FLOAT_T>* fdrs);
+
+  // Target-decoy competition q-values for targets and decoys that are both
+  // sorted best first. FDR = min(1, (#better decoys + 1) / #targets so far).
+  static void Tdc(const std::vector<FLOAT_T>& targets, const std::vector<FLOAT_T>& decoys,
+                  bool ascending, std::vector<FLOAT_T>* qvalues);
+
+  // Mix-max q-values (Keich, Kertesz-Farkas and Noble 2015) for targets and
+  // decoys that are both sorted worst first, as SortScores and then a
+  // reverse leaves them.
+  static void MixMax(const std::vector<FLOAT_T>& targets, const std::vector<FLOAT_T>& decoys,
+                     bool ascending, FLOAT_T piZero, std::vector<FLOAT_T>* qvalues);
+
+  // Average target-decoy competition FDRs for targets sorted best first.
+  // decoys holds numDecoySets sets of targets.size() scores one after another,
+  // where decoys[set * targets.size() + i] is paired with targets[i]. Ties
+  // between a target and its decoy are won by the target when
+  // randomLimit(2) == 0.
+  static void Atdc(const std::vector<FLOAT_T>& targets, const std::vector<FLOAT_T>& decoys,
+                   size_t numDecoySets, bool ascending, bool oldAtdc,
+                   int (*randomLimit)(int), std::vector<FLOAT_T>* fdrs);
+
+ private:
+  QValues();
+  ~QValues();
+};
+
+#endif
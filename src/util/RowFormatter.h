@@ -0,0 +1,73 @@
+#ifndef ROWFORMATTER_H
+#define ROWFORMATTER_H
+
+#include <ostream>
+#include <string>
+#include "StringUtils.h"
+
+// A row of delimited output built in one reusable buffer. Values are appended
+// with << and print as they would to an ostream with default settings;
+// number() values print as StringUtils::ToString. Numbers are formatted in place,
+// and the row goes to its stream in a single write.
+class RowFormatter {
+ public:
+  RowFormatter() { buffer_.reserve(1024); }
+
+  RowFormatter& operator<<(const std::string& s) { buffer_.append(s); return *this; }
+  RowFormatter& operator<<(const char* s) { buffer_.append(s); return *this; }
+  RowFormatter& operator<<(char c) { buffer_.push_back(c); return *this; }
+  RowFormatter& operator<<(int value) { StringUtils::AppendInt(&buffer_, value); return *this; }
+  RowFormatter& operator<<(long value) { StringUtils::AppendInt(&buffer_, value); return *this; }
+  RowFormatter& operator<<(long long value) {
+    StringUtils::AppendInt(&buffer_, value);
+    return *this;
+  }
+  RowFormatter& operator<<(unsigned int value) {
+    StringUtils::AppendUnsigned(&buffer_, value);
+    return *this;
+  }
+  RowFormatter& operator<<(unsigned long value) {
+    StringUtils::AppendUnsigned(&buffer_, value);
+    return *this;
+  }
+  RowFormatter& operator<<(unsigned long long value) {
+    StringUtils::AppendUnsigned(&buffer_, value);
+    return *this;
+  }
+  // An ostream prints 6 significant digits by default.
+  RowFormatter& operator<<(double value) {
+    StringUtils::AppendDouble(&buffer_, value, 6, false);
+    return *this;
+  }
+  RowFormatter& operator<<(float value) { return *this << (double)value; }
+
+  // A number to print as StringUtils::ToString(value, decimals, fixedFloat).
+  struct Number {
+    double value;
+    int decimals;
+    bool fixedFloat;
+  };
+  static Number number(double value, int decimals = -1, bool fixedFloat = true) {
+    Number n = { value, decimals, fixedFloat };
+    return n;
+  }
+  RowFormatter& operator<<(const Number& n) {
+    StringUtils::AppendDouble(&buffer_, n.value, n.decimals, n.fixedFloat);
+    return *this;
+  }
+
+  const std::string& str() const { return buffer_; }
+  bool empty() const { return buffer_.empty(); }
+  void clear() { buffer_.clear(); }
+
+  // Writes the row to out and clears it.
+  void writeTo(std::ostream* out) {
+    out->write(buffer_.data(), buffer_.size());
+    buffer_.clear();
+  }
+
+ private:
+  std::string buffer_;
+};
+
+#endif
@@ -1,11 +1,194 @@
 #include "StringUtils.h"
 
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include "boost/algorithm/string.hpp"
 
 using namespace std;
 
 const char* StringUtils::WHITESPACE_CHARS = " \t\n\v\f\r";
 
+// An ostream formats floating point numbers with these snprintf conversions,
+// so the text is the same as with a stringstream.
+static void appendFormatted(string* out, const char* format, int precision, double value) {
+  char buffer[64];
+  int length = snprintf(buffer, sizeof(buffer), format, precision, value);
+  if (length < (int)sizeof(buffer)) {
+    out->append(buffer, length);
+    return;
+  }
+  size_t size = out->size();
+  out->resize(size + length + 1);
+  snprintf(&(*out)[size], length + 1, format, precision, value);
+  out->resize(size + length);
+}
+
+// Copies the number in length characters at s to buffer, null terminated, for
+// strtod and friends. A stream skips leading whitespace and reads only these
+// characters, and fails unless it reads the whole string; so anything else,
+// such as "inf" or hex, is rejected here too.
+static bool copyNumber(const char* s, size_t length, const char* allowed,
+                       char* buffer, size_t size) {
+  while (length > 0 && isspace((unsigned char)*s)) {
+    ++s;
+    --length;
+  }
+  if (length == 0 || length >= size) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (strchr(allowed, s[i]) == NULL || s[i] == '\0') {
+      return false;
+    }
+    buffer[i] = s[i];
+  }
+  buffer[length] = '\0';
+  return true;
+}
+
+bool StringUtils::TryFromString(const char* s, size_t length, double* out) {
+  char buffer[128];
+  if (!copyNumber(s, length, "0123456789+-.eE", buffer, sizeof(buffer))) {
+    return length >= sizeof(buffer) && TryFromString(string(s, length), out);
+  }
+  char* end;
+  errno = 0;
+  double value = strtod(buffer, &end);
+  if (*end != '\0' || end == buffer ||
+      (errno == ERANGE && fabs(value) == HUGE_VAL)) {
+    return false;
+  }
+  *out = value;
+  return true;
+}
+
+bool StringUtils::TryFromString(const char* s, size_t length, float* out) {
+  char buffer[128];
+  if (!copyNumber(s, length, "0123456789+-.eE", buffer, sizeof(buffer))) {
+    return length >= sizeof(buffer) && TryFromString(string(s, length), out);
+  }
+  char* end;
+  errno = 0;
+  float value = strtof(buffer, &end);
+  if (*end != '\0' || end == buffer ||
+      (errno == ERANGE && fabs(value) == HUGE_VALF)) {
+    return false;
+  }
+  *out = value;
+  return true;
+}
+
+bool StringUtils::TryFromString(const char* s, size_t length, int* out) {
+  char buffer[64];
+  if (!copyNumber(s, length, "0123456789+-", buffer, sizeof(buffer))) {
+    return length >= sizeof(buffer) && TryFromString(string(s, length), out);
+  }
+  char* end;
+  errno = 0;
+  long value = strtol(buffer, &end, 10);
+  if (*end != '\0' || end == buffer || errno == ERANGE ||
+      value < INT_MIN || value > INT_MAX) {
+    return false;
+  }
+  *out = (int)value;
+  return true;
+}
+
+void StringUtils::AppendDouble(string* out, double value, int decimals, bool fixedFloat) {
+  if (decimals < 0) {
+    appendFormatted(out, "%.*g", 8, value);
+  } else {
+    appendFormatted(out, fixedFloat ? "%.*f" : "%.*g", decimals, value);
+  }
+}
+
+void StringUtils::AppendUnsigned(string* out, unsigned long long value) {
+  char buffer[24];
+  char* end = buffer + sizeof(buffer);
+  char* begin = end;
+  do {
+    *--begin = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  out->append(begin, end - begin);
+}
+
+void StringUtils::AppendInt(string* out, long long value) {
+  if (value < 0) {
+    out->push_back('-');
+    AppendUnsigned(out, 0ULL - (unsigned long long)value);
+  } else {
+    AppendUnsigned(out, value);
+  }
+}
+
+string StringUtils::ToString(double value, int decimals, bool fixedFloat) {
+  string s;
+  AppendDouble(&s, value, decimals, fixedFloat);
+  return s;
+}
+
+string StringUtils::ToString(float value, int decimals, bool fixedFloat) {
+  return ToString((double)value, decimals, fixedFloat);
+}
+
+string StringUtils::ToString(int value) {
+  string s;
+  AppendInt(&s, value);
+  return s;
+}
+
+string StringUtils::ToString(unsigned int value) {
+  string s;
+  AppendUnsigned(&s, value);
+  return s;
+}
+
+string StringUtils::ToString(long value) {
+  string s;
+  AppendInt(&s, value);
+  return s;
+}
+
+string StringUtils::ToString(unsigned long value) {
+  string s;
+  AppendUnsigned(&s, value);
+  return s;
+}
+
+string StringUtils::ToString(long long value) {
+  string s;
+  AppendInt(&s, value);
+  return s;
+}
+
+string StringUtils::ToString(unsigned long long value) {
+  string s;
+  AppendUnsigned(&s, value);
+  return s;
+}
+
+string StringUtils::Join(const vector<string>& values, const char delimiter) {
+  size_t length = values.size();
+  for (vector<string>::const_iterator i = values.begin(); i != values.end(); i++) {
+    length += i->length();
+  }
+  string joined;
+  joined.reserve(length);
+  for (vector<string>::const_iterator i = values.begin(); i != values.end(); i++) {
+    if (i != values.begin() && delimiter != '\0') {
+      joined.push_back(delimiter);
+    }
+    joined.append(*i);
+  }
+  return joined;
+}
+
 vector<string> StringUtils::Split(const string& s, char delimiter) {
   return Split<string>(s, delimiter);
 }
@@ -31,6 +31,12 @@ class StringUtils {
     return true;
   }
 
+  // The same conversions for length characters at s, which need not be null
+  // terminated, parsed in place.
+  static bool TryFromString(const char* s, size_t length, double* out);
+  static bool TryFromString(const char* s, size_t length, float* out);
+  static bool TryFromString(const char* s, size_t length, int* out);
+
   // Convert to a string
   // Description added by Andy Lin
   // If fixedFloat is true, then the enum (most likely defined in objects.h)
@@ -54,6 +60,23 @@ class StringUtils {
     return converter.str();
   }
 
+  // The same conversions for numbers, formatted without a stringstream.
+  static std::string ToString(double value, int decimals = -1, bool fixedFloat = true);
+  static std::string ToString(float value, int decimals = -1, bool fixedFloat = true);
+  static std::string ToString(int value);
+  static std::string ToString(unsigned int value);
+  static std::string ToString(long value);
+  static std::string ToString(unsigned long value);
+  static std::string ToString(long long value);
+  static std::string ToString(unsigned long long value);
+
+  // Appends value to out as ToString(value, decimals, fixedFloat) returns it.
+  static void AppendDouble(std::string* out, double value, int decimals = -1,
+                           bool fixedFloat = true);
+  // Appends an integer to out.
+  static void AppendInt(std::string* out, long long value);
+  static void AppendUnsigned(std::string* out, unsigned long long value);
+
   // Joins a vector of strings into a single string separated by a delimiter
   template<typename T>
   static std::string Join(const T& values, const char delimiter ='\0') {
@@ -66,6 +89,7 @@ class StringUtils {
     }
     return ss.str();
   }
+  static std::string Join(const std::vector<std::string>& values, const char delimiter ='\0');
 
   // added by Yang
   // Joins a vector of double into a single string separated by a delimiter, preserving the high precision
@@ -0,0 +1,216 @@
+#include <cppunit/config/SourcePrefix.h>
+#include "TestDelimitedFileReader.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "util/StringUtils.h"
+
+using namespace std;
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TestDelimitedFileReader );
+
+static void writeFile(const string& filename, const string& text) {
+  ofstream out(filename.c_str(), ios::binary);
+  out << text;
+}
+
+static vector<string> makeRow(const char* a, const char* b, const char* c) {
+  vector<string> row;
+  row.push_back(a);
+  row.push_back(b);
+  row.push_back(c);
+  return row;
+}
+
+void TestDelimitedFileReader::setUp(){
+  // an empty cell, a short row and a row longer than the header
+  unixText = "a\tb\tc\n1\t2.5\tx\n3\t\t\n4\n5\t6\t7\t8\n";
+  crlfText = "a\tb\tc\r\n1\t2.5\tx\r\n3\t\t\r\n4\r\n5\t6\t7\t8\r\n";
+  noNewlineText = "a\tb\n1\t2";
+
+  unixFile = "tiny-reader-unix.txt";
+  crlfFile = "tiny-reader-crlf.txt";
+  noNewlineFile = "tiny-reader-no-newline.txt";
+  writeFile(unixFile, unixText);
+  writeFile(crlfFile, crlfText);
+  writeFile(noNewlineFile, noNewlineText);
+}
+
+void TestDelimitedFileReader::tearDown(){
+  remove(unixFile.c_str());
+  remove(crlfFile.c_str());
+  remove(noNewlineFile.c_str());
+}
+
+vector< vector<string> > TestDelimitedFileReader::readRows(
+  DelimitedFileReader& reader,
+  unsigned int num_cells
+){
+  vector< vector<string> > rows;
+  while (reader.hasNext()) {
+    vector<string> row;
+    for (unsigned int col_idx = 0; col_idx < num_cells; col_idx++) {
+      row.push_back(reader.getString(col_idx));
+    }
+    rows.push_back(row);
+    reader.next();
+  }
+  return rows;
+}
+
+void TestDelimitedFileReader::mappedMatchesStream(){
+  // a stream is read line by line, as every file was before
+  const string* files[] = { &unixFile, &crlfFile, &noNewlineFile };
+  const string* texts[] = { &unixText, &crlfText, &noNewlineText };
+  for (int i = 0; i < 3; i++) {
+    DelimitedFileReader mapped(*files[i]);
+    istringstream stream(*texts[i]);
+    DelimitedFileReader streamed(&stream);
+
+    CPPUNIT_ASSERT(mapped.getColumnNames() == streamed.getColumnNames());
+    CPPUNIT_ASSERT_EQUAL(streamed.numRows(), mapped.numRows());
+    while (streamed.hasNext()) {
+      CPPUNIT_ASSERT(mapped.hasNext());
+      CPPUNIT_ASSERT_EQUAL(streamed.getString(), mapped.getString());
+      CPPUNIT_ASSERT(streamed.getCurrentRowData() == mapped.getCurrentRowData());
+      streamed.next();
+      mapped.next();
+    }
+    CPPUNIT_ASSERT(!mapped.hasNext());
+  }
+}
+
+void TestDelimitedFileReader::unixLines(){
+  DelimitedFileReader reader(unixFile);
+  CPPUNIT_ASSERT_EQUAL(3u, reader.numCols());
+  CPPUNIT_ASSERT_EQUAL(string("c"), reader.getColumnName(2));
+  CPPUNIT_ASSERT_EQUAL(4u, reader.numRows());
+  CPPUNIT_ASSERT_EQUAL(string("1\t2.5\tx"), reader.getString());
+
+  vector< vector<string> > rows = readRows(reader, 3);
+  CPPUNIT_ASSERT_EQUAL((size_t)4, rows.size());
+  CPPUNIT_ASSERT(rows[0] == makeRow("1", "2.5", "x"));
+  // empty cells, and cells missing from a short row, are empty strings
+  CPPUNIT_ASSERT(rows[1] == makeRow("3", "", ""));
+  CPPUNIT_ASSERT(rows[2] == makeRow("4", "", ""));
+  CPPUNIT_ASSERT(rows[3] == makeRow("5", "6", "7"));
+
+  // cells beyond the header are kept
+  reader.reset();
+  for (int i = 0; i < 3; i++) {
+    reader.next();
+  }
+  CPPUNIT_ASSERT_EQUAL((size_t)4, reader.getCurrentRowData().size());
+  CPPUNIT_ASSERT_EQUAL(string("8"), reader.getString(3));
+}
+
+void TestDelimitedFileReader::crlfLines(){
+  // The header is trimmed; data rows keep their carriage returns.
+  DelimitedFileReader reader(crlfFile);
+  CPPUNIT_ASSERT_EQUAL(3u, reader.numCols());
+  CPPUNIT_ASSERT_EQUAL(string("c"), reader.getColumnName(2));
+  CPPUNIT_ASSERT_EQUAL(4u, reader.numRows());
+  CPPUNIT_ASSERT_EQUAL(string("1\t2.5\tx\r"), reader.getString());
+
+  vector< vector<string> > rows = readRows(reader, 3);
+  CPPUNIT_ASSERT_EQUAL((size_t)4, rows.size());
+  CPPUNIT_ASSERT(rows[0] == makeRow("1", "2.5", "x\r"));
+  CPPUNIT_ASSERT(rows[1] == makeRow("3", "", "\r"));
+  CPPUNIT_ASSERT(rows[2] == makeRow("4\r", "", ""));
+  CPPUNIT_ASSERT(rows[3] == makeRow("5", "6", "7"));
+}
+
+void TestDelimitedFileReader::noFinalNewline(){
+  DelimitedFileReader reader(noNewlineFile);
+  CPPUNIT_ASSERT_EQUAL(2u, reader.numCols());
+  CPPUNIT_ASSERT_EQUAL(1u, reader.numRows());
+
+  vector< vector<string> > rows = readRows(reader, 2);
+  CPPUNIT_ASSERT_EQUAL((size_t)1, rows.size());
+  CPPUNIT_ASSERT_EQUAL(string("1"), rows[0][0]);
+  CPPUNIT_ASSERT_EQUAL(string("2"), rows[0][1]);
+}
+
+void TestDelimitedFileReader::cells(){
+  // getCell returns the text that getString copies
+  const string* files[] = { &unixFile, &crlfFile, &noNewlineFile };
+  for (int i = 0; i < 3; i++) {
+    DelimitedFileReader reader(*files[i]);
+    while (reader.hasNext()) {
+      size_t num_cells = reader.getCurrentRowData().size();
+      for (unsigned int col_idx = 0; col_idx < num_cells; col_idx++) {
+        size_t length;
+        const char* cell = reader.getCell(col_idx, &length);
+        CPPUNIT_ASSERT_EQUAL(reader.getString(col_idx), string(cell, length));
+      }
+      reader.next();
+    }
+  }
+}
+
+void TestDelimitedFileReader::numbers(){
+  DelimitedFileReader reader(unixFile);
+  CPPUNIT_ASSERT_EQUAL(1, reader.getInteger(0u));
+  CPPUNIT_ASSERT_EQUAL(2.5, reader.getDouble("b"));
+  CPPUNIT_ASSERT_THROW(reader.getDouble("c"), runtime_error);
+  CPPUNIT_ASSERT_THROW(reader.getInteger("c"), runtime_error);
+  CPPUNIT_ASSERT_THROW(reader.getInteger("b"), runtime_error);
+  reader.next();
+  // an empty cell is 0 as a double, but not an integer
+  CPPUNIT_ASSERT_EQUAL(0.0, reader.getDouble("b"));
+  CPPUNIT_ASSERT_THROW(reader.getInteger("b"), runtime_error);
+  reader.next();
+  CPPUNIT_ASSERT_EQUAL(0.0, reader.getDouble("c"));
+
+  // a carriage return is not part of a number
+  DelimitedFileReader crlf_reader(crlfFile);
+  CPPUNIT_ASSERT_EQUAL(2.5, crlf_reader.getDouble("b"));
+  crlf_reader.next();
+  crlf_reader.next();
+  CPPUNIT_ASSERT_THROW(crlf_reader.getInteger("a"), runtime_error);
+  CPPUNIT_ASSERT_THROW(crlf_reader.getDouble("a"), runtime_error);
+}
+
+void TestDelimitedFileReader::tryFromString(){
+  // The in-place conversions succeed and fail where the stringstream ones do.
+  const char* inputs[] = {
+    "0", "1", "-1", "+1", "007", "1.5", "-.5", ".5", "5.", "1e5", "1E-5",
+    "2147483647", "-2147483648", "2147483648", "99999999999",
+    "1e999", "-1e999", "3.4e38", "3.5e38", "1e-30",
+    "", " ", "-", "+", ".", "e5", "1e", "1e+", "1.2.3", "--1", "1-",
+    " 1", "1 ", "1\r", "1\t", "1,5", "1a", "abc", "0x10", "inf", "-inf", "nan",
+    "Inf", "NaN",
+    "1.000000000000000000000000000000000000000000000000000000000000000000000000"
+    "00000000000000000000000000000000000000000000000000000000000000000000000001"
+  };
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    string s(inputs[i]);
+    string message = "'" + s + "'";
+
+    double d_stream = 0, d_cell = 0;
+    bool ok_stream = StringUtils::TryFromString(s, &d_stream);
+    bool ok_cell = StringUtils::TryFromString(s.data(), s.length(), &d_cell);
+    CPPUNIT_ASSERT_EQUAL_MESSAGE("double " + message, ok_stream, ok_cell);
+    if (ok_stream) {
+      CPPUNIT_ASSERT_EQUAL_MESSAGE("double " + message, d_stream, d_cell);
+    }
+
+    float f_stream = 0, f_cell = 0;
+    ok_stream = StringUtils::TryFromString(s, &f_stream);
+    ok_cell = StringUtils::TryFromString(s.data(), s.length(), &f_cell);
+    CPPUNIT_ASSERT_EQUAL_MESSAGE("float " + message, ok_stream, ok_cell);
+    if (ok_stream) {
+      CPPUNIT_ASSERT_EQUAL_MESSAGE("float " + message, f_stream, f_cell);
+    }
+
+    int i_stream = 0, i_cell = 0;
+    ok_stream = StringUtils::TryFromString(s, &i_stream);
+    ok_cell = StringUtils::TryFromString(s.data(), s.length(), &i_cell);
+    CPPUNIT_ASSERT_EQUAL_MESSAGE("int " + message, ok_stream, ok_cell);
+    if (ok_stream) {
+      CPPUNIT_ASSERT_EQUAL_MESSAGE("int " + message, i_stream, i_cell);
+    }
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef CPP_UNIT_TESTDELIMITEDFILEREADER_H
+#define CPP_UNIT_TESTDELIMITEDFILEREADER_H
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+#include <vector>
+#include "io/DelimitedFileReader.h"
+
+/**
+ * Checks that a DelimitedFileReader on a memory mapped file returns what
+ * it returned when every file was read as a stream and split into strings.
+ */
+class TestDelimitedFileReader : public CPPUNIT_NS::TestFixture
+{
+  CPPUNIT_TEST_SUITE( TestDelimitedFileReader );
+  CPPUNIT_TEST( mappedMatchesStream );
+  CPPUNIT_TEST( unixLines );
+  CPPUNIT_TEST( crlfLines );
+  CPPUNIT_TEST( noFinalNewline );
+  CPPUNIT_TEST( cells );
+  CPPUNIT_TEST( numbers );
+  CPPUNIT_TEST( tryFromString );
+  CPPUNIT_TEST_SUITE_END();
+
+ protected:
+  // variables to use in testing
+  std::string unixFile;
+  std::string crlfFile;
+  std::string noNewlineFile;
+  std::string unixText;
+  std::string crlfText;
+  std::string noNewlineText;
+
+  // every row, as the cells returned by getString(col_idx)
+  std::vector< std::vector<std::string> > readRows(
+    DelimitedFileReader& reader,
+    unsigned int num_cells
+  );
+
+ public:
+  void setUp();
+  void tearDown();
+
+ protected:
+  void mappedMatchesStream();
+  void unixLines();
+  void crlfLines();
+  void noFinalNewline();
+  void cells();
+  void numbers();
+  void tryFromString();
+};
+
+#endif //CPP_UNIT_TESTDELIMITEDFILEREADER_H
@@ -0,0 +1,141 @@
+#include <cppunit/config/SourcePrefix.h>
+#include "TestPsmTable.h"
+
+#include <cmath>
+#include <limits>
+#include "model/SpectrumZState.h"
+
+using namespace std;
+using namespace Crux;
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TestPsmTable );
+
+void TestPsmTable::setUp(){
+  table = new PsmTable();
+}
+
+void TestPsmTable::tearDown(){
+  // the table frees the target matches; matches do not free their spectra
+  delete table;
+  for (size_t i = 0; i < spectra.size(); i++) {
+    delete spectra[i];
+  }
+  spectra.clear();
+}
+
+size_t TestPsmTable::addPsm(
+  FLOAT_T score,
+  int file,
+  int scan,
+  int charge,
+  bool decoy,
+  int decoy_index,
+  int peptide
+){
+  Spectrum* spectrum = new Spectrum(scan, scan, 500, vector<int>(1, charge), "");
+  spectra.push_back(spectrum);
+  Match* match = new Match(NULL, spectrum, SpectrumZState(1000, charge), decoy);
+  match->setScore(XCORR, score);
+  match->setFileIndex(file);
+  match->setDecoyIndex(decoy_index);
+  size_t row = table->add(match, XCORR, peptide);
+  // the table holds its own reference to a target
+  Match::freeMatch(match);
+  return row;
+}
+
+void TestPsmTable::sortedRowsBreakTies(){
+  // tied scores, added out of file, scan and charge order
+  size_t a = addPsm(2, 1, 10, 2);
+  size_t b = addPsm(2, 0, 20, 3);
+  size_t c = addPsm(3, 1, 5, 2);
+  size_t d = addPsm(2, 0, 20, 2);
+  size_t e = addPsm(2, 0, 7, 3);
+  size_t f = addPsm(1, 0, 1, 1);
+  size_t g = addPsm(2, 0, 20, 2);
+  addPsm(2, 0, 1, 1, true);
+
+  // larger scores first; ties by file, scan, charge, then row
+  size_t expected[] = { c, e, d, g, b, a, f };
+  vector<size_t> rows = table->sortedRows(false, false, 0, 1);
+  CPPUNIT_ASSERT(rows == vector<size_t>(expected, expected + 7));
+
+  // smaller scores first; the ties keep the same order
+  size_t expected_ascending[] = { f, e, d, g, b, a, c };
+  rows = table->sortedRows(true, false, 0, 1);
+  CPPUNIT_ASSERT(rows == vector<size_t>(expected_ascending, expected_ascending + 7));
+
+  // the same on several threads
+  rows = table->sortedRows(false, false, 0, 4);
+  CPPUNIT_ASSERT(rows == vector<size_t>(expected, expected + 7));
+}
+
+void TestPsmTable::sortedRowsByDecoyIndex(){
+  addPsm(5, 0, 1, 2);
+  size_t a = addPsm(1, 0, 2, 2, true, 1);
+  size_t b = addPsm(4, 0, 3, 2, true, 0);
+  size_t c = addPsm(4, 0, 1, 2, true, 1);
+  size_t d = addPsm(2, 0, 4, 2, true, 0);
+  size_t e = addPsm(4, 0, 1, 2, true, 1);
+
+  int indexes[] = { 0, 1 };
+  CPPUNIT_ASSERT(table->decoyIndexes() == vector<int>(indexes, indexes + 2));
+
+  size_t expected0[] = { b, d };
+  CPPUNIT_ASSERT(table->sortedRows(false, true, 0, 1) == vector<size_t>(expected0, expected0 + 2));
+  size_t expected1[] = { c, e, a };
+  CPPUNIT_ASSERT(table->sortedRows(false, true, 1, 1) == vector<size_t>(expected1, expected1 + 3));
+  CPPUNIT_ASSERT(table->sortedRows(false, true, 2, 1).empty());
+
+  // decoys hold no match
+  CPPUNIT_ASSERT(table->match(a) == NULL);
+  CPPUNIT_ASSERT(table->isDecoy(a));
+  CPPUNIT_ASSERT_EQUAL(1, table->decoyIndex(a));
+}
+
+void TestPsmTable::assignQValues(){
+  size_t a = addPsm(2, 0, 1, 2);
+  size_t b = addPsm(1, 0, 2, 2);
+  size_t c = addPsm(numeric_limits<FLOAT_T>::quiet_NaN(), 0, 3, 2);
+  size_t d = addPsm(numeric_limits<FLOAT_T>::infinity(), 0, 4, 2);
+  size_t e = addPsm(-numeric_limits<FLOAT_T>::infinity(), 0, 5, 2);
+  addPsm(2, 0, 6, 2, true);
+
+  // 2 is listed twice, and the last q-value given for it is used
+  vector<FLOAT_T> scores, qvalues;
+  scores.push_back(2);
+  qvalues.push_back(0.1f);
+  scores.push_back(1);
+  qvalues.push_back(0.2f);
+  scores.push_back(2);
+  qvalues.push_back(0.3f);
+  scores.push_back(numeric_limits<FLOAT_T>::infinity());
+  qvalues.push_back(0.4f);
+  table->assignQValues(scores, qvalues, QVALUE_TDC);
+
+  CPPUNIT_ASSERT_EQUAL(0.3f, (float)table->match(a)->getScore(QVALUE_TDC));
+  CPPUNIT_ASSERT_EQUAL(0.2f, (float)table->match(b)->getScore(QVALUE_TDC));
+  // scores that are not finite get NaN
+  CPPUNIT_ASSERT(isnan(table->match(c)->getScore(QVALUE_TDC)));
+  CPPUNIT_ASSERT(isnan(table->match(d)->getScore(QVALUE_TDC)));
+  CPPUNIT_ASSERT(isnan(table->match(e)->getScore(QVALUE_TDC)));
+}
+
+void TestPsmTable::peptides(){
+  CPPUNIT_ASSERT_EQUAL(-1, table->findPeptide("PEPTIDE"));
+  int pep = table->internPeptide("PEPTIDE");
+  int other = table->internPeptide("PEPTIDEK");
+  CPPUNIT_ASSERT(pep != other);
+  CPPUNIT_ASSERT_EQUAL(pep, table->internPeptide("PEPTIDE"));
+  CPPUNIT_ASSERT_EQUAL(pep, table->findPeptide("PEPTIDE"));
+  CPPUNIT_ASSERT_EQUAL(other, table->findPeptide("PEPTIDEK"));
+  CPPUNIT_ASSERT_EQUAL(-1, table->findPeptide("PEPTID"));
+  CPPUNIT_ASSERT_EQUAL((size_t)2, table->numPeptides());
+
+  size_t a = addPsm(2, 0, 1, 2, false, 0, pep);
+  size_t b = addPsm(1, 0, 2, 2, true, 0, table->findPeptide("PEPTIDEK"));
+  size_t c = addPsm(1, 0, 3, 2);
+  CPPUNIT_ASSERT_EQUAL(pep, table->peptide(a));
+  CPPUNIT_ASSERT_EQUAL(other, table->peptide(b));
+  CPPUNIT_ASSERT_EQUAL(-1, table->peptide(c));
+}
@@ -0,0 +1,45 @@
+#ifndef CPP_UNIT_TESTPSMTABLE_H
+#define CPP_UNIT_TESTPSMTABLE_H
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <vector>
+#include "app/PsmTable.h"
+#include "model/Spectrum.h"
+
+class TestPsmTable : public CPPUNIT_NS::TestFixture
+{
+  CPPUNIT_TEST_SUITE( TestPsmTable );
+  CPPUNIT_TEST( sortedRowsBreakTies );
+  CPPUNIT_TEST( sortedRowsByDecoyIndex );
+  CPPUNIT_TEST( assignQValues );
+  CPPUNIT_TEST( peptides );
+  CPPUNIT_TEST_SUITE_END();
+
+ protected:
+  // variables to use in testing
+  std::vector<Crux::Spectrum*> spectra;
+  PsmTable* table;
+
+  // adds a PSM with an XCorr score to table, and returns its row
+  size_t addPsm(
+    FLOAT_T score,
+    int file,
+    int scan,
+    int charge,
+    bool decoy = false,
+    int decoy_index = 0,
+    int peptide = -1
+  );
+
+ public:
+  void setUp();
+  void tearDown();
+
+ protected:
+  void sortedRowsBreakTies();
+  void sortedRowsByDecoyIndex();
+  void assignQValues();
+  void peptides();
+};
+
+#endif //CPP_UNIT_TESTPSMTABLE_H
@@ -0,0 +1,602 @@
+#include <cppunit/config/SourcePrefix.h>
+#include "TestQValues.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+using namespace std;
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TestQValues );
+
+// Match::ScoreLess and Match::ScoreGreater, which rank scores that are not
+// finite worst.
+static bool scoreLess(double x, double y) {
+  if (isnan(x) || isinf(x)) {
+    x = numeric_limits<double>::max();
+  }
+  if (isnan(y) || isinf(y)) {
+    y = numeric_limits<double>::max();
+  }
+  return x < y;
+}
+
+static bool scoreGreater(double x, double y) {
+  if (isnan(x) || isinf(x)) {
+    x = -numeric_limits<double>::max();
+  }
+  if (isnan(y) || isinf(y)) {
+    y = -numeric_limits<double>::max();
+  }
+  return x > y;
+}
+
+static bool sameValue(FLOAT_T x, FLOAT_T y) {
+  return x == y || (isnan(x) && isnan(y));
+}
+
+static bool sameValues(const vector<FLOAT_T>& x, const vector<FLOAT_T>& y) {
+  if (x.size() != y.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < x.size(); i++) {
+    if (!sameValue(x[i], y[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// AssignConfidenceApplication::convert_fdr_to_qvalue
+static void oldFdrToQValues(vector<FLOAT_T>& qvalues) {
+  FLOAT_T prev_fdr = qvalues[qvalues.size() - 1];
+  for (int idx = qvalues.size() - 2; idx >= 0; idx--) {
+    FLOAT_T this_fdr = qvalues[idx];
+    if (prev_fdr < this_fdr) {
+      qvalues[idx] = prev_fdr;
+    }
+    prev_fdr = qvalues[idx];
+  }
+}
+
+// AssignConfidenceApplication::compute_decoy_qvalues_tdc
+static vector<FLOAT_T> oldTdc(
+  vector<FLOAT_T> target_scores,
+  vector<FLOAT_T> decoy_scores,
+  bool ascending
+) {
+  if (ascending) {
+    sort(target_scores.begin(), target_scores.end(), scoreLess);
+    sort(decoy_scores.begin(), decoy_scores.end(), scoreLess);
+  } else {
+    sort(target_scores.begin(), target_scores.end(), scoreGreater);
+    sort(decoy_scores.begin(), decoy_scores.end(), scoreGreater);
+  }
+
+  vector<FLOAT_T> qvalues;
+  int decoy_idx = 0;
+  for (int target_idx = 0; target_idx < (int)target_scores.size(); target_idx++) {
+    double target_score = target_scores[target_idx];
+    if (ascending) {
+      while (decoy_idx < (int)decoy_scores.size() &&
+             scoreLess(decoy_scores[decoy_idx], target_score)) {
+        decoy_idx++;
+      }
+    } else {
+      while (decoy_idx < (int)decoy_scores.size() &&
+             scoreGreater(decoy_scores[decoy_idx], target_score)) {
+        decoy_idx++;
+      }
+    }
+    FLOAT_T fdr = ((FLOAT_T)(decoy_idx + 1)/(FLOAT_T)(target_idx + 1));
+    if (fdr > 1.0) {
+      fdr = 1.0;
+    }
+    qvalues.push_back(fdr);
+    while (target_idx < (int)target_scores.size() - 1 &&
+           target_scores[target_idx + 1] == target_score) {
+      target_idx++;
+      qvalues.push_back(fdr);
+    }
+  }
+  oldFdrToQValues(qvalues);
+  return qvalues;
+}
+
+// AssignConfidenceApplication::compute_decoy_qvalues_mixmax, for a given
+// pi_zero
+static vector<FLOAT_T> oldMixMax(
+  vector<FLOAT_T> target_scores,
+  vector<FLOAT_T> decoy_scores,
+  bool ascending,
+  FLOAT_T pi_zero
+) {
+  int num_targets = target_scores.size();
+  int num_decoys = decoy_scores.size();
+  if (ascending) {
+    sort(target_scores.begin(), target_scores.end(), greater<FLOAT_T>());
+    sort(decoy_scores.begin(), decoy_scores.end(), greater<FLOAT_T>());
+  } else {
+    sort(target_scores.begin(), target_scores.end());
+    sort(decoy_scores.begin(), decoy_scores.end());
+  }
+
+  vector<double> h_w_le_z(num_decoys + 1, 0);
+  vector<double> h_z_le_z(num_decoys + 1, 0);
+  int idx = 0;
+  for (int i = 0; i < num_decoys; ++i) {
+    while (idx < num_targets && (ascending ?
+      decoy_scores[i] <= target_scores[idx] :
+      decoy_scores[i] >= target_scores[idx])) {
+      ++idx;
+    }
+    h_w_le_z[i] = (double)idx;
+  }
+  idx = 0;
+  for (int i = 0; i < num_decoys; ++i) {
+    while (idx < num_targets && (ascending ?
+      decoy_scores[i] <= decoy_scores[idx] :
+      decoy_scores[i] >= decoy_scores[idx])) {
+      ++idx;
+    }
+    h_z_le_z[i] = (double)idx;
+  }
+  h_w_le_z[num_decoys] = (double)num_targets;
+  h_z_le_z[num_decoys] = (double)num_decoys;
+
+  vector<FLOAT_T> fdrmod(num_targets, 0);
+  double estPx_lt_zj = 0.0;
+  double E_f1_mod_run_tot = 0.0;
+  int j = num_decoys - 1;
+  int k = num_targets - 1;
+  int n_z_ge_w = 0;
+  int n_w_ge_w = 0;
+  double prev_fdr = -1;
+  for (int i = num_targets - 1; i >= 0; --i) {
+    while (j >= 0 && (ascending ?
+      decoy_scores[j] <= target_scores[i] :
+      decoy_scores[j] >= target_scores[i])) {
+      double cnt_w = h_w_le_z[j + 1];
+      double cnt_z = h_z_le_z[j + 1];
+      estPx_lt_zj = (double)(cnt_w - pi_zero*cnt_z) / ((1.0 - pi_zero)*cnt_z);
+      estPx_lt_zj = estPx_lt_zj > 1 ? 1 : estPx_lt_zj;
+      estPx_lt_zj = estPx_lt_zj < 0 ? 0 : estPx_lt_zj;
+      E_f1_mod_run_tot += estPx_lt_zj * ((1.0 - pi_zero));
+      ++n_z_ge_w;
+      --j;
+    }
+    while (k >= 0 && (ascending ?
+      target_scores[k] <= target_scores[i] :
+      target_scores[k] >= target_scores[i])) {
+      ++n_w_ge_w;
+      --k;
+    }
+    double qvalue = ((double)n_z_ge_w * pi_zero + E_f1_mod_run_tot) / (double)(n_w_ge_w);
+    fdrmod[i] = qvalue > 1.0 ? 1.0 : qvalue;
+    if (prev_fdr > fdrmod[i]) {
+      fdrmod[i] = prev_fdr;
+    }
+    prev_fdr = fdrmod[i];
+  }
+  return fdrmod;
+}
+
+// The old and new a-TDC break target-decoy ties with their own generators,
+// seeded alike.
+static mt19937 oldTieRng;
+static mt19937 newTieRng;
+
+static int oldRandomLimit(int limit) {
+  return oldTieRng() % limit;
+}
+
+static int newRandomLimit(int limit) {
+  return newTieRng() % limit;
+}
+
+// AssignConfidenceApplication::AtdcScoreSet::fdps, for targets sorted best
+// first and one vector of paired decoy scores per decoy set
+static vector<FLOAT_T> oldAtdc(
+  const vector<FLOAT_T>& targetScores,
+  const vector< vector<FLOAT_T> >& decoyScores,
+  bool ascending,
+  bool oldATDC
+) {
+  vector< pair<FLOAT_T, vector<FLOAT_T> > > scores_;
+  for (size_t i = 0; i < targetScores.size(); i++) {
+    FLOAT_T targetScore = ascending ? targetScores[i] : -targetScores[i];
+    scores_.push_back(make_pair(targetScore, vector<FLOAT_T>(decoyScores.size(), 0)));
+    for (size_t j = 0; j < decoyScores.size(); j++) {
+      scores_.back().second[j] = ascending ? decoyScores[j][i] : -decoyScores[j][i];
+    }
+  }
+
+  const size_t numScores = scores_.size();
+  const size_t numDecoySets = decoyScores.size();
+
+  vector<size_t> optIdxCnt(numScores, 0);
+  vector<FLOAT_T> sumNtds(numScores, 0);
+  vector<FLOAT_T> sumNdds(numScores, 0);
+  for (size_t i = 0; i < numDecoySets; i++) {
+    vector<int> ntds(numScores, 0);
+    vector<int> ndds(numScores, 0);
+    for (size_t j = 0; j < numScores; j++) {
+      FLOAT_T scoreTarget = scores_[j].first;
+      FLOAT_T scoreDecoy = scores_[j].second[i];
+      bool targetBetter = scoreTarget != scoreDecoy ? scoreTarget < scoreDecoy : oldRandomLimit(2) == 0;
+      FLOAT_T x = targetBetter ? scoreTarget : scoreDecoy;
+      vector<int>& hist = targetBetter ? ntds : ndds;
+      if (targetBetter) {
+        optIdxCnt[j]++;
+      }
+      // histBin: x is in the nth bin if edges[n] < x <= edges[n+1]
+      for (size_t k = 0; k < numScores; k++) {
+        if (x <= scores_[k].first) {
+          hist[k]++;
+          break;
+        }
+      }
+    }
+    int ntdsTotal = 0, nddsTotal = 0;
+    for (size_t j = 0; j < numScores; j++) {
+      sumNtds[j] += (ntdsTotal += ntds[j]);
+      sumNdds[j] += (nddsTotal += ndds[j]);
+    }
+  }
+
+  if (oldATDC) {
+    for (size_t i = 0; i < numScores; i++) {
+      sumNtds[i] /= numDecoySets;
+      sumNdds[i] /= numDecoySets;
+    }
+  }
+
+  vector<bool> isTargetPsm(numScores, true);
+  int numTargetPsms = 0;
+  vector< vector<int> > optIdxCntMat(numDecoySets + 1, vector<int>(numScores, 0));
+  vector<size_t> currentOptIdx(numDecoySets + 1, 0);
+  size_t lowestOptIdx = numDecoySets + 1;
+  for (size_t i = 0; i < numScores; i++) {
+    size_t idx = optIdxCnt[i];
+    size_t idx2 = oldATDC ? currentOptIdx[idx]++ : ++currentOptIdx[idx];
+    optIdxCntMat[idx][idx2] = i;
+    if (idx < lowestOptIdx) {
+      lowestOptIdx = idx;
+    }
+    int denominator = oldATDC ? 1 : numDecoySets;
+    if ((FLOAT_T)numTargetPsms <= (sumNtds[i] / denominator) - 0.5) {
+      numTargetPsms++;
+      continue;
+    }
+    if (oldATDC) {
+      isTargetPsm[optIdxCntMat[lowestOptIdx][--currentOptIdx[lowestOptIdx]]] = false;
+    } else {
+      isTargetPsm[optIdxCntMat[lowestOptIdx][currentOptIdx[lowestOptIdx]--]] = false;
+    }
+    for ( ; lowestOptIdx < numDecoySets + 1 && currentOptIdx[lowestOptIdx] == 0; lowestOptIdx++);
+  }
+
+  int targetPsmsTotal = 0;
+  if (oldATDC) {
+    for (size_t i = 0; i < numScores; i++) {
+      if (isTargetPsm[i]) {
+        targetPsmsTotal++;
+      }
+      sumNdds[i] = (1 + sumNdds[i]) / max(1, targetPsmsTotal);
+    }
+  } else {
+    // bc1 = -1 / numDecoySets is always negative
+    vector<FLOAT_T> ndds(numScores, 0);
+    FLOAT_T prev = 0;
+    for (size_t i = 0; i < numScores; i++) {
+      ndds[i] = sumNdds[i] - prev;
+      prev = sumNdds[i];
+    }
+    for (size_t i = 0; i < numScores; i++) {
+      if (isTargetPsm[i]) {
+        targetPsmsTotal++;
+      }
+      sumNdds[i] = ((min((FLOAT_T)numDecoySets, max((FLOAT_T)1, ndds[i])) + sumNdds[i]) / numDecoySets) /
+        max(1, targetPsmsTotal);
+    }
+  }
+  return sumNdds;
+}
+
+void TestQValues::setUp(){
+  rng.seed(7);
+}
+
+void TestQValues::tearDown(){
+}
+
+FLOAT_T TestQValues::randomScore(bool finite){
+  if (!finite) {
+    switch (rng() % 100) {
+      case 0: return numeric_limits<FLOAT_T>::quiet_NaN();
+      case 1: return numeric_limits<FLOAT_T>::infinity();
+      case 2: return -numeric_limits<FLOAT_T>::infinity();
+      case 3: return -0.0;
+    }
+  }
+  // a quarter of the scores are small integers, so ties are common
+  if (rng() % 4 == 0) {
+    return (FLOAT_T)(rng() % 20);
+  }
+  return (FLOAT_T)((int)(rng() % 100000) / 7.0 - 5000);
+}
+
+vector<FLOAT_T> TestQValues::randomScores(size_t num_scores, bool finite){
+  vector<FLOAT_T> scores(num_scores);
+  for (size_t i = 0; i < num_scores; i++) {
+    scores[i] = randomScore(finite);
+  }
+  return scores;
+}
+
+// The order of items that std::stable_sort gives with the old comparators.
+static vector<size_t> stableOrder(const vector<FLOAT_T>& scores, bool ascending) {
+  vector<size_t> items(scores.size());
+  for (size_t i = 0; i < items.size(); i++) {
+    items[i] = i;
+  }
+  stable_sort(items.begin(), items.end(), [&](size_t x, size_t y) {
+    return ascending ? scoreLess(scores[x], scores[y]) : scoreGreater(scores[x], scores[y]);
+  });
+  return items;
+}
+
+static vector<size_t> radixOrder(const vector<FLOAT_T>& scores, bool ascending, int num_threads) {
+  vector<size_t> items(scores.size());
+  for (size_t i = 0; i < items.size(); i++) {
+    items[i] = i;
+  }
+  QValues::SortByScore(scores, ascending, num_threads, &items);
+  return items;
+}
+
+void TestQValues::sortMatchesStableSort(){
+  // ties, including -0 with 0 and NaN with infinity, keep their input order
+  FLOAT_T nan = numeric_limits<FLOAT_T>::quiet_NaN();
+  FLOAT_T inf = numeric_limits<FLOAT_T>::infinity();
+  FLOAT_T tied[] = { 2, nan, 0, -inf, 1, -0.0, 2, inf, 1, -3 };
+  vector<FLOAT_T> scores(tied, tied + 10);
+  size_t expected[] = { 9, 2, 5, 4, 8, 0, 6, 1, 3, 7 };
+  CPPUNIT_ASSERT(radixOrder(scores, true, 1) == vector<size_t>(expected, expected + 10));
+  size_t expected_descending[] = { 0, 6, 4, 8, 2, 5, 9, 1, 3, 7 };
+  CPPUNIT_ASSERT(radixOrder(scores, false, 1) == vector<size_t>(expected_descending, expected_descending + 10));
+
+  for (int i = 0; i < 50; i++) {
+    vector<FLOAT_T> scores = randomScores(rng() % 500, false);
+    for (int ascending = 0; ascending < 2; ascending++) {
+      vector<size_t> order = stableOrder(scores, ascending);
+      CPPUNIT_ASSERT(radixOrder(scores, ascending, 1) == order);
+
+      vector<FLOAT_T> sorted = scores;
+      QValues::SortScores(&sorted, ascending, 1);
+      for (size_t j = 0; j < order.size(); j++) {
+        CPPUNIT_ASSERT(sameValue(scores[order[j]], sorted[j]));
+      }
+    }
+  }
+
+  vector<size_t> none;
+  QValues::SortByScore(vector<FLOAT_T>(), true, 4, &none);
+  CPPUNIT_ASSERT(none.empty());
+}
+
+void TestQValues::threadedSort(){
+  // large enough to be counted and scattered on several threads
+  vector<FLOAT_T> scores = randomScores((1 << 17) + 5, false);
+  for (int ascending = 0; ascending < 2; ascending++) {
+    vector<size_t> order = stableOrder(scores, ascending);
+    CPPUNIT_ASSERT(radixOrder(scores, ascending, 1) == order);
+    CPPUNIT_ASSERT(radixOrder(scores, ascending, 3) == order);
+    CPPUNIT_ASSERT(radixOrder(scores, ascending, 8) == order);
+  }
+}
+
+void TestQValues::fdrToQValues(){
+  for (int i = 0; i < 20; i++) {
+    vector<FLOAT_T> fdrs = randomScores(1 + rng() % 100, true);
+    vector<FLOAT_T> expected = fdrs;
+    oldFdrToQValues(expected);
+    QValues::FdrToQValues(&fdrs);
+    CPPUNIT_ASSERT(sameValues(expected, fdrs));
+  }
+  vector<FLOAT_T> none;
+  QValues::FdrToQValues(&none);
+  CPPUNIT_ASSERT(none.empty());
+}
+
+// Infinite scores become NaN. Both rank worst, but std::sort left them in
+// no particular order, and the old TDC shared an FDR between equal
+// infinities only when they happened to be next to each other.
+static void infinityToNaN(vector<FLOAT_T>& scores) {
+  for (size_t i = 0; i < scores.size(); i++) {
+    if (isinf(scores[i])) {
+      scores[i] = numeric_limits<FLOAT_T>::quiet_NaN();
+    }
+  }
+}
+
+void TestQValues::tdcMatchesOld(){
+  for (int i = 0; i < 100; i++) {
+    vector<FLOAT_T> targets = randomScores(1 + rng() % 300, false);
+    vector<FLOAT_T> decoys = randomScores(1 + rng() % 300, false);
+    infinityToNaN(targets);
+    infinityToNaN(decoys);
+    for (int ascending = 0; ascending < 2; ascending++) {
+      vector<FLOAT_T> expected = oldTdc(targets, decoys, ascending);
+      vector<FLOAT_T> sorted_targets = targets, sorted_decoys = decoys, qvalues;
+      QValues::SortScores(&sorted_targets, ascending, 1);
+      QValues::SortScores(&sorted_decoys, ascending, 1);
+      QValues::Tdc(sorted_targets, sorted_decoys, ascending, &qvalues);
+      CPPUNIT_ASSERT(sameValues(expected, qvalues));
+    }
+  }
+
+  // Decoys that are not finite are never better than a target.
+  FLOAT_T nan = numeric_limits<FLOAT_T>::quiet_NaN();
+  FLOAT_T inf = numeric_limits<FLOAT_T>::infinity();
+  FLOAT_T target_scores[] = { 1, 2, 3 };
+  FLOAT_T decoy_scores[] = { -inf, inf, nan };
+  vector<FLOAT_T> targets(target_scores, target_scores + 3);
+  vector<FLOAT_T> decoys(decoy_scores, decoy_scores + 3);
+  vector<FLOAT_T> qvalues;
+  for (int ascending = 0; ascending < 2; ascending++) {
+    QValues::SortScores(&targets, ascending, 1);
+    QValues::SortScores(&decoys, ascending, 1);
+    QValues::Tdc(targets, decoys, ascending, &qvalues);
+    CPPUNIT_ASSERT(qvalues == vector<FLOAT_T>(3, (FLOAT_T)1 / 3));
+  }
+}
+
+// Sorts scores worst first, for mix-max.
+static void sortWorstFirst(vector<FLOAT_T>* scores, bool ascending) {
+  QValues::SortScores(scores, ascending, 1);
+  reverse(scores->begin(), scores->end());
+}
+
+void TestQValues::mixMaxMatchesOld(){
+  // The old mix-max sorted with std::less and std::greater, so only finite
+  // scores are ranked alike. It also counted decoys only up to the number of
+  // targets, so it agrees only when there are as many targets as decoys.
+  for (int i = 0; i < 100; i++) {
+    size_t num_scores = 1 + rng() % 300;
+    vector<FLOAT_T> targets = randomScores(num_scores, true);
+    vector<FLOAT_T> decoys = randomScores(num_scores, true);
+    FLOAT_T pi_zero = (FLOAT_T)(0.1 * (1 + rng() % 9));
+    for (int ascending = 0; ascending < 2; ascending++) {
+      vector<FLOAT_T> expected = oldMixMax(targets, decoys, ascending, pi_zero);
+      vector<FLOAT_T> sorted_targets = targets, sorted_decoys = decoys, qvalues;
+      sortWorstFirst(&sorted_targets, ascending);
+      sortWorstFirst(&sorted_decoys, ascending);
+      QValues::MixMax(sorted_targets, sorted_decoys, ascending, pi_zero, &qvalues);
+      CPPUNIT_ASSERT(sameValues(expected, qvalues));
+    }
+  }
+}
+
+void TestQValues::mixMaxUnequalCounts(){
+  // larger scores are better; both are sorted worst first
+  FLOAT_T target_scores[] = { 1, 2, 3, 4, 5, 6 };
+  FLOAT_T decoy_scores[] = { 2.5, 4.5 };
+  vector<FLOAT_T> targets(target_scores, target_scores + 6);
+  vector<FLOAT_T> decoys(decoy_scores, decoy_scores + 2);
+  vector<FLOAT_T> qvalues;
+  QValues::MixMax(targets, decoys, false, 0.5, &qvalues);
+
+  // Each decoy adds pi0 + (1 - pi0) * min(1, (#w - pi0 * #z) / ((1 - pi0) * #z))
+  // = 1 to the estimate, with the counts #w and #z at or below the decoy
+  // after it. FDRs are 2/6, 2/5, 1/4, 1/3, 0/2 and 0/1, and q-values are
+  // their running maximum from the best target.
+  FLOAT_T expected[] = { 0.4, 0.4, 1.0 / 3, 1.0 / 3, 0, 0 };
+  CPPUNIT_ASSERT_EQUAL((size_t)6, qvalues.size());
+  for (size_t i = 0; i < 6; i++) {
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(expected[i], qvalues[i], 1e-6);
+  }
+
+  // With fewer targets, all three decoys count: each adds 0.5 + 0.5 / 3,
+  // from #w = 2 and #z = 3. FDRs are 4/3 / 2 and 2/3 / 1.
+  FLOAT_T fewer_target_scores[] = { 2, 4 };
+  FLOAT_T more_decoy_scores[] = { 1, 3, 5 };
+  targets.assign(fewer_target_scores, fewer_target_scores + 2);
+  decoys.assign(more_decoy_scores, more_decoy_scores + 3);
+  QValues::MixMax(targets, decoys, false, 0.5, &qvalues);
+  CPPUNIT_ASSERT_EQUAL((size_t)2, qvalues.size());
+  CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0 / 3, qvalues[0], 1e-6);
+  CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0 / 3, qvalues[1], 1e-6);
+}
+
+void TestQValues::mixMaxNotFinite(){
+  // Scores that are not finite are sorted first, and rank as the worst
+  // finite score does.
+  for (int i = 0; i < 50; i++) {
+    size_t num_decoys = 1 + rng() % 300;
+    vector<FLOAT_T> targets = randomScores(1 + rng() % num_decoys, false);
+    vector<FLOAT_T> decoys = randomScores(num_decoys, false);
+    for (int ascending = 0; ascending < 2; ascending++) {
+      FLOAT_T worst = ascending ? numeric_limits<FLOAT_T>::max() : -numeric_limits<FLOAT_T>::max();
+      sortWorstFirst(&targets, ascending);
+      sortWorstFirst(&decoys, ascending);
+      vector<FLOAT_T> finite_targets = targets, finite_decoys = decoys;
+      for (size_t j = 0; j < targets.size(); j++) {
+        CPPUNIT_ASSERT(j == 0 || isfinite(targets[j]) || !isfinite(targets[j - 1]));
+        if (!isfinite(targets[j])) {
+          finite_targets[j] = worst;
+        }
+      }
+      for (size_t j = 0; j < decoys.size(); j++) {
+        if (!isfinite(decoys[j])) {
+          finite_decoys[j] = worst;
+        }
+      }
+
+      vector<FLOAT_T> qvalues, expected;
+      QValues::MixMax(targets, decoys, ascending, 0.5, &qvalues);
+      QValues::MixMax(finite_targets, finite_decoys, ascending, 0.5, &expected);
+      CPPUNIT_ASSERT(sameValues(expected, qvalues));
+    }
+  }
+}
+
+void TestQValues::atdcMatchesOld(){
+  for (int i = 0; i < 60; i++) {
+    size_t num_scores = 1 + rng() % 300;
+    size_t num_decoy_sets = 1 + rng() % 4;
+    for (int ascending = 0; ascending < 2; ascending++) {
+      vector<FLOAT_T> targets = randomScores(num_scores, true);
+      QValues::SortScores(&targets, ascending, 1);
+
+      // a third of the decoys tie with their targets; some are not finite
+      vector< vector<FLOAT_T> > decoy_sets(num_decoy_sets, vector<FLOAT_T>(num_scores));
+      vector<FLOAT_T> decoys;
+      for (size_t set = 0; set < num_decoy_sets; set++) {
+        for (size_t j = 0; j < num_scores; j++) {
+          decoy_sets[set][j] = rng() % 3 == 0 ? targets[j] : randomScore(false);
+        }
+        decoys.insert(decoys.end(), decoy_sets[set].begin(), decoy_sets[set].end());
+      }
+
+      for (int old_atdc = 0; old_atdc < 2; old_atdc++) {
+        oldTieRng.seed(i);
+        newTieRng.seed(i);
+        vector<FLOAT_T> expected = oldAtdc(targets, decoy_sets, ascending, old_atdc);
+        vector<FLOAT_T> fdrs;
+        QValues::Atdc(targets, decoys, num_decoy_sets, ascending, old_atdc,
+                      newRandomLimit, &fdrs);
+        CPPUNIT_ASSERT(sameValues(expected, fdrs));
+      }
+    }
+  }
+}
+
+void TestQValues::emptyAndAllDecoy(){
+  // The old procedures stopped on empty input; these return no q-values.
+  vector<FLOAT_T> none, qvalues;
+  vector<FLOAT_T> decoys = randomScores(10, false);
+  QValues::SortScores(&decoys, false, 1);
+  QValues::Tdc(none, decoys, false, &qvalues);
+  CPPUNIT_ASSERT(qvalues.empty());
+  QValues::Tdc(none, none, false, &qvalues);
+  CPPUNIT_ASSERT(qvalues.empty());
+  QValues::MixMax(none, decoys, false, 0.5, &qvalues);
+  CPPUNIT_ASSERT(qvalues.empty());
+  QValues::Atdc(none, none, 2, false, false, newRandomLimit, &qvalues);
+  CPPUNIT_ASSERT(qvalues.empty());
+
+  // Without decoys, TDC estimates one decoy among all the targets.
+  FLOAT_T scores[] = { 4, 3, 3, 1 };
+  vector<FLOAT_T> targets(scores, scores + 4);
+  QValues::Tdc(targets, none, false, &qvalues);
+  CPPUNIT_ASSERT(qvalues == vector<FLOAT_T>(4, (FLOAT_T)0.25));
+  // and mix-max estimates none
+  reverse(targets.begin(), targets.end());
+  QValues::MixMax(targets, none, false, 0.5, &qvalues);
+  CPPUNIT_ASSERT(qvalues == vector<FLOAT_T>(4, (FLOAT_T)0));
+  // and a-TDC has no decoy sets to average
+  QValues::Atdc(targets, none, 0, true, false, newRandomLimit, &qvalues);
+  CPPUNIT_ASSERT(qvalues == vector<FLOAT_T>(4, (FLOAT_T)0));
+}
@@ -0,0 +1,52 @@
+#ifndef CPP_UNIT_TESTQVALUES_H
+#define CPP_UNIT_TESTQVALUES_H
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <random>
+#include <vector>
+#include "util/QValues.h"
+
+/**
+ * Checks the QValues routines against the sort-based TDC, mix-max and
+ * a-TDC procedures that assign-confidence used before them.
+ */
+class TestQValues : public CPPUNIT_NS::TestFixture
+{
+  CPPUNIT_TEST_SUITE( TestQValues );
+  CPPUNIT_TEST( sortMatchesStableSort );
+  CPPUNIT_TEST( threadedSort );
+  CPPUNIT_TEST( fdrToQValues );
+  CPPUNIT_TEST( tdcMatchesOld );
+  CPPUNIT_TEST( mixMaxMatchesOld );
+  CPPUNIT_TEST( mixMaxUnequalCounts );
+  CPPUNIT_TEST( mixMaxNotFinite );
+  CPPUNIT_TEST( atdcMatchesOld );
+  CPPUNIT_TEST( emptyAndAllDecoy );
+  CPPUNIT_TEST_SUITE_END();
+
+ protected:
+  // variables to use in testing
+  std::mt19937 rng;
+
+  // a random score, often tied with others, and unless finite, sometimes
+  // NaN, infinite or -0
+  FLOAT_T randomScore(bool finite);
+  std::vector<FLOAT_T> randomScores(size_t num_scores, bool finite);
+
+ public:
+  void setUp();
+  void tearDown();
+
+ protected:
+  void sortMatchesStableSort();
+  void threadedSort();
+  void fdrToQValues();
+  void tdcMatchesOld();
+  void mixMaxMatchesOld();
+  void mixMaxUnequalCounts();
+  void mixMaxNotFinite();
+  void atdcMatchesOld();
+  void emptyAndAllDecoy();
+};
+
+#endif //CPP_UNIT_TESTQVALUES_H
@@ -0,0 +1,111 @@
+// Microbenchmark for the q-value procedures in src/util/QValues.cpp, on
+// random scores. From this directory:
+//
+//   g++ -O2 -std=c++11 -I../../src -I../../src/util -o qvalue-benchmark
+//     qvalue-benchmark.cpp ../../src/util/QValues.cpp
+//     -lboost_thread -lboost_system -pthread
+//   ./qvalue-benchmark [number of PSMs] [number of threads]
+//
+// (the g++ command is one line).
+//
+// Sorting with std::sort and Match::ScoreLess semantics is timed alongside
+// for comparison.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <vector>
+#include "QValues.h"
+
+using namespace std;
+
+namespace {
+
+mt19937 rng(1);
+
+int randomLimit(int max) {
+  return rng() % max;
+}
+
+bool scoreLess(FLOAT_T x, FLOAT_T y) {
+  if (isnan(x) || isinf(x)) {
+    x = numeric_limits<FLOAT_T>::max();
+  }
+  if (isnan(y) || isinf(y)) {
+    y = numeric_limits<FLOAT_T>::max();
+  }
+  return x < y;
+}
+
+vector<FLOAT_T> randomScores(size_t n, double mean) {
+  normal_distribution<double> normal(mean, 1.0);
+  vector<FLOAT_T> scores(n);
+  for (size_t i = 0; i < n; i++) {
+    scores[i] = (FLOAT_T)normal(rng);
+  }
+  return scores;
+}
+
+template<typename F>
+double seconds(F work) {
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  work();
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+}
+
+int main(int argc, char** argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  int threads = argc > 2 ? atoi(argv[2]) : 4;
+  const size_t numDecoySets = 3;
+  printf("%lu PSMs, %d threads\n", (unsigned long)n, threads);
+
+  // Lower scores are better; targets are a mix of null and better scores.
+  vector<FLOAT_T> targets = randomScores(n, -0.5);
+  vector<FLOAT_T> decoys = randomScores(n, 0);
+
+  vector<FLOAT_T> copy = targets;
+  printf("std::sort           %8.3f s\n", seconds([&]() {
+    sort(copy.begin(), copy.end(), scoreLess);
+  }));
+  copy = targets;
+  printf("SortScores          %8.3f s\n", seconds([&]() {
+    QValues::SortScores(&copy, true, 1);
+  }));
+  copy = targets;
+  printf("SortScores threaded %8.3f s\n", seconds([&]() {
+    QValues::SortScores(&copy, true, threads);
+  }));
+
+  vector<FLOAT_T> qvalues;
+  printf("TDC                 %8.3f s\n", seconds([&]() {
+    vector<FLOAT_T> sortedTargets = targets, sortedDecoys = decoys;
+    QValues::SortScores(&sortedTargets, true, threads);
+    QValues::SortScores(&sortedDecoys, true, threads);
+    QValues::Tdc(sortedTargets, sortedDecoys, true, &qvalues);
+  }));
+  printf("mix-max             %8.3f s\n", seconds([&]() {
+    vector<FLOAT_T> sortedTargets = targets, sortedDecoys = decoys;
+    QValues::SortScores(&sortedTargets, true, threads);
+    QValues::SortScores(&sortedDecoys, true, threads);
+    reverse(sortedTargets.begin(), sortedTargets.end());
+    reverse(sortedDecoys.begin(), sortedDecoys.end());
+    QValues::MixMax(sortedTargets, sortedDecoys, true, 0.5, &qvalues);
+  }));
+
+  vector<FLOAT_T> sortedTargets = targets;
+  QValues::SortScores(&sortedTargets, true, threads);
+  vector<FLOAT_T> decoySets;
+  for (size_t i = 0; i < numDecoySets; i++) {
+    vector<FLOAT_T> decoySet = randomScores(n, 0);
+    decoySets.insert(decoySets.end(), decoySet.begin(), decoySet.end());
+  }
+  printf("a-TDC (%lu sets)     %8.3f s\n", (unsigned long)numDecoySets, seconds([&]() {
+    QValues::Atdc(sortedTargets, decoySets, numDecoySets, true, false, randomLimit, &qvalues);
+    QValues::FdrToQValues(&qvalues);
+  }));
+  return 0;
+}
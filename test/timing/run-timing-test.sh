@@ -95,7 +95,7 @@ for precursor in 3 10; do
 	    comet_threads="--num_threads $threads"
 	    tide_threads="--num-threads $threads"
 	    
-	    for engine in tide-xcorr tide-p tide-combined comet; do
+	    for engine in tide-xcorr tide-formats tide-p tide-combined comet; do
 		root=$engine.pre=$precursor.frag$fragment.threads$threads
 
                 if [[ $fragment == 02 ]]; then
@@ -116,6 +116,9 @@ for precursor in 3 10; do
 		log_file=$scratch_dir/$root/tide-search.log.txt
 		if [[ $engine == "tide-xcorr" ]]; then
 		    search_command="tide-search"
+		elif [[ $engine == "tide-formats" ]]; then
+		    # As tide-xcorr, writing every other PSM format as well.
+		    search_command="tide-search --pin-output T --pepxml-output T --mzid-output T --sqt-output T"
 		elif [[ $engine == "tide-p" ]]; then
 		    search_command="tide-search --exact-p-value T"
 		elif [[ $engine == "tide-combined" ]]; then
@@ -144,7 +147,9 @@ for precursor in 3 10; do
 		    fi
 		fi
 		echo -n "$root " >> $html
-		awk -F ":" '$2 == " Elapsed time" {print $3}' $log_file >> $html
+		awk -F ":" '$2 == " Elapsed time" {elapsed = $3}
+		            $2 == " Result conversion time" {conversion = " (conversion" $3 ")"}
+		            END {print elapsed conversion}' $log_file >> $html
 	    done
 	done
     done